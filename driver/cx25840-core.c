@@ -63,45 +63,192 @@ I2C_CLIENT_INSMOD;
 
 /* ----------------------------------------------------------------------- */
 
+/* Register shadow cache.
+ *
+ * Every register access is a full I2C round-trip, and an input or standard
+ * switch does dozens of read-modify-write cycles on registers that only we
+ * ever change. The shadow remembers what was last read from or written to
+ * each register so that reads of a known register and writes that would not
+ * change it never reach the bus.
+ *
+ * Status registers and registers owned by the audio microcontroller are
+ * volatile and always go to the chip, as do the reset and DLL strobes whose
+ * side effect is the write itself. */
+
+static int cx25840_regcache = 1;
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2,5,0)
+module_param(cx25840_regcache, bool, 0644);
+#else
+MODULE_PARM(cx25840_regcache, "i");
+#endif
+
+MODULE_PARM_DESC(cx25840_regcache, "Shadow cache for decoder registers [0=Off 1=On (default)]");
+
+static int cx25840_volatile(u16 addr)
+{
+	switch (addr) {
+	case 0x000:		/* host control, toggled by firmware load */
+	case 0x136:		/* DLL strobes */
+	case 0x13c:
+	case 0x159 ... 0x15f:
+	case 0x40d ... 0x40f:	/* GEN_STAT */
+	case 0x4a5:		/* reset strobe */
+	case 0x800 ... 0x80f:	/* audio microcontroller control and status */
+	case 0x8d3:		/* mute, changed by the microcontroller */
+		return 1;
+	}
+	return addr >= CX25840_NUM_REGS;
+}
+
+static inline struct cx25840_state *cx25840_cache(struct i2c_client *client)
+{
+	/* NULL while the chip is still being detected */
+	return i2c_get_clientdata(client);
+}
+
+/* The shadow is kept up to date even with cx25840_regcache off, so that
+   it can be switched back on at runtime without going stale. */
+static inline int cx25840_cached(struct cx25840_state *state, u16 addr)
+{
+	return cx25840_regcache && !cx25840_volatile(addr) &&
+	       (state->regs_valid[addr >> 3] & (1 << (addr & 7)));
+}
+
+static inline void cx25840_cache_set(struct cx25840_state *state, u16 addr,
+				     u8 value)
+{
+	if (cx25840_volatile(addr))
+		return;
+	state->regs[addr] = value;
+	state->regs_valid[addr >> 3] |= 1 << (addr & 7);
+}
+
+static inline void cx25840_cache_clear(struct cx25840_state *state, u16 addr)
+{
+	if (addr < CX25840_NUM_REGS)
+		state->regs_valid[addr >> 3] &= ~(1 << (addr & 7));
+}
+
+void cx25840_cache_invalidate(struct i2c_client *client)
+{
+	struct cx25840_state *state = i2c_get_clientdata(client);
+
+	if (state)
+		memset(state->regs_valid, 0, sizeof(state->regs_valid));
+}
+
 int cx25840_write(struct i2c_client *client, u16 addr, u8 value)
 {
+	struct cx25840_state *state = cx25840_cache(client);
 	u8 buffer[3];
+	int ret;
+
+	if (state && cx25840_cached(state, addr) && state->regs[addr] == value) {
+		state->i2c_saved++;
+		return 3;
+	}
+
 	buffer[0] = addr >> 8;
 	buffer[1] = addr & 0xff;
 	buffer[2] = value;
-	return i2c_master_send(client, buffer, 3);
+	ret = i2c_master_send(client, buffer, 3);
+
+	if (state) {
+		state->i2c_xfers++;
+		if (ret == 3)
+			cx25840_cache_set(state, addr, value);
+		else
+			cx25840_cache_clear(state, addr);
+	}
+	return ret;
 }
 
 int cx25840_write4(struct i2c_client *client, u16 addr, u32 value)
 {
+	struct cx25840_state *state = cx25840_cache(client);
 	u8 buffer[6];
+	int i, ret;
+
 	buffer[0] = addr >> 8;
 	buffer[1] = addr & 0xff;
 	buffer[2] = value >> 24;
 	buffer[3] = (value >> 16) & 0xff;
 	buffer[4] = (value >> 8) & 0xff;
 	buffer[5] = value & 0xff;
-	return i2c_master_send(client, buffer, 6);
+
+	if (state) {
+		for (i = 0; i < 4; i++)
+			if (!cx25840_cached(state, addr + i) ||
+			    state->regs[addr + i] != buffer[2 + i])
+				break;
+		if (i == 4) {
+			state->i2c_saved++;
+			return 6;
+		}
+	}
+
+	ret = i2c_master_send(client, buffer, 6);
+
+	if (state) {
+		state->i2c_xfers++;
+		for (i = 0; i < 4; i++) {
+			if (ret == 6)
+				cx25840_cache_set(state, addr + i, buffer[2 + i]);
+			else
+				cx25840_cache_clear(state, addr + i);
+		}
+	}
+	return ret;
 }
 
 u8 cx25840_read(struct i2c_client * client, u16 addr)
 {
+	struct cx25840_state *state = cx25840_cache(client);
 	u8 buffer[2];
+
+	if (state && cx25840_cached(state, addr)) {
+		state->i2c_saved++;
+		return state->regs[addr];
+	}
+
 	buffer[0] = addr >> 8;
 	buffer[1] = addr & 0xff;
 
+	if (state)
+		state->i2c_xfers++;
+
 	if (i2c_master_send(client, buffer, 2) < 2)
 		return 0;
 
 	if (i2c_master_recv(client, buffer, 1) < 1)
 		return 0;
 
+	if (state)
+		cx25840_cache_set(state, addr, buffer[0]);
+
 	return buffer[0];
 }
 
 u32 cx25840_read4(struct i2c_client * client, u16 addr)
 {
+	struct cx25840_state *state = cx25840_cache(client);
 	u8 buffer[4];
+	int i;
+
+	if (state) {
+		for (i = 0; i < 4; i++)
+			if (!cx25840_cached(state, addr + i))
+				break;
+		if (i == 4) {
+			state->i2c_saved++;
+			return (state->regs[addr] << 24) |
+			    (state->regs[addr + 1] << 16) |
+			    (state->regs[addr + 2] << 8) | state->regs[addr + 3];
+		}
+		state->i2c_xfers++;
+	}
+
 	buffer[0] = addr >> 8;
 	buffer[1] = addr & 0xff;
 
@@ -111,6 +258,10 @@ u32 cx25840_read4(struct i2c_client * client, u16 addr)
 	if (i2c_master_recv(client, buffer, 4) < 4)
 		return 0;
 
+	if (state)
+		for (i = 0; i < 4; i++)
+			cx25840_cache_set(state, addr + i, buffer[i]);
+
 	return (buffer[0] << 24) | (buffer[1] << 16) |
 	    (buffer[2] << 8) | buffer[3];
 }
@@ -161,6 +312,9 @@ static void cx25840_initialize(struct i2c_client *client, int loadfw)
 {
 	struct cx25840_state *state = i2c_get_clientdata(client);
 
+	/* the chip may have been reset behind our back, start from scratch */
+	cx25840_cache_invalidate(client);
+
 	/* datasheet startup in numbered steps, refer to page 3-77 */
 	/* 2. */
 	cx25840_and_or(client, 0x803, ~0x10, 0x00);
@@ -617,6 +771,8 @@ static int cx25840_command(struct i2c_client *client, unsigned int cmd,
 
 		if (reg->i2c_id != I2C_DRIVERID_CX25840)
 			return -EINVAL;
+		/* always show what the chip has, not the shadow */
+		cx25840_cache_clear(state, reg->reg & 0x0fff);
 		reg->val = cx25840_read(client, reg->reg & 0x0fff);
 		break;
 	}
@@ -629,6 +785,7 @@ static int cx25840_command(struct i2c_client *client, unsigned int cmd,
 			return -EINVAL;
 		if (!capable(CAP_SYS_ADMIN))
 			return -EPERM;
+		cx25840_cache_clear(state, reg->reg & 0x0fff);
 		cx25840_write(client, reg->reg & 0x0fff, reg->val & 0xff);
 		break;
 	}
@@ -1062,6 +1219,9 @@ static void log_status(struct i2c_client *client)
 	default: p = "undefined";
 	}
 	cx25840_info("Specified audioclock freq: %s\n", p);
+	cx25840_info("Register cache:            %s, %lu of %lu I2C transfers saved\n",
+		    cx25840_regcache ? "on" : "off", state->i2c_saved,
+		    state->i2c_saved + state->i2c_xfers);
 
 	switch (pref_mode & 0xf) {
 	case 0: p = "mono/language A"; break;
@@ -25,6 +25,7 @@
 #include <linux/slab.h>
 #include <linux/pci.h>
 #include <linux/interrupt.h>
+#include <linux/hugetlb.h>
 #include <asm/page.h>
 #include <asm/pgtable.h>
 
@@ -38,6 +39,13 @@
 static int debug = 0;
 module_param(debug, int, 0644);
 
+/* Largest scatterlist entry built from user pages */
+#if defined(CONFIG_HUGETLB_PAGE) && defined(HPAGE_SIZE)
+#define IVTVBUF_SG_MAX HPAGE_SIZE
+#else
+#define IVTVBUF_SG_MAX PAGE_SIZE
+#endif
+
 #define dprintk(level, fmt, arg...)	if (debug >= level) \
 	printk(KERN_DEBUG "vbuf: " fmt , ## arg)
 
@@ -127,10 +135,12 @@ ivtvbuf_vmalloc_to_sg(unsigned char *virt, int nr_pages)
 }
 
 struct scatterlist*
-ivtvbuf_pages_to_sg(struct page **pages, int nr_pages, int offset)
+ivtvbuf_pages_to_sg(struct page **pages, int nr_pages, int offset,
+		    int *nr_sg)
 {
 	struct scatterlist *sglist;
-	int i = 0;
+	unsigned long pfn, prev;
+	int i = 0, n = 0;
 
 	if (NULL == pages[0])
 		return NULL;
@@ -147,14 +157,25 @@ ivtvbuf_pages_to_sg(struct page **pages, int nr_pages, int offset)
 	sglist[0].page   = pages[0];
 	sglist[0].offset = offset;
 	sglist[0].length = PAGE_SIZE - offset;
+	prev = page_to_pfn(pages[0]);
 	for (i = 1; i < nr_pages; i++) {
 		if (NULL == pages[i])
 			goto nopage;
 		if (PageHighMem(pages[i]))
 			goto highmem;
-		sglist[i].page   = pages[i];
-		sglist[i].length = PAGE_SIZE;
+		/* the next page of the same huge page goes on the entry */
+		pfn = page_to_pfn(pages[i]);
+		if (pfn == prev + 1 &&
+		    (pfn & ((IVTVBUF_SG_MAX >> PAGE_SHIFT) - 1)) != 0) {
+			sglist[n].length += PAGE_SIZE;
+		} else {
+			n++;
+			sglist[n].page   = pages[i];
+			sglist[n].length = PAGE_SIZE;
+		}
+		prev = pfn;
 	}
+	*nr_sg = n + 1;
 	return sglist;
 
  nopage:
@@ -177,6 +198,58 @@ void ivtvbuf_dma_init(struct ivtvbuf_dmabuf *dma)
 	//printk(KERN_ERR "dma_init(%d pages) success\n",dma->nr_pages);
 }
 
+/*
+ * Pin the user pages of a buffer.  Within a hugetlb mapping one
+ * reference is taken on each huge page and its small pages follow from
+ * the first, instead of faulting in and pinning every one of them.
+ */
+static int ivtvbuf_pin_user(struct ivtvbuf_dmabuf *dma, unsigned long addr,
+			    int write)
+{
+	struct vm_area_struct *vma;
+	int i = 0, n, err = 0;
+
+	while (i < dma->nr_pages) {
+		n = dma->nr_pages - i;
+		vma = find_vma(current->mm, addr);
+		if (NULL == vma || vma->vm_start > addr)
+			return -EFAULT;
+#ifdef CONFIG_HUGETLB_PAGE
+		if (is_vm_hugetlb_page(vma)) {
+			unsigned long base = addr & HPAGE_MASK;
+			int sub = (addr - base) >> PAGE_SHIFT, j;
+			struct page *head;
+
+			n = min_t(int, n, (HPAGE_SIZE >> PAGE_SHIFT) - sub);
+			err = get_user_pages(current, current->mm, base, 1,
+					     write, 1, &head, NULL);
+			if (err != 1)
+				return err < 0 ? err : -EFAULT;
+			dma->pinned[dma->nr_pinned++] = head;
+			for (j = 0; j < n; j++)
+				dma->pages[i + j] = head + sub + j;
+			i += n;
+			addr += n << PAGE_SHIFT;
+			continue;
+		}
+#endif
+		n = min_t(int, n, (vma->vm_end - addr) >> PAGE_SHIFT);
+		err = get_user_pages(current, current->mm, addr, n,
+				     write, 1, /* force */
+				     dma->pages + i, NULL);
+		if (err > 0) {
+			memcpy(dma->pinned + dma->nr_pinned, dma->pages + i,
+			       err * sizeof(struct page *));
+			dma->nr_pinned += err;
+		}
+		if (err != n)
+			return err < 0 ? err : -EFAULT;
+		i += n;
+		addr += n << PAGE_SHIFT;
+	}
+	return 0;
+}
+
 int ivtvbuf_dma_init_user(struct ivtvbuf_dmabuf *dma, int direction,
 			   unsigned long data, unsigned long size)
 {
@@ -196,23 +269,30 @@ int ivtvbuf_dma_init_user(struct ivtvbuf_dmabuf *dma, int direction,
 	dma->nr_pages = last-first+1;
 	dma->pages = kmalloc(dma->nr_pages * sizeof(struct page*),
 			     GFP_KERNEL);
+	dma->pinned = kmalloc(dma->nr_pages * sizeof(struct page*),
+			      GFP_KERNEL);
 	//printk(KERN_ERR "dma_init_user(%d pages) success\n",dma->nr_pages);
-	if (NULL == dma->pages)
+	if (NULL == dma->pages || NULL == dma->pinned) {
+		kfree(dma->pages);
+		kfree(dma->pinned);
+		dma->pages = NULL;
+		dma->pinned = NULL;
 		return -ENOMEM;
+	}
+	dma->nr_pinned = 0;
 	dprintk(1,"init user [0x%lx+0x%lx => %d pages]\n",
 		data,size,dma->nr_pages);
 
 	down_read(&current->mm->mmap_sem);
-	err = get_user_pages(current,current->mm,
-			     data & PAGE_MASK, dma->nr_pages,
-			     rw == READ, 1, /* force */
-			     dma->pages, NULL);
+	err = ivtvbuf_pin_user(dma, data & PAGE_MASK, rw == READ);
 	up_read(&current->mm->mmap_sem);
-	if (err != dma->nr_pages) {
-		dma->nr_pages = (err >= 0) ? err : 0;
-		dprintk(1,"get_user_pages: err=%d [%d]\n",err,dma->nr_pages);
-		return err < 0 ? err : -EINVAL;
+	if (err < 0) {
+		dprintk(1,"get_user_pages: err=%d [%d pinned]\n",
+			err,dma->nr_pinned);
+		return err;
 	}
+	dprintk(1,"init user: %d pages in %d pins\n",
+		dma->nr_pages,dma->nr_pinned);
 	return 0;
 }
 
@@ -253,11 +333,12 @@ int ivtvbuf_dma_pci_map(struct pci_dev *dev, struct ivtvbuf_dmabuf *dma)
 
 	if (dma->pages) {
 		dma->sglist = ivtvbuf_pages_to_sg(dma->pages, dma->nr_pages,
-						   dma->offset);
+						   dma->offset, &dma->nr_sg);
 	}
 	if (dma->vmalloc) {
 		dma->sglist = ivtvbuf_vmalloc_to_sg
 			(dma->vmalloc,dma->nr_pages);
+		dma->nr_sg = dma->nr_pages;
 	}
 	if (dma->bus_addr) {
 		dma->sglist = kmalloc(sizeof(struct scatterlist), GFP_KERNEL);
@@ -274,7 +355,7 @@ int ivtvbuf_dma_pci_map(struct pci_dev *dev, struct ivtvbuf_dmabuf *dma)
 	}
 
 	if (!dma->bus_addr) {
-		dma->sglen = pci_map_sg(dev,dma->sglist,dma->nr_pages,
+		dma->sglen = pci_map_sg(dev,dma->sglist,dma->nr_sg,
 					dma->direction);
 		if (0 == dma->sglen) {
 			printk(KERN_WARNING
@@ -294,7 +375,7 @@ int ivtvbuf_dma_pci_sync(struct pci_dev *dev, struct ivtvbuf_dmabuf *dma)
 	BUG_ON(!dma->sglen);
 
 	if (!dma->bus_addr)
-		pci_dma_sync_sg_for_cpu(dev,dma->sglist,dma->nr_pages,dma->direction);
+		pci_dma_sync_sg_for_cpu(dev,dma->sglist,dma->nr_sg,dma->direction);
 	return 0;
 }
 
@@ -305,7 +386,7 @@ int ivtvbuf_dma_pci_unmap(struct pci_dev *dev, struct ivtvbuf_dmabuf *dma)
 		return 0;
 
 	if (!dma->bus_addr)
-		pci_unmap_sg(dev,dma->sglist,dma->nr_pages,dma->direction);
+		pci_unmap_sg(dev,dma->sglist,dma->nr_sg,dma->direction);
 	kfree(dma->sglist);
 	dma->sglist = NULL;
 	dma->sglen = 0;
@@ -319,9 +400,12 @@ int ivtvbuf_dma_free(struct ivtvbuf_dmabuf *dma)
 
 	if (dma->pages) {
 		int i;
-		for (i=0; i < dma->nr_pages; i++)
-			page_cache_release(dma->pages[i]);
+		for (i=0; i < dma->nr_pinned; i++)
+			page_cache_release(dma->pinned[i]);
+		kfree(dma->pinned);
 		kfree(dma->pages);
+		dma->pinned = NULL;
+		dma->nr_pinned = 0;
 		dma->pages = NULL;
 	}
 
@@ -396,6 +480,9 @@ ivtvbuf_iolock(struct pci_dev *pci, struct ivtvbuf_buffer *vb,
 						       pages);
 			if (0 != err)
 				return err;
+		} else if (vb->dma.sglen) {
+			/* still mapped, taken from the pin cache */
+			return 0;
 		} else {
 			/* dma directly to userspace */
 			err = ivtvbuf_dma_init_user(&vb->dma,PCI_DMA_FROMDEVICE,
@@ -427,6 +514,142 @@ ivtvbuf_iolock(struct pci_dev *pci, struct ivtvbuf_buffer *vb,
 
 /* --------------------------------------------------------------------- */
 
+static void
+ivtvbuf_pin_drop(struct ivtvbuf_queue *q, struct ivtvbuf_pin *pin)
+{
+	ivtvbuf_dma_pci_unmap(q->pci,&pin->dma);
+	ivtvbuf_dma_free(&pin->dma);
+	pin->baddr = 0;
+}
+
+/* The one VMA all of [addr, addr+size) is in, if there is one */
+static struct vm_area_struct *
+ivtvbuf_pin_vma(unsigned long addr, size_t size)
+{
+	struct vm_area_struct *vma = find_vma(current->mm, addr);
+
+	if (NULL == vma || vma->vm_start > addr || vma->vm_end < addr + size)
+		return NULL;
+	return vma;
+}
+
+/* Keep the mapping of a USERPTR buffer about to get a new address */
+static void
+ivtvbuf_pin_put(struct ivtvbuf_queue *q, struct ivtvbuf_buffer *vb)
+{
+	struct ivtvbuf_pin *pin;
+	struct vm_area_struct *vma;
+
+	if (NULL == vb->dma.pages || 0 == vb->dma.sglen)
+		return;
+	down_read(&current->mm->mmap_sem);
+	vma = ivtvbuf_pin_vma(vb->baddr,vb->bsize);
+	if (NULL == vma) {
+		/* spread over several mappings, not worth keeping */
+		up_read(&current->mm->mmap_sem);
+		return;
+	}
+	pin = &q->pins[q->pin_next];
+	q->pin_next = (q->pin_next + 1) % IVTVBUF_PIN_CACHE;
+	if (pin->dma.pages)
+		ivtvbuf_pin_drop(q,pin);
+	pin->mm       = current->mm;
+	pin->vma      = vma;
+	pin->vm_start = vma->vm_start;
+	pin->vm_end   = vma->vm_end;
+	pin->vm_pgoff = vma->vm_pgoff;
+	pin->vm_flags = vma->vm_flags;
+	pin->vm_file  = vma->vm_file;
+	up_read(&current->mm->mmap_sem);
+	pin->baddr = vb->baddr;
+	pin->bsize = vb->bsize;
+	pin->dma   = vb->dma;
+	ivtvbuf_dma_init(&vb->dma);
+	dprintk(2,"pin cache: keep 0x%lx+0x%lx\n",pin->baddr,
+		(unsigned long)pin->bsize);
+}
+
+static int
+ivtvbuf_pin_page_same(struct ivtvbuf_dmabuf *dma, unsigned long addr, int i)
+{
+	struct page *page;
+	int err;
+
+	err = get_user_pages(current,current->mm,addr + (i << PAGE_SHIFT),1,
+			     dma->direction == PCI_DMA_FROMDEVICE,0,&page,NULL);
+	if (err != 1)
+		return 0;
+	page_cache_release(page);
+	return page == dma->pages[i];
+}
+
+/*
+ * The kept mapping is good while the buffer is in the same VMA it was
+ * pinned from, unchanged in place, offset, file and flags.  An munmap,
+ * mremap or mprotect of any part of the buffer splits, moves or
+ * replaces the VMA; an munmap and mmap of the same range gives new
+ * anonymous pages, which the first and last page show.  That is a
+ * VMA lookup and two page lookups a hit instead of a walk of the whole
+ * buffer.  Pages replaced within the VMA, by madvise(MADV_DONTNEED) for
+ * one, go unnoticed as they do for any USERPTR buffer while queued.
+ */
+static int
+ivtvbuf_pin_same(struct ivtvbuf_pin *pin, unsigned long addr)
+{
+	struct vm_area_struct *vma = ivtvbuf_pin_vma(addr,pin->bsize);
+
+	if (pin->mm != current->mm || NULL == vma || vma != pin->vma ||
+	    vma->vm_start != pin->vm_start || vma->vm_end != pin->vm_end ||
+	    vma->vm_pgoff != pin->vm_pgoff || vma->vm_flags != pin->vm_flags ||
+	    vma->vm_file != pin->vm_file)
+		return 0;
+	addr &= PAGE_MASK;
+	return ivtvbuf_pin_page_same(&pin->dma,addr,0) &&
+		ivtvbuf_pin_page_same(&pin->dma,addr,pin->dma.nr_pages - 1);
+}
+
+/* Give a USERPTR buffer the mapping kept for its address, if any */
+static void
+ivtvbuf_pin_get(struct ivtvbuf_queue *q, struct ivtvbuf_buffer *vb)
+{
+	struct ivtvbuf_pin *pin;
+	int i, ok;
+
+	for (i = 0; i < IVTVBUF_PIN_CACHE; i++) {
+		pin = &q->pins[i];
+		if (NULL == pin->dma.pages || pin->baddr != vb->baddr)
+			continue;
+		ok = (pin->bsize == vb->bsize);
+		if (ok) {
+			down_read(&current->mm->mmap_sem);
+			ok = ivtvbuf_pin_same(pin,vb->baddr);
+			up_read(&current->mm->mmap_sem);
+		}
+		if (!ok) {
+			dprintk(1,"pin cache: 0x%lx changed\n",pin->baddr);
+			ivtvbuf_pin_drop(q,pin);
+			return;
+		}
+		vb->dma = pin->dma;
+		ivtvbuf_dma_init(&pin->dma);
+		pin->baddr = 0;
+		dprintk(2,"pin cache: reuse 0x%lx\n",vb->baddr);
+		return;
+	}
+}
+
+static void
+ivtvbuf_pin_flush(struct ivtvbuf_queue *q)
+{
+	int i;
+
+	for (i = 0; i < IVTVBUF_PIN_CACHE; i++)
+		if (q->pins[i].dma.pages)
+			ivtvbuf_pin_drop(q,&q->pins[i]);
+}
+
+/* --------------------------------------------------------------------- */
+
 void ivtvbuf_queue_init(struct ivtvbuf_queue* q,
 			 struct ivtvbuf_queue_ops *ops,
 			 struct pci_dev *pci,
@@ -509,6 +732,7 @@ ivtvbuf_queue_cancel(struct ivtvbuf_queue *q)
 			continue;
 		q->ops->buf_release(q,q->bufs[i]);
 	}
+	ivtvbuf_pin_flush(q);
 	INIT_LIST_HEAD(&q->stream);
 }
 
@@ -687,9 +911,13 @@ ivtvbuf_qbuf(struct ivtvbuf_queue *q,
 	case V4L2_MEMORY_USERPTR:
 		if (b->length < buf->bsize)
 			goto done;
-		if (STATE_NEEDS_INIT != buf->state && buf->baddr != b->m.userptr)
+		if (STATE_NEEDS_INIT != buf->state && buf->baddr != b->m.userptr) {
+			ivtvbuf_pin_put(q,buf);
 			q->ops->buf_release(q,buf);
+		}
 		buf->baddr = b->m.userptr;
+		if (STATE_NEEDS_INIT == buf->state)
+			ivtvbuf_pin_get(q,buf);
 		break;
 	case V4L2_MEMORY_OVERLAY:
 		buf->boff = b->m.offset;
@@ -1220,6 +1448,7 @@ int ivtvbuf_mmap_free(struct ivtvbuf_queue *q)
 		kfree(q->bufs[i]);
 		q->bufs[i] = NULL;
 	}
+	ivtvbuf_pin_flush(q);
 	return 0;
 }
 
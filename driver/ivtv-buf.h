@@ -38,10 +38,11 @@ struct scatterlist* ivtvbuf_vmalloc_to_sg(unsigned char *virt, int nr_pages);
 /*
  * Return a scatterlist for a an array of userpages (NULL on errors).
  * Memory for the scatterlist is allocated using kmalloc.  The caller
- * must free the memory.
+ * must free the memory.  Physically contiguous pages within one huge
+ * page share an entry, *nr_sg is set to the number of entries.
  */
 struct scatterlist* ivtvbuf_pages_to_sg(struct page **pages, int nr_pages,
-					 int offset);
+					 int offset, int *nr_sg);
 
 /* --------------------------------------------------------------------- */
 
@@ -70,6 +71,8 @@ struct ivtvbuf_dmabuf {
 	/* for userland buffer */
 	int                 offset;
 	struct page         **pages;
+	struct page         **pinned;	/* references held, one per huge page */
+	int                 nr_pinned;
 
 	/* for kernel buffers */
 	void                *vmalloc;
@@ -80,6 +83,7 @@ struct ivtvbuf_dmabuf {
 	/* common */
 	struct scatterlist  *sglist;
 	int                 sglen;
+	int                 nr_sg;	/* entries in sglist before mapping */
 	int                 nr_pages;
 	int                 direction;
 };
@@ -169,6 +173,25 @@ struct ivtvbuf_buffer {
 	struct timeval          ts;
 };
 
+/*
+ * USERPTR buffers given a new address keep their pinned pages and DMA
+ * mapping here, so an application going round a fixed set of buffers
+ * doesn't pin and map them again each time one moves to another index.
+ * The VMA the buffer was in is remembered to tell if it is still mapped
+ * the same way.
+ */
+#define IVTVBUF_PIN_CACHE VIDEO_MAX_FRAME
+
+struct ivtvbuf_pin {
+	unsigned long           baddr;
+	size_t                  bsize;
+	struct ivtvbuf_dmabuf  dma;	/* unused when dma.pages is NULL */
+	struct mm_struct       *mm;
+	struct vm_area_struct  *vma;
+	unsigned long           vm_start, vm_end, vm_pgoff, vm_flags;
+	struct file            *vm_file;
+};
+
 struct ivtvbuf_queue_ops {
 	int (*buf_setup)(struct ivtvbuf_queue *q,
 			 unsigned int *count, unsigned int *size);
@@ -203,6 +226,10 @@ struct ivtvbuf_queue {
 	unsigned int               read_off;
 	struct ivtvbuf_buffer     *read_buf;
 
+	/* USERPTR mappings not in use by a buffer */
+	struct ivtvbuf_pin         pins[IVTVBUF_PIN_CACHE];
+	unsigned int               pin_next;
+
 	/* driver private data */
 	void                       *priv_data;
 };
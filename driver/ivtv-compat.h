@@ -168,6 +168,23 @@ static inline unsigned long msecs_to_jiffies(const unsigned int m)
 #define I2C_NAME(s) (s)->name
 #endif /* I2C_NAME */
 
+/* Buffer timestamps. Before 2.6.17 there is no exported monotonic
+   clock, fall back to the wall clock. */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 17)
+#include <linux/ktime.h>
+#define ivtv_monotonic_ts(ts) ktime_get_ts(ts)
+#else
+#include <linux/time.h>
+static inline void ivtv_monotonic_ts(struct timespec *ts)
+{
+	struct timeval tv;
+
+	do_gettimeofday(&tv);
+	ts->tv_sec = tv.tv_sec;
+	ts->tv_nsec = tv.tv_usec * 1000;
+}
+#endif
+
 #ifndef I2C_DRIVERID_SAA7127
 // Using temporary hack for missing I2C driver-ID for SAA7127
 #define I2C_DRIVERID_SAA7127 72
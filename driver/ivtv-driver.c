@@ -139,6 +139,8 @@ int errno;
 
 int newi2c = 1;
 
+static int mpg_fanout = 0;
+
 module_param_array(tuner, int, &tuner_c, 0644);
 module_param_array(radio, bool, &radio_c, 0644);
 module_param_array(cardtype, int, &cardtype_c, 0644);
@@ -150,6 +152,7 @@ module_param(ivtv_efw, charp, 0644);
 module_param(ivtv_dfw, charp, 0644);
 module_param(ivtv_first_minor, int, 0644);
 module_param(newi2c, int, 0644);
+module_param(mpg_fanout, int, 0444);
 
 MODULE_PARM_DESC(tuner, "Tuner type selection,\n"
 			"\t\t\tsee tuner.h for values");
@@ -181,6 +184,12 @@ MODULE_PARM_DESC(newi2c,
 		 "Use new I2C implementation\n"
 		 "\t\t\t default is 1 (yes)");
 
+MODULE_PARM_DESC(mpg_fanout,
+		 "Share the MPEG stream between all readers through a ring\n"
+		 "\t\t\tof this many buffers, a power of 2 from 2 to 256. Other\n"
+		 "\t\t\tvalues fail the load. A reader that falls behind skips\n"
+		 "\t\t\tdata. Default: 0 (off)");
+
 MODULE_PARM_DESC(ivtv_first_minor, "Set minor assigned to first card");
 
 MODULE_AUTHOR("Chris Kennedy, Kevin Thayer, Hans Verkuil");
@@ -347,6 +356,7 @@ static void ivtv_process_options(struct ivtv *itv)
 	itv->options.radio = radio[itv->num];
 	itv->options.tda9887 = tda9887[itv->num];
 	itv->options.newi2c = newi2c;
+	itv->options.mpg_fanout = mpg_fanout;
 
         chipname = "cx23416";
 	if ((itv->card = ivtv_get_card(itv->options.cardtype - 1))) {
@@ -475,7 +485,7 @@ static int __devinit ivtv_init_struct1(struct ivtv *itv)
 	/* Encoder Options */
 	itv->end_gop = 0;
 	itv->idx_sdf_offset = 0;
-	itv->idx_sdf_num = 400;
+	itv->idx_sdf_num = 0;	/* set by the firmware on encoder start */
 	itv->idx_sdf_mask = 7;
 
 	itv->dmaboxnum = 5;
@@ -1026,6 +1036,12 @@ static int module_start(void)
 		return -1;
 	}
 
+	if (mpg_fanout != 0 && (mpg_fanout < 2 || mpg_fanout > 256 ||
+				(mpg_fanout & (mpg_fanout - 1)))) {
+		printk(KERN_ERR "ivtv:  mpg_fanout must be 0 or a power of 2 from 2 to 256. Exiting...\n");
+		return -EINVAL;
+	}
+
 	if (ivtv_debug < 0 || ivtv_debug > 511) {
 		ivtv_debug = 1;
 		printk(KERN_INFO "ivtv:  debug value must be >= 0 and <= 511!\n");
@@ -277,6 +277,28 @@ struct ivtv_dma_settings {
 #define IVTV_CMD_SDRAM_REFRESH_INIT 0x80000640
 #define IVTV_SDRAM_SLEEPTIME (60 * HZ / 100)	/* 600ms */
 
+/* IVTV_IOC_S_FREQUENCY_WAIT, timeouts in msecs */
+#define IVTV_TUNE_TIMEOUT	1000
+#define IVTV_TUNE_TIMEOUT_MAX	5000
+#define IVTV_TUNE_POLL		(HZ / 100)	/* 10ms */
+
+/* Encoder program index, the firmware keeps at most 400 entries and so
+   does the driver between IVTV_IOC_G_ENC_INDEX calls */
+#define IVTV_MAX_PGM_INDEX	400
+
+/* Sliced VBI: at most 2 * 18 lines per frame, which the encoder moves in
+   38 line slots of vbi_sliced_size (288) bytes */
+#define IVTV_VBI_SLICED_LINES		36
+#define IVTV_VBI_SLICED_RAW_SIZE	(38 * 288)
+
+/* IVTV_IOC_S_PACK: transfers are padded to 256 bytes, the data starts
+   after the header */
+#define IVTV_PACK_CHUNK(size)		(((size) + 255) & ~255)
+#define IVTV_PACK_DATA_OFFSET		IVTV_PACK_CHUNK(sizeof(struct ivtv_pack_header))
+
+/* The firmware PTS is 33 bits of a 90 kHz clock */
+#define IVTV_PTS_MASK			0x1ffffffffULL
+
 #define IVTV_IRQ_ENC_START_CAP		(0x1 << 31)
 #define IVTV_IRQ_ENC_EOS		(0x1 << 30)
 #define IVTV_IRQ_ENC_VBI_CAP		(0x1 << 29)
@@ -432,6 +454,7 @@ struct ivtv_options {
 	int radio;		/* enable/disable radio */
         int tda9887;
 	int newi2c;		/* New I2C algorithm */
+	int mpg_fanout;		/* MPEG ring buffers shared by all readers, 0 is off */
 };
 
 /* ivtv-specific mailbox template */
@@ -509,7 +532,13 @@ struct ivtv_buffer {
 	struct ivtv_fmt      	*fmt;
 	u32 			count;
 	int 			type;
-	u64 			pts_stamp;
+	u64 			pts_stamp;	/* 33 bit firmware PTS */
+	struct timespec		ts_mono;	/* monotonic time at DMA done */
+
+	/* IVTV_IOC_S_PACK: transfers in this buffer so far, and where
+	   the next one goes */
+	u32			pack_count;
+	u32			pack_fill;
 };
 
 struct cx23416_dma_request {
@@ -598,12 +627,34 @@ struct ivtv_stream {
 	struct semaphore mlock;
 
 	int first_read;		/* used to clean up stream */
+
+	/* IVTV_IOC_S_PACK, transfers per buffer (0 is one, unpacked) and
+	   the buffer size without packing */
+	u32 pack_chunks;
+	int chunksize;
+	u32 pack_drops;		/* transfers that didn't fit a buffer */
+
+	/* The ring all readers of the MPEG stream share with the
+	   mpg_fanout option, see ivtv-fanout.c */
+	struct ivtv_fanout *fanout;
 };
 
 struct ivtv_open_id {
 	int open_id;
 	int type;
 	struct ivtv *itv;
+
+	/* Claimed its stream at VIDIOC_REQBUFS or VIDIOC_STREAMON, the
+	   buffer ioctls then only check stream->id */
+	int owner;
+
+	/* Position of this reader in the MPEG fan-out ring */
+	int fan_reader;
+	struct list_head fan_list;
+	u32 fan_seq;		/* transfer being read */
+	u32 fan_off;		/* bytes of it read */
+	u32 fan_overruns;
+	u32 fan_lost;		/* transfers skipped by overruns */
 };
 
 /* dualwatch thread and flags */
@@ -716,8 +767,12 @@ struct ivtv {
 	/* Buffer for the maximum of 2 * 18 * packet_size sliced VBI lines.
 	   One for /dev/vbi0 and one for /dev/vbi4 */
 
-        struct v4l2_sliced_vbi_data vbi_sliced_data[36];
-        struct v4l2_sliced_vbi_data vbi_sliced_dec_data[36];
+        struct v4l2_sliced_vbi_data vbi_sliced_data[IVTV_VBI_SLICED_LINES];
+        struct v4l2_sliced_vbi_data vbi_sliced_dec_data[IVTV_VBI_SLICED_LINES];
+
+	/* One frame of sliced lines copied out of a capture buffer and
+	   byteswapped, see ivtv_vbi_process_sliced() */
+	u8 *vbi_sliced_raw;
 
 	/* Buffer for VBI data inserted into MPEG stream.
 	   The first byte is a dummy byte that's never used.
@@ -747,6 +802,14 @@ struct ivtv {
 	u32 idx_sdf_num;
 	u32 idx_sdf_mask;
 
+	/* Program index copied out of the firmware table as the MPEG data
+	   is transferred, protected by DMA_slock */
+	struct ivtv_enc_index_entry pgm_index[IVTV_MAX_PGM_INDEX];
+	int pgm_index_rd;
+	int pgm_index_wr;
+	u32 pgm_index_fw;	/* next firmware table entry to read */
+	u64 mpg_data_received;	/* MPEG bytes transferred this capture */
+
 	wait_queue_head_t cap_w;
 
 	/* i2c */
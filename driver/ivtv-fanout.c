@@ -0,0 +1,333 @@
+/*
+    MPEG stream fan-out to several readers
+
+    With the mpg_fanout module option read() on the MPEG device no longer
+    gives the stream to the first file handle. The encoder DMAs into a
+    ring of kernel buffers which nobody waits on: the oldest buffer is
+    always the next one filled. Every reader keeps its own position in
+    the ring and copies straight out of it to user space. A reader that
+    falls a whole ring behind skips to the oldest data still there and
+    counts an overrun, it never holds up the capture or the other
+    readers. The capture runs while there is at least one reader.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ivtv-driver.h"
+#include "ivtv-fileops.h"
+#include "ivtv-queue.h"
+#include "ivtv-irq.h"
+#include "ivtv-fanout.h"
+
+static void ivtv_fanout_free(struct ivtv *itv, struct ivtv_stream *st,
+			     struct ivtv_fanout *fan)
+{
+	struct ivtv_buffer *buf;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&st->slock, flags);
+	for (i = 0; i < fan->nbufs; i++) {
+		if ((buf = fan->bufs[i]) == NULL)
+			continue;
+		if (buf->vb.state == STATE_QUEUED || buf->vb.state == STATE_ACTIVE)
+			list_del(&buf->vb.queue);
+		buf->vb.state = STATE_ERROR;
+	}
+	spin_unlock_irqrestore(&st->slock, flags);
+
+	for (i = 0; i < fan->nbufs; i++) {
+		if ((buf = fan->bufs[i]) == NULL)
+			continue;
+		ivtv_free_v4lbuf(itv->dev, buf, st);
+		kfree(buf);
+	}
+	kfree(fan);
+}
+
+/* Allocate the ring and queue all of it for DMA */
+static struct ivtv_fanout *ivtv_fanout_alloc(struct ivtv *itv,
+					     struct ivtv_stream *st, int nbufs)
+{
+	struct ivtv_fanout *fan;
+	struct ivtv_buffer *buf;
+	unsigned long flags;
+	int size = sizeof(*fan) + nbufs * (sizeof(*fan->bufs) + sizeof(*fan->slot));
+	int i;
+
+	fan = kmalloc(size, GFP_KERNEL);
+	if (fan == NULL)
+		return NULL;
+	memset(fan, 0, size);
+	fan->nbufs = nbufs;
+	fan->slot = (struct ivtv_fanout_slot *)(fan + 1);
+	fan->bufs = (struct ivtv_buffer **)(fan->slot + nbufs);
+	init_waitqueue_head(&fan->waitq);
+	INIT_LIST_HEAD(&fan->readers);
+
+	for (i = 0; i < nbufs; i++) {
+		buf = ivtvbuf_alloc(sizeof(struct ivtv_buffer));
+		if (buf == NULL)
+			goto fail;
+
+		/* kernel bounce buffer, see ivtvbuf_iolock() */
+		buf->vb.i = i;
+		buf->vb.memory = V4L2_MEMORY_USERPTR;
+		buf->vb.baddr = 0;
+		buf->vb.size = st->bufsize;
+		if (ivtvbuf_iolock(itv->dev, &buf->vb, NULL)) {
+			ivtv_free_v4lbuf(itv->dev, buf, st);
+			kfree(buf);
+			goto fail;
+		}
+		ivtv_init_v4l2buf(itv->dev, st, buf->vb.dma.sglist, buf);
+		fan->bufs[i] = buf;
+
+		spin_lock_irqsave(&st->slock, flags);
+		buf->vb.state = STATE_QUEUED;
+		list_add_tail(&buf->vb.queue, &st->queued);
+		spin_unlock_irqrestore(&st->slock, flags);
+	}
+	return fan;
+
+fail:
+	IVTV_DEBUG_WARN("Could not allocate %d fan-out buffers of %d bytes\n",
+			nbufs, st->bufsize);
+	ivtv_fanout_free(itv, st, fan);
+	return NULL;
+}
+
+/* Add a reader, the first one starts the capture */
+static int ivtv_fanout_attach(struct ivtv_open_id *id)
+{
+	struct ivtv *itv = id->itv;
+	struct ivtv_stream *st = &itv->streams[id->type];
+	struct ivtv_fanout *fan;
+	unsigned long flags;
+
+	down(&st->mlock);
+	if (id->fan_reader) {
+		up(&st->mlock);
+		return 0;
+	}
+	fan = st->fanout;
+	if (fan == NULL) {
+		if (ivtv_claim_stream(id, id->type)) {
+			up(&st->mlock);
+			return -EBUSY;
+		}
+		/* already capturing through the videobuf queue */
+		if (test_and_set_bit(IVTV_F_S_CAPTURING, &st->s_flags)) {
+			up(&st->mlock);
+			return -EBUSY;
+		}
+		fan = ivtv_fanout_alloc(itv, st, itv->options.mpg_fanout);
+		if (fan == NULL) {
+			clear_bit(IVTV_F_S_CAPTURING, &st->s_flags);
+			ivtv_release_stream(itv, id->type);
+			up(&st->mlock);
+			return -ENOMEM;
+		}
+		st->fanout = fan;
+		st->first_read = 0;
+		if (ivtv_start_enc_capture(itv, id->type)) {
+			/* the stream is released already */
+			st->fanout = NULL;
+			ivtv_fanout_free(itv, st, fan);
+			up(&st->mlock);
+			return -EIO;
+		}
+		IVTV_DEBUG_INFO("MPEG fan-out started, %d buffers\n", fan->nbufs);
+	}
+
+	spin_lock_irqsave(&st->slock, flags);
+	id->fan_seq = fan->head;
+	spin_unlock_irqrestore(&st->slock, flags);
+	id->fan_off = 0;
+	id->fan_overruns = 0;
+	id->fan_lost = 0;
+	id->fan_reader = 1;
+	list_add_tail(&id->fan_list, &fan->readers);
+	fan->nreaders++;
+	up(&st->mlock);
+	return 0;
+}
+
+/* Remove a reader from close(), the last one stops the capture */
+void ivtv_fanout_detach(struct ivtv_open_id *id)
+{
+	struct ivtv *itv = id->itv;
+	struct ivtv_stream *st = &itv->streams[id->type];
+	struct ivtv_fanout *fan = st->fanout;
+
+	down(&st->mlock);
+	list_del(&id->fan_list);
+	id->fan_reader = 0;
+	if (--fan->nreaders) {
+		/* the stream belongs to one of the readers left */
+		if (st->id == id->open_id)
+			st->id = list_entry(fan->readers.next,
+				struct ivtv_open_id, fan_list)->open_id;
+		up(&st->mlock);
+		return;
+	}
+
+	IVTV_DEBUG_INFO("MPEG fan-out stopped\n");
+	if (test_bit(IVTV_F_S_CAPTURING, &st->s_flags))
+		ivtv_stop_enc_capture(itv, id->type);
+	st->fanout = NULL;
+	ivtv_fanout_free(itv, st, fan);
+	ivtv_v4l2_release(itv, st);
+	ivtv_release_stream(itv, id->type);
+	up(&st->mlock);
+}
+
+void ivtv_fanout_done(struct ivtv_stream *st, struct ivtv_buffer *buf)
+{
+	struct ivtv_fanout *fan = st->fanout;
+	struct ivtv_fanout_slot *slot = &fan->slot[fan->head & (fan->nbufs - 1)];
+
+	slot->buf = buf;
+	slot->len = buf->vb.size;
+	fan->head++;
+
+	/* straight back to the end of the queue, it is filled again once
+	   it is the oldest */
+	list_del(&buf->vb.queue);
+	buf->vb.state = STATE_QUEUED;
+	list_add_tail(&buf->vb.queue, &st->queued);
+
+	wake_up_interruptible(&fan->waitq);
+}
+
+/* Is transfer seq still intact? The buffer of transfer head - nbufs is
+   the next one filled and may be under DMA already. Called with the
+   slock held. */
+static inline int ivtv_fanout_valid(struct ivtv_fanout *fan, u32 seq)
+{
+	return fan->head - seq < fan->nbufs;
+}
+
+ssize_t ivtv_fanout_read(struct ivtv_open_id *id, char *ubuf, size_t count,
+			 int non_blocking)
+{
+	struct ivtv *itv = id->itv;
+	struct ivtv_stream *st = &itv->streams[id->type];
+	struct ivtv_fanout *fan;
+	struct ivtv_buffer *buf;
+	unsigned long flags;
+	size_t done = 0;
+	u32 len, bytes;
+	int valid, rc;
+
+	if (!id->fan_reader && (rc = ivtv_fanout_attach(id)))
+		return rc;
+	fan = st->fanout;
+
+	while (done < count) {
+		/* a DMA that found no buffer to go into */
+		if (test_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags) &&
+		    list_empty(&st->active))
+			ivtv_sched_DMA(itv, st->type);
+
+		spin_lock_irqsave(&st->slock, flags);
+		if (fan->head == id->fan_seq) {
+			spin_unlock_irqrestore(&st->slock, flags);
+			if (done)
+				break;
+			if (non_blocking)
+				return -EAGAIN;
+			if (wait_event_interruptible(fan->waitq,
+						     fan->head != id->fan_seq))
+				return -ERESTARTSYS;
+			continue;
+		}
+		if (!ivtv_fanout_valid(fan, id->fan_seq)) {
+			/* overwritten, go on with the oldest one left */
+			id->fan_lost += fan->head - (fan->nbufs - 1) - id->fan_seq;
+			id->fan_seq = fan->head - (fan->nbufs - 1);
+			id->fan_off = 0;
+			id->fan_overruns++;
+			IVTV_DEBUG_WARN("MPEG fan-out reader %d overrun\n",
+					id->open_id);
+		}
+		buf = fan->slot[id->fan_seq & (fan->nbufs - 1)].buf;
+		len = fan->slot[id->fan_seq & (fan->nbufs - 1)].len;
+		spin_unlock_irqrestore(&st->slock, flags);
+
+		if (id->fan_off == 0)
+			ivtvbuf_dma_pci_sync(itv->dev, &buf->vb.dma);
+		bytes = min((size_t)(len - id->fan_off), count - done);
+		if (copy_to_user(ubuf + done,
+				 (u8 *)buf->vb.dma.vmalloc + id->fan_off, bytes))
+			return done ? done : -EFAULT;
+
+		/* the DMA may have caught up with us during the copy */
+		spin_lock_irqsave(&st->slock, flags);
+		valid = ivtv_fanout_valid(fan, id->fan_seq);
+		spin_unlock_irqrestore(&st->slock, flags);
+		if (!valid)
+			continue;
+
+		done += bytes;
+		id->fan_off += bytes;
+		if (id->fan_off == len) {
+			id->fan_off = 0;
+			id->fan_seq++;
+		}
+	}
+	return done;
+}
+
+unsigned int ivtv_fanout_poll(struct file *filp, poll_table *wait)
+{
+	struct ivtv_open_id *id = filp->private_data;
+	struct ivtv_stream *st = &id->itv->streams[id->type];
+	struct ivtv_fanout *fan;
+
+	/* the capture starts here as well, select() comes before read() */
+	if (!id->fan_reader && ivtv_fanout_attach(id))
+		return POLLERR;
+	fan = st->fanout;
+
+	poll_wait(filp, &fan->waitq, wait);
+	if (fan->head != id->fan_seq)
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+int ivtv_fanout_status(struct ivtv_open_id *id, struct ivtv_fanout_status *fs)
+{
+	struct ivtv_stream *st = &id->itv->streams[id->type];
+	struct ivtv_fanout *fan;
+	unsigned long flags;
+
+	down(&st->mlock);
+	if (!id->fan_reader) {
+		up(&st->mlock);
+		return -EINVAL;
+	}
+	fan = st->fanout;
+	memset(fs, 0, sizeof(*fs));
+	fs->buffers = fan->nbufs;
+	fs->readers = fan->nreaders;
+	spin_lock_irqsave(&st->slock, flags);
+	fs->lag = fan->head - id->fan_seq;
+	spin_unlock_irqrestore(&st->slock, flags);
+	fs->overruns = id->fan_overruns;
+	fs->lost = id->fan_lost;
+	up(&st->mlock);
+	return 0;
+}
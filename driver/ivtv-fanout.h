@@ -0,0 +1,44 @@
+/*
+    MPEG stream fan-out to several readers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+struct ivtv_fanout {
+	int nbufs;		/* a power of 2 */
+	struct ivtv_buffer **bufs;
+
+	/* transfer seq is in slot[seq & (nbufs - 1)] while
+	   head - seq < nbufs, protected by the stream's slock */
+	struct ivtv_fanout_slot {
+		struct ivtv_buffer *buf;
+		u32 len;
+	} *slot;
+	u32 head;		/* sequence number of the next transfer */
+	wait_queue_head_t waitq;
+
+	/* the readers, protected by the stream's mlock */
+	struct list_head readers;
+	int nreaders;
+};
+
+ssize_t ivtv_fanout_read(struct ivtv_open_id *id, char *ubuf, size_t count,
+			 int non_blocking);
+unsigned int ivtv_fanout_poll(struct file *filp, poll_table *wait);
+void ivtv_fanout_detach(struct ivtv_open_id *id);
+int ivtv_fanout_status(struct ivtv_open_id *id, struct ivtv_fanout_status *fs);
+
+/* Called with the stream's slock held when a DMA into buf is done */
+void ivtv_fanout_done(struct ivtv_stream *st, struct ivtv_buffer *buf);
@@ -31,6 +31,7 @@
 #include "audiochip.h"
 #include "cx25840.h"
 #include "ivtv-ioctl.h"
+#include "ivtv-fanout.h"
 
 typedef unsigned long uintptr_t;
 
@@ -288,6 +289,7 @@ void buffer_queue(struct ivtvbuf_queue *vq,
         list_add_tail(&buf->vb.queue,&st->queued);
         buf->vb.state = STATE_QUEUED;
         buf->count    = 1;
+	buf->pack_count = 0;
         IVTV_DEBUG_INFO("[%p/%d] %s - append to queue in state 0x%0x\n",
                buf, buf->vb.i, __FUNCTION__, buf->vb.state);
 }
@@ -362,33 +364,13 @@ static int ivtv_read(struct file *filp, char *ubuf, size_t count, loff_t * pos)
 	return -EINVAL;
 }
 
-ssize_t ivtv_v4l2_read(struct file * filp, char *buf, size_t count,
-		       loff_t * pos)
+/* Start the encoder on a claimed stream with IVTV_F_S_CAPTURING set, and
+   the VBI capture for VBI insertion if it is an MPEG stream. On failure
+   the stream is released again and -EIO returned. */
+int ivtv_start_enc_capture(struct ivtv *itv, int type)
 {
-	struct ivtv_open_id *id = filp->private_data;
-	struct ivtv_stream *stream;
+	struct ivtv_stream *stream = &itv->streams[type];
        	struct ivtv_stream *vbi_stream;
-	struct ivtv *itv = id->itv;
-	int type = id->type;
-
-	IVTV_DEBUG_INFO("v4l2 read\n");
-
-	if (type == IVTV_ENC_STREAM_TYPE_RAD) {
-		/* you cannot read from these stream types. */
-		return -EPERM;
-	}
-
-	stream = &itv->streams[type];
-
-	/* Try to claim this stream. */
-	if (ivtv_claim_stream(id, type))
-		return -EBUSY;
-
-	/* If capture is already in progress, then we also have to
-	   do nothing extra. */
-	if (test_and_set_bit(IVTV_F_S_CAPTURING, &stream->s_flags)) {
-		return ivtv_read(filp, buf, count, pos);
-	}
 
 	/* Start VBI capture if required */
        	vbi_stream = &itv->streams[IVTV_ENC_STREAM_TYPE_VBI];
@@ -421,14 +403,17 @@ ssize_t ivtv_v4l2_read(struct file * filp, char *buf, size_t count,
                	IVTV_DEBUG_INFO("VBI insertion started\n");
 	}
 
-	//IVTV_DEBUG_INFO("VIDEOC_STREAMON\n");
-        ivtvbuf_streamon(&stream->vidq);
-	//ivtvbuf_read_start(&stream->vidq);
+	/* the fan-out ring is not a videobuf queue */
+	if (stream->fanout == NULL) {
+		//IVTV_DEBUG_INFO("VIDEOC_STREAMON\n");
+        	ivtvbuf_streamon(&stream->vidq);
+		//ivtvbuf_read_start(&stream->vidq);
+	}
 
 	/* Tell the card to start capturing */
 	if (!ivtv_start_v4l2_encode_stream(itv, type)) {
         	/* We're done */
-	        return ivtv_read(filp, buf, count, pos);
+	        return 0;
         }
 
         /* failure, clean up */
@@ -447,6 +432,67 @@ ssize_t ivtv_v4l2_read(struct file * filp, char *buf, size_t count,
         return -EIO;
 }
 
+/* Stop a capture started by ivtv_start_enc_capture(), the stream stays
+   claimed. */
+void ivtv_stop_enc_capture(struct ivtv *itv, int type)
+{
+	struct ivtv_stream *vbi_stream = &itv->streams[IVTV_ENC_STREAM_TYPE_VBI];
+
+	IVTV_DEBUG_INFO("close stopping capture\n");
+	/* Special case: a running VBI capture for VBI insertion
+	   in the mpeg stream. Need to stop that too. */
+	if (type == IVTV_ENC_STREAM_TYPE_MPG &&
+	    test_bit(IVTV_F_S_CAPTURING, &vbi_stream->s_flags) &&
+	    vbi_stream->id == -1) {
+		IVTV_DEBUG_INFO(
+			"close stopping embedded VBI capture\n");
+
+		ivtv_stop_capture(itv, IVTV_ENC_STREAM_TYPE_VBI);
+
+		/* 'Unclaim' this stream */
+		ivtv_v4l2_release(itv, vbi_stream);
+	}
+
+	ivtv_stop_capture(itv, type);
+}
+
+ssize_t ivtv_v4l2_read(struct file * filp, char *buf, size_t count,
+		       loff_t * pos)
+{
+	struct ivtv_open_id *id = filp->private_data;
+	struct ivtv_stream *stream;
+	struct ivtv *itv = id->itv;
+	int type = id->type;
+
+	IVTV_DEBUG_INFO("v4l2 read\n");
+
+	if (type == IVTV_ENC_STREAM_TYPE_RAD) {
+		/* you cannot read from these stream types. */
+		return -EPERM;
+	}
+
+	/* Shared between all readers, see ivtv-fanout.c */
+	if (type == IVTV_ENC_STREAM_TYPE_MPG && itv->options.mpg_fanout)
+		return ivtv_fanout_read(id, buf, count,
+					filp->f_flags & O_NONBLOCK);
+
+	stream = &itv->streams[type];
+
+	/* Try to claim this stream. */
+	if (ivtv_claim_stream(id, type))
+		return -EBUSY;
+
+	/* If capture is already in progress, then we also have to
+	   do nothing extra. */
+	if (test_and_set_bit(IVTV_F_S_CAPTURING, &stream->s_flags)) {
+		return ivtv_read(filp, buf, count, pos);
+	}
+
+	if (ivtv_start_enc_capture(itv, type))
+		return -EIO;
+	return ivtv_read(filp, buf, count, pos);
+}
+
 ssize_t ivtv_v4l2_write(struct file * filp, const char *buf, size_t count,
 			loff_t * pos)
 {
@@ -466,6 +512,9 @@ unsigned int ivtv_v4l2_enc_poll(struct file *filp, poll_table * wait)
 	struct ivtv *itv = id->itv;
 	struct ivtv_buffer *buf;
 
+	if (id->type == IVTV_ENC_STREAM_TYPE_MPG && itv->options.mpg_fanout)
+		return ivtv_fanout_poll(filp, wait);
+
 	st = &itv->streams[id->type];
 	if (!st || st->state == 0) {
 		mask |= POLLERR;
@@ -615,7 +664,7 @@ int ivtv_v4l2_release(struct ivtv *itv, struct ivtv_stream *st) {
 int ivtv_v4l2_close(struct inode *inode, struct file *filp)
 {
 	struct ivtv_open_id *id = filp->private_data;
-	struct ivtv_stream *stream, *vbi_stream;
+	struct ivtv_stream *stream;
 	struct ivtv *itv;
 
 	if (NULL == id) {
@@ -629,6 +678,13 @@ int ivtv_v4l2_close(struct inode *inode, struct file *filp)
 
 	stream = &itv->streams[id->type];
 
+	/* A reader of the shared MPEG stream, the last one stops it */
+	if (id->fan_reader) {
+		ivtv_fanout_detach(id);
+		kfree(id);
+		return 0;
+	}
+
 	/* Easy case first: this stream was never claimed by us */
 	if (stream->id != id->open_id) {
                 kfree(id);
@@ -668,27 +724,8 @@ int ivtv_v4l2_close(struct inode *inode, struct file *filp)
 	}
 
 	/* Stop capturing */
-	if (test_bit(IVTV_F_S_CAPTURING, &stream->s_flags)) {
-		vbi_stream = &itv->streams[IVTV_ENC_STREAM_TYPE_VBI];
-
-
-		IVTV_DEBUG_INFO("close stopping capture\n");
-		/* Special case: a running VBI capture for VBI insertion
-		   in the mpeg stream. Need to stop that too. */
-		if (id->type == IVTV_ENC_STREAM_TYPE_MPG &&
-	            test_bit(IVTV_F_S_CAPTURING, &vbi_stream->s_flags) &&
-                    vbi_stream->id == -1) {
-			IVTV_DEBUG_INFO(
-				"close stopping embedded VBI capture\n");
-
-			ivtv_stop_capture(itv, IVTV_ENC_STREAM_TYPE_VBI);
-
-			/* 'Unclaim' this stream */
-			ivtv_v4l2_release(itv, vbi_stream);
-		}
-
-		ivtv_stop_capture(itv, id->type);
-	}
+	if (test_bit(IVTV_F_S_CAPTURING, &stream->s_flags))
+		ivtv_stop_enc_capture(itv, id->type);
 	/* 'Unclaim' this stream */
 	ivtv_v4l2_release(itv, stream);
 
@@ -737,6 +774,8 @@ int ivtv_v4l2_open(struct inode *inode, struct file *filp)
 	}
 	item->itv = itv;
 	item->type = y;
+	item->fan_reader = 0;
+	item->owner = 0;
 
 	item->open_id = itv->open_id++;
 	filp->private_data = item;
@@ -42,6 +42,11 @@ int ivtv_claim_stream(struct ivtv_open_id *id, int type);
 /* Release a previously claimed stream. */
 void ivtv_release_stream(struct ivtv *itv, int type);
 
+/* Start and stop the encoder for a claimed stream, with the VBI
+   insertion that goes with it. */
+int ivtv_start_enc_capture(struct ivtv *itv, int type);
+void ivtv_stop_enc_capture(struct ivtv *itv, int type);
+
 int ivtv_mmap(struct file *flip, struct vm_area_struct *vma);
 
 void ivtv_timeout(unsigned long data);
@@ -35,6 +35,8 @@
 #include "audiochip.h"
 #include "cx25840.h"
 #include "ivtv-reset.h"
+#include "ivtv-fanout.h"
+#include <linux/smp_lock.h>
 
 /* from v4l1_compat.c */
 extern int
@@ -267,6 +269,30 @@ static int ivtv_get_fmt(struct ivtv *itv, int streamtype, struct v4l2_format *fm
         return 0;
 }
 
+/* The VBI device delivers raw or sliced VBI, whichever was set last.
+   The buffer type can't change under a running capture, nor while
+   buffers of the old type are still allocated. */
+static int ivtv_set_vbi_buftype(struct ivtv *itv, int streamtype, u32 buftype)
+{
+	struct ivtv_stream *st = &itv->streams[streamtype];
+	int i;
+
+	if (streamtype != IVTV_ENC_STREAM_TYPE_VBI || st->buftype == buftype)
+		return 0;
+	if (test_bit(IVTV_F_S_CAPTURING, &st->s_flags))
+		return -EBUSY;
+	for (i = 0; i < VIDEO_MAX_FRAME; i++)
+		if (st->vidq.bufs[i])
+			return -EBUSY;
+	st->buftype = buftype;
+	st->vidq.type = buftype;
+
+	/* sliced data is rewritten in place, that doesn't mix with packing */
+	if (buftype == V4L2_BUF_TYPE_SLICED_VBI_CAPTURE && st->pack_chunks)
+		ivtv_stream_set_pack(itv, streamtype, 0);
+	return 0;
+}
+
 static int ivtv_try_or_set_fmt(struct ivtv *itv, int streamtype,
                 struct v4l2_format *fmt, int set_fmt)
 {
@@ -315,11 +341,12 @@ static int ivtv_try_or_set_fmt(struct ivtv *itv, int streamtype,
                     atomic_read(&itv->capturing) > 0) {
                         return -EBUSY;
                 }
+		if (set_fmt && ivtv_set_vbi_buftype(itv, streamtype,
+						    V4L2_BUF_TYPE_VBI_CAPTURE))
+			return -EBUSY;
 		itv->vbi_sliced_in->service_set = 0;
                 itv->card->video_dec_func(itv, VIDIOC_S_FMT, &itv->vbi_in);
 
- 		//st->buftype = V4L2_BUF_TYPE_VBI_CAPTURE;
-
                 return ivtv_get_fmt(itv, streamtype, fmt);
         }
        
@@ -344,9 +371,6 @@ static int ivtv_try_or_set_fmt(struct ivtv *itv, int streamtype,
         set = check_service_set(vbifmt, itv->is_50hz);
         vbifmt->service_set = get_service_set(vbifmt);
 
-	// Sliced Buffers
-        //st->buftype = V4L2_BUF_TYPE_SLICED_VBI_CAPTURE;
-
         if (!set_fmt)
                 return 0;
         if (set == 0)
@@ -354,6 +378,8 @@ static int ivtv_try_or_set_fmt(struct ivtv *itv, int streamtype,
         if (atomic_read(&itv->capturing) > 0 && itv->vbi_sliced_in->service_set == 0) {
                 return -EBUSY;
         }
+	if (ivtv_set_vbi_buftype(itv, streamtype, V4L2_BUF_TYPE_SLICED_VBI_CAPTURE))
+		return -EBUSY;
         itv->card->video_dec_func(itv, VIDIOC_S_FMT, fmt);
 	memcpy(itv->vbi_sliced_in, vbifmt, sizeof(*itv->vbi_sliced_in));
         return 0;
@@ -453,6 +479,131 @@ int ivtv_internal_ioctls(struct ivtv *itv, int streamtype, unsigned int cmd,
 	return 0;
 }
 
+static void ivtv_set_freq(struct ivtv *itv, struct v4l2_frequency *vf)
+{
+	if (test_bit(IVTV_F_I_RADIO_USER, &itv->i_flags)) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 13)
+                vf->frequency *= 1000;
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 13) */
+		itv->freq_radio = vf->frequency;
+		vf->type = V4L2_TUNER_RADIO; /* not always set, and needed by IF demod */
+	} else {
+		itv->freq_tv = vf->frequency;
+		vf->type = V4L2_TUNER_ANALOG_TV;
+	}
+
+	ivtv_mute(itv);
+	IVTV_DEBUG_INFO("v4l2 ioctl: set frequency %d\n", vf->frequency);
+	if (vf->type == V4L2_TUNER_ANALOG_TV) {
+		ivtv_tv_tuner(itv, VIDIOC_S_FREQUENCY, vf);
+	}
+	else {
+		ivtv_radio_tuner(itv, VIDIOC_S_FREQUENCY, vf);
+	}
+	if (itv->options.tda9887 == 0) ivtv_tda9887(itv, VIDIOC_S_FREQUENCY, vf);
+	ivtv_audio_freq_changed(itv);
+	ivtv_unmute(itv);
+}
+
+/* Tune, then poll the tuner PLL and the video decoder until both report a
+   signal. Tuners that cannot report their status count as locked. In radio
+   mode, or when the decoder does not support VIDIOC_G_TUNER, there is no
+   video to wait for and IVTV_TUNE_VIDEO is never set. */
+static int ivtv_tune_wait(struct ivtv *itv, struct ivtv_ioctl_tune *tune)
+{
+	int radio = test_bit(IVTV_F_I_RADIO_USER, &itv->i_flags);
+	u32 wanted = radio ? IVTV_TUNE_LOCKED :
+			     IVTV_TUNE_LOCKED | IVTV_TUNE_VIDEO;
+	u32 msecs = tune->timeout ? tune->timeout : IVTV_TUNE_TIMEOUT;
+	struct v4l2_frequency vf;
+	unsigned long start, timeout;
+
+	if (msecs > IVTV_TUNE_TIMEOUT_MAX)
+		msecs = IVTV_TUNE_TIMEOUT_MAX;
+
+	memset(&vf, 0, sizeof(vf));
+	vf.frequency = tune->frequency;
+	ivtv_set_freq(itv, &vf);
+
+	tune->status = 0;
+	tune->afc = 0;
+	tune->lock_time = tune->signal_time = 0;
+	start = jiffies;
+	timeout = start + msecs_to_jiffies(msecs);
+
+	for (;;) {
+		u32 elapsed = (jiffies - start) * 1000 / HZ;
+
+		if (!(tune->status & IVTV_TUNE_LOCKED)) {
+			struct tuner_status ts;
+
+			memset(&ts, 0, sizeof(ts));
+			if (!radio)
+				ivtv_tv_tuner(itv, TUNER_GET_STATUS, &ts);
+			if (!ts.valid || ts.locked) {
+				tune->status |= IVTV_TUNE_LOCKED;
+				tune->lock_time = elapsed;
+			}
+			tune->afc = ts.afc;
+		}
+
+		if ((wanted & IVTV_TUNE_VIDEO) &&
+		    !(tune->status & IVTV_TUNE_VIDEO)) {
+			struct v4l2_tuner sig;
+
+			memset(&sig, 0, sizeof(sig));
+			if (itv->card->video_dec_func(itv, VIDIOC_G_TUNER,
+						      &sig) < 0)
+				wanted &= ~IVTV_TUNE_VIDEO;
+			else if (sig.signal) {
+				tune->status |= IVTV_TUNE_VIDEO;
+				tune->signal_time = elapsed;
+			}
+		}
+
+		if ((tune->status & wanted) == wanted ||
+		    time_after(jiffies, timeout))
+			break;
+		if (ivtv_sleep_timeout(IVTV_TUNE_POLL, 1))
+			return -EINTR;
+	}
+
+	IVTV_DEBUG_INFO("tuned to %d: status 0x%x afc %d, lock %u ms, video %u ms\n",
+			tune->frequency, tune->status, tune->afc,
+			tune->lock_time, tune->signal_time);
+	return 0;
+}
+
+/* Claim the stream for the buffer ioctls. A file handle that has it
+   keeps it until close, or until capture fails to start, so once it is
+   known to be the owner only stream->id needs checking. */
+static int ivtv_own_stream(struct ivtv_open_id *id, struct ivtv_stream *stream)
+{
+	if (id->owner && stream->id == id->open_id)
+		return 0;
+	if (ivtv_claim_stream(id, stream->type))
+		return -EBUSY;
+	if (id->open_id != stream->id)
+		return -EBUSY;
+	id->owner = 1;
+	return 0;
+}
+
+/* Start a DMA that found no buffer to go into. The buffer ioctls run
+   without the big kernel lock and the DMA state is the card's, so this
+   takes DMA_slock like the interrupt handler does. */
+static void ivtv_kick_DMA(struct ivtv *itv, struct ivtv_stream *stream)
+{
+	unsigned long flags;
+
+	if (!test_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags))
+		return;
+	spin_lock_irqsave(&itv->DMA_slock, flags);
+	if (!list_empty(&stream->queued) && list_empty(&stream->active))
+		ivtv_sched_DMA(itv, stream->type);
+	spin_unlock_irqrestore(&itv->DMA_slock, flags);
+}
+
 int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *id,
 		     int streamtype, unsigned int cmd, void *arg)
 {
@@ -651,6 +802,7 @@ int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *i
                 }
 
                 IVTV_DEBUG_INFO("VIDEOC_STREAMON\n");
+		id->owner = 1;
 		ivtvbuf_streamon(&stream->vidq);	
 
  		set_bit(IVTV_F_S_CAPTURING, &stream->s_flags);
@@ -663,6 +815,7 @@ int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *i
 
                                         clear_bit(IVTV_F_S_CAPTURING,
                                                   &stream->s_flags);
+					id->owner = 0;
                                         return -EIO;
                 }
 
@@ -723,6 +876,7 @@ int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *i
 		// Claim the stream
                 if (ivtv_claim_stream(id, stream->type))
                 	return -EBUSY;
+		id->owner = (id->open_id == stream->id);
 
 		// Double check buffers requested
 		if (req->count > bufmax || req->count < bufmin) 
@@ -759,18 +913,12 @@ int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *i
 	case VIDIOC_QUERYBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		// Claim the stream
-                if (ivtv_claim_stream(id, stream->type)) {
+		// Claim the stream, once
+                if (ivtv_own_stream(id, stream)) {
                         IVTV_DEBUG_WARN("VIDEOC_QEURYBUF - Device cannot be claimed!!!\n");
                 	return -EBUSY;
 		}
 
-		// Check if right stream id
-                if (id->open_id != stream->id) {
-                        IVTV_DEBUG_WARN("VIDEOC_QEURYBUF - Was not the right ID\n");
-                        return -EBUSY;
-                }
-
                 IVTV_DEBUG_INFO("VIDEOC_QUERYBUF - %d\n", buf->index);
 		return ivtvbuf_querybuf(&stream->vidq, buf);
 	}
@@ -780,11 +928,8 @@ int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *i
 		int ret = 0;
 		//int blocking = !(filp->f_flags & O_NONBLOCK);
 
-		// Claim the stream
-                if (ivtv_claim_stream(id, stream->type))
-                	return -EBUSY;
-		// Check if right stream id
-                if (id->open_id != stream->id) {
+		// Claim the stream, once
+                if (ivtv_own_stream(id, stream)) {
                         IVTV_DEBUG_WARN("VIDEOC_QBUF - Was not the right ID\n");
                         return -EBUSY;
                 }
@@ -793,12 +938,7 @@ int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *i
 		if ((ret = ivtvbuf_qbuf(&stream->vidq, buf)))
 			return ret;
 
-		if (test_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags) &&
-			!list_empty(&stream->queued) && list_empty(&stream->active)) 
-		{
-			ivtv_sched_DMA(itv, stream->type);
-		}
-
+		ivtv_kick_DMA(itv, stream);
 		return ret;
 	}
 
@@ -813,20 +953,13 @@ int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *i
                 	return -EIO;
 		}
 
-		// Claim the stream
-                if (ivtv_claim_stream(id, stream->type))
-                	return -EBUSY;
-		// Make sure we own this stream
-                if (id->open_id != stream->id) {
+		// Claim the stream, once
+                if (ivtv_own_stream(id, stream)) {
                         IVTV_DEBUG_WARN("VIDEOC_DQBUF - Was not the right ID\n");
                         return -EBUSY;
                 }
 
-		if (test_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags) && 
-				!list_empty(&stream->queued) && list_empty(&stream->active)) 
-		{
-			ivtv_sched_DMA(itv, stream->type);
-		}
+		ivtv_kick_DMA(itv, stream);
 
 		// Get a full buffer from Queue
 		if ((ret = ivtvbuf_dqbuf(&stream->vidq, 
@@ -1002,31 +1135,15 @@ int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *i
 		if (vf.tuner != 0)
 			return -EINVAL;
 
-		if (test_bit(IVTV_F_I_RADIO_USER, &itv->i_flags)) {
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 13)
-                        vf.frequency *= 1000;
-#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 13) */
-			itv->freq_radio = vf.frequency;
-			vf.type = V4L2_TUNER_RADIO; /* not always set, and needed by IF demod */
-		} else {
-			itv->freq_tv = vf.frequency;
-			vf.type = V4L2_TUNER_ANALOG_TV;
-		}
-
-		ivtv_mute(itv);
-		IVTV_DEBUG_INFO("v4l2 ioctl: set frequency %d\n", vf.frequency);
-                if (vf.type == V4L2_TUNER_ANALOG_TV) {
-		        ivtv_tv_tuner(itv, VIDIOC_S_FREQUENCY, &vf);
-                }
-                else {
-		        ivtv_radio_tuner(itv, VIDIOC_S_FREQUENCY, &vf);
-                }
-		if (itv->options.tda9887 == 0) ivtv_tda9887(itv, VIDIOC_S_FREQUENCY, &vf);
-		ivtv_audio_freq_changed(itv);
-		ivtv_unmute(itv);
+		ivtv_set_freq(itv, &vf);
 		break;
 	}
 
+	case IVTV_IOC_S_FREQUENCY_WAIT:{
+		IVTV_DEBUG_IOCTL("IVTV_IOC_S_FREQUENCY_WAIT\n");
+		return ivtv_tune_wait(itv, (struct ivtv_ioctl_tune *)arg);
+	}
+
 	case VIDIOC_ENUMSTD:{
 		struct v4l2_standard *vs = arg;
 
@@ -1239,6 +1356,85 @@ int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *i
 	return 0;
 }
 
+/* IVTV_IOC_BATCH_BUF: VIDIOC_QBUF for each buffer given, then
+   VIDIOC_DQBUF for each one done, with the stream claimed once */
+static int ivtv_batch_buf(struct ivtv *itv, struct ivtv_open_id *id,
+			  struct ivtv_stream *stream, struct ivtv_buf_batch *b)
+{
+	struct v4l2_buffer vb;
+	struct ivtv_batch_buf *e;
+	struct ivtv_buffer *buf;
+	int i, ret, max = IVTV_BATCH_MAX;
+
+	if (b->nqueue > IVTV_BATCH_MAX)
+		return -EINVAL;
+	if ((b->flags & IVTV_BATCH_LIMIT) && b->ndone < max)
+		max = b->ndone;
+	if (atomic_read(&itv->capturing) == 0 && (stream->id == -1))
+		return -EIO;
+	if (ivtv_own_stream(id, stream))
+		return -EBUSY;
+
+	b->error = 0;
+	for (i = 0; i < b->nqueue; i++) {
+		e = &b->buf[i];
+		memset(&vb, 0, sizeof(vb));
+		vb.index = e->index;
+		vb.type = stream->buftype;
+		if (e->userptr) {
+			vb.memory = V4L2_MEMORY_USERPTR;
+			vb.m.userptr = (unsigned long)e->userptr;
+			vb.length = e->length;
+		} else {
+			vb.memory = V4L2_MEMORY_MMAP;
+		}
+		if ((ret = ivtvbuf_qbuf(&stream->vidq, &vb))) {
+			IVTV_DEBUG_INFO("IVTV_IOC_BATCH_BUF: buffer %d not queued\n",
+					e->index);
+			b->nqueue = i;
+			b->error = ret;
+			break;
+		}
+	}
+
+	ivtv_kick_DMA(itv, stream);
+
+	ret = 0;
+	for (i = 0; i < max; i++) {
+		memset(&vb, 0, sizeof(vb));
+		vb.type = stream->buftype;
+		ret = ivtvbuf_dqbuf(&stream->vidq, &vb,
+				    i || !(b->flags & IVTV_BATCH_WAIT));
+		if (ret && ret != -EIO)
+			break;
+		e = &b->buf[i];
+		e->index = vb.index;
+		e->bytesused = vb.bytesused;
+		e->sequence = vb.sequence;
+		e->flags = vb.flags;
+		e->userptr = vb.memory == V4L2_MEMORY_USERPTR ? vb.m.userptr : 0;
+		e->length = vb.length;
+		e->error = ret ? EIO : 0;
+		e->ts_usec = (u64)vb.timestamp.tv_sec * 1000000 +
+			vb.timestamp.tv_usec;
+		/* dequeued, nothing else touches it now */
+		buf = container_of(stream->vidq.bufs[vb.index],
+				   struct ivtv_buffer, vb);
+		e->pts = buf->pts_stamp;
+		e->mono_ns = (u64)buf->ts_mono.tv_sec * 1000000000 +
+			buf->ts_mono.tv_nsec;
+	}
+	b->ndone = i;
+	IVTV_DEBUG_INFO("IVTV_IOC_BATCH_BUF: %d queued, %d done\n",
+			b->nqueue, b->ndone);
+
+	/* waiting was interrupted with nothing to return, what was given
+	   is queued */
+	if (i == 0 && ret == -EINTR && b->error == 0)
+		return ret;
+	return 0;
+}
+
 int ivtv_ivtv_ioctls(struct ivtv *itv, struct ivtv_open_id *id,
 		     int streamtype, unsigned int cmd, void *arg)
 {
@@ -1367,6 +1563,77 @@ int ivtv_ivtv_ioctls(struct ivtv *itv, struct ivtv_open_id *id,
 		ivtv_vapi(itv, IVTV_API_PAUSE_ENCODER, 0);
 		break;
 	}
+
+	case IVTV_IOC_G_ENC_INDEX:{
+		struct ivtv_enc_index *idx = arg;
+		unsigned long flags;
+		int i;
+
+		IVTV_DEBUG_IOCTL("IVTV_IOC_G_ENC_INDEX\n");
+		if (streamtype != IVTV_ENC_STREAM_TYPE_MPG)
+			return -EINVAL;
+
+		memset(idx, 0, sizeof(*idx));
+		idx->entries_cap = IVTV_MAX_PGM_INDEX;
+
+		spin_lock_irqsave(&itv->DMA_slock, flags);
+		for (i = 0; i < IVTV_ENC_INDEX_ENTRIES &&
+			    itv->pgm_index_rd != itv->pgm_index_wr; i++) {
+			idx->entry[i] = itv->pgm_index[itv->pgm_index_rd];
+			itv->pgm_index_rd = (itv->pgm_index_rd + 1) % IVTV_MAX_PGM_INDEX;
+		}
+		spin_unlock_irqrestore(&itv->DMA_slock, flags);
+		idx->entries = i;
+		break;
+	}
+	case IVTV_IOC_S_PACK:{
+		struct ivtv_pack *pack = arg;
+		struct ivtv_stream *st = &itv->streams[streamtype];
+		int ret;
+
+		IVTV_DEBUG_IOCTL("IVTV_IOC_S_PACK\n");
+		if (streamtype != IVTV_ENC_STREAM_TYPE_PCM &&
+		    streamtype != IVTV_ENC_STREAM_TYPE_VBI)
+			return -EINVAL;
+		if (st->buftype == V4L2_BUF_TYPE_SLICED_VBI_CAPTURE)
+			return -EINVAL;
+		if (test_bit(IVTV_F_S_CAPTURING, &st->s_flags) ||
+		    st->vidq.streaming || st->vidq.reading || st->vidq.bufs[0])
+			return -EBUSY;
+
+		ret = ivtv_stream_set_pack(itv, streamtype, pack->chunks);
+		if (ret)
+			return ret;
+		pack->chunks = st->pack_chunks;
+		pack->bufsize = st->bufsize;
+		break;
+	}
+	case IVTV_IOC_G_BUF_TS:{
+		struct ivtv_buf_ts *ts = arg;
+		struct ivtvbuf_queue *q = &itv->streams[streamtype].vidq;
+		struct ivtv_buffer *buf;
+		int ret = -EINVAL;
+
+		if (ts->index >= VIDEO_MAX_FRAME)
+			return -EINVAL;
+		down(&q->lock);
+		if (q->bufs[ts->index]) {
+			buf = container_of(q->bufs[ts->index], struct ivtv_buffer, vb);
+			ts->sequence = buf->vb.field_count >> 1;
+			ts->pts = buf->pts_stamp;
+			ts->mono_ns = (u64)buf->ts_mono.tv_sec * 1000000000 +
+				buf->ts_mono.tv_nsec;
+			memset(ts->reserved, 0, sizeof(ts->reserved));
+			ret = 0;
+		}
+		up(&q->lock);
+		return ret;
+	}
+	case IVTV_IOC_G_FANOUT:
+		return ivtv_fanout_status(id, arg);
+	case IVTV_IOC_BATCH_BUF:
+		IVTV_DEBUG_IOCTL("IVTV_IOC_BATCH_BUF\n");
+		return ivtv_batch_buf(itv, id, &itv->streams[streamtype], arg);
 	default:
 		IVTV_DEBUG_WARN("unknown IVTV command %08x\n", cmd);
 		return -EINVAL;
@@ -1415,6 +1682,7 @@ static int ivtv_v4l2_do_ioctl(struct inode *inode, struct file *filp,
 	case VIDIOC_ENUM_FMT:
 	case VIDIOC_G_FREQUENCY:
 	case VIDIOC_S_FREQUENCY:
+	case IVTV_IOC_S_FREQUENCY_WAIT:
 	case VIDIOC_ENUMSTD:
 	case VIDIOC_G_STD:
 	case VIDIOC_S_STD:
@@ -1444,6 +1712,11 @@ static int ivtv_v4l2_do_ioctl(struct inode *inode, struct file *filp,
 	case IVTV_IOC_S_GOP_END:
 	case IVTV_IOC_PAUSE_ENCODE:
 	case IVTV_IOC_RESUME_ENCODE:
+	case IVTV_IOC_G_ENC_INDEX:
+	case IVTV_IOC_S_PACK:
+	case IVTV_IOC_G_BUF_TS:
+	case IVTV_IOC_G_FANOUT:
+	case IVTV_IOC_BATCH_BUF:
                 return ivtv_ivtv_ioctls(itv, id, streamtype, cmd, arg);
 
 	case 0x00005401:	/* Handle isatty() calls */
@@ -1585,3 +1858,33 @@ int ivtv_v4l2_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,
 	}
 	return video_usercopy(inode, filp, cmd, arg, ivtv_v4l2_do_ioctl);
 }
+
+/* The buffer ioctls of the file handle owning the stream only touch its
+   queue, which has its own semaphore and spinlock, so they run without
+   the big kernel lock. Streams of a card captured at once, say YUV, PCM
+   and VBI, then don't queue up behind each other on it. All other
+   ioctls take it, as they did through .ioctl. */
+long ivtv_v4l2_unlocked_ioctl(struct file *filp, unsigned int cmd,
+			      unsigned long arg)
+{
+	struct ivtv_open_id *id = filp->private_data;
+	struct inode *inode = filp->f_dentry->d_inode;
+	struct ivtv_stream *stream = &id->itv->streams[id->type];
+	int ret;
+
+	switch (cmd) {
+	case VIDIOC_QBUF:
+	case VIDIOC_DQBUF:
+	case VIDIOC_QUERYBUF:
+	case IVTV_IOC_BATCH_BUF:
+		if (id->owner && stream->id == id->open_id)
+			return video_usercopy(inode, filp, cmd, arg,
+					      ivtv_v4l2_do_ioctl);
+		break;
+	}
+
+	lock_kernel();
+	ret = ivtv_v4l2_ioctl(inode, filp, cmd, arg);
+	unlock_kernel();
+	return ret;
+}
@@ -24,6 +24,8 @@ u16 service2vbi(int type);
 u16 get_service_set(struct v4l2_sliced_vbi_format *fmt);
 int ivtv_v4l2_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,
 		    unsigned long arg);
+long ivtv_v4l2_unlocked_ioctl(struct file *filp, unsigned int cmd,
+			      unsigned long arg);
 int ivtv_v4l2_ioctls(struct file *filp, struct ivtv *itv, struct ivtv_open_id *id, int streamtype,
 		     unsigned int cmd, void *arg);
 int ivtv_internal_ioctls(struct ivtv *itv, int streamtype, unsigned int cmd,
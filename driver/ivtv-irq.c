@@ -26,11 +26,16 @@
 #include "ivtv-ioctl.h"
 #include "ivtv-mailbox.h"
 #include "ivtv-vbi.h"
+#include "ivtv-fanout.h"
 
 typedef unsigned long uintptr_t;
 
 static void cx23416_dma_start(struct ivtv *itv, int vbi);
 static void cx23416_dma_finish(struct ivtv *itv);
+static void ivtv_update_pgm_index(struct ivtv *itv);
+static int ivtv_pack_done(struct ivtv_stream *st, struct ivtv_buffer *buf);
+static int ivtv_pack_sg(struct ivtv *itv, struct ivtv_stream *st,
+			struct ivtv_buffer **pbuf, u32 offset, u32 size, u64 pts);
 
 IRQRETURN_T ivtv_irq_handler(int irq, void *dev_id, struct pt_regs *regs)
 {
@@ -123,12 +128,10 @@ IRQRETURN_T ivtv_irq_handler(int irq, void *dev_id, struct pt_regs *regs)
 
 void cx23416_dma_start(struct ivtv *itv, int vbi) {
 	u32 reQdata[IVTV_MBOX_MAX_DATA], reQresult;
-	u32 type, status;
 	u64 pts_stamp = 0;
 	u32 reQtype, size, offset;
 	u32 UVsize = 0, UVoffset = 0;
 	u64 reQpts_stamp = 0;
-	struct ivtv_stream *st = NULL;
 	struct ivtv_stream *reQst = NULL;
 	int x = 0;
 	int streamtype = -1;
@@ -198,13 +201,13 @@ void cx23416_dma_start(struct ivtv *itv, int vbi) {
 
                 itv->vbi_frame += itv->vbi_fpi;
 
-		// Trim off header and time stamp
-		offset = reQdata[1]+12;
+		// Trim off header and time stamp, the mailbox isn't read for
+		// VBI so the frame is found through the firmware's pointer
+		offset = bufptr;
 
 		// Size isn't right yet
 		//size = reQdata[2];
 
-                //offset = bufptr;
                 size = ((itv->vbi_enc_size+16) * (itv->vbi_fpi))-16;
 
 
@@ -251,11 +254,6 @@ void cx23416_dma_start(struct ivtv *itv, int vbi) {
 		reQst->pts = reQpts_stamp;
 		reQst->dmatype = reQtype;
 
-		// Previous DMA Status
-		type =  st->dma_info.type;
-		status =  st->dma_info.status;
-		pts_stamp =  st->dma_info.pts_stamp;
-
 		// Check if DMA is already Pending
 		if (test_and_set_bit(IVTV_F_S_DMAP, &reQst->s_flags)) {
 			IVTV_DEBUG_WARN(
@@ -315,8 +313,10 @@ void cx23416_dma_start(struct ivtv *itv, int vbi) {
 		   	"DMA Request: Already a DMA In Progress for HW Type %d\n", 
 				reQtype);
 
-			// Mark that the DMA has been ignored for now...
+			// Mark that the DMA has been ignored for now, the
+			// stream has no transfer of its own to finish
 			//set_bit(IVTV_F_S_NEEDS_DATA, &itv->DMAP);
+			clear_bit(IVTV_F_S_DMAP, &reQst->s_flags);
 			set_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags);
 
 			return;
@@ -337,6 +337,7 @@ void cx23416_dma_start(struct ivtv *itv, int vbi) {
                        		"DMA Request: stream %d Firmware is busy!!!.\n", reQst->type);
 
 			clear_bit(IVTV_F_S_DMAP, &reQst->s_flags);
+			clear_bit(IVTV_F_S_DMAP, &itv->DMAP);
 
 			set_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags);
 			return;
@@ -345,7 +346,9 @@ void cx23416_dma_start(struct ivtv *itv, int vbi) {
 
  	// Set off request
         if (!ivtv_sched_DMA(itv, streamtype)) {
+		// Nothing was sent, no DMA Done will release the engine
 		clear_bit(IVTV_F_S_DMAP, &reQst->s_flags);
+		clear_bit(IVTV_F_S_DMAP, &itv->DMAP);
 		set_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags);
         	atomic_set(&itv->r_intr, 1);
 	}
@@ -473,6 +476,204 @@ void cx23416_dma_finish(struct ivtv *itv) {
 	}
 }
 
+/* Copy the new entries of the firmware program index into the driver.
+   The firmware table is a ring of idx_sdf_num entries of 6 words each,
+   preceded by the encoder address the next entry will be written to:
+	length, offset low, offset high, type (1=I 2=P 4=B 0=none), PTS,
+	bit 32 of the PTS.
+   Entries are written when a picture is encoded, so anything beyond the
+   MPEG data transferred so far is left for the next DMA. Called with
+   DMA_slock held. */
+static void ivtv_update_pgm_index(struct ivtv *itv)
+{
+	static const u32 frame_type[8] = {
+		-1, IVTV_ENC_INDEX_FRAME_I, IVTV_ENC_INDEX_FRAME_P, -1,
+		IVTV_ENC_INDEX_FRAME_B, -1, -1, -1
+	};
+	struct ivtv_enc_index_entry *e;
+	u32 fw_wr, addr, type;
+	u64 offset;
+
+	if (itv->idx_sdf_num == 0)
+		return;
+
+	fw_wr = (readl(itv->enc_mem + itv->idx_sdf_offset) -
+		 itv->idx_sdf_offset - 4) / 24;
+	if (fw_wr >= itv->idx_sdf_num)
+		return;
+
+	while (itv->pgm_index_fw != fw_wr) {
+		addr = itv->idx_sdf_offset + 4 + itv->pgm_index_fw * 24;
+
+		offset = readl(itv->enc_mem + addr + 4) |
+			((u64)readl(itv->enc_mem + addr + 8) << 32);
+		if (offset > itv->mpg_data_received)
+			break;
+		type = frame_type[readl(itv->enc_mem + addr + 12) & 7];
+
+		if (type != (u32)-1) {
+			e = &itv->pgm_index[itv->pgm_index_wr];
+			e->offset = offset;
+			e->length = readl(itv->enc_mem + addr);
+			e->pts = readl(itv->enc_mem + addr + 16) |
+				((u64)(readl(itv->enc_mem + addr + 20) & 1) << 32);
+			e->flags = type;
+
+			itv->pgm_index_wr = (itv->pgm_index_wr + 1) % IVTV_MAX_PGM_INDEX;
+			/* Nobody is reading, drop the oldest entry */
+			if (itv->pgm_index_wr == itv->pgm_index_rd)
+				itv->pgm_index_rd = (itv->pgm_index_rd + 1) % IVTV_MAX_PGM_INDEX;
+		}
+		itv->pgm_index_fw = (itv->pgm_index_fw + 1) % itv->idx_sdf_num;
+	}
+}
+
+/* Mark a capture buffer done and hand it to the reader. Called with
+   the stream's slock held. */
+static void ivtv_buf_done(struct ivtv_buffer *buf)
+{
+	do_gettimeofday(&buf->vb.ts);
+	ivtv_monotonic_ts(&buf->ts_mono);
+
+	// Mark it Done and remove from queue
+	buf->vb.state = STATE_DONE;
+	list_del(&buf->vb.queue);
+	wake_up(&buf->vb.done);
+}
+
+/* IVTV_IOC_S_PACK: a transfer into buf is done, add it to the header at
+   the start of the buffer. Returns 1 if the buffer is full. Called with
+   the stream's slock held. */
+static int ivtv_pack_done(struct ivtv_stream *st, struct ivtv_buffer *buf)
+{
+	struct ivtv_pack_entry e;
+	u32 hdr[2];
+
+	e.offset = buf->pack_fill;
+	e.size = st->dma_req.size;
+	e.pts = st->dma_req.pts_stamp;
+	ivtv_buf_copy(&buf->vb.dma, offsetof(struct ivtv_pack_header, entry) +
+		      buf->pack_count * sizeof(e), (u8 *)&e, sizeof(e), 1);
+
+	buf->pack_count++;
+	buf->pack_fill += IVTV_PACK_CHUNK(e.size);
+
+	hdr[0] = IVTV_PACK_MAGIC;
+	hdr[1] = buf->pack_count;
+	ivtv_buf_copy(&buf->vb.dma, 0, (u8 *)hdr, sizeof(hdr), 1);
+
+	buf->buffer.bytesused = buf->pack_fill;
+	buf->vb.size = buf->pack_fill;
+
+	return buf->pack_count >= st->pack_chunks;
+}
+
+/* The mapped scatterlist of a buffer may have entries spanning a whole
+   huge page (see ivtvbuf_pages_to_sg()), the firmware SG elements stay
+   within a page. Walk the list in page sized pieces. */
+struct ivtv_sg_iter {
+	struct ivtvbuf_dmabuf *dma;
+	int x;
+	u32 done;	/* of entry x */
+};
+
+static void ivtv_sg_start(struct ivtv_sg_iter *it, struct ivtvbuf_dmabuf *dma)
+{
+	it->dma = dma;
+	it->x = 0;
+	it->done = 0;
+}
+
+static int ivtv_sg_next(struct ivtv_sg_iter *it, dma_addr_t *addr, u32 *len)
+{
+	struct scatterlist *sg;
+	u32 left;
+
+	if (it->x >= it->dma->sglen)
+		return 0;
+	sg = &it->dma->sglist[it->x];
+	*addr = sg_dma_address(sg) + it->done;
+	left = sg_dma_len(sg) - it->done;
+	*len = PAGE_SIZE - (*addr & ~PAGE_MASK);
+	if (*len > left)
+		*len = left;
+	it->done += *len;
+	if (it->done == sg_dma_len(sg)) {
+		it->x++;
+		it->done = 0;
+	}
+	return 1;
+}
+
+/* IVTV_IOC_S_PACK: point the SG array at the free space of the buffer
+   being filled. If this transfer doesn't fit the buffer is handed to
+   the reader as it is and the next one is used. Returns the number of
+   SG elements, 0 if there is no buffer to use yet, or -1 if the transfer
+   doesn't fit even an empty buffer and has to be dropped. */
+static int ivtv_pack_sg(struct ivtv *itv, struct ivtv_stream *st,
+			struct ivtv_buffer **pbuf, u32 offset, u32 size, u64 pts)
+{
+	struct ivtv_buffer *buf = *pbuf;
+	u32 xfer = IVTV_PACK_CHUNK(size);
+	u32 pos = 0, skip, len, fill;
+	struct ivtv_sg_iter it;
+	dma_addr_t addr;
+	unsigned long flags;
+	int n = 0;
+
+	if (buf->pack_count && buf->pack_fill + xfer > st->bufsize) {
+		spin_lock_irqsave(&st->slock, flags);
+		ivtv_buf_done(buf);
+		buf = NULL;
+		if (!list_empty(&st->queued))
+			buf = list_entry(st->queued.next, struct ivtv_buffer, vb.queue);
+		spin_unlock_irqrestore(&st->slock, flags);
+		if (buf == NULL)
+			return 0;
+		*pbuf = buf;
+	}
+
+	fill = buf->pack_count ? buf->pack_fill : IVTV_PACK_DATA_OFFSET;
+	if (fill + xfer > st->bufsize) {
+		IVTV_DEBUG_WARN("Pack: %d byte transfer doesn't fit a %d byte buffer\n",
+			size, st->bufsize);
+		return -1;
+	}
+
+	ivtv_sg_start(&it, &buf->vb.dma);
+	while (xfer && ivtv_sg_next(&it, &addr, &len)) {
+		if (pos + len <= fill) {
+			pos += len;
+			continue;
+		}
+		skip = fill > pos ? fill - pos : 0;
+		pos += len;
+		len -= skip;
+		if (len > xfer)
+			len = xfer;
+
+		st->SGarray[n].src = offset;
+		st->SGarray[n].dst = addr + skip;
+		st->SGarray[n].size = len;
+		offset += len;
+		xfer -= len;
+		n++;
+	}
+	if (xfer) {
+		IVTV_DEBUG_WARN("Pack: buffer %d has only %d bytes mapped\n",
+			buf->vb.i, pos);
+		return -1;
+	}
+
+	if (buf->pack_count == 0) {
+		buf->pack_fill = fill;
+		buf->buffer.sequence = ++st->seq;
+		buf->vb.field_count = st->seq * 2;
+		buf->pts_stamp = pts & IVTV_PTS_MASK;
+	}
+	return n;
+}
+
 int ivtv_FROM_DMA_done(struct ivtv *itv, int stmtype)
 {
 	struct ivtv_stream *stream = NULL;
@@ -523,12 +724,24 @@ int ivtv_FROM_DMA_done(struct ivtv *itv, int stmtype)
         	if (!list_empty(&stream->active)) {
                 	buf = list_entry(stream->active.next, struct ivtv_buffer, vb.queue);
 
-			do_gettimeofday(&buf->vb.ts);
+			if (stream->fanout) {
+				ivtv_fanout_done(stream, buf);
+			} else if (stream->pack_chunks && !ivtv_pack_done(stream, buf)) {
+				// Room for more, it stays at the head of the queue
+				list_del(&buf->vb.queue);
+				buf->vb.state = STATE_QUEUED;
+				list_add(&buf->vb.queue, &stream->queued);
+			} else {
+				if (stream->buftype == V4L2_BUF_TYPE_SLICED_VBI_CAPTURE)
+					ivtv_vbi_process_sliced(itv, buf);
+
+				ivtv_buf_done(buf);
+			}
 
-			// Mark it Done and remove from queue
-                	buf->vb.state = STATE_DONE;
-               		list_del(&buf->vb.queue);
-               		wake_up(&buf->vb.done);
+			if (stmtype == IVTV_ENC_STREAM_TYPE_MPG) {
+				itv->mpg_data_received += buf->buffer.bytesused;
+				ivtv_update_pgm_index(itv);
+			}
 
                        	IVTV_DEBUG_DMA("[%llu/%u] DMA Done DMA for stream %d buffer %d in state 0x%0x\n",
                                	stream->SG_handle, stream->SG_length, stream->type, buf->vb.i, buf->vb.state);
@@ -569,6 +782,9 @@ int ivtv_sched_DMA(struct ivtv *itv, int streamtype)
 	long sequence;
 	u32 bytes_needed = 0, bytes_read = 0, bytes_received = 0;
 	struct ivtv_buffer *buf = NULL;
+	struct ivtv_sg_iter it;
+	dma_addr_t addr;
+	u32 len;
 	int xfer_pad;
 	int pio_mode = 0;
 	/* Set these as you wish */
@@ -586,14 +802,14 @@ int ivtv_sched_DMA(struct ivtv *itv, int streamtype)
 	if (!st || st->id == -1) {
 		if (st) {
 	    		clear_bit(IVTV_F_S_DMAP, &st->s_flags);
-			clear_bit(IVTV_F_T_ENC_DMA_QUEUED, &st->s_flags);
+			clear_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags);
 		}
 		IVTV_DEBUG_WARN("error: DMA Schedule called and Stream is not in use!!!\n");
 		return retval;
 	}
 
 	
-	if (!(test_bit(IVTV_F_T_ENC_DMA_QUEUED, &st->s_flags)|test_bit(IVTV_F_S_DMAP, &st->s_flags)) ||
+	if (!(test_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags)|test_bit(IVTV_F_S_DMAP, &st->s_flags)) ||
                 st->dma_info.done   != 0x00 ||
                 st->dma_req.done    != 0x00 ||
                 st->SG_length > 0)
@@ -603,6 +819,17 @@ int ivtv_sched_DMA(struct ivtv *itv, int streamtype)
                 // Nothing to finish?
                 return 0;
         }
+
+	// Kicked from QBUF/DQBUF or read(): the engine isn't ours yet, and
+	// only one caller gets the request that was left queued
+	if (!test_bit(IVTV_F_S_DMAP, &st->s_flags)) {
+		if (test_and_set_bit(IVTV_F_S_DMAP, &itv->DMAP))
+			return 0;
+		if (!test_and_clear_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags)) {
+			clear_bit(IVTV_F_S_DMAP, &itv->DMAP);
+			return 0;
+		}
+	}
 	set_bit(IVTV_F_S_DMAP, &st->s_flags);
 
 	IVTV_DEBUG_DMA("ENC: Sched DMA\n");
@@ -645,7 +872,8 @@ int ivtv_sched_DMA(struct ivtv *itv, int streamtype)
                 IVTV_DEBUG_WARN(
                        "DMA Request: stream %d Xfer failed since state = 0.\n", st->type);
 		clear_bit(IVTV_F_S_DMAP, &st->s_flags);
-		clear_bit(IVTV_F_T_ENC_DMA_QUEUED, &st->s_flags);
+		clear_bit(IVTV_F_S_DMAP, &itv->DMAP);
+		clear_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags);
 		return 1;
 	}
 
@@ -662,6 +890,23 @@ int ivtv_sched_DMA(struct ivtv *itv, int streamtype)
 	}
 	spin_unlock_irqrestore(&st->slock, flags);
 
+	if (st->pack_chunks) {
+		x = ivtv_pack_sg(itv, st, &buf, offset, size, pts_stamp);
+		if (x < 0) {
+			// Retrying can't help, the firmware moves on without it
+			st->pack_drops++;
+			IVTV_DEBUG_WARN("Pack: stream %d dropped a transfer, %u so far\n",
+				st->type, st->pack_drops);
+			st->dma_info.done = 0x01;
+			st->dma_req.done = 0x01;
+			clear_bit(IVTV_F_S_DMAP, &st->s_flags);
+			clear_bit(IVTV_F_S_DMAP, &itv->DMAP);
+			return 1;
+		}
+		bytes_read = IVTV_PACK_CHUNK(size);
+		goto sg_built;
+	}
+
 	sequence = ++st->seq;
 
 	/* increment the sequence # */
@@ -671,16 +916,8 @@ int ivtv_sched_DMA(struct ivtv *itv, int streamtype)
 
 	buf->buffer.bytesused = 0;
 
-	// Time Code
-	buf->buffer.timecode.type = 0x00; // 0x01 = drop frame
-	buf->buffer.timecode.flags = V4L2_TC_TYPE_30FPS;
-	buf->buffer.timecode.frames = st->seq;
-	buf->buffer.timecode.seconds = do_div(pts_stamp,1000);
-	buf->buffer.timecode.minutes = 
-		do_div(buf->buffer.timecode.seconds,60);
-	buf->buffer.timecode.hours = 
-		do_div(buf->buffer.timecode.minutes,60);
-	buf->pts_stamp = pts_stamp;
+	// Raw firmware PTS, see IVTV_IOC_G_BUF_TS
+	buf->pts_stamp = pts_stamp & IVTV_PTS_MASK;
 
 	page_count = buf->vb.dma.nr_pages;
 	y_page_count = 0;
@@ -698,15 +935,17 @@ int ivtv_sched_DMA(struct ivtv *itv, int streamtype)
 	else
 		buf->vb.field_count = sequence * 2;	
 
-	for (x = 0; x < page_count && bytes_read < bytes_needed; x++) {
+	ivtv_sg_start(&it, &buf->vb.dma);
+	for (x = 0; bytes_read < bytes_needed &&
+		    ivtv_sg_next(&it, &addr, &len); x++) {
                 /* extract the buffers we procured earlier */
 
                 buf->buffer.index = x;
                 buf->buffer.sequence = sequence;
 
-                bytes_read += sg_dma_len(&buf->vb.dma.sglist[x]);
+                bytes_read += len;
 
-                if (size < sg_dma_len(&buf->vb.dma.sglist[x])) {
+                if (size < len) {
                         xfer_pad = 256; // Java processor requirement 256 byte align reads
                         pad = size;
                         buf->buffer.bytesused += size;
@@ -721,12 +960,12 @@ int ivtv_sched_DMA(struct ivtv *itv, int streamtype)
 
                 } else {
                         pad = 0;
-                        buf->buffer.bytesused += sg_dma_len(&buf->vb.dma.sglist[x]);;
-                        st->SGarray[x].size = sg_dma_len(&buf->vb.dma.sglist[x]);
+                        buf->buffer.bytesused += len;
+                        st->SGarray[x].size = len;
                         size -= st->SGarray[x].size;
                 }
                 st->SGarray[x].src = offset;    /* Encoder Addr */
-                st->SGarray[x].dst = sg_dma_address(&buf->vb.dma.sglist[x]);   /* Encoder Addr */
+                st->SGarray[x].dst = addr;   /* Encoder Addr */
 
                 /* PIO Mode */
                 if (pio_mode) {
@@ -749,6 +988,7 @@ int ivtv_sched_DMA(struct ivtv *itv, int streamtype)
        	IVTV_DEBUG_DMA("Built SG Array: with %d bytes for Y and %d bytes for UV or %d total, x=%d page_count=%d\n", 
 		(int)(y_page_count*PAGE_SIZE), (int)(uv_page_count*PAGE_SIZE), bytes_read, x, page_count);
 
+sg_built:
 	/* This should wrap gracefully */
 	st->trans_id++;
 
@@ -842,11 +1082,15 @@ int ivtv_sched_DMA(struct ivtv *itv, int streamtype)
                                 st->SG_handle, st->SG_length, st->type);
                 }
 
-		// If failed, put back into queue
+		// If failed, put back into queue, a partly packed buffer
+		// or the oldest one of a fan-out ring stays first
         	list_del(&buf->vb.queue);
         	buf->vb.state = STATE_QUEUED;
         	buf->count = 1;
-		list_add_tail(&buf->vb.queue, &st->queued);
+		if (buf->pack_count || st->fanout)
+			list_add(&buf->vb.queue, &st->queued);
+		else
+			list_add_tail(&buf->vb.queue, &st->queued);
         	wake_up(&buf->vb.done);
 		spin_unlock_irqrestore(&st->slock, flags);
 
@@ -64,6 +64,7 @@ void ivtv_free_v4lbuf(struct pci_dev *dev, struct ivtv_buffer *buf,
 	buf->count = 0;
 	buf->type = 0;
 	buf->pts_stamp = 0;
+	buf->ts_mono.tv_sec = buf->ts_mono.tv_nsec = 0;
 
 	/* setup buffer */
 	buf->buffer.index = 0;
@@ -85,6 +86,7 @@ void ivtv_init_v4l2buf(struct pci_dev *dev, struct ivtv_stream *st, struct scatt
 	buf->count = 0;
 	buf->type = 0;
 	buf->pts_stamp = 0;
+	buf->ts_mono.tv_sec = buf->ts_mono.tv_nsec = 0;
 
 	/* setup buffer */
 	buf->buffer.index = buf->vb.i;
@@ -98,6 +100,39 @@ void ivtv_init_v4l2buf(struct pci_dev *dev, struct ivtv_stream *st, struct scatt
 	return;
 }
 
+/* Copy len bytes starting at off between a capture buffer and p. The
+   buffer is either a kernel bounce buffer or user pages, which are
+   never highmem (see ivtvbuf_pages_to_sg()). */
+void ivtv_buf_copy(struct ivtvbuf_dmabuf *dma, u32 off, u8 *p, u32 len,
+		   int to_buf)
+{
+	u32 chunk;
+	u8 *v;
+
+	if (dma->vmalloc) {
+		v = (u8 *)dma->vmalloc + off;
+		if (to_buf)
+			memcpy(v, p, len);
+		else
+			memcpy(p, v, len);
+		return;
+	}
+
+	off += dma->offset;
+	while (len) {
+		chunk = min_t(u32, len, PAGE_SIZE - (off & ~PAGE_MASK));
+		v = (u8 *)page_address(dma->pages[off >> PAGE_SHIFT]) +
+			(off & ~PAGE_MASK);
+		if (to_buf)
+			memcpy(v, p, chunk);
+		else
+			memcpy(p, v, chunk);
+		off += chunk;
+		p += chunk;
+		len -= chunk;
+	}
+}
+
 void ivtv_stream_free(struct ivtv *itv, int stream)
 {
 	struct ivtv_stream *s = &itv->streams[stream];
@@ -120,6 +155,11 @@ void ivtv_stream_free(struct ivtv *itv, int stream)
 		s->SGarray = NULL;
 	}
 
+	if (stream == IVTV_ENC_STREAM_TYPE_VBI && itv->vbi_sliced_raw) {
+		kfree(itv->vbi_sliced_raw);
+		itv->vbi_sliced_raw = NULL;
+	}
+
 	return;
 }
 
@@ -28,5 +28,7 @@ void ivtv_init_v4l2buf(struct pci_dev *dev,
 					struct scatterlist *sglist,
 					struct ivtv_buffer *buf);
 int ivtv_sleep_timeout(int timeout, int intr);
+void ivtv_buf_copy(struct ivtvbuf_dmabuf *dma, u32 off, u8 *p, u32 len,
+		   int to_buf);
 void ivtv_stream_free(struct ivtv *itv, int stream);
 const char *ivtv_stream_name(int streamtype);
@@ -55,7 +55,11 @@ static struct file_operations ivtv_v4l2_enc_fops = {
       read:ivtv_v4l2_read,
       write:ivtv_v4l2_write,
       open:ivtv_v4l2_open,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,11)
+      unlocked_ioctl:ivtv_v4l2_unlocked_ioctl,
+#else
       ioctl:ivtv_v4l2_ioctl,
+#endif
       release:ivtv_v4l2_close,
       poll:ivtv_v4l2_enc_poll,
       mmap:ivtv_mmap,
@@ -112,9 +116,18 @@ static int ivtv_stream_init(struct ivtv *itv, int streamtype,
 
 		s->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	} else if (streamtype == IVTV_ENC_STREAM_TYPE_VBI) {
-		s->buftype = V4L2_BUF_TYPE_VBI_CAPTURE;
-		//s->buftype = V4L2_BUF_TYPE_SLICED_VBI_CAPTURE;
+		/* VIDIOC_S_FMT switches between raw and sliced */
+		if (itv->vbi_sliced_in->service_set)
+			s->buftype = V4L2_BUF_TYPE_SLICED_VBI_CAPTURE;
+		else
+			s->buftype = V4L2_BUF_TYPE_VBI_CAPTURE;
 		s->field = V4L2_FIELD_SEQ_TB;
+
+		itv->vbi_sliced_raw = kmalloc(IVTV_VBI_SLICED_RAW_SIZE, GFP_KERNEL);
+		if (itv->vbi_sliced_raw == NULL) {
+			IVTV_ERR("Could not allocate sliced VBI buffer\n");
+			return -ENOMEM;
+		}
 	} else if (streamtype == IVTV_ENC_STREAM_TYPE_PCM) {
 		s->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	} else if (streamtype == IVTV_ENC_STREAM_TYPE_RAD) {
@@ -183,6 +196,10 @@ static int ivtv_stream_init(struct ivtv *itv, int streamtype,
 	s->SG_length = 0;
 	s->buffers = buffers;
 	s->bufsize = bufsize;
+	s->chunksize = bufsize;
+	s->pack_chunks = 0;
+	s->pack_drops = 0;
+	s->fanout = NULL;
 	s->buf_total = 0;
 	s->buf_fill = 0;
 	s->dmatype = 0;
@@ -194,6 +211,43 @@ static int ivtv_stream_init(struct ivtv *itv, int streamtype,
 	return 0;
 }
 
+/* Have each capture buffer of a PCM or VBI stream collect up to chunks
+   DMA transfers (IVTV_IOC_S_PACK), 0 for one transfer per buffer. The
+   buffers grow to hold them and so does the SG array, which has one
+   element per page of a buffer. */
+int ivtv_stream_set_pack(struct ivtv *itv, int type, u32 chunks)
+{
+	struct ivtv_stream *s = &itv->streams[type];
+	struct ivtv_SG_element *SGarray;
+	int bufsize = s->chunksize;
+	int SGsize;
+
+	if (chunks > IVTV_PACK_MAX_CHUNKS)
+		chunks = IVTV_PACK_MAX_CHUNKS;
+	if (chunks)
+		bufsize = PAGE_ALIGN(IVTV_PACK_DATA_OFFSET +
+				chunks * IVTV_PACK_CHUNK(s->chunksize));
+
+	/* one more in case a user buffer doesn't start on a page */
+	SGsize = (PAGE_ALIGN(bufsize) >> PAGE_SHIFT) + 1;
+	SGarray = kmalloc(SGsize * sizeof(struct ivtv_SG_element), GFP_KERNEL);
+	if (SGarray == NULL) {
+		IVTV_ERR("Could not allocate SGarray\n");
+		return -ENOMEM;
+	}
+	memset(SGarray, 0, SGsize * sizeof(struct ivtv_SG_element));
+
+	kfree(s->SGarray);
+	s->SGarray = SGarray;
+	s->bufsize = bufsize;
+	s->pack_chunks = chunks;
+	s->pack_drops = 0;
+
+	IVTV_DEBUG_INFO("%s stream: %d transfers per buffer of %d bytes\n",
+		ivtv_stream_name(type), chunks ? chunks : 1, bufsize);
+	return 0;
+}
+
 static int ivtv_reg_dev(struct ivtv *itv, int streamtype, int minor, int reg_type)
 {
 	struct ivtv_stream *s = &itv->streams[streamtype];
@@ -545,7 +599,9 @@ void ivtv_vbi_setup(struct ivtv *itv, int mode)
 			data[1] = 1;
 			data[2] = 1;
 		} else {
-			data[1] = 4; 	
+			/* One frame per interrupt, each buffer of the
+			   sliced VBI device then holds one frame */
+			data[1] = 1;
 			data[2] = 40;
 		}
 	}
@@ -647,6 +703,7 @@ int ivtv_start_v4l2_encode_stream(struct ivtv *itv, int type)
 {
 	u32 data[IVTV_MBOX_MAX_DATA], result;
 	int captype = 0, subtype = 0;
+	unsigned long flags;
 	struct ivtv_stream *st = ivtv_stream_safeget(
 		"ivtv_start_v4l2_encode_stream", itv, type);
 
@@ -758,13 +815,24 @@ int ivtv_start_v4l2_encode_stream(struct ivtv *itv, int type)
 	  			2, itv->digitizer, itv->digitizer);
 		}
 
-		/*assign program index info. Mask 0: Disable, Num_req: 400 max*/
-		data[0] = 0;//itv->idx_sdf_mask;
-		data[1] = 0;//itv->idx_sdf_num;
-		ivtv_api(itv, itv->enc_mbox, &itv->enc_msem,
-	 		IVTV_API_ASSIGN_PGM_INDEX_INFO, &result, 2, &data[0]);
+		/*assign program index info. Mask 7: I, P and B frames, Num_req: 400 max*/
+		data[0] = itv->idx_sdf_mask;
+		data[1] = IVTV_MAX_PGM_INDEX;
+		if (ivtv_api(itv, itv->enc_mbox, &itv->enc_msem,
+	 		IVTV_API_ASSIGN_PGM_INDEX_INFO, &result, 2, &data[0]))
+			data[1] = 0;
 		itv->idx_sdf_offset = data[0];
 		itv->idx_sdf_num = data[1];
+		if (itv->idx_sdf_num > IVTV_MAX_PGM_INDEX)
+			itv->idx_sdf_num = 0;
+
+		/* Start a new index, offsets count from the first byte of
+		   this capture */
+		spin_lock_irqsave(&itv->DMA_slock, flags);
+		itv->pgm_index_rd = itv->pgm_index_wr = 0;
+		itv->pgm_index_fw = 0;
+		itv->mpg_data_received = 0;
+		spin_unlock_irqrestore(&itv->DMA_slock, flags);
 
 		IVTV_DEBUG_INFO(
 	   		"ENC: PGM Index at 0x%08x with 0x%08x elements\n",
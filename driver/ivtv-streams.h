@@ -32,4 +32,5 @@ int ivtv_stop_capture(struct ivtv *itv, int type);
 int ivtv_stop_all_captures(struct ivtv *itv);
 void ivtv_vbi_setup(struct ivtv *itv, int mode);
 int ivtv_init_digitizer(struct ivtv *itv);
+int ivtv_stream_set_pack(struct ivtv *itv, int type, u32 chunks);
 
@@ -23,7 +23,9 @@
 #include "ivtv-i2c.h"
 #include "ivtv-vbi.h"
 #include "ivtv-ioctl.h"
+#include "ivtv-queue.h"
 #include "v4l2-common.h"
+#include "cx25840.h"
 
 typedef unsigned long uintptr_t;
 
@@ -75,3 +77,131 @@ void ivtv_disable_vbi(struct ivtv *itv)
 	itv->vbi_cc_pos = 0;
 }
 
+
+/* Sliced VBI capture.
+
+   With sliced VBI selected the cx25840 replaces each VBI line by an
+   ancillary data packet, and the encoder transfers those lines as they
+   are, one line slot per line. The lines are decoded here into
+   struct v4l2_sliced_vbi_data when the DMA is done, so readers of the
+   sliced VBI device get a few hundred bytes per frame instead of the
+   line slots.
+
+   The decoding is the same as the cx25840's VIDIOC_INT_DECODE_VBI_LINE,
+   but that goes through the i2c client list under i2c_lock and so can't
+   be used from the interrupt handler. The parity and VPS helpers come
+   from cx25840.h. */
+
+/* p points just past the SAV code of a line. Returns 1 and fills in
+   *vbi if the line holds data for one of the services in use. */
+static int ivtv_vbi_decode_line(struct ivtv *itv, u8 *p,
+		struct v4l2_sliced_vbi_data *vbi)
+{
+	int id1, id2, l, err = 0;
+
+	if (p[0] || p[1] != 0xff || p[2] != 0xff ||
+	    (p[3] != 0x55 && p[3] != 0x91))
+		return 0;
+
+	p += 4;
+	id1 = p[-1];
+	id2 = p[0] & 0xf;
+	/* the same offsets the cx25840 sets up in cx25840_vbi_setup() */
+	l = (p[2] & 0x3f) + (itv->is_50hz ? 5 : 8);
+	p += 4;
+
+	switch (id2) {
+	case 1:
+		id2 = V4L2_SLICED_TELETEXT_B;
+		break;
+	case 4:
+		id2 = V4L2_SLICED_WSS_625;
+		break;
+	case 6:
+		id2 = V4L2_SLICED_CAPTION_525;
+		err = !cx25840_odd_parity(p[0]) || !cx25840_odd_parity(p[1]);
+		break;
+	case 9:
+		id2 = V4L2_SLICED_VPS;
+		err = cx25840_decode_vps(p, p) != 0;
+		break;
+	default:
+		err = 1;
+		break;
+	}
+	if (err || !(id2 & itv->vbi_sliced_in->service_set))
+		return 0;
+
+	vbi->id = id2;
+	vbi->field = (id1 == 0x55);
+	vbi->line = l;
+	vbi->reserved = 0;
+	memcpy(vbi->data, p, sizeof(vbi->data));
+	return 1;
+}
+
+/* Decode the lines in buf[0..size) that carry the given SAV code into
+   vbi_sliced_data[], starting at entry line. Returns the next entry. */
+static u32 compress_sliced_buf(struct ivtv *itv, u32 line, u8 *buf, u32 size, u8 sav)
+{
+	u32 line_size = itv->vbi_sliced_decoder_line_size;
+	u32 i;
+
+	/* find the first line */
+	for (i = 0; i + 4 <= size; i++, buf++) {
+		if (buf[0] == 0xff && !buf[1] && !buf[2] && buf[3] == sav)
+			break;
+	}
+	size -= i;
+
+	for (i = 0; i + line_size <= size && line < IVTV_VBI_SLICED_LINES; i += line_size) {
+		u8 *p = buf + i;
+
+		if (p[0] != 0xff || p[1] || p[2] || p[3] != sav)
+			continue;
+		line += ivtv_vbi_decode_line(itv, p + 4, &itv->vbi_sliced_data[line]);
+	}
+	return line;
+}
+
+/* Turn a buffer of sliced lines from the encoder into sliced VBI data.
+   Called from the interrupt handler when the DMA into buf is done. */
+void ivtv_vbi_process_sliced(struct ivtv *itv, struct ivtv_buffer *buf)
+{
+	u32 size = buf->buffer.bytesused;
+	u32 *w = (u32 *)itv->vbi_sliced_raw;
+	u32 lines, i;
+
+	if (w == NULL || (buf->vb.dma.vmalloc == NULL && buf->vb.dma.pages == NULL))
+		return;
+
+	if (size > IVTV_VBI_SLICED_RAW_SIZE)
+		size = IVTV_VBI_SLICED_RAW_SIZE;
+	size &= ~3;
+	ivtv_buf_copy(&buf->vb.dma, 0, itv->vbi_sliced_raw, size, 0);
+
+	/* VBI data is byteswapped by the encoder */
+	for (i = 0; i < size / 4; i++)
+		w[i] = swab32(w[i]);
+
+	lines = compress_sliced_buf(itv, 0, itv->vbi_sliced_raw, size / 2,
+			itv->vbi_sliced_decoder_sav_odd_field);
+	/* the second field does not always start at exactly half the
+	   buffer, so start looking a bit earlier */
+	if (size >= 64)
+		lines = compress_sliced_buf(itv, lines,
+				itv->vbi_sliced_raw + size / 2 - 32, size / 2 + 32,
+				itv->vbi_sliced_decoder_sav_even_field);
+
+	/* Always return at least one (empty) line, a read of 0 bytes
+	   would look like end of file */
+	if (lines == 0) {
+		memset(&itv->vbi_sliced_data[0], 0, sizeof(itv->vbi_sliced_data[0]));
+		lines = 1;
+	}
+
+	size = lines * sizeof(itv->vbi_sliced_data[0]);
+	ivtv_buf_copy(&buf->vb.dma, 0, (u8 *)itv->vbi_sliced_data, size, 1);
+	buf->buffer.bytesused = size;
+	buf->vb.size = size;
+}
@@ -22,3 +22,4 @@
 
 void ivtv_disable_vbi(struct ivtv *itv);
 void vbi_setup_lcr(struct ivtv *itv, int set, int is_pal, struct v4l2_sliced_vbi_format *fmt);
+void ivtv_vbi_process_sliced(struct ivtv *itv, struct ivtv_buffer *buf);
@@ -1727,6 +1727,24 @@ static int tuner_command(struct i2c_client *client, unsigned int cmd, void *arg)
 			t->radio = 1;
 		}
 		break;
+	case TUNER_GET_STATUS:
+	{
+		struct tuner_status *ts = arg;
+		int status;
+
+		memset(ts, 0, sizeof(*ts));
+		/* only the plain PLL tuners have a TV mode status byte */
+		if (t->radio || t->type == TUNER_MT2032 ||
+		    t->type == TUNER_TEA5767 || t->type == TUNER_PHILIPS_TDA8290)
+			break;
+		/* one read gives both, tuner_islocked() and
+		   tuner_afcstatus() would cost a transfer each */
+		status = tuner_getstatus(client);
+		ts->valid = 1;
+		ts->locked = (status & TUNER_FL) ? 1 : 0;
+		ts->afc = (status & TUNER_AFC) - 2;
+		break;
+	}
 	case AUDC_CONFIG_PINNACLE:
 		switch (*iarg) {
 		case 2:
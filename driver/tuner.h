@@ -146,6 +146,14 @@ struct tuner_setup {
 #endif
 
 #define  TDA9887_SET_CONFIG          _IOW('t',5,int)
+
+#define TUNER_GET_STATUS             _IOR('t',6,struct tuner_status)
+struct tuner_status {
+	int valid;		/* 0 if this tuner cannot report its status */
+	int locked;		/* PLL in lock */
+	int afc;		/* AFC offset in steps, 0 is centered */
+};
+
 /* tv card specific */
 # define TDA9887_PRESENT             (1<<0)
 # define TDA9887_PORT1_INACTIVE      (1<<1)
@@ -18,6 +18,9 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -26,8 +29,13 @@
 #define __user
 #include "videodev2.h"
 
+#include "ivtv.h"
+
 #define VIDIOC_S_FREQUENCY2 0x402c5639
 
+/* msecs to wait for tuner lock and video, 0 is the driver default */
+#define TUNE_TIMEOUT 0
+
 enum v4l2_tuner_type2 {
 	__V4L2_TUNER_RADIO = 1,
 	__V4L2_TUNER_ANALOG_TV = 2,
@@ -513,9 +521,32 @@ int chanf(int fd, int frequency)
 {
 	int retval;
 	struct v4l2_frequency2 vf;
+	struct ivtv_ioctl_tune tune;
 
 	frequency = (int)((frequency * 16) / 1000);	/* was /1000 */
 
+	/* Tune and wait for lock, so capture can start right away */
+	memset(&tune, 0, sizeof(tune));
+	tune.frequency = frequency;
+	tune.timeout = TUNE_TIMEOUT;
+	if (ioctl(fd, IVTV_IOC_S_FREQUENCY_WAIT, &tune) == 0) {
+		if (tune.status & IVTV_TUNE_VIDEO)
+			printf("tuned frequency %d: locked in %u ms, "
+			       "video in %u ms (afc %d)\n", frequency,
+			       tune.lock_time, tune.signal_time, tune.afc);
+		else
+			printf("tuned frequency %d: no video before timeout "
+			       "(%slocked, afc %d)\n", frequency,
+			       (tune.status & IVTV_TUNE_LOCKED) ? "" : "not ",
+			       tune.afc);
+		return 0;
+	}
+	if (errno != EINVAL && errno != ENOTTY) {
+		printf("ioctl for frequency %d failed", frequency);
+		return 1;
+	}
+
+	/* older driver, plain tune */
 	vf.tuner = 0;
 	vf.type = V4L2_TUNER_ANALOG_TV;
 	vf.frequency = frequency;
@@ -559,7 +590,7 @@ int chann(int fd, int channel)
 	retval = chanf(fd, freq);
 
 	if (retval) {
-		printf("failed to set channel %d", channel);
+		printf("failed to set channel %d\n", channel);
 		return 1;
 	}
 
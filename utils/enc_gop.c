@@ -0,0 +1,81 @@
+/*
+    Find the GOPs in a live MPEG program stream
+
+    The encoder writes a pack header, the sequence header and the GOP
+    header one after the other in front of every I frame, so the pack
+    the GOP header is in is where a recording can start. These offsets
+    are the same ones mindex() puts in the .index file.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+
+#include "enc_gop.h"
+
+#define PACK_START	0x000001ba
+#define GOP_START	0x000001b8
+#define PICTURE_START	0x00000100
+
+void gop_scan_init(struct gop_scan *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->state = 0xffffffff;
+}
+
+void gop_scan(struct gop_scan *s, const unsigned char *buf, int len,
+	      void (*found)(void *arg, uint64_t offset), void *arg)
+{
+	const unsigned char *p = buf, *end = buf + len;
+	uint32_t state = s->state;
+
+	while (p < end) {
+		if (s->need) {
+			s->timecode = (s->timecode << 8) | *p;
+			state = (state << 8) | *p++;
+			if (--s->need == 0) {
+				s->gops++;
+				found(arg, s->cut);
+			}
+			continue;
+		}
+		/* no start code can end before the next 00 */
+		if ((state & 0xff) != 0 && (state & 0xffffff) != 0x000001) {
+			const unsigned char *z = memchr(p, 0, end - p);
+
+			if (z == NULL) {
+				state = 0xffffffff;
+				break;
+			}
+			if (z != p) {
+				state = 0xffffffff;
+				p = z;
+			}
+		}
+		state = (state << 8) | *p++;
+		if ((state & 0xffffff00) != 0x00000100)
+			continue;
+		if (state == PACK_START) {
+			s->pack = s->pos + (p - buf) - 4;
+		} else if (state == GOP_START) {
+			s->cut = s->pack;
+			s->need = 4;
+		} else if (state == PICTURE_START) {
+			s->frames++;
+		}
+	}
+	s->state = state;
+	s->pos += len;
+}
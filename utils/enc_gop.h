@@ -0,0 +1,45 @@
+/*
+    Find the GOPs in a live MPEG program stream
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __ENC_GOP_H
+#define __ENC_GOP_H
+
+#include <stdint.h>
+
+/* Start code scanner state, kept across reads */
+struct gop_scan {
+	uint32_t state;		/* last bytes seen */
+	uint64_t pos;		/* stream offset of the next byte */
+	uint64_t pack;		/* offset of the last pack header */
+	uint64_t cut;		/* pack of the GOP being read */
+	uint32_t gops;
+	uint32_t frames;	/* pictures before the GOP found */
+	uint32_t timecode;	/* of the GOP found, as in its header */
+	int need;		/* bytes of the time code still to come */
+};
+
+void gop_scan_init(struct gop_scan *s);
+
+/* Scan the next len bytes of the stream. For each GOP header found,
+   found() gets the stream offset of the pack it starts in, the place to
+   cut the stream for it to begin with that GOP, and can look at the
+   frames and timecode of it in the scanner. */
+void gop_scan(struct gop_scan *s, const unsigned char *buf, int len,
+	      void (*found)(void *arg, uint64_t offset), void *arg);
+
+#endif
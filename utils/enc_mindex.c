@@ -42,12 +42,19 @@
 #include <sys/uio.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
 #include "mpeg2structs.h"
 
+#define __user
+#include "videodev2.h"
+#include "ivtv.h"
+
 #define VERBOSE 0
 #define STATUS 1
 
 int mindex(char *, char *, char *);
+int findex(int, char *, char *);
 
 // general stuff
 int debug = 0;
@@ -528,3 +535,105 @@ int mindex(char *i_mpeg, char *o_index, char *bstatus)
 	fclose(indexfd);
 	return 0;
 }
+
+/* Seconds to wait for the first index entry before giving up on the
+   driver's index */
+#define FINDEX_TIMEOUT	5
+
+/* Write the same index as mindex(), but from the picture index the
+   encoder firmware builds (IVTV_IOC_G_ENC_INDEX), without reading back
+   the MPEG file. The GOP timestamps are made from the PTS of each
+   I frame, at the frame rate of the current standard. Returns -1 if
+   the driver has no index, or gave no entry in FINDEX_TIMEOUT seconds,
+   so the caller can fall back to mindex(). */
+int findex(int fd, char *o_index, char *bstatus)
+{
+	struct ivtv_enc_index idx;
+	struct ivtv_enc_index_entry *e;
+	uint64_t first_pts = 0, frames;
+	v4l2_std_id std;
+	int have_pts = 0, polls = 0;
+	int i, secs, fps;
+
+	if (fd < 0 || o_index == NULL)
+		return -1;
+
+	if (ioctl(fd, VIDIOC_G_STD, &std) < 0)
+		return -1;
+	fps = (std & V4L2_STD_525_60) ? 30 : 25;
+
+	memset(&idx, 0, sizeof(idx));
+	if (ioctl(fd, IVTV_IOC_G_ENC_INDEX, &idx) < 0)
+		return -1;
+
+	indexfd = fopen(o_index, "w");
+	if (!indexfd) {
+		fprintf(stderr,
+			"mpegindex: Error: cannot create index file %s.\n",
+			o_index);
+		return -2;
+	}
+
+	for (;;) {
+		for (i = 0; i < idx.entries; i++) {
+			e = &idx.entry[i];
+			if (!have_pts) {
+				first_pts = e->pts;
+				have_pts = 1;
+			}
+			if ((e->flags & IVTV_ENC_INDEX_FRAME_MASK) !=
+			    IVTV_ENC_INDEX_FRAME_I) {
+				framecount++;
+				continue;
+			}
+
+			/* 33 bit PTS, 90kHz */
+			frames = ((e->pts - first_pts) & 0x1ffffffffULL) * fps / 90000;
+			secs = frames / fps;
+
+			last_index_written.frame = framecount;
+			last_index_written.timestamp.data = 0;
+			last_index_written.timestamp.hour = secs / 3600;
+			last_index_written.timestamp.minute = (secs / 60) % 60;
+			last_index_written.timestamp.second = secs % 60;
+			last_index_written.timestamp.frame = frames % fps;
+			last_index_written.offset = e->offset;
+			framecount++;
+
+			fwrite(&last_index_written, sizeof(last_index_written),
+			       1, indexfd);
+
+			/* Write out Status to LOCK */
+			if (STATUS == 1 && bstatus != NULL) {
+				FILE *lck = fopen(bstatus, "w");
+
+				if (lck != NULL) {
+					fprintf(lck,
+						"% 15lld: GOP %s frame %d\n",
+						last_index_written.offset,
+						timestamp_to_string(NULL,
+							last_index_written.timestamp),
+						framecount);
+					fclose(lck);
+				}
+			}
+		}
+		fflush(indexfd);
+
+		/* no index from the firmware, say idx_sdf_num is 0 */
+		if (!have_pts && ++polls > FINDEX_TIMEOUT * 10) {
+			fclose(indexfd);
+			indexfd = NULL;
+			return -1;
+		}
+
+		/* the driver holds enough for a few seconds of pictures */
+		if (idx.entries < IVTV_ENC_INDEX_ENTRIES)
+			usleep(100000);
+		if (ioctl(fd, IVTV_IOC_G_ENC_INDEX, &idx) < 0)
+			break;
+	}
+
+	fclose(indexfd);
+	return 0;
+}
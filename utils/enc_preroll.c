@@ -0,0 +1,382 @@
+/*
+    Pre-roll: keep the encoder running into memory, record from the past
+
+    The encoder runs all the time and its MPEG stream goes into a ring in
+    memory holding the last few seconds, together with where and when
+    each GOP started. Recordings are asked for through a FIFO, one
+    command per line:
+
+	record <file> [<start> [<seconds>]]
+	stop [<file>]
+	quit
+
+    start is a UNIX time, or seconds before now when negative, and the
+    recording begins with the last GOP that started at or before it, as
+    far back as the ring goes. A start in the future waits for its time,
+    no start means now. The recording then continues with the live
+    stream until seconds have passed (0 or none for until stopped) and
+    ends before the first GOP after that. A recording never has to wait
+    for the encoder to start or for the next GOP.
+
+    A recording that can not keep up with the disk falls out of the ring,
+    it loses data and goes on from the oldest GOP left.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "enc_gop.h"
+
+int preroll(int fd, int seconds, int bitrate, char *ctl_file, int port);
+
+#define READ_SIZE	65536
+#define WRITE_CHUNK	(1024 * 1024)	/* per recording and read, reading comes first */
+#define MAX_GOPS	8192		/* over an hour at 2 GOPs a second */
+#define MAX_RECORDINGS	4
+#define VERBOSE 1
+
+struct gop_entry {
+	uint64_t offset;	/* in the stream */
+	double when;		/* time its data came from the driver */
+};
+
+struct recording {
+	int fd;			/* -1 for a free entry */
+	char file[256];
+	double start;		/* wanted start, 0 once it has started */
+	double end;		/* 0 for until stopped */
+	uint64_t pos;		/* written up to this stream offset */
+	uint32_t gop;		/* next GOP to look at for the end */
+	uint64_t end_pos;	/* the GOP it ends before, 0 while unknown */
+	uint64_t bytes;
+	uint64_t lost;
+};
+
+static unsigned char *ring;
+static uint64_t ring_size;
+static uint64_t head;		/* bytes of stream read */
+static struct gop_entry gops[MAX_GOPS];
+static uint32_t ngops;		/* GOPs seen, gop n is gops[n % MAX_GOPS] */
+static uint32_t first_gop;	/* none before it is in the ring */
+static struct recording rec[MAX_RECORDINGS];
+static double now;
+static int vport;
+
+static double time_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* oldest stream offset still in the ring */
+static uint64_t ring_tail(void)
+{
+	return head > ring_size ? head - ring_size : 0;
+}
+
+/* index of the oldest GOP still in the ring, ngops if none */
+static uint32_t oldest_gop(void)
+{
+	if (ngops - first_gop > MAX_GOPS)
+		first_gop = ngops - MAX_GOPS;
+	while (first_gop < ngops && gops[first_gop % MAX_GOPS].offset < ring_tail())
+		first_gop++;
+	return first_gop;
+}
+
+static void gop_found(void *arg, uint64_t offset)
+{
+	struct gop_entry *g = &gops[ngops++ % MAX_GOPS];
+
+	g->offset = offset;
+	g->when = now;
+}
+
+static void rec_close(struct recording *r)
+{
+	fprintf(stderr, "(%d) Recording %s done, %llu bytes",
+		vport, r->file, (unsigned long long)r->bytes);
+	if (r->lost)
+		fprintf(stderr, ", %llu bytes lost", (unsigned long long)r->lost);
+	fprintf(stderr, "\n");
+	close(r->fd);
+	r->fd = -1;
+}
+
+/* Start a recording at the last GOP at or before its start time */
+static void rec_start(struct recording *r)
+{
+	uint32_t n = oldest_gop(), g;
+
+	if (n == ngops)
+		return;		/* no GOP yet, wait for one */
+	for (g = n; g + 1 < ngops && gops[(g + 1) % MAX_GOPS].when <= r->start; g++)
+		;
+	r->pos = gops[g % MAX_GOPS].offset;
+	r->gop = g + 1;
+	if (VERBOSE)
+		fprintf(stderr, "(%d) Recording %s from %.1f seconds back\n",
+			vport, r->file, now - gops[g % MAX_GOPS].when);
+	r->start = 0;
+}
+
+/* Write some more of a recording, returns 1 when it has more to write */
+static int rec_write(struct recording *r, uint64_t limit)
+{
+	uint64_t to, off, len, from = r->pos;
+	ssize_t n;
+
+	if (r->start) {
+		if (now < r->start)
+			return 0;
+		rec_start(r);
+		if (r->start)
+			return 0;
+	}
+	if (r->pos < ring_tail()) {
+		/* the ring went past it, go on from the oldest GOP left */
+		fprintf(stderr, "(%d) Recording %s fell behind, skipping\n",
+			vport, r->file);
+		r->start = now;
+		rec_start(r);
+		if (r->start)
+			r->pos = head;
+		r->lost += r->pos - from;
+		if (r->start)
+			return 0;
+	}
+	if (r->gop < oldest_gop())
+		r->gop = oldest_gop();
+	while (r->end && !r->end_pos && r->gop < ngops) {
+		if (gops[r->gop % MAX_GOPS].when >= r->end)
+			r->end_pos = gops[r->gop % MAX_GOPS].offset;
+		r->gop++;
+	}
+
+	to = head;
+	if (r->end_pos && r->end_pos < to)
+		to = r->end_pos;
+	if (to - r->pos > limit)
+		to = r->pos + limit;
+	while (r->pos < to) {
+		off = r->pos % ring_size;
+		len = to - r->pos;
+		if (len > ring_size - off)
+			len = ring_size - off;
+		n = write(r->fd, ring + off, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "(%d) Recording %s: %s\n",
+				vport, r->file, strerror(errno));
+			rec_close(r);
+			return 0;
+		}
+		r->pos += n;
+		r->bytes += n;
+	}
+	if (r->end_pos && r->pos >= r->end_pos) {
+		rec_close(r);
+		return 0;
+	}
+	return r->pos < head;
+}
+
+static void command(char *line)
+{
+	char cmd[16], file[256];
+	double start = 0, secs = 0;
+	struct recording *r = NULL;
+	int i, n;
+
+	n = sscanf(line, "%15s %255s %lf %lf", cmd, file, &start, &secs);
+	if (n < 1)
+		return;
+	if (strcmp(cmd, "record") == 0 && n >= 2) {
+		for (i = 0; i < MAX_RECORDINGS; i++)
+			if (rec[i].fd < 0)
+				r = &rec[i];
+		if (r == NULL) {
+			fprintf(stderr, "(%d) Too many recordings for %s\n",
+				vport, file);
+			return;
+		}
+		memset(r, 0, sizeof(*r));
+		r->fd = open(file, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+		if (r->fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", file,
+				strerror(errno));
+			return;
+		}
+		snprintf(r->file, sizeof(r->file), "%s", file);
+		if (start <= 0)
+			start += now;
+		r->start = start;
+		r->end = secs > 0 ? start + secs : 0;
+	} else if (strcmp(cmd, "stop") == 0) {
+		/* ends before the next GOP from now */
+		for (i = 0; i < MAX_RECORDINGS; i++) {
+			if (rec[i].fd < 0 || (n >= 2 && strcmp(rec[i].file, file)))
+				continue;
+			if (rec[i].start) {
+				rec_close(&rec[i]);
+				unlink(rec[i].file);
+			} else if (!rec[i].end || rec[i].end > now) {
+				rec[i].end = now;
+			}
+		}
+	} else if (strcmp(cmd, "quit") == 0) {
+		for (i = 0; i < MAX_RECORDINGS; i++) {
+			if (rec[i].fd < 0)
+				continue;
+			if (!rec[i].start) {
+				rec[i].end_pos = head;
+				while (rec[i].fd >= 0)
+					rec_write(&rec[i], head);
+			} else {
+				rec_close(&rec[i]);
+				unlink(rec[i].file);
+			}
+		}
+		ring_size = 0;
+	} else {
+		fprintf(stderr, "(%d) Unknown command %s\n", vport, cmd);
+	}
+}
+
+/* Run the encoder into a ring of the last seconds of the stream and make
+   recordings out of it as the control FIFO asks */
+int preroll(int fd, int seconds, int bitrate, char *ctl_file, int port)
+{
+	struct gop_scan scan;
+	char line[1024];
+	int ctl, len = 0, i, n, more = 0;
+
+	vport = port;
+	/* a GOP more than asked for, so the first one is still there */
+	ring_size = (uint64_t)(seconds + 2) * bitrate / 8;
+	ring_size = (ring_size + READ_SIZE - 1) / READ_SIZE * READ_SIZE;
+	ring = malloc(ring_size);
+	if (ring == NULL) {
+		fprintf(stderr, "(%d) No memory for %d seconds of pre-roll\n",
+			vport, seconds);
+		return -1;
+	}
+	/* touch it now, not while capturing */
+	memset(ring, 0, ring_size);
+
+	if (mkfifo(ctl_file, 0600) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Failed to create %s: %s\n", ctl_file,
+			strerror(errno));
+		free(ring);
+		return -1;
+	}
+	/* opened for writing too, so it never reads end of file */
+	ctl = open(ctl_file, O_RDWR | O_NONBLOCK);
+	if (ctl < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", ctl_file,
+			strerror(errno));
+		free(ring);
+		return -1;
+	}
+	for (i = 0; i < MAX_RECORDINGS; i++)
+		rec[i].fd = -1;
+	gop_scan_init(&scan);
+	head = 0;
+	ngops = 0;
+	first_gop = 0;
+
+	if (VERBOSE)
+		fprintf(stderr, "(%d) Keeping %d seconds (%llu bytes), control %s\n",
+			vport, seconds, (unsigned long long)ring_size, ctl_file);
+
+	while (ring_size) {
+		struct timeval tv = { 1, 0 };
+		fd_set fds;
+
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		FD_SET(ctl, &fds);
+		/* don't wait while a recording is catching up */
+		if (more)
+			tv.tv_sec = 0;
+		n = select((fd > ctl ? fd : ctl) + 1, &fds, NULL, NULL, &tv);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		now = time_now();
+
+		if (n > 0 && FD_ISSET(fd, &fds)) {
+			uint64_t off = head % ring_size;
+
+			n = ring_size - off;
+			n = read(fd, ring + off, n < READ_SIZE ? n : READ_SIZE);
+			if (n < 0 && errno != EINTR && errno != EAGAIN) {
+				fprintf(stderr, "(%d) Encoder read: %s\n",
+					vport, strerror(errno));
+				break;
+			}
+			if (n > 0) {
+				gop_scan(&scan, ring + off, n, gop_found, NULL);
+				head += n;
+			}
+		}
+
+		if (FD_ISSET(ctl, &fds)) {
+			char *p, *nl;
+
+			n = read(ctl, line + len, sizeof(line) - 1 - len);
+			if (n > 0) {
+				len += n;
+				line[len] = '\0';
+				for (p = line; (nl = strchr(p, '\n')) != NULL; p = nl + 1) {
+					*nl = '\0';
+					command(p);
+				}
+				len -= p - line;
+				memmove(line, p, len);
+				/* no newline in a full buffer, throw it away */
+				if (len == sizeof(line) - 1)
+					len = 0;
+			}
+		}
+
+		more = 0;
+		for (i = 0; ring_size && i < MAX_RECORDINGS; i++)
+			if (rec[i].fd >= 0)
+				more |= rec_write(&rec[i], WRITE_CHUNK);
+	}
+
+	for (i = 0; i < MAX_RECORDINGS; i++)
+		if (rec[i].fd >= 0)
+			rec_close(&rec[i]);
+	close(ctl);
+	free(ring);
+	ring = NULL;
+	return 0;
+}
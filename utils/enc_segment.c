@@ -0,0 +1,310 @@
+/*
+    Segments: the encoder writing a recording as a series of files
+
+    A new file is started at the first GOP after the one being written
+    reaches a size or a running time, so every file begins with a GOP
+    and plays on its own. Each file is allocated before it is written to,
+    the next one while the one before it fills, so the filesystem
+    neither has to find blocks for every write nor spread them about
+    when several encoders write at once. A file gets its own .index, in
+    the format of mindex(), and is added to an m3u playlist once it is
+    complete, so it can be used straight away.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "enc_gop.h"
+
+int segment(int fd, char *file, uint64_t max_bytes, int max_secs,
+	    uint64_t prealloc, int fps, int port);
+
+#define READ_SIZE	65536
+#define MAX_NEW_GOPS	64	/* in one read */
+#define VERBOSE 1
+
+/* The .index entry of mindex() */
+struct mpeg_index_entry {
+	unsigned int frame;
+	uint32_t timestamp;	/* GOP time code, flag bits cleared */
+	unsigned long long offset;
+};
+#define TIMECODE_MASK	0x7ff7ff80
+
+struct cut {
+	uint64_t offset;
+	uint32_t frames;
+	uint32_t timecode;
+};
+
+struct seg {
+	int fd;
+	FILE *index;
+	int number;
+	uint64_t start;		/* stream offset it begins at */
+	uint32_t frames;	/* pictures before it */
+};
+
+static char base[256], ext[32], playlist_file[300];
+static FILE *playlist;
+static struct seg cur = { -1 }, next = { -1 };
+static uint64_t seg_prealloc;
+static struct cut cuts[MAX_NEW_GOPS];
+static int ncuts;
+static int seg_fps;
+static int vport;
+
+static void seg_cut(void *arg, uint64_t offset)
+{
+	struct gop_scan *s = arg;
+
+	if (ncuts == MAX_NEW_GOPS)
+		return;
+	cuts[ncuts].offset = offset;
+	cuts[ncuts].frames = s->frames;
+	cuts[ncuts].timecode = s->timecode & TIMECODE_MASK;
+	ncuts++;
+}
+
+static void seg_name(char *name, int size, int number, const char *suffix)
+{
+	snprintf(name, size, "%s-%04d%s%s", base, number, ext, suffix);
+}
+
+/* Create and allocate segment number, ready to be written */
+static int seg_open(struct seg *s, int number)
+{
+	char name[320];
+
+	seg_name(name, sizeof(name), number, "");
+	s->fd = open(name, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (s->fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+	/* the size stays at what has been written */
+	if (fallocate(s->fd, FALLOC_FL_KEEP_SIZE, 0, seg_prealloc) < 0 &&
+	    VERBOSE && number < 2)
+		fprintf(stderr, "(%d) Can't preallocate %s: %s\n", vport, name,
+			strerror(errno));
+	seg_name(name, sizeof(name), number, ".index");
+	s->index = fopen(name, "w");
+	if (s->index == NULL) {
+		fprintf(stderr, "Failed to open %s: %s\n", name, strerror(errno));
+		close(s->fd);
+		s->fd = -1;
+		return -1;
+	}
+	s->number = number;
+	return 0;
+}
+
+/* Drop a segment that was never used */
+static void seg_remove(struct seg *s)
+{
+	char name[320];
+
+	close(s->fd);
+	fclose(s->index);
+	s->fd = -1;
+	seg_name(name, sizeof(name), s->number, "");
+	unlink(name);
+	seg_name(name, sizeof(name), s->number, ".index");
+	unlink(name);
+}
+
+/* Finish the segment, up to stream offset end and frame frames */
+static void seg_close(struct seg *s, uint64_t end, uint32_t frames)
+{
+	char name[320], *p;
+
+	/* give back what was allocated and not used */
+	if (ftruncate(s->fd, end - s->start) < 0)
+		fprintf(stderr, "(%d) Truncating segment %d: %s\n", vport,
+			s->number, strerror(errno));
+	close(s->fd);
+	fclose(s->index);
+	s->fd = -1;
+
+	seg_name(name, sizeof(name), s->number, "");
+	p = strrchr(name, '/');
+	fprintf(playlist, "#EXTINF:%d,\n%s\n",
+		(frames - s->frames + seg_fps / 2) / seg_fps, p ? p + 1 : name);
+	fflush(playlist);
+	if (VERBOSE)
+		fprintf(stderr, "(%d) Segment %s, %llu bytes, %u frames\n", vport,
+			name, (unsigned long long)(end - s->start),
+			frames - s->frames);
+}
+
+static int writeall_seg(struct seg *s, unsigned char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(s->fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "(%d) Segment %d write: %s\n", vport,
+				s->number, strerror(errno));
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static struct gop_scan scan;
+static unsigned char *buf;	/* stream from bufpos on */
+static uint64_t bufpos;
+static int have;
+static uint64_t seg_written;
+
+static void seg_exit(void)
+{
+	if (cur.fd >= 0) {
+		/* what was kept back */
+		if (writeall_seg(&cur, buf + (seg_written - bufpos),
+				 bufpos + have - seg_written) == 0)
+			seg_written = bufpos + have;
+		seg_close(&cur, seg_written, scan.frames);
+	}
+	if (next.fd >= 0)
+		seg_remove(&next);
+	if (playlist) {
+		fclose(playlist);
+		playlist = NULL;
+	}
+	free(buf);
+	buf = NULL;
+}
+
+/* Run the encoder into segment files until it stops */
+int segment(int fd, char *file, uint64_t max_bytes, int max_secs,
+	    uint64_t prealloc, int fps, int port)
+{
+	uint64_t end, keep;
+	struct mpeg_index_entry e;
+	int i;
+	ssize_t n;
+	char *p;
+
+	vport = port;
+	seg_fps = fps;
+	seg_prealloc = prealloc;
+	/* file.mpg goes to file-0000.mpg, file-0001.mpg ... and file.m3u */
+	snprintf(base, sizeof(base), "%s", file);
+	p = strrchr(base, '.');
+	if (p && !strchr(p, '/')) {
+		snprintf(ext, sizeof(ext), "%s", p);
+		*p = '\0';
+	}
+	snprintf(playlist_file, sizeof(playlist_file), "%s.m3u", base);
+	playlist = fopen(playlist_file, "w");
+	if (playlist == NULL) {
+		fprintf(stderr, "Failed to open %s: %s\n", playlist_file,
+			strerror(errno));
+		return -1;
+	}
+	fprintf(playlist, "#EXTM3U\n");
+	fflush(playlist);
+
+	/* a pack kept back from the last read comes before the next one */
+	buf = malloc(2 * READ_SIZE);
+	if (buf == NULL || seg_open(&cur, 0) < 0 || seg_open(&next, 1) < 0) {
+		seg_exit();
+		return -1;
+	}
+	cur.start = 0;
+	cur.frames = 0;
+	bufpos = 0;
+	have = 0;
+	seg_written = 0;
+	gop_scan_init(&scan);
+	atexit(seg_exit);
+
+	if (VERBOSE)
+		fprintf(stderr, "(%d) Segments %s-NNNN%s, playlist %s\n", port,
+			base, ext, playlist_file);
+
+	for (;;) {
+		n = read(fd, buf + have, READ_SIZE);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0) {
+			if (n < 0)
+				fprintf(stderr, "(%d) Encoder read: %s\n", port,
+					strerror(errno));
+			break;
+		}
+		ncuts = 0;
+		gop_scan(&scan, buf + have, n, seg_cut, &scan);
+		have += n;
+
+		for (i = 0; i < ncuts; i++) {
+			struct cut *c = &cuts[i];
+
+			if (c->offset < seg_written)
+				c->offset = seg_written;
+			if (c->offset > cur.start &&
+			    ((max_bytes && c->offset - cur.start >= max_bytes) ||
+			     (max_secs &&
+			      c->frames - cur.frames >= (uint32_t)max_secs * fps))) {
+				/* roll over to the file made ready for it */
+				if (writeall_seg(&cur, buf + (seg_written - bufpos),
+						 c->offset - seg_written) < 0)
+					goto out;
+				seg_written = c->offset;
+				seg_close(&cur, c->offset, c->frames);
+				cur = next;
+				cur.start = c->offset;
+				cur.frames = c->frames;
+				if (seg_open(&next, cur.number + 1) < 0)
+					goto out;
+			}
+			e.frame = c->frames - cur.frames;
+			e.timestamp = c->timecode;
+			e.offset = c->offset - cur.start;
+			fwrite(&e, sizeof(e), 1, cur.index);
+		}
+		fflush(cur.index);
+
+		/* keep the last pack back, its GOP header may be in the next read */
+		end = bufpos + have;
+		keep = end;
+		if (scan.pack >= seg_written && end - scan.pack < READ_SIZE)
+			keep = scan.pack;
+		if (writeall_seg(&cur, buf + (seg_written - bufpos),
+				 keep - seg_written) < 0)
+			goto out;
+		seg_written = keep;
+		have = end - keep;
+		memmove(buf, buf + (keep - bufpos), have);
+		bufpos = keep;
+	}
+
+out:
+	seg_exit();
+	return 0;
+}
@@ -0,0 +1,332 @@
+/*
+    Timeshift: the encoder writing round a fixed size file
+
+    The file is made its full size once and then written over and over,
+    so taking the disk space and the block allocation happen before
+    recording. The last GOPs written and the window of the stream in the
+    file are kept in POSIX shared memory, so a player can pause, rewind
+    and seek while the encoder goes on.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "enc_gop.h"
+#include "enc_timeshift.h"
+
+#define READ_SIZE	65536
+#define MAX_NEW_GOPS	64	/* in one read */
+#define VERBOSE 1
+
+#define wmb()	__sync_synchronize()
+#define rmb()	__sync_synchronize()
+
+static struct timeshift_hdr *ts;
+static char ts_name[64];
+static struct timeshift_gop new_gops[MAX_NEW_GOPS];
+static int nnew;
+static uint64_t read_usec;
+
+static void ts_gop_found(void *arg, uint64_t offset)
+{
+	if (nnew == MAX_NEW_GOPS)
+		return;
+	new_gops[nnew].offset = offset;
+	new_gops[nnew].usec = read_usec;
+	nnew++;
+}
+
+static void ts_exit(void)
+{
+	if (ts == NULL)
+		return;
+	ts->closed = 1;
+	munmap(ts, sizeof(*ts));
+	shm_unlink(ts_name);
+	ts = NULL;
+}
+
+static int pwriteall(int fd, unsigned char *buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len) {
+		n = pwrite(fd, buf, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+/* Run the encoder into file round and round until it stops */
+int timeshift(int fd, char *file, uint64_t size, char *name, int port)
+{
+	struct gop_scan scan;
+	struct timeval tv;
+	unsigned char *buf;
+	uint64_t head = 0, tail, off;
+	uint32_t first;
+	int out, shm, err, i;
+	ssize_t n;
+
+	buf = malloc(READ_SIZE);
+	if (buf == NULL)
+		return -1;
+
+	/* the same file is used again, only made the right size */
+	out = open(file, O_CREAT | O_WRONLY, 0644);
+	if (out < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+		free(buf);
+		return -1;
+	}
+	err = ftruncate(out, size) < 0 ? errno : posix_fallocate(out, 0, size);
+	if (err) {
+		fprintf(stderr, "Failed to make %s %llu bytes: %s\n", file,
+			(unsigned long long)size, strerror(err));
+		close(out);
+		free(buf);
+		return -1;
+	}
+
+	snprintf(ts_name, sizeof(ts_name), "%s", name);
+	shm_unlink(name);
+	shm = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (shm < 0 || ftruncate(shm, sizeof(*ts)) < 0) {
+		fprintf(stderr, "Failed to create %s: %s\n", name,
+			strerror(errno));
+		if (shm >= 0) {
+			close(shm);
+			shm_unlink(name);
+		}
+		close(out);
+		free(buf);
+		return -1;
+	}
+	ts = mmap(NULL, sizeof(*ts), PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+	close(shm);
+	if (ts == MAP_FAILED) {
+		ts = NULL;
+		shm_unlink(name);
+		close(out);
+		free(buf);
+		return -1;
+	}
+	atexit(ts_exit);
+	ts->version = TIMESHIFT_VERSION;
+	ts->size = size;
+	if (file[0] == '/')
+		snprintf(ts->file, sizeof(ts->file), "%s", file);
+	else if (getcwd(ts->file, sizeof(ts->file)) != NULL)
+		snprintf(ts->file + strlen(ts->file),
+			 sizeof(ts->file) - strlen(ts->file), "/%s", file);
+	wmb();
+	ts->magic = TIMESHIFT_MAGIC;
+
+	if (VERBOSE)
+		fprintf(stderr, "(%d) Timeshift in %s, %llu bytes, index %s\n",
+			port, file, (unsigned long long)size, name);
+
+	gop_scan_init(&scan);
+	for (;;) {
+		n = read(fd, buf, READ_SIZE);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0) {
+			if (n < 0)
+				fprintf(stderr, "(%d) Encoder read: %s\n", port,
+					strerror(errno));
+			break;
+		}
+		gettimeofday(&tv, NULL);
+		read_usec = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+		nnew = 0;
+		gop_scan(&scan, buf, n, ts_gop_found, NULL);
+
+		/* the part about to be written over goes out of the window */
+		tail = head + n > size ? head + n - size : 0;
+		first = ts->first_gop;
+		while (first < ts->ngops &&
+		       ts->gop[first % TIMESHIFT_GOPS].offset < tail)
+			first++;
+		ts->seq++;
+		wmb();
+		ts->tail = tail;
+		ts->first_gop = first;
+		wmb();
+		ts->seq++;
+
+		off = head % size;
+		if (off + n > size) {
+			err = pwriteall(out, buf, size - off, off) ||
+				pwriteall(out, buf + (size - off),
+					  n - (size - off), 0);
+		} else {
+			err = pwriteall(out, buf, n, off);
+		}
+		if (err) {
+			fprintf(stderr, "(%d) Timeshift write: %s\n", port,
+				strerror(errno));
+			break;
+		}
+		head += n;
+
+		/* then the new GOPs, now that they are in the file */
+		ts->seq++;
+		wmb();
+		for (i = 0; i < nnew; i++) {
+			if (new_gops[i].offset < tail)
+				continue;
+			ts->gop[ts->ngops % TIMESHIFT_GOPS] = new_gops[i];
+			ts->ngops++;
+		}
+		if (ts->ngops - ts->first_gop > TIMESHIFT_GOPS)
+			ts->first_gop = ts->ngops - TIMESHIFT_GOPS;
+		ts->head = head;
+		wmb();
+		ts->seq++;
+	}
+
+	close(out);
+	free(buf);
+	ts_exit();
+	return 0;
+}
+
+int timeshift_attach(struct timeshift *t, const char *name)
+{
+	struct timeshift_hdr *h;
+	int shm;
+
+	t->hdr = NULL;
+	shm = shm_open(name, O_RDONLY, 0);
+	if (shm < 0)
+		return -1;
+	h = mmap(NULL, sizeof(*h), PROT_READ, MAP_SHARED, shm, 0);
+	close(shm);
+	if (h == MAP_FAILED)
+		return -1;
+	rmb();
+	if (h->magic != TIMESHIFT_MAGIC || h->version != TIMESHIFT_VERSION) {
+		munmap(h, sizeof(*h));
+		errno = EINVAL;
+		return -1;
+	}
+	t->fd = open(h->file, O_RDONLY);
+	if (t->fd < 0) {
+		munmap(h, sizeof(*h));
+		return -1;
+	}
+	t->hdr = h;
+	return 0;
+}
+
+void timeshift_detach(struct timeshift *t)
+{
+	close(t->fd);
+	munmap(t->hdr, sizeof(*t->hdr));
+	t->hdr = NULL;
+}
+
+void timeshift_window(struct timeshift *t, uint64_t *tail, uint64_t *head)
+{
+	struct timeshift_hdr *h = t->hdr;
+	uint32_t seq;
+
+	do {
+		seq = h->seq;
+		rmb();
+		*tail = h->tail;
+		*head = h->head;
+		rmb();
+	} while ((seq & 1) || seq != h->seq);
+}
+
+int timeshift_seek(struct timeshift *t, uint64_t usec, uint64_t *pos)
+{
+	struct timeshift_hdr *h = t->hdr;
+	uint32_t seq, first, last, n;
+
+	for (;;) {
+		seq = h->seq;
+		rmb();
+		first = h->first_gop;
+		last = h->ngops;
+		if (first == last) {
+			rmb();
+			if ((seq & 1) || seq != h->seq)
+				continue;
+			return -1;
+		}
+		/* the GOP times go up, look for the last one not after usec */
+		n = first;
+		while (last - n > 1) {
+			uint32_t mid = n + (last - n) / 2;
+
+			if (h->gop[mid % TIMESHIFT_GOPS].usec <= usec)
+				n = mid;
+			else
+				last = mid;
+		}
+		*pos = h->gop[n % TIMESHIFT_GOPS].offset;
+		rmb();
+		if (!(seq & 1) && seq == h->seq)
+			return 0;
+	}
+}
+
+ssize_t timeshift_read(struct timeshift *t, uint64_t pos, void *buf, size_t len)
+{
+	uint64_t tail, head, off;
+	ssize_t n;
+
+	timeshift_window(t, &tail, &head);
+	if (pos < tail) {
+		errno = ERANGE;
+		return -1;
+	}
+	if (pos >= head)
+		return 0;
+	if (len > head - pos)
+		len = head - pos;
+	off = pos % t->hdr->size;
+	if (len > t->hdr->size - off)
+		len = t->hdr->size - off;
+	n = pread(t->fd, buf, len, off);
+	if (n <= 0)
+		return n;
+	/* it was being written over if the window went past it meanwhile */
+	timeshift_window(t, &tail, &head);
+	if (pos < tail) {
+		errno = ERANGE;
+		return -1;
+	}
+	return n;
+}
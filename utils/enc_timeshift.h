@@ -0,0 +1,77 @@
+/*
+    Timeshift: the encoder writing round a fixed size file
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __ENC_TIMESHIFT_H
+#define __ENC_TIMESHIFT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* The stream is numbered in bytes from the start of the encoding, and
+   stream offset pos is at pos % size in the file. Everything from tail
+   up to head can be read, and the GOPs in it are in the index. */
+
+#define TIMESHIFT_SHM		"/ivtv-timeshift."	/* and the port */
+#define TIMESHIFT_MAGIC		0x53545649		/* "IVTS" */
+#define TIMESHIFT_VERSION	1
+#define TIMESHIFT_GOPS		4096			/* a power of 2 */
+
+struct timeshift_gop {
+	uint64_t offset;	/* of the pack the GOP header is in */
+	uint64_t usec;		/* UNIX time its data came from the driver */
+};
+
+struct timeshift_hdr {
+	uint32_t magic;
+	uint32_t version;
+	char file[256];
+	uint64_t size;			/* of the file */
+	volatile uint32_t seq;		/* odd while the rest changes */
+	volatile uint32_t closed;	/* the encoder has stopped */
+	volatile uint64_t head;		/* stream written to the file */
+	volatile uint64_t tail;		/* oldest stream offset that can be read */
+	volatile uint32_t first_gop;	/* GOPs first_gop to ngops - 1 are in */
+	volatile uint32_t ngops;	/* gop n is gop[n % TIMESHIFT_GOPS] */
+	struct timeshift_gop gop[TIMESHIFT_GOPS];
+};
+
+/* Writer, in ivtv-encoder */
+int timeshift(int fd, char *file, uint64_t size, char *name, int port);
+
+/* Player side */
+struct timeshift {
+	struct timeshift_hdr *hdr;
+	int fd;			/* the file */
+};
+
+int timeshift_attach(struct timeshift *t, const char *name);
+void timeshift_detach(struct timeshift *t);
+
+/* Copy out where the window is now */
+void timeshift_window(struct timeshift *t, uint64_t *tail, uint64_t *head);
+
+/* The start of the last GOP at or before UNIX time usec, or the oldest
+   one held. Returns -1 when there is no GOP yet. */
+int timeshift_seek(struct timeshift *t, uint64_t usec, uint64_t *pos);
+
+/* Read the stream from pos on, as much as has been written. Fails with
+   ERANGE when pos is not in the file any more, the data may have been
+   overwritten while it was read. */
+ssize_t timeshift_read(struct timeshift *t, uint64_t pos, void *buf, size_t len);
+
+#endif
@@ -45,6 +45,7 @@
 
 #include "ivtv-functions.h"
 #include "encoder.h"
+#include "enc_timeshift.h"
 
 /* defined in compile args */
 /* #define VIDEO_PORT 0 */
@@ -55,6 +56,7 @@ void stop_encoder(int);
 void index_t(void);
 void *index_thread(void *);
 int mindex(char *output_file, char *index_file, char *bstatus);
+int findex(int fd, char *index_file, char *bstatus);
 int streamfd(int fdout, int fdin, int count);
 int writeall(int fd, char *buf, int count);
 int chann(int fd, int chan_num);
@@ -62,6 +64,9 @@ int chanf(int fd, int frequency);
 void usage(void);
 
 int splice(unsigned char *, int, int);
+int preroll(int fd, int seconds, int bitrate, char *ctl_file, int port);
+int segment(int fd, char *file, uint64_t max_bytes, int max_secs,
+	    uint64_t prealloc, int fps, int port);
 #define SPLICE_START 1
 #define SPLICE_END   2
 #define GOP_COUNTER  3
@@ -108,6 +113,7 @@ int settings[18] = { ASPECT, BMODE, BRATE, BPEAK, STREAM, AUDIO,
 #define ELOCK "/tmp/en_lock."
 #define ELOCKLINK "/tmp/en_lock_l."
 #define BSTATUS "/tmp/"
+#define ECTL "/tmp/en_ctl."
 
 //#define MAX_INPUT_LINE 1572864
 //#define MAX_INPUT_LINE 256000
@@ -167,6 +173,10 @@ int main(int argc, char *argv[])
 	int launch_thread = 0;
 	int setup_only = 0;
 	int stdout_stream = 0;
+	int preroll_secs = 0;
+	int timeshift_mb = 0;
+	int segment_mb = 0;
+	int segment_secs = 0;
 
 	/* GOP Splicer/Timer Variables */
 	prvpkt[0] = '\0';
@@ -593,6 +603,90 @@ int main(int argc, char *argv[])
 				settings[17] = (int)atoi(var);
 				i++;
 				continue;
+			} else if (strncmp(argv[i], "-preroll", 8) == 0) {
+				/* Pre-roll Seconds */
+				char *var = NULL;
+				for (j = 0; argv[i + 1][j] != '\0'; j++) {
+					if (isdigit(argv[i + 1][j]) == 0) {
+						/* Bad Argument Given */
+						fprintf(stderr,
+							"Pre-roll: ERROR: bad option! %s\n",
+							argv[i]);
+						usage();
+						exit(1);
+					}
+				}
+				strsize = strlen(argv[i + 1]);
+				var = malloc(strsize + 1);
+				if (var == NULL)
+					continue;
+				strncpy(var, argv[i + 1], strsize + 1);
+				preroll_secs = (int)atoi(var);
+				i++;
+				continue;
+			} else if (strncmp(argv[i], "-timeshift", 9) == 0) {
+				/* Timeshift File Size */
+				char *var = NULL;
+				for (j = 0; argv[i + 1][j] != '\0'; j++) {
+					if (isdigit(argv[i + 1][j]) == 0) {
+						/* Bad Argument Given */
+						fprintf(stderr,
+							"Timeshift: ERROR: bad option! %s\n",
+							argv[i]);
+						usage();
+						exit(1);
+					}
+				}
+				strsize = strlen(argv[i + 1]);
+				var = malloc(strsize + 1);
+				if (var == NULL)
+					continue;
+				strncpy(var, argv[i + 1], strsize + 1);
+				timeshift_mb = (int)atoi(var);
+				i++;
+				continue;
+			} else if (strncmp(argv[i], "-segsize", 7) == 0) {
+				/* Segment Size */
+				char *var = NULL;
+				for (j = 0; argv[i + 1][j] != '\0'; j++) {
+					if (isdigit(argv[i + 1][j]) == 0) {
+						/* Bad Argument Given */
+						fprintf(stderr,
+							"Segment Size: ERROR: bad option! %s\n",
+							argv[i]);
+						usage();
+						exit(1);
+					}
+				}
+				strsize = strlen(argv[i + 1]);
+				var = malloc(strsize + 1);
+				if (var == NULL)
+					continue;
+				strncpy(var, argv[i + 1], strsize + 1);
+				segment_mb = (int)atoi(var);
+				i++;
+				continue;
+			} else if (strncmp(argv[i], "-segtime", 7) == 0) {
+				/* Segment Time */
+				char *var = NULL;
+				for (j = 0; argv[i + 1][j] != '\0'; j++) {
+					if (isdigit(argv[i + 1][j]) == 0) {
+						/* Bad Argument Given */
+						fprintf(stderr,
+							"Segment Time: ERROR: bad option! %s\n",
+							argv[i]);
+						usage();
+						exit(1);
+					}
+				}
+				strsize = strlen(argv[i + 1]);
+				var = malloc(strsize + 1);
+				if (var == NULL)
+					continue;
+				strncpy(var, argv[i + 1], strsize + 1);
+				segment_secs = (int)atoi(var);
+				i++;
+				continue;
 			} else if (strncmp(argv[i], "-vport", 6) == 0) {
 				/* Video Device */
 				char *var = NULL;
@@ -708,7 +802,7 @@ int main(int argc, char *argv[])
 	snprintf(bstatus, 29 + 1, "%s%d.status", BSTATUS, video_port);
 
 	/* Printout What we will do */
-	if (VERBOSE && setup_only == 0)
+	if (VERBOSE && setup_only == 0 && preroll_secs == 0)
 		fprintf(stderr, "\n(%d) Encoding for %d Seconds to %s\n",
 			video_port, seconds, output_file);
 
@@ -771,6 +865,45 @@ int main(int argc, char *argv[])
 	/* End Encoding at GOP Ending Call 0=StopNOW, 1=GOPwait */
 	ivtv_api_enc_endgop(fdin, CAP_LAST_GOP);
 
+	/* Keep encoding into memory, recordings are asked for on ECTL */
+	if (preroll_secs > 0) {
+		char ctl_file[32];
+
+		snprintf(ctl_file, sizeof(ctl_file), "%s%d", ECTL, video_port);
+		alarm(seconds);
+		preroll(fdin, preroll_secs,
+			settings[3] > settings[2] ? settings[3] : settings[2],
+			ctl_file, video_port);
+		cleanup(0);
+	}
+
+	/* Write round a fixed size file, the index goes to shared memory */
+	if (timeshift_mb > 0 && !stdout_stream && output_file != NULL) {
+		char shm_name[32];
+
+		snprintf(shm_name, sizeof(shm_name), "%s%d", TIMESHIFT_SHM,
+			 video_port);
+		alarm(seconds);
+		timeshift(fdin, output_file, (uint64_t)timeshift_mb << 20,
+			  shm_name, video_port);
+		cleanup(0);
+	}
+
+	/* Split into files at GOPs, each allocated before it is written */
+	if ((segment_mb > 0 || segment_secs > 0) && !stdout_stream
+	    && output_file != NULL) {
+		uint64_t prealloc = (uint64_t)segment_mb << 20;
+
+		if (segment_secs > 0 && (segment_mb == 0 ||
+		    (uint64_t)segment_secs * settings[3] / 8 < prealloc))
+			prealloc = (uint64_t)segment_secs * settings[3] / 8;
+		alarm(seconds);
+		segment(fdin, output_file, (uint64_t)segment_mb << 20,
+			segment_secs, prealloc + (4 << 20),
+			settings[16] ? 25 : 30, video_port);
+		cleanup(0);
+	}
+
 	/* Open Mpeg Output */
 	if (!stdout_stream) {
 		if ((fdout = open(output_file, O_CREAT | O_WRONLY)) < 0) {
@@ -1007,7 +1140,10 @@ void index_t(void)
 /* Index Thread */
 void *index_thread(void *arg)
 {
-	mindex(output_file, index_file, bstatus);
+	/* Take the picture index from the driver, only parse the
+	   MPEG file when the driver can't give us one */
+	if (findex(fdin, index_file, bstatus) < 0)
+		mindex(output_file, index_file, bstatus);
 	if (VERBOSE)
 		fprintf(stderr, "(%d) index_loop stopped on byte %lu\n",
 			video_port, total_bytes);
@@ -1036,6 +1172,11 @@ void usage(void)
 [-contrast N]\t0-127\n\
 [-saturation N]\t0-127\n\
 [-hue N]\t-128-128\n\
-[-input N]\tInput Port: 0-8\n");
+[-input N]\tInput Port: 0-8\n\
+[-preroll N]\tKeep the last N seconds in memory, record through\n\
+\t\t" ECTL "N: record file [start [seconds]] | stop [file] | quit\n\
+[-timeshift N]\tWrite round an N MB mpegfile, index in " TIMESHIFT_SHM "N\n\
+[-segsize N]\tStart a new file at the first GOP after N MB\n\
+[-segtime N]\tStart a new file at the first GOP after N seconds\n");
 
 }
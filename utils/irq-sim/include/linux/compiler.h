@@ -0,0 +1 @@
+#include "../sim-kernel.h"
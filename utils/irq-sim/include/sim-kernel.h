@@ -0,0 +1,414 @@
+/*
+   Just enough of the kernel for the encoder DMA and IRQ code
+
+   driver/ivtv-irq.c, ivtv-mailbox.c and ivtv-queue.c are built against
+   this instead of the kernel headers, every linux/ and asm/ header they
+   include is a stub of this one. Register and mailbox accesses go to the
+   firmware model through sim_readl()/sim_writel(), time is the virtual
+   clock of the simulation and bus addresses come from a table kept by
+   pci_map_single(). Everything runs in one thread: the locks only check
+   that they are taken and released in pairs.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __SIM_KERNEL_H
+#define __SIM_KERNEL_H
+
+/* libc headers that don't pull in linux/ ones, see the Makefile */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <asm-generic/ioctl.h>
+
+#define KERNEL_VERSION(a, b, c)	(((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE	KERNEL_VERSION(2, 6, 18)
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+typedef u8 __u8;
+typedef u16 __u16;
+typedef u32 __u32;
+typedef u64 __u64;
+typedef s8 __s8;
+typedef s16 __s16;
+typedef s32 __s32;
+typedef s64 __s64;
+typedef u32 __le32;
+typedef u64 dma_addr_t;
+typedef int irqreturn_t;
+
+#define IRQ_NONE	0
+#define IRQ_HANDLED	1
+
+#define __init
+#define __exit
+#define __iomem
+#define __devinit
+#define __devexit
+#define __force
+#define __user
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define KERN_EMERG	"<0>"
+#define KERN_ALERT	"<1>"
+#define KERN_CRIT	"<2>"
+#define KERN_ERR	"<3>"
+#define KERN_WARNING	"<4>"
+#define KERN_NOTICE	"<5>"
+#define KERN_INFO	"<6>"
+#define KERN_DEBUG	"<7>"
+
+int printk(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+void sim_bug(const char *what, const char *file, int line);
+
+#define BUG()		sim_bug("BUG", __FILE__, __LINE__)
+#define BUG_ON(x)	do { if (x) BUG(); } while (0)
+#define dump_stack()	do { } while (0)
+#define in_interrupt()	0
+#define might_sleep()	do { } while (0)
+
+#define EXPORT_SYMBOL(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_LICENSE(x)
+#define MODULE_PARM_DESC(x, y)
+#define module_param(x, y, z)
+#define module_param_array(a, b, c, d)
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define min(x, y)		((x) < (y) ? (x) : (y))
+#define max(x, y)		((x) > (y) ? (x) : (y))
+#define min_t(type, x, y)	((type)(x) < (type)(y) ? (type)(x) : (type)(y))
+#define max_t(type, x, y)	((type)(x) > (type)(y) ? (type)(x) : (type)(y))
+
+#define ENOMEM		12
+#define EBUSY		16
+#define ENODEV		19
+#define EINVAL		22
+#define EIO		5
+#define EINTR		4
+#define EAGAIN		11
+#define ERESTARTSYS	512
+
+/* Memory */
+
+#define PAGE_SHIFT	12
+#define PAGE_SIZE	(1UL << PAGE_SHIFT)
+#define PAGE_MASK	(~(PAGE_SIZE - 1))
+#define PAGE_ALIGN(x)	(((x) + PAGE_SIZE - 1) & PAGE_MASK)
+
+#define GFP_KERNEL	0
+#define GFP_ATOMIC	1
+
+#define kmalloc(size, flags)	malloc(size)
+#define kzalloc(size, flags)	calloc(1, size)
+#define kfree(p)		free(p)
+#define vmalloc(size)		malloc(size)
+#define vmalloc_32(size)	malloc(size)
+#define vfree(p)		free(p)
+
+struct page {
+	void *virtual;
+};
+#define page_address(p)		((p)->virtual)
+
+#define memcpy_fromio(d, s, n)	memcpy(d, s, n)
+#define memcpy_toio(d, s, n)	memcpy(d, s, n)
+#define memset_io(d, c, n)	memset(d, c, n)
+
+/* The card: register, encoder memory and mailbox accesses */
+u32 sim_readl(const volatile void *addr);
+void sim_writel(u32 val, volatile void *addr);
+
+#define readl(addr)		sim_readl((const volatile void *)(addr))
+#define writel(val, addr)	sim_writel((val), (volatile void *)(addr))
+
+/* Lists */
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name)	{ &(name), &(name) }
+#define LIST_HEAD(name)		struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+/* Poisoned like the kernel's, a second list_del() faults */
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	entry->next = (struct list_head *)0x100100;
+	entry->prev = (struct list_head *)0x200200;
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_for_each(pos, head) \
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+#define list_for_each_safe(pos, n, head) \
+	for (pos = (head)->next, n = pos->next; pos != (head); \
+	     pos = n, n = pos->next)
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_entry((head)->next, typeof(*pos), member); \
+	     &pos->member != (head); \
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+/* Locks, atomics and bits, all in one thread */
+
+typedef struct {
+	int locked;
+} spinlock_t;
+
+#define SPIN_LOCK_UNLOCKED	(spinlock_t) { 0 }
+#define DEFINE_SPINLOCK(x)	spinlock_t x = SPIN_LOCK_UNLOCKED
+
+void sim_lock(spinlock_t *lock, const char *file, int line);
+void sim_unlock(spinlock_t *lock, const char *file, int line);
+
+#define spin_lock_init(l)		((l)->locked = 0)
+#define spin_lock(l)			sim_lock(l, __FILE__, __LINE__)
+#define spin_unlock(l)			sim_unlock(l, __FILE__, __LINE__)
+#define spin_lock_irq(l)		spin_lock(l)
+#define spin_unlock_irq(l)		spin_unlock(l)
+#define spin_lock_irqsave(l, f)		do { (f) = 0; spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, f)	do { (void)(f); spin_unlock(l); } while (0)
+#define spin_lock_bh(l)			spin_lock(l)
+#define spin_unlock_bh(l)		spin_unlock(l)
+
+typedef struct {
+	volatile int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+#define atomic_read(v)		((v)->counter)
+#define atomic_set(v, i)	((v)->counter = (i))
+#define atomic_inc(v)		((v)->counter++)
+#define atomic_dec(v)		((v)->counter--)
+#define atomic_add(i, v)	((v)->counter += (i))
+#define atomic_sub(i, v)	((v)->counter -= (i))
+#define atomic_dec_and_test(v)	(--(v)->counter == 0)
+#define atomic_inc_and_test(v)	(++(v)->counter == 0)
+
+#define BITS_PER_LONG	(8 * sizeof(long))
+#define BIT_WORD(nr)	((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)	(1UL << ((nr) % BITS_PER_LONG))
+
+static inline void set_bit(int nr, volatile unsigned long *addr)
+{
+	addr[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+static inline void clear_bit(int nr, volatile unsigned long *addr)
+{
+	addr[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
+static inline int test_bit(int nr, const volatile unsigned long *addr)
+{
+	return (addr[BIT_WORD(nr)] & BIT_MASK(nr)) != 0;
+}
+
+static inline int test_and_set_bit(int nr, volatile unsigned long *addr)
+{
+	int old = test_bit(nr, addr);
+
+	set_bit(nr, addr);
+	return old;
+}
+
+static inline int test_and_clear_bit(int nr, volatile unsigned long *addr)
+{
+	int old = test_bit(nr, addr);
+
+	clear_bit(nr, addr);
+	return old;
+}
+
+struct semaphore {
+	atomic_t count;
+};
+
+#define sema_init(s, n)		atomic_set(&(s)->count, (n))
+#define init_MUTEX(s)		sema_init(s, 1)
+#define init_MUTEX_LOCKED(s)	sema_init(s, 0)
+
+void sim_down(struct semaphore *sem, const char *file, int line);
+
+#define down(s)			sim_down(s, __FILE__, __LINE__)
+#define down_interruptible(s)	(down(s), 0)
+#define down_trylock(s)		(atomic_read(&(s)->count) > 0 ? (down(s), 0) : 1)
+#define up(s)			atomic_inc(&(s)->count)
+
+/* Waiting: nobody ever sleeps, wake ups are counted */
+
+typedef struct {
+	unsigned long wakeups;
+} wait_queue_head_t;
+
+#define init_waitqueue_head(q)		((q)->wakeups = 0)
+#define wake_up(q)			((q)->wakeups++)
+#define wake_up_interruptible(q)	((q)->wakeups++)
+#define wake_up_all(q)			((q)->wakeups++)
+#define waitqueue_active(q)		0
+
+struct task_struct {
+	int state;
+};
+extern struct task_struct *current;
+
+#define TASK_RUNNING		0
+#define TASK_INTERRUPTIBLE	1
+#define TASK_UNINTERRUPTIBLE	2
+
+#define set_current_state(s)	(current->state = (s))
+#define signal_pending(t)	0
+
+/* Time: jiffies, timers and clocks follow the virtual clock */
+
+#define HZ		1000
+extern volatile unsigned long jiffies;
+
+long schedule_timeout(long timeout);
+void do_gettimeofday(struct timeval *tv);
+void ktime_get_ts(struct timespec *ts);
+
+#define time_after(a, b)	((long)(b) - (long)(a) < 0)
+#define time_before(a, b)	time_after(b, a)
+#define msecs_to_jiffies(m)	((unsigned long)(m) * HZ / 1000)
+#define udelay(n)		do { } while (0)
+#define mdelay(n)		do { } while (0)
+#define msleep(n)		do { } while (0)
+
+struct timer_list {
+	unsigned long expires;
+	void (*function)(unsigned long);
+	unsigned long data;
+	int pending;
+};
+
+#define init_timer(t)		((t)->pending = 0)
+#define add_timer(t)		((t)->pending = 1)
+#define mod_timer(t, e)		((t)->expires = (e), (t)->pending = 1)
+#define del_timer(t)		((t)->pending = 0)
+#define del_timer_sync(t)	((t)->pending = 0)
+
+/* PCI and DMA mapping */
+
+struct pci_dev {
+	int irq;
+};
+
+#define PCI_DMA_BIDIRECTIONAL	0
+#define PCI_DMA_TODEVICE	1
+#define PCI_DMA_FROMDEVICE	2
+#define PCI_DMA_NONE		3
+
+/* Bus addresses are handed out from a table, the firmware model looks
+   them up to find host memory, see simkernel.c */
+dma_addr_t pci_map_single(struct pci_dev *dev, void *ptr, size_t size,
+			  int direction);
+void pci_unmap_single(struct pci_dev *dev, dma_addr_t addr, size_t size,
+		      int direction);
+
+struct scatterlist {
+	struct page *page;
+	unsigned int offset;
+	dma_addr_t dma_address;
+	unsigned int length;
+};
+
+#define sg_dma_address(sg)	((sg)->dma_address)
+#define sg_dma_len(sg)		((sg)->length)
+
+/* Types the headers name without the simulated code using them */
+
+struct pt_regs;
+struct file;
+struct inode;
+struct module;
+struct vm_area_struct;
+struct file_operations;
+struct class_device_attribute;
+typedef struct poll_table_struct poll_table;
+
+struct device {
+	void *driver_data;
+};
+
+struct class_device {
+	struct device *dev;
+};
+
+struct i2c_adapter {
+	char name[32];
+	void *algo_data;
+};
+
+struct i2c_algo_bit_data {
+	void *data;
+};
+
+struct i2c_client {
+	char name[32];
+	unsigned short addr;
+	struct i2c_adapter *adapter;
+};
+
+#define class_device_create_file(cd, attr)	do { } while (0)
+#define class_device_remove_file(cd, attr)	do { } while (0)
+
+#endif
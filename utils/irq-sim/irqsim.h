@@ -0,0 +1,36 @@
+/*
+   Between the kernel side of the simulation and the firmware model
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __IRQSIM_H
+#define __IRQSIM_H
+
+extern u64 sim_now;		/* virtual time in ns */
+extern int sim_quiet;		/* don't print driver messages */
+extern unsigned long sim_printks;	/* driver messages, printed or not */
+extern unsigned long sim_bugs;	/* BUG()s and misused locks */
+extern unsigned long sim_bus_mapped;	/* mappings not yet undone */
+
+void sim_set_time(u64 ns);
+
+/* Called after every writel(), for the firmware to see it */
+extern void (*sim_write_hook)(volatile void *addr, u32 val);
+
+/* Host memory of len bytes at bus address addr, NULL if not all mapped */
+void *sim_bus_to_virt(u32 addr, u32 len);
+
+#endif
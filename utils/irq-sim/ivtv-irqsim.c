@@ -0,0 +1,1293 @@
+/*
+   ivtv-irqsim: the encoder DMA and interrupt code on a model of the card
+
+   driver/ivtv-irq.c and the mailbox code run unchanged against a model
+   of the cx23416 firmware, see include/sim-kernel.h for the kernel they
+   are built on. The model encodes chunks of each stream at a set rate
+   into a FIFO in encoder memory, asks for them with ENC_START_CAP and
+   mailbox 9 (VBI_CAP and the VBI frame pointer for VBI), carries out the
+   SG transfer the driver schedules through mailbox 5 or 6, taking a
+   setup time plus the size over the bus bandwidth, and reports it in
+   mailbox 8 with ENC_DMA_COMPLETE. A chunk the FIFO has no room for is
+   lost, as on the card. The firmware asks for a stream when it has
+   encoded a chunk of it and for the next one with data when a transfer
+   ends, and asks again after a while if nothing was transferred.
+   An application takes each finished buffer after a wake up latency
+   and queues it again after holding it, through the same code paths
+   as VIDIOC_DQBUF and VIDIOC_QBUF.
+
+   Every chunk carries its stream, sequence number and encode time, so
+   what reaches the application is checked for lost, repeated and
+   damaged chunks, and the latency from encode to done is measured.
+   Time is virtual: minutes run in a second, and a script and seed give
+   the same run every time. The wall clock time of each call of the
+   interrupt handler is measured as well.
+
+   An IRQ storm is extra interrupts at a rate: "spurious" ones with
+   nothing pending (a shared line), "cap" repeating the last
+   ENC_START_CAP, "done" repeating the last ENC_DMA_COMPLETE.
+
+   Usage: ivtv-irqsim [-v] [-s seed] [-t secs] [-e directives] [script]
+	  ivtv-irqsim -b	runs the scenarios of bench_scripts[]
+
+   A script has one directive per line (or separated by ';'), # starts
+   a comment. Times are in us unless said otherwise.
+
+	duration <secs>
+	seed <n>
+	irq-latency <us>		raise to handler
+	dma setup <us> bw <MB/s>
+	retry <us>			ask again when nothing moved, 0 never
+	stream <mpg|yuv|pcm|vbi> [on|off] rate <per sec> size <bytes>
+		uvsize <bytes> bufs <n> bufsize <bytes> fifo <chunks>
+		jitter <fraction of the period> pack <chunks>
+	consumer wake <us> hold <us> jitter <us>
+	storm <spurious|cap|done> <per sec>
+	at <secs> <directive>		later in the run
+	expect kicks			fail unless QBUF/DQBUF start transfers
+
+   The sizes, buffers and FIFOs of a stream are fixed once it runs.
+   pack is IVTV_IOC_S_PACK for pcm and vbi: each buffer then collects
+   up to that many chunks behind a struct ivtv_pack_header, and each
+   chunk of it is checked.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "ivtv-driver.h"
+#include "ivtv-irq.h"
+#include "ivtv-queue.h"
+#include "irqsim.h"
+
+#define NSTREAMS	4
+#define MAX_BUFS	32
+#define MAX_FIFO	32
+#define MAX_SG		4096
+#define MAX_AT		256
+#define MAX_TOK		32
+
+#define NS		1000ULL		/* per us */
+
+/* At the start of every chunk, the last word of a chunk is seq ^
+   CHUNK_TAIL */
+struct chunk_hdr {
+	u32 magic;
+	u32 fwtype;
+	u32 seq;
+	u32 size;
+	u64 t;		/* encoded, virtual ns */
+};
+
+#define CHUNK_MAGIC	0x4d495356
+#define CHUNK_TAIL	0x5a5a5a5a
+
+/* The VBI frame pointer is the word before vbi_enc_start */
+#define VBI_ENC_START	0x800
+#define FIFO_START	0x1000
+
+/* Samples for percentiles */
+struct samples {
+	u32 *v;
+	size_t n, size;
+	int sorted;
+};
+
+struct sim_stream {
+	const char *name;
+	int type;		/* IVTV_ENC_STREAM_TYPE_* */
+	int fwtype;		/* in the mailboxes */
+	u32 buftype;
+
+	/* settings */
+	int on;
+	double rate;
+	double jitter;
+	u32 size, uvsize;
+	int nbufs;
+	u32 bufsize;
+	int fifo;
+	int pack;		/* chunks per buffer, 0 unpacked */
+
+	/* firmware FIFO of encoded chunks */
+	u32 base, slot;
+	int head, count;
+	int sent;		/* the head is being transferred */
+	u32 seq;
+	u64 pts[MAX_FIFO];
+	int producing;
+
+	/* application */
+	struct ivtv_buffer buf[MAX_BUFS];
+	u8 *mem[MAX_BUFS];
+	int with_app[MAX_BUFS];
+	u32 expect;
+
+	/* results */
+	unsigned long produced, fw_drops, delivered, lost, repeated, damaged;
+	unsigned long dqbufs;
+	u64 bytes;
+	struct samples lat;	/* encode to done, us */
+};
+
+static struct sim_stream streams[NSTREAMS] = {
+	{ "mpg", IVTV_ENC_STREAM_TYPE_MPG, 0, V4L2_BUF_TYPE_VIDEO_CAPTURE,
+	  0, 8, 0.1, 131072, 0, 8, 0, 8 },
+	{ "yuv", IVTV_ENC_STREAM_TYPE_YUV, 1, V4L2_BUF_TYPE_VIDEO_CAPTURE,
+	  0, 30, 0, 720 * 480, 720 * 240, 4, 0, 4 },
+	{ "pcm", IVTV_ENC_STREAM_TYPE_PCM, 2, V4L2_BUF_TYPE_VIDEO_CAPTURE,
+	  0, 48000 * 4 / 4608.0, 0, 4608, 0, 8, 0, 8 },
+	{ "vbi", IVTV_ENC_STREAM_TYPE_VBI, 3, V4L2_BUF_TYPE_VBI_CAPTURE,
+	  0, 30, 0, 24 * 1443, 0, 8, 0, 8 },
+};
+
+static struct {
+	double duration;
+	u64 seed;
+	u64 irq_latency;
+	u64 dma_setup;
+	double dma_bw;		/* bytes per ns */
+	u64 retry;
+	u64 wake, hold, hold_jitter;
+	double storm[3];	/* spurious, cap, done */
+	int expect_kicks;
+} cfg = { 10, 1, 5 * NS, 10 * NS, 0.1, 2000 * NS, 20 * NS, 2000 * NS,
+	  1000 * NS, { 0, 0, 0 } };
+
+static const char *storm_names[3] = { "spurious", "cap", "done" };
+
+enum { EV_PRODUCE, EV_IRQ, EV_DMA_DONE, EV_RETRY, EV_DQBUF, EV_QBUF,
+       EV_STORM, EV_SCRIPT, EV_END };
+
+struct event {
+	u64 t;
+	u64 order;
+	int type;
+	int arg;
+};
+
+static struct event *heap;
+static int nheap, heap_size;
+static u64 ev_order;
+
+static struct ivtv *itv;
+static struct pci_dev pdev;
+static u8 *reg_mem;
+
+/* The card */
+static struct {
+	u32 irqstatus;
+	u32 dmastatus;
+	int irq_pending;
+	int busy;		/* transfer in progress */
+	int stream;		/* of it, -1 not a chunk in a FIFO */
+	u32 type;
+	u32 bytes;
+	int nsg;
+	struct ivtv_SG_element sg[MAX_SG];
+	int rr;			/* stream to ask for next */
+	int retry_pending;
+	u64 last_ask, last_start;
+	int storm_on[3];
+
+	unsigned long asks, xfers, errors, rejected, stale, api;
+} fw;
+
+/* The driver, as seen from outside */
+static struct {
+	unsigned long calls, not_ours, storm_calls;
+	unsigned long kicks, kick_xfers;
+	struct samples handler;	/* ns of wall clock */
+	u64 handler_ns;
+} drv;
+
+static char **at_tok[MAX_AT];
+static int at_ntok[MAX_AT];
+static int nat;
+static int verbose;
+
+static u64 rnd_state;
+
+static u64 rnd64(void)
+{
+	/* xorshift64*, the same runs everywhere */
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return rnd_state * 2685821657736338717ULL;
+}
+
+/* In [0, 1) */
+static double rnd(void)
+{
+	return (rnd64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static u64 wall_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void fail(const char *fmt, const char *arg)
+{
+	fprintf(stderr, fmt, arg);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static void samples_add(struct samples *s, u32 v)
+{
+	if (s->n == s->size) {
+		s->size = s->size ? 2 * s->size : 1024;
+		s->v = realloc(s->v, s->size * sizeof(*s->v));
+		if (s->v == NULL)
+			fail("Out of memory%s", "");
+	}
+	s->v[s->n++] = v;
+	s->sorted = 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static u32 percentile(struct samples *s, double pct)
+{
+	size_t i;
+
+	if (s->n == 0)
+		return 0;
+	if (!s->sorted) {
+		qsort(s->v, s->n, sizeof(*s->v), cmp_u32);
+		s->sorted = 1;
+	}
+	i = (size_t)(pct / 100 * s->n);
+	return s->v[i < s->n ? i : s->n - 1];
+}
+
+/* Events, a binary heap on time then order of adding */
+
+static int ev_before(struct event *a, struct event *b)
+{
+	return a->t < b->t || (a->t == b->t && a->order < b->order);
+}
+
+static void ev_add(u64 t, int type, int arg)
+{
+	struct event e = { t, ev_order++, type, arg };
+	int i;
+
+	if (nheap == heap_size) {
+		heap_size = heap_size ? 2 * heap_size : 256;
+		heap = realloc(heap, heap_size * sizeof(*heap));
+		if (heap == NULL)
+			fail("Out of memory%s", "");
+	}
+	for (i = nheap++; i && ev_before(&e, &heap[(i - 1) / 2]); i = (i - 1) / 2)
+		heap[i] = heap[(i - 1) / 2];
+	heap[i] = e;
+}
+
+static struct event ev_pop(void)
+{
+	struct event top = heap[0], last = heap[--nheap];
+	int i = 0, c;
+
+	while ((c = 2 * i + 1) < nheap) {
+		if (c + 1 < nheap && ev_before(&heap[c + 1], &heap[c]))
+			c++;
+		if (!ev_before(&heap[c], &last))
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = last;
+	return top;
+}
+
+static u64 exp_interval(double rate)
+{
+	return (u64)(-log(1 - rnd()) / rate * 1e9) + 1;
+}
+
+/* Interrupts */
+
+static void collect_done(void);
+
+static void call_handler(void)
+{
+	u64 t0, t1;
+	int ret;
+
+	drv.calls++;
+	t0 = wall_ns();
+	ret = ivtv_irq_handler(0, itv, NULL);
+	t1 = wall_ns();
+	if (ret == IRQ_NONE)
+		drv.not_ours++;
+	samples_add(&drv.handler, t1 - t0);
+	drv.handler_ns += t1 - t0;
+	collect_done();
+}
+
+static void set_irqstatus(u32 v)
+{
+	fw.irqstatus = v;
+	*(u32 *)(reg_mem + IVTV_REG_IRQSTATUS) = v;
+}
+
+static void set_dmastatus(u32 v)
+{
+	fw.dmastatus = v;
+	*(u32 *)(reg_mem + IVTV_REG_DMASTATUS) = v;
+}
+
+/* Level triggered: the handler runs while an unmasked bit is set */
+static void irq_kick(void)
+{
+	if (fw.irq_pending || !(fw.irqstatus & ~itv->irqmask))
+		return;
+	fw.irq_pending = 1;
+	ev_add(sim_now + cfg.irq_latency, EV_IRQ, 0);
+}
+
+static void raise_irq(u32 bits)
+{
+	set_irqstatus(fw.irqstatus | bits);
+	irq_kick();
+}
+
+/* The firmware */
+
+static u32 *enc_word(u32 off)
+{
+	return (u32 *)(itv->enc_mem + off);
+}
+
+static u32 chunk_offset(struct sim_stream *s, int n)
+{
+	return s->base + ((s->head + n) % s->fifo) * s->slot;
+}
+
+/* Where the data of the chunk starts, after the PCM or VBI header */
+static u32 chunk_data(struct sim_stream *s, u32 off)
+{
+	if (s->fwtype == 2 || s->fwtype == 3)
+		return off + 12;
+	return off;
+}
+
+static void write_chunk(struct sim_stream *s, u32 off, u64 pts)
+{
+	struct chunk_hdr *h = (struct chunk_hdr *)(itv->enc_mem + chunk_data(s, off));
+	u32 tail;
+
+	h->magic = CHUNK_MAGIC;
+	h->fwtype = s->fwtype;
+	h->seq = s->seq;
+	h->size = s->size;
+	h->t = sim_now;
+	if (s->fwtype == 1)
+		tail = off + PAGE_ALIGN(s->size) + s->uvsize - 4;
+	else
+		tail = chunk_data(s, off) + s->size - 4;
+	*enc_word(tail) = s->seq ^ CHUNK_TAIL;
+	if (s->fwtype == 3) {
+		/* start code, then the PTS the driver reads back */
+		*enc_word(off) = 0x000001bf;
+		*enc_word(off + 4) = pts >> 32;
+		*enc_word(off + 8) = (u32)pts;
+	}
+}
+
+static void ask(struct sim_stream *s)
+{
+	struct ivtv_mailbox *mb = &itv->enc_mbox[IVTV_MBOX_DMA];
+	u32 off;
+
+	/* one request at a time, the next one follows the transfer */
+	if (s->count <= s->sent || fw.busy)
+		return;
+	off = chunk_offset(s, s->sent);
+	fw.asks++;
+	fw.last_ask = sim_now;
+	if (s->fwtype == 3) {
+		*enc_word(itv->vbi_enc_start - 4) = off;
+		raise_irq(IVTV_IRQ_ENC_VBI_CAP);
+	} else {
+		u64 pts = s->pts[(s->head + s->sent) % s->fifo];
+
+		memset(mb->data, 0, sizeof(mb->data));
+		mb->data[0] = s->fwtype;
+		mb->data[1] = off;
+		mb->data[2] = s->fwtype == 2 ? s->size + 12 : s->size;
+		if (s->fwtype == 1) {
+			mb->data[3] = off + PAGE_ALIGN(s->size);
+			mb->data[4] = s->uvsize;
+		}
+		mb->data[5] = pts >> 32;
+		mb->data[6] = (u32)pts;
+		raise_irq(IVTV_IRQ_ENC_START_CAP);
+	}
+	if (cfg.retry && !fw.retry_pending) {
+		fw.retry_pending = 1;
+		ev_add(sim_now + cfg.retry, EV_RETRY, 0);
+	}
+}
+
+/* Ask for VBI and one other stream, there is a single mailbox 9 */
+static void ask_next(void)
+{
+	int i;
+
+	if (streams[3].on)
+		ask(&streams[3]);
+	for (i = 0; i < 3; i++) {
+		struct sim_stream *s = &streams[(fw.rr + i) % 3];
+
+		if (s->count > s->sent) {
+			ask(s);
+			fw.rr = (fw.rr + i + 1) % 3;
+			break;
+		}
+	}
+}
+
+static int pending(void)
+{
+	int i;
+
+	for (i = 0; i < NSTREAMS; i++)
+		if (streams[i].count > streams[i].sent)
+			return 1;
+	return 0;
+}
+
+static void produce(struct sim_stream *s)
+{
+	u64 period, pts = sim_now * 9 / 100000;	/* 90 kHz */
+
+	if (!s->on) {
+		s->producing = 0;
+		return;
+	}
+	s->produced++;
+	if (s->count == s->fifo) {
+		s->fw_drops++;
+	} else {
+		s->pts[(s->head + s->count) % s->fifo] = pts;
+		write_chunk(s, chunk_offset(s, s->count), pts);
+		s->count++;
+		ask(s);
+	}
+	s->seq++;
+
+	period = 1e9 / s->rate;
+	if (s->jitter)
+		period += (rnd() - 0.5) * 2 * s->jitter * period;
+	ev_add(sim_now + period, EV_PRODUCE, s - streams);
+}
+
+static struct sim_stream *stream_of(u32 src, int *slot)
+{
+	int i;
+
+	for (i = 0; i < NSTREAMS; i++) {
+		struct sim_stream *s = &streams[i];
+
+		if (s->slot && src >= s->base && src < s->base + s->fifo * s->slot) {
+			*slot = (src - s->base) / s->slot;
+			return s;
+		}
+	}
+	return NULL;
+}
+
+/* Mailbox 5 or 6: IVTV_API_SCHED_DMA_TO_HOST, returns retval */
+static u32 sched_dma(u32 sgaddr, u32 size, u32 type)
+{
+	struct sim_stream *s;
+	u64 bytes = 0;
+	int i, slot;
+
+	if (fw.busy) {
+		fw.rejected++;
+		return 1;
+	}
+	for (i = 0; i < MAX_SG; i++) {
+		struct ivtv_SG_element *e;
+
+		e = sim_bus_to_virt(sgaddr + i * sizeof(*e), sizeof(*e));
+		if (e == NULL)
+			break;
+		fw.sg[i] = *e;
+		bytes += e->size & 0x7fffffff;
+		if (e->size & 0x80000000)
+			break;
+	}
+	fw.nsg = i < MAX_SG && sim_bus_to_virt(sgaddr + i * 12, 12) ? i + 1 : -1;
+	fw.busy = 1;
+	fw.type = type;
+	fw.bytes = bytes;
+	fw.stream = -1;
+	fw.last_start = sim_now;
+	fw.xfers++;
+	set_dmastatus(0);
+
+	if (fw.nsg > 0 && (s = stream_of(fw.sg[0].src, &slot))) {
+		if (slot == s->head && s->count && !s->sent) {
+			s->sent = 1;
+			fw.stream = s - streams;
+		} else
+			fw.stale++;
+	} else
+		fw.stale++;
+
+	ev_add(sim_now + cfg.dma_setup + (u64)(bytes / cfg.dma_bw),
+	       EV_DMA_DONE, 0);
+	return 0;
+}
+
+static void dma_done(void)
+{
+	struct ivtv_mailbox *mb = &itv->enc_mbox[8];
+	u32 status = 0x02;
+	u64 pts = 0;
+	int i;
+
+	if (fw.nsg < 0)
+		status = 0x18;
+	for (i = 0; i < fw.nsg && status == 0x02; i++) {
+		struct ivtv_SG_element *e = &fw.sg[i];
+		u32 len = e->size & 0x7fffffff;
+		void *dst = sim_bus_to_virt(e->dst, len);
+
+		if (dst == NULL || (u64)e->src + len > IVTV_ENCODER_SIZE)
+			status = 0x18;
+		else
+			memcpy(dst, itv->enc_mem + e->src, len);
+	}
+	fw.busy = 0;
+	if (fw.stream >= 0) {
+		struct sim_stream *s = &streams[fw.stream];
+
+		pts = s->pts[s->head];
+		s->sent = 0;
+		s->head = (s->head + 1) % s->fifo;
+		s->count--;
+	}
+
+	memset(mb->data, 0, sizeof(mb->data));
+	mb->data[0] = status;
+	mb->data[1] = fw.type;
+	mb->data[2] = pts >> 32;
+	mb->data[3] = (u32)pts;
+	set_dmastatus(status);
+	if (status == 0x02) {
+		raise_irq(IVTV_IRQ_ENC_DMA_COMPLETE);
+	} else {
+		fw.errors++;
+		raise_irq(IVTV_IRQ_DMA_ERR);
+	}
+	ask_next();
+}
+
+static void write_hook(volatile void *addr, u32 val)
+{
+	u8 *p = (u8 *)addr;
+	u8 *mbox = (u8 *)itv->enc_mbox;
+
+	if (p >= mbox && p < mbox + 10 * sizeof(struct ivtv_mailbox)) {
+		struct ivtv_mailbox *mb;
+		int n = (p - mbox) / sizeof(*mb);
+
+		mb = &itv->enc_mbox[n];
+		if (p != (u8 *)&mb->flags || !(val & IVTV_MBOX_DRIVER_DONE))
+			return;
+		if (mb->cmd == IVTV_API_SCHED_DMA_TO_HOST)
+			mb->retval = sched_dma(mb->data[0], mb->data[1], mb->data[2]);
+		else {
+			fw.api++;
+			mb->retval = 0;
+		}
+		mb->flags |= IVTV_MBOX_FIRMWARE_DONE;
+	} else if (p == reg_mem + IVTV_REG_IRQSTATUS) {
+		/* write 1 to clear */
+		set_irqstatus(fw.irqstatus & ~val);
+	} else if (p == reg_mem + IVTV_REG_DMASTATUS) {
+		set_dmastatus(fw.dmastatus);
+	}
+}
+
+/* The application */
+
+static void check_chunk(struct sim_stream *s, struct ivtv_buffer *buf,
+			u8 *mem, u32 len)
+{
+	struct chunk_hdr *h = (struct chunk_hdr *)mem;
+	u32 tail;
+	u64 done;
+
+	if (s->fwtype == 1)
+		tail = PAGE_ALIGN(s->size) + s->uvsize - 4;
+	else
+		tail = s->size - 4;
+
+	if (h->magic != CHUNK_MAGIC || h->fwtype != s->fwtype ||
+	    h->size != s->size || tail + 4 > len ||
+	    *(u32 *)(mem + tail) != (h->seq ^ CHUNK_TAIL)) {
+		s->damaged++;
+	} else if (h->seq < s->expect) {
+		s->repeated++;
+	} else {
+		s->lost += h->seq - s->expect;
+		s->expect = h->seq + 1;
+		s->delivered++;
+		s->bytes += s->size + s->uvsize;
+		done = buf->ts_mono.tv_sec * 1000000000ULL + buf->ts_mono.tv_nsec;
+		samples_add(&s->lat, (done - h->t) / NS);
+	}
+	/* a buffer coming back without new data shows */
+	h->magic = 0;
+}
+
+/* A packed buffer as an application reads it, through the header */
+static void check_buffer(struct sim_stream *s, struct ivtv_buffer *buf, u8 *mem)
+{
+	struct ivtv_pack_header *ph = (struct ivtv_pack_header *)mem;
+	u32 i;
+
+	if (!s->pack) {
+		check_chunk(s, buf, mem, s->bufsize);
+		return;
+	}
+	if (ph->magic != IVTV_PACK_MAGIC || ph->count == 0 ||
+	    ph->count > s->pack || buf->buffer.bytesused > s->bufsize) {
+		s->damaged++;
+		return;
+	}
+	for (i = 0; i < ph->count; i++) {
+		struct ivtv_pack_entry *e = &ph->entry[i];
+
+		if (e->offset < sizeof(*ph) || e->size != s->size ||
+		    e->offset + e->size > buf->buffer.bytesused)
+			s->damaged++;
+		else
+			check_chunk(s, buf, mem + e->offset, e->size);
+	}
+	ph->magic = 0;
+}
+
+/* What the QBUF and DQBUF ioctls do before and after the queue */
+static void kick(struct sim_stream *s)
+{
+	struct ivtv_stream *st = &itv->streams[s->type];
+	unsigned long xfers = fw.xfers;
+
+	if (test_bit(IVTV_F_T_ENC_DMA_QUEUED, &itv->t_flags) &&
+	    !list_empty(&st->queued) && list_empty(&st->active)) {
+		drv.kicks++;
+		ivtv_sched_DMA(itv, st->type);
+		if (fw.xfers != xfers)
+			drv.kick_xfers++;
+	}
+}
+
+static void collect_done(void)
+{
+	int i, j;
+
+	for (i = 0; i < NSTREAMS; i++) {
+		struct sim_stream *s = &streams[i];
+
+		for (j = 0; j < s->nbufs; j++) {
+			if (s->buf[j].vb.state != STATE_DONE || s->with_app[j])
+				continue;
+			s->with_app[j] = 1;
+			ev_add(sim_now + cfg.wake, EV_DQBUF, i * MAX_BUFS + j);
+		}
+	}
+}
+
+static void dqbuf(struct sim_stream *s, int i)
+{
+	kick(s);
+	s->dqbufs++;
+	check_buffer(s, &s->buf[i], s->mem[i]);
+	ev_add(sim_now + cfg.hold + (u64)(rnd() * cfg.hold_jitter), EV_QBUF,
+	       (s - streams) * MAX_BUFS + i);
+}
+
+static void qbuf(struct sim_stream *s, int i)
+{
+	struct ivtv_stream *st = &itv->streams[s->type];
+	struct ivtv_buffer *buf = &s->buf[i];
+
+	buf->vb.state = STATE_QUEUED;
+	buf->pack_count = 0;
+	list_add_tail(&buf->vb.queue, &st->queued);
+	s->with_app[i] = 0;
+	kick(s);
+}
+
+/* Setting up */
+
+static void setup_stream(struct sim_stream *s)
+{
+	struct ivtv_stream *st = &itv->streams[s->type];
+	int i, j, npages;
+
+	st->type = s->type;
+	st->id = -1;
+	st->dma = PCI_DMA_FROMDEVICE;
+	st->buftype = s->buftype;
+	st->SG_handle = IVTV_DMA_UNMAPPED;
+	INIT_LIST_HEAD(&st->active);
+	INIT_LIST_HEAD(&st->queued);
+	spin_lock_init(&st->slock);
+	init_waitqueue_head(&st->waitq);
+	init_timer(&st->timeout);
+	init_MUTEX(&st->mlock);
+	if (!s->on)
+		return;
+
+	if (s->nbufs < 1 || s->nbufs > MAX_BUFS)
+		fail("%s: 1 to 32 buffers", s->name);
+	if (s->fifo < 1 || s->fifo > MAX_FIFO)
+		fail("%s: a FIFO of 1 to 32 chunks", s->name);
+	if (s->size < sizeof(struct chunk_hdr) + 4 || (s->uvsize && s->uvsize < 4))
+		fail("%s: chunks too small", s->name);
+	if (s->rate <= 0)
+		fail("%s: rate must be above 0", s->name);
+	if (s->pack && s->fwtype != 2 && s->fwtype != 3)
+		fail("%s: only pcm and vbi can be packed", s->name);
+	if (s->pack > IVTV_PACK_MAX_CHUNKS)
+		fail("%s: at most 32 chunks per buffer", s->name);
+	/* as ivtv_stream_set_pack() */
+	if (s->bufsize == 0 && s->pack)
+		s->bufsize = IVTV_PACK_DATA_OFFSET +
+			s->pack * IVTV_PACK_CHUNK(s->size);
+	else if (s->bufsize == 0)
+		s->bufsize = PAGE_ALIGN(PAGE_ALIGN(s->size) + s->uvsize);
+	s->bufsize = PAGE_ALIGN(s->bufsize);
+
+	st->id = 1;
+	st->state = 1;
+	st->streaming = 1;
+	st->bufsize = s->bufsize;
+	st->chunksize = PAGE_ALIGN(s->size);
+	st->pack_chunks = s->pack;
+	/* as ivtv_stream_init(), with one more to find overruns */
+	npages = s->bufsize / PAGE_SIZE;
+	st->SGarray = kzalloc((npages + 1) * sizeof(struct ivtv_SG_element),
+			      GFP_KERNEL);
+
+	for (i = 0; i < s->nbufs; i++) {
+		struct ivtv_buffer *buf = &s->buf[i];
+		struct scatterlist *sg;
+		dma_addr_t bus;
+
+		s->mem[i] = aligned_alloc(PAGE_SIZE, s->bufsize);
+		sg = calloc(npages, sizeof(*sg));
+		if (s->mem[i] == NULL || sg == NULL || st->SGarray == NULL)
+			fail("Out of memory%s", "");
+		memset(s->mem[i], 0, s->bufsize);
+		bus = pci_map_single(&pdev, s->mem[i], s->bufsize,
+				     PCI_DMA_FROMDEVICE);
+		/* a page each, as for user memory */
+		for (j = 0; j < npages; j++) {
+			sg[j].dma_address = bus + j * PAGE_SIZE;
+			sg[j].length = PAGE_SIZE;
+		}
+		buf->vb.i = i;
+		buf->vb.size = s->bufsize;
+		buf->vb.dma.sglist = sg;
+		buf->vb.dma.sglen = npages;
+		buf->vb.dma.nr_pages = npages;
+		buf->vb.dma.vmalloc = s->mem[i];
+		init_waitqueue_head(&buf->vb.done);
+		ivtv_init_v4l2buf(&pdev, st, sg, buf);
+		buf->vb.state = STATE_QUEUED;
+		list_add_tail(&buf->vb.queue, &st->queued);
+	}
+}
+
+static void setup(void)
+{
+	u32 off = FIFO_START;
+	int i;
+
+	itv = calloc(1, sizeof(*itv));
+	itv->streams = calloc(IVTV_ENC_STREAM_TYPE_RAD + 1, sizeof(*itv->streams));
+	itv->enc_mem = aligned_alloc(PAGE_SIZE, IVTV_ENCODER_SIZE);
+	reg_mem = itv->reg_mem = calloc(1, IVTV_REG_SIZE);
+	if (itv->streams == NULL || itv->enc_mem == NULL || reg_mem == NULL)
+		fail("Out of memory%s", "");
+	memset(itv->enc_mem, 0, IVTV_ENCODER_SIZE);
+
+	itv->dev = &pdev;
+	strcpy(itv->name, "ivtv0");
+	itv->enc_mbox = (struct ivtv_mailbox *)itv->enc_mem;
+	itv->dmaboxnum = 5;
+	itv->streamcount = NSTREAMS;
+	itv->irqmask = ~(IVTV_IRQ_ENC_START_CAP | IVTV_IRQ_ENC_VBI_CAP |
+			 IVTV_IRQ_ENC_DMA_COMPLETE | IVTV_IRQ_DMA_ERR |
+			 IVTV_IRQ_ENC_EOS | IVTV_IRQ_ENC_VIM_RST);
+	spin_lock_init(&itv->DMA_slock);
+	init_MUTEX(&itv->enc_msem);
+	init_MUTEX(&itv->streams_lock);
+	init_waitqueue_head(&itv->cap_w);
+
+	itv->vbi_enc_start = VBI_ENC_START;
+	itv->vbi_enc_size = streams[3].size;
+	itv->vbi_fpi = 1;
+	if (streams[3].on)
+		set_bit(IVTV_F_T_ENC_VBI_STARTED, &itv->t_flags);
+
+	for (i = 0; i < NSTREAMS; i++) {
+		struct sim_stream *s = &streams[i];
+
+		setup_stream(s);
+		if (!s->on)
+			continue;
+		s->slot = PAGE_ALIGN(PAGE_ALIGN(s->size + 12) + s->uvsize);
+		s->base = off;
+		off += s->fifo * s->slot;
+		if (off > IVTV_ENCODER_SIZE)
+			fail("The FIFOs don't fit the %s of encoder memory", "8MB");
+		atomic_inc(&itv->capturing);
+	}
+
+	set_dmastatus(0x02);
+	sim_write_hook = write_hook;
+	fw.stream = -1;
+}
+
+/* Scripts */
+
+static double num(char **tok, int n, int i)
+{
+	char *end;
+	double v;
+
+	if (i >= n)
+		fail("%s: a value is missing", tok[0]);
+	v = strtod(tok[i], &end);
+	if (*end || v < 0)
+		fail("Not a number: %s", tok[i]);
+	return v;
+}
+
+static void start_storm(int k)
+{
+	if (cfg.storm[k] > 0 && !fw.storm_on[k]) {
+		fw.storm_on[k] = 1;
+		ev_add(sim_now + exp_interval(cfg.storm[k]), EV_STORM, k);
+	}
+}
+
+static void directive(char **tok, int n, int running)
+{
+	int i;
+
+	if (n == 0)
+		return;
+	if (!strcmp(tok[0], "duration")) {
+		cfg.duration = num(tok, n, 1);
+	} else if (!strcmp(tok[0], "seed")) {
+		cfg.seed = num(tok, n, 1);
+	} else if (!strcmp(tok[0], "irq-latency")) {
+		cfg.irq_latency = num(tok, n, 1) * NS;
+	} else if (!strcmp(tok[0], "retry")) {
+		cfg.retry = num(tok, n, 1) * NS;
+	} else if (!strcmp(tok[0], "dma")) {
+		for (i = 1; i < n; i += 2) {
+			if (!strcmp(tok[i], "setup"))
+				cfg.dma_setup = num(tok, n, i + 1) * NS;
+			else if (!strcmp(tok[i], "bw") && num(tok, n, i + 1) > 0)
+				cfg.dma_bw = num(tok, n, i + 1) * 1e6 / 1e9;
+			else
+				fail("dma: unknown %s", tok[i]);
+		}
+	} else if (!strcmp(tok[0], "consumer")) {
+		for (i = 1; i < n; i += 2) {
+			if (!strcmp(tok[i], "wake"))
+				cfg.wake = num(tok, n, i + 1) * NS;
+			else if (!strcmp(tok[i], "hold"))
+				cfg.hold = num(tok, n, i + 1) * NS;
+			else if (!strcmp(tok[i], "jitter"))
+				cfg.hold_jitter = num(tok, n, i + 1) * NS;
+			else
+				fail("consumer: unknown %s", tok[i]);
+		}
+	} else if (!strcmp(tok[0], "storm") && n == 3) {
+		for (i = 0; i < 3; i++)
+			if (!strcmp(tok[1], storm_names[i]))
+				break;
+		if (i == 3)
+			fail("Unknown storm %s", tok[1]);
+		cfg.storm[i] = num(tok, n, 2);
+		if (running)
+			start_storm(i);
+	} else if (!strcmp(tok[0], "stream") && n >= 2) {
+		struct sim_stream *s = NULL;
+
+		for (i = 0; i < NSTREAMS; i++)
+			if (!strcmp(tok[1], streams[i].name))
+				s = &streams[i];
+		if (s == NULL)
+			fail("Unknown stream %s", tok[1]);
+		if (running && !s->slot && !(n > 2 && !strcmp(tok[2], "off")))
+			fail("%s: streams can't be added once running", s->name);
+		s->on = 1;
+		for (i = 2; i < n; i++) {
+			if (!strcmp(tok[i], "on") || !strcmp(tok[i], "off")) {
+				s->on = tok[i][1] == 'n';
+				continue;
+			}
+			if (!strcmp(tok[i], "rate"))
+				s->rate = num(tok, n, i + 1);
+			else if (!strcmp(tok[i], "jitter"))
+				s->jitter = num(tok, n, i + 1);
+			else if (running)
+				fail("%s: only rate, jitter, on and off once running",
+				     s->name);
+			else if (!strcmp(tok[i], "size"))
+				s->size = num(tok, n, i + 1);
+			else if (!strcmp(tok[i], "uvsize"))
+				s->uvsize = num(tok, n, i + 1);
+			else if (!strcmp(tok[i], "bufs"))
+				s->nbufs = num(tok, n, i + 1);
+			else if (!strcmp(tok[i], "bufsize"))
+				s->bufsize = num(tok, n, i + 1);
+			else if (!strcmp(tok[i], "fifo"))
+				s->fifo = num(tok, n, i + 1);
+			else if (!strcmp(tok[i], "pack"))
+				s->pack = num(tok, n, i + 1);
+			else
+				fail("stream: unknown %s", tok[i]);
+			i++;
+		}
+		if (running && s->rate <= 0)
+			fail("%s: rate must be above 0", s->name);
+		if (running && s->on && !s->producing) {
+			s->producing = 1;
+			ev_add(sim_now, EV_PRODUCE, s - streams);
+		}
+	} else if (!strcmp(tok[0], "expect") && n == 2 &&
+		   !strcmp(tok[1], "kicks")) {
+		cfg.expect_kicks = 1;
+	} else if (!strcmp(tok[0], "at") && n >= 3 && !running) {
+		if (nat == MAX_AT)
+			fail("More than %s at directives", "256");
+		at_tok[nat] = malloc(n * sizeof(char *));
+		for (i = 0; i < n; i++)
+			at_tok[nat][i] = strdup(tok[i]);
+		at_ntok[nat++] = n;
+	} else {
+		fail("Unknown directive %s", tok[0]);
+	}
+}
+
+/* Lines or ';' separated directives */
+static void parse(char *text)
+{
+	char *line, *next, *tok[MAX_TOK], *p;
+	int n;
+
+	for (line = text; line; line = next) {
+		next = line + strcspn(line, "\n;");
+		if (*next)
+			*next++ = '\0';
+		else
+			next = NULL;
+		if ((p = strchr(line, '#')))
+			*p = '\0';
+		n = 0;
+		for (p = strtok(line, " \t\r"); p && n < MAX_TOK; p = strtok(NULL, " \t\r"))
+			tok[n++] = p;
+		directive(tok, n, 0);
+	}
+}
+
+static char *read_file(const char *name)
+{
+	FILE *f = fopen(name, "r");
+	char *text = NULL;
+	size_t len = 0, n;
+
+	if (f == NULL)
+		fail("Can't open %s", name);
+	for (;;) {
+		text = realloc(text, len + 4097);
+		n = fread(text + len, 1, 4096, f);
+		len += n;
+		if (n == 0)
+			break;
+	}
+	text[len] = '\0';
+	fclose(f);
+	return text;
+}
+
+/* Running */
+
+static void run(void)
+{
+	u64 end = cfg.duration * 1e9;
+	int i;
+
+	rnd_state = cfg.seed * 0x9e3779b97f4a7c15ULL + 1;
+	for (i = 0; i < NSTREAMS; i++) {
+		if (streams[i].on) {
+			streams[i].producing = 1;
+			ev_add((u64)(rnd() * 1e9 / streams[i].rate), EV_PRODUCE, i);
+		}
+	}
+	for (i = 0; i < 3; i++)
+		start_storm(i);
+	for (i = 0; i < nat; i++)
+		ev_add(num(at_tok[i], at_ntok[i], 1) * 1e9, EV_SCRIPT, i);
+	ev_add(end, EV_END, 0);
+
+	while (nheap) {
+		struct event e = ev_pop();
+		struct sim_stream *s = &streams[e.arg / MAX_BUFS];
+
+		sim_set_time(e.t);
+		switch (e.type) {
+		case EV_PRODUCE:
+			produce(&streams[e.arg]);
+			break;
+		case EV_IRQ:
+			fw.irq_pending = 0;
+			call_handler();
+			irq_kick();
+			break;
+		case EV_DMA_DONE:
+			dma_done();
+			break;
+		case EV_RETRY:
+			fw.retry_pending = 0;
+			if (!fw.busy && pending()) {
+				if (sim_now - fw.last_ask >= cfg.retry &&
+				    sim_now - fw.last_start >= cfg.retry)
+					ask_next();
+				else if (!fw.retry_pending) {
+					fw.retry_pending = 1;
+					ev_add(fw.last_ask + cfg.retry, EV_RETRY, 0);
+				}
+			}
+			break;
+		case EV_DQBUF:
+			dqbuf(s, e.arg % MAX_BUFS);
+			break;
+		case EV_QBUF:
+			qbuf(s, e.arg % MAX_BUFS);
+			break;
+		case EV_STORM:
+			fw.storm_on[e.arg] = 0;
+			if (cfg.storm[e.arg] <= 0)
+				break;
+			if (e.arg == 0) {
+				drv.storm_calls++;
+				call_handler();
+			} else if (e.arg == 1) {
+				raise_irq(IVTV_IRQ_ENC_START_CAP);
+			} else {
+				raise_irq(IVTV_IRQ_ENC_DMA_COMPLETE);
+			}
+			start_storm(e.arg);
+			break;
+		case EV_SCRIPT:
+			directive(at_tok[e.arg] + 2, at_ntok[e.arg] - 2, 1);
+			break;
+		case EV_END:
+			return;
+		}
+	}
+}
+
+static void report(const char *title, double wall)
+{
+	double secs = cfg.duration;
+	int i, j;
+
+	if (title)
+		printf("== %s\n", title);
+	printf("%.1f s simulated in %.2f s, seed %llu\n", secs, wall,
+	       (unsigned long long)cfg.seed);
+	printf("irq: %lu handler calls (%lu not ours, %lu storm), %.0f/s, "
+	       "%u/%u/%u ns p50/p99/max, %.2f%% of a CPU\n",
+	       drv.calls, drv.not_ours, drv.storm_calls, drv.calls / secs,
+	       percentile(&drv.handler, 50), percentile(&drv.handler, 99),
+	       percentile(&drv.handler, 100), drv.handler_ns / secs / 1e7);
+	printf("dma: %lu requests, %lu transfers (%lu from QBUF/DQBUF), "
+	       "%lu errors, %lu stale, %lu refused busy\n",
+	       fw.asks, fw.xfers, drv.kick_xfers, fw.errors, fw.stale,
+	       fw.rejected);
+	printf("stream  MB/s  chunks  fw-drop  lost  repeat  damaged  drop%%"
+	       "  latency ms p50/p99/max\n");
+	for (i = 0; i < NSTREAMS; i++) {
+		struct sim_stream *s = &streams[i];
+		int active = 0;
+
+		if (!s->slot)
+			continue;
+		printf("%-6s %6.2f %7lu %8lu %5lu %7lu %8lu %6.2f  %.2f/%.2f/%.2f\n",
+		       s->name, s->bytes / secs / 1e6, s->delivered, s->fw_drops,
+		       s->lost, s->repeated, s->damaged,
+		       s->delivered + s->lost ?
+		       100.0 * s->lost / (s->delivered + s->lost) : 0,
+		       percentile(&s->lat, 50) / 1e3,
+		       percentile(&s->lat, 99) / 1e3,
+		       percentile(&s->lat, 100) / 1e3);
+		for (j = 0; j < s->nbufs; j++)
+			active += s->buf[j].vb.state == STATE_ACTIVE;
+		if (s->pack)
+			printf("       %lu buffers dequeued, %.1f chunks each\n",
+			       s->dqbufs, s->dqbufs ?
+			       (double)s->delivered / s->dqbufs : 0);
+		if (itv->streams[s->type].pack_drops)
+			printf("       %u transfers too large to pack, dropped\n",
+			       itv->streams[s->type].pack_drops);
+		if (active > 1 || (active && !fw.busy))
+			printf("       %d buffers left active with no transfer\n",
+			       active - fw.busy);
+	}
+	printf("driver: %lu messages, %lu BUG()s or lock errors\n",
+	       sim_printks, sim_bugs);
+}
+
+/* The built-in scenarios of -b, 10 seconds each */
+static const char *bench_scripts[][2] = {
+	{ "baseline: MPEG, YUV, PCM and VBI",
+	  "stream mpg; stream yuv; stream pcm; stream vbi" },
+	{ "MPEG at 1000 chunks/s, 128MB/s",
+	  "stream mpg rate 1000 bufs 32 fifo 32; dma bw 200; consumer hold 500" },
+	{ "spurious IRQ storm, 100000/s",
+	  "stream mpg; stream pcm; stream vbi; storm spurious 100000" },
+	{ "repeated ENC_START_CAP, 20000/s",
+	  "stream mpg; stream pcm; stream vbi; storm cap 20000" },
+	{ "repeated ENC_DMA_COMPLETE, 5000/s",
+	  "stream mpg; stream pcm; stream vbi; storm done 5000" },
+	{ "slow application, 2 buffers held 100ms",
+	  "stream mpg bufs 2; stream pcm bufs 2; consumer hold 100000; "
+	  "expect kicks" },
+	{ "PCM and VBI packed 8 and 4 to a buffer",
+	  "stream mpg; stream pcm pack 8; stream vbi pack 4" },
+	{ "packed PCM, chunks larger than the buffers",
+	  "stream pcm pack 8 bufsize 4096; stream vbi pack 4" },
+	{ "no retry by the firmware",
+	  "stream mpg; stream yuv; stream pcm; stream vbi; retry 0" },
+};
+
+static int run_script(const char *title, char *text, const char *file)
+{
+	u64 t0;
+
+	if (text)
+		parse(text);
+	if (file)
+		parse(read_file(file));
+	for (t0 = 0; t0 < NSTREAMS; t0++)
+		if (streams[t0].on)
+			break;
+	if (t0 == NSTREAMS)
+		streams[0].on = 1;
+
+	setup();
+	t0 = wall_ns();
+	run();
+	report(title, (wall_ns() - t0) / 1e9);
+	/* buffers coming back after a request found none must restart it */
+	if (cfg.expect_kicks && drv.kick_xfers == 0) {
+		printf("FAIL: no transfer was started from QBUF/DQBUF\n");
+		return 1;
+	}
+	return sim_bugs ? 1 : 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: ivtv-irqsim [-v] [-s seed] [-t secs] [-e directives] [script]\n"
+		"       ivtv-irqsim -b\n"
+		"  -v  print driver warnings, -vv all driver debug output\n"
+		"  -b  run the benchmark scenarios\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char *text = NULL;
+	int bench = 0, opt, i, status, ret = 0;
+
+	while ((opt = getopt(argc, argv, "bvs:t:e:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bench = 1;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		case 's':
+			cfg.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg.duration = atof(optarg);
+			break;
+		case 'e':
+			text = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind < argc - 1)
+		usage();
+
+	ivtv_debug = verbose > 1 ? ~0 : IVTV_DBGFLG_WARN;
+	sim_quiet = verbose == 0;
+
+	if (!bench)
+		return run_script(NULL, text, optind < argc ? argv[optind] : NULL);
+
+	/* each scenario starts from nothing in a process of its own */
+	for (i = 0; i < sizeof(bench_scripts) / sizeof(bench_scripts[0]); i++) {
+		pid_t pid;
+
+		fflush(stdout);
+		pid = fork();
+		if (pid == 0)
+			exit(run_script(bench_scripts[i][0],
+					strdup(bench_scripts[i][1]), NULL));
+		if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = 1;
+		printf("\n");
+	}
+	return ret;
+}
@@ -0,0 +1,214 @@
+/*
+   The kernel side of the simulation, see include/sim-kernel.h
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdarg.h>
+
+#include "ivtv-driver.h"
+#include "ivtv-fanout.h"
+#include "ivtv-vbi.h"
+#include "irqsim.h"
+
+int ivtv_debug = 0;
+
+u64 sim_now;
+volatile unsigned long jiffies;
+int sim_quiet;
+unsigned long sim_printks;
+unsigned long sim_bugs;
+
+static struct task_struct sim_task;
+struct task_struct *current = &sim_task;
+
+void (*sim_write_hook)(volatile void *addr, u32 val);
+
+void sim_set_time(u64 ns)
+{
+	sim_now = ns;
+	jiffies = ns / (1000000000 / HZ);
+}
+
+int printk(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	sim_printks++;
+	if (sim_quiet)
+		return 0;
+	/* drop the level, all of it goes to stderr */
+	if (fmt[0] == '<' && fmt[1] && fmt[2] == '>')
+		fmt += 3;
+	fprintf(stderr, "[%6llu.%06llu] ", sim_now / 1000000000,
+		sim_now / 1000 % 1000000);
+	va_start(ap, fmt);
+	n = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+void sim_bug(const char *what, const char *file, int line)
+{
+	sim_bugs++;
+	fprintf(stderr, "[%6llu.%06llu] %s at %s:%d\n", sim_now / 1000000000,
+		sim_now / 1000 % 1000000, what, file, line);
+}
+
+void sim_lock(spinlock_t *lock, const char *file, int line)
+{
+	if (lock->locked)
+		sim_bug("spinlock recursion", file, line);
+	lock->locked = 1;
+}
+
+void sim_unlock(spinlock_t *lock, const char *file, int line)
+{
+	if (!lock->locked)
+		sim_bug("unlocking a free spinlock", file, line);
+	lock->locked = 0;
+}
+
+/* Nothing else runs to give it back */
+void sim_down(struct semaphore *sem, const char *file, int line)
+{
+	if (atomic_read(&sem->count) <= 0)
+		sim_bug("down() would sleep forever", file, line);
+	atomic_dec(&sem->count);
+}
+
+/* Sleeping doesn't move the clock, the firmware answers at once */
+long schedule_timeout(long timeout)
+{
+	current->state = TASK_RUNNING;
+	return 0;
+}
+
+void do_gettimeofday(struct timeval *tv)
+{
+	tv->tv_sec = sim_now / 1000000000;
+	tv->tv_usec = sim_now / 1000 % 1000000;
+}
+
+void ktime_get_ts(struct timespec *ts)
+{
+	ts->tv_sec = sim_now / 1000000000;
+	ts->tv_nsec = sim_now % 1000000000;
+}
+
+u32 sim_readl(const volatile void *addr)
+{
+	return *(const volatile u32 *)addr;
+}
+
+void sim_writel(u32 val, volatile void *addr)
+{
+	*(volatile u32 *)addr = val;
+	if (sim_write_hook)
+		sim_write_hook(addr, val);
+}
+
+/* Bus addresses: mapping n of at most 16MB is at SIM_BUS_BASE + n * 16MB,
+   so they fit the 32 bit SG elements and an address finds its mapping
+   without a search. */
+#define SIM_BUS_BASE	0x80000000u
+#define SIM_BUS_SHIFT	24
+#define SIM_BUS_MAPS	128
+
+static struct {
+	void *ptr;
+	size_t size;
+} bus_map[SIM_BUS_MAPS];
+
+unsigned long sim_bus_mapped;
+
+dma_addr_t pci_map_single(struct pci_dev *dev, void *ptr, size_t size,
+			  int direction)
+{
+	int i;
+
+	if (size > 1 << SIM_BUS_SHIFT) {
+		sim_bug("pci_map_single() of more than 16MB", __FILE__, __LINE__);
+		return 0;
+	}
+	for (i = 0; i < SIM_BUS_MAPS; i++)
+		if (bus_map[i].ptr == NULL)
+			break;
+	if (i == SIM_BUS_MAPS) {
+		sim_bug("out of bus addresses, is something never unmapped?",
+			__FILE__, __LINE__);
+		return 0;
+	}
+	bus_map[i].ptr = ptr;
+	bus_map[i].size = size;
+	sim_bus_mapped++;
+	return SIM_BUS_BASE + ((dma_addr_t)i << SIM_BUS_SHIFT);
+}
+
+void pci_unmap_single(struct pci_dev *dev, dma_addr_t addr, size_t size,
+		      int direction)
+{
+	u32 i = (addr - SIM_BUS_BASE) >> SIM_BUS_SHIFT;
+
+	if (addr < SIM_BUS_BASE || i >= SIM_BUS_MAPS ||
+	    (addr & ((1 << SIM_BUS_SHIFT) - 1)) || bus_map[i].ptr == NULL) {
+		sim_bug("pci_unmap_single() of an address not mapped",
+			__FILE__, __LINE__);
+		return;
+	}
+	if (size != bus_map[i].size)
+		sim_bug("pci_unmap_single() size differs from the mapping",
+			__FILE__, __LINE__);
+	bus_map[i].ptr = NULL;
+	sim_bus_mapped--;
+}
+
+void *sim_bus_to_virt(u32 addr, u32 len)
+{
+	u32 i = (addr - SIM_BUS_BASE) >> SIM_BUS_SHIFT;
+	u32 off = addr & ((1 << SIM_BUS_SHIFT) - 1);
+
+	if (addr < SIM_BUS_BASE || i >= SIM_BUS_MAPS || bus_map[i].ptr == NULL ||
+	    off + (u64)len > bus_map[i].size)
+		return NULL;
+	return (u8 *)bus_map[i].ptr + off;
+}
+
+/* Called by ivtv-irq.c, the simulation has no fan-out or sliced VBI */
+void ivtv_fanout_done(struct ivtv_stream *st, struct ivtv_buffer *buf)
+{
+	BUG();
+}
+
+void ivtv_vbi_process_sliced(struct ivtv *itv, struct ivtv_buffer *buf)
+{
+}
+
+/* Called from ivtv-queue.c and ivtv-mailbox.c, not on the DMA path */
+int ivtvbuf_waiton(struct ivtvbuf_buffer *vb, int non_blocking, int intr)
+{
+	return 0;
+}
+
+int ivtvbuf_dma_pci_unmap(struct pci_dev *dev, struct ivtvbuf_dmabuf *dma)
+{
+	return 0;
+}
+
+int ivtvbuf_dma_free(struct ivtvbuf_dmabuf *dma)
+{
+	return 0;
+}
@@ -0,0 +1,914 @@
+/*
+   ivtv-bench: how much capture a host sustains, as JSON
+
+   Finds the ivtv cards like ivtv-detect, sets the codec of each the way
+   ivtv-encoder does (setup_encoder()) if asked to, then captures the
+   chosen streams of every card at once for a fixed time, with mmap,
+   user pointer or read() I/O. The data is not written anywhere, with -x
+   it is read once as an application would.
+
+   For each stream it reports the MB/s captured, the gaps in
+   v4l2_buffer.sequence, the latency from the end of the DMA into a
+   buffer (IVTV_IOC_G_BUF_TS) to VIDIOC_DQBUF returning it, and the CPU
+   time spent on it; for the whole run the CPU use of the process and
+   of the system, interrupts included. The report is one JSON object,
+   for comparing runs:
+
+       ivtv-bench -t 60 -s mpg,pcm -b 8000000 > before.json
+
+   The stream of a device follows its minor, as registered by the
+   driver: video0-15 MPEG, video24-31 PCM, video32-47 YUV, vbi0-15 VBI,
+   the card number is the one of IVTV_IOC_G_DRIVER_INFO.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <linux/types.h>
+
+#define __user
+#include "videodev2.h"
+#include "ivtv.h"
+#include "encoder.h"
+
+#define MAX_CARDS	16
+#define MAX_BUFS	32
+#define READ_SIZE	(128 * 1024)	/* per read(), the driver's MPEG buffer */
+
+enum kind { K_MPG, K_YUV, K_PCM, K_VBI, NKINDS };
+
+static const char *kind_name[NKINDS] = { "mpg", "yuv", "pcm", "vbi" };
+
+enum io_method { IO_MMAP, IO_USERPTR, IO_READ };
+
+static const char *io_name[] = { "mmap", "userptr", "read" };
+
+struct samples {
+	uint32_t *v;
+	size_t n, size;
+	int sorted;
+};
+
+struct stream {
+	enum kind kind;
+	char dev[32];
+	int fd;
+	uint32_t type;		/* V4L2_BUF_TYPE_* */
+	size_t bufsize;
+	unsigned nbufs;
+	void *mem[MAX_BUFS];
+	size_t len[MAX_BUFS];
+	int started;
+	int failed;		/* errno that stopped it */
+
+	uint64_t bytes;
+	unsigned long buffers;
+	int have_seq;
+	uint32_t last_seq;
+	unsigned long gaps;	/* times the sequence skipped */
+	unsigned long lost;	/* sequence numbers skipped */
+	unsigned long errors;	/* VIDIOC_DQBUF gave EIO */
+	struct samples lat;	/* DMA done to dequeued, us */
+	uint64_t cpu_ns;
+	uint32_t sum;		/* of the data, with -x */
+};
+
+struct card {
+	int nr;
+	char name[32];
+	char bus_info[32];
+	struct stream *st[NKINDS];
+};
+
+static struct card cards[MAX_CARDS];
+static int ncards;
+
+static enum io_method io = IO_MMAP;
+static unsigned nbufs = 8;
+static double duration = 30;
+static int want_kind[NKINDS] = { 1, 0, 0, 0 };
+static int want_card[MAX_CARDS];
+static int any_card = 1;
+static int touch;
+static int list_only;
+static const char *out_name;
+
+/* codec settings to make, -1 leaves it as it is */
+static long bitrate = -1, bitrate_peak = -1, bitrate_mode = -1;
+static long stream_type = -1;
+
+static volatile int stop;
+
+static void sig_stop(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "    -t <secs>      capture this long (default: %.0f)\n", duration);
+	fprintf(stderr, "    -s <streams>   any of mpg,yuv,pcm,vbi (default: mpg)\n");
+	fprintf(stderr, "    -c <cards>     card numbers, as 0,2 (default: all)\n");
+	fprintf(stderr, "    -i <io>        mmap, userptr or read (default: mmap)\n");
+	fprintf(stderr, "    -n <buffers>   buffers per stream (default: %u)\n", nbufs);
+	fprintf(stderr, "    -b <bps>       MPEG bitrate to set\n");
+	fprintf(stderr, "    -p <bps>       MPEG peak bitrate to set\n");
+	fprintf(stderr, "    -m <vbr|cbr>   MPEG bitrate mode to set\n");
+	fprintf(stderr, "    -S <type>      MPEG stream type to set (ivtvctl -h lists them)\n");
+	fprintf(stderr, "    -x             read every byte captured\n");
+	fprintf(stderr, "    -o <file>      write the report here (default: stdout)\n");
+	fprintf(stderr, "    -l             list the cards and streams found and exit\n");
+	fprintf(stderr, "    -h             display this help message\n");
+}
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+	int r;
+
+	do r = ioctl(fd, request, arg);
+	while (r == -1 && errno == EINTR);
+	return r;
+}
+
+static uint64_t now_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void samples_add(struct samples *s, uint32_t v)
+{
+	if (s->n == s->size) {
+		s->size = s->size ? 2 * s->size : 1024;
+		s->v = realloc(s->v, s->size * sizeof(*s->v));
+		if (s->v == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	s->v[s->n++] = v;
+	s->sorted = 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint32_t permille(struct samples *s, int pm)
+{
+	size_t i;
+
+	if (s->n == 0)
+		return 0;
+	if (!s->sorted) {
+		qsort(s->v, s->n, sizeof(*s->v), cmp_u32);
+		s->sorted = 1;
+	}
+	i = s->n * pm / 1000;
+	return s->v[i < s->n ? i : s->n - 1];
+}
+
+/* Finding the cards */
+
+/* The stream and card of a device node from its minor, -1 if it is
+   none of the encoder's */
+static int node_kind(const char *base, int n, int *cardnr)
+{
+	if (!strcmp(base, "vbi")) {
+		*cardnr = n;
+		return n < 16 ? K_VBI : -1;
+	}
+	if (n < 16) {
+		*cardnr = n;
+		return K_MPG;
+	}
+	if (n >= 24 && n < 32) {
+		*cardnr = n - 24;
+		return K_PCM;
+	}
+	if (n >= 32 && n < 48) {
+		*cardnr = n - 32;
+		return K_YUV;
+	}
+	return -1;
+}
+
+static struct card *find_card(int nr, const struct v4l2_capability *cap)
+{
+	int i;
+
+	for (i = 0; i < ncards; i++)
+		if (cards[i].nr == nr)
+			return &cards[i];
+	if (ncards == MAX_CARDS)
+		return NULL;
+	cards[ncards].nr = nr;
+	snprintf(cards[ncards].name, sizeof(cards[ncards].name), "%s",
+		 (const char *)cap->card);
+	snprintf(cards[ncards].bus_info, sizeof(cards[ncards].bus_info), "%s",
+		 (const char *)cap->bus_info);
+	return &cards[ncards++];
+}
+
+static void discover(void)
+{
+	static const char *bases[] = { "video", "vbi" };
+	int b, n;
+
+	for (b = 0; b < 2; b++) {
+		for (n = 0; n < 48; n++) {
+			struct ivtv_driver_info info;
+			struct v4l2_capability cap;
+			struct stream *s;
+			struct card *c;
+			char dev[32];
+			int fd, kind, cardnr;
+
+			kind = node_kind(bases[b], n, &cardnr);
+			if (kind < 0)
+				continue;
+			snprintf(dev, sizeof(dev), "/dev/%s%d", bases[b], n);
+			fd = open(dev, O_RDONLY | O_NONBLOCK);
+			if (fd == -1)
+				continue;
+			if (xioctl(fd, VIDIOC_QUERYCAP, &cap) == -1 ||
+			    strcmp((char *)cap.driver, "ivtv")) {
+				close(fd);
+				continue;
+			}
+			memset(&info, 0, sizeof(info));
+			info.size = sizeof(info);
+			if (xioctl(fd, IVTV_IOC_G_DRIVER_INFO, &info) == 0 &&
+			    info.size != IVTV_DRIVER_INFO_V1_SIZE)
+				cardnr = info.cardnr;
+			close(fd);
+
+			c = find_card(cardnr, &cap);
+			if (c == NULL || c->st[kind])
+				continue;
+			s = calloc(1, sizeof(*s));
+			if (s == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			s->kind = kind;
+			s->fd = -1;
+			strcpy(s->dev, dev);
+			s->type = kind == K_VBI ? V4L2_BUF_TYPE_VBI_CAPTURE :
+				V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			c->st[kind] = s;
+		}
+	}
+}
+
+static int card_used(struct card *c)
+{
+	return any_card || (c->nr >= 0 && c->nr < MAX_CARDS && want_card[c->nr]);
+}
+
+/* Setting up */
+
+static int set_codec(int fd)
+{
+	struct ivtv_ioctl_codec codec;
+	struct v4l2_control ctrl;
+	static const uint32_t ctrls[4] = { V4L2_CID_BRIGHTNESS,
+		V4L2_CID_CONTRAST, V4L2_CID_SATURATION, V4L2_CID_HUE };
+	int settings[18];
+	int i;
+
+	if (bitrate < 0 && bitrate_peak < 0 && bitrate_mode < 0 &&
+	    stream_type < 0)
+		return 0;
+
+	/* setup_encoder() sets everything, so start from what is set */
+	if (xioctl(fd, IVTV_IOC_G_CODEC, &codec) == -1)
+		return -1;
+	for (i = 0; i < 4; i++) {
+		ctrl.id = ctrls[i];
+		if (xioctl(fd, VIDIOC_G_CTRL, &ctrl) == -1)
+			return -1;
+		settings[11 + i] = ctrl.value;
+	}
+	if (xioctl(fd, VIDIOC_G_INPUT, &settings[15]) == -1)
+		return -1;
+	settings[0] = codec.aspect;
+	settings[1] = bitrate_mode >= 0 ? bitrate_mode : codec.bitrate_mode;
+	settings[2] = bitrate >= 0 ? bitrate : codec.bitrate;
+	settings[3] = bitrate_peak >= 0 ? bitrate_peak : codec.bitrate_peak;
+	if (settings[3] < settings[2])
+		settings[3] = settings[2];
+	settings[4] = stream_type >= 0 ? stream_type : codec.stream_type;
+	settings[5] = codec.audio_bitmask;
+	settings[6] = codec.dnr_mode;
+	settings[7] = codec.dnr_type;
+	settings[8] = codec.dnr_spatial;
+	settings[9] = codec.dnr_temporal;
+	settings[10] = codec.pulldown;
+	settings[16] = codec.framerate;
+	settings[17] = codec.framespergop;
+	return setup_encoder(fd, settings);
+}
+
+/* The size of a buffer: what the format says, at least a page */
+static size_t buffer_size(struct stream *s)
+{
+	struct v4l2_format fmt;
+	size_t size = 0;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = s->type;
+	if (xioctl(s->fd, VIDIOC_G_FMT, &fmt) == 0) {
+		if (s->kind == K_VBI)
+			size = (size_t)(fmt.fmt.vbi.count[0] + fmt.fmt.vbi.count[1]) *
+				fmt.fmt.vbi.samples_per_line;
+		else
+			size = fmt.fmt.pix.sizeimage;
+	}
+	if (size == 0)
+		size = READ_SIZE;
+	return (size + 4095) & ~(size_t)4095;
+}
+
+static int queue(struct stream *s, unsigned i)
+{
+	struct v4l2_buffer buf;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type = s->type;
+	buf.index = i;
+	if (io == IO_MMAP) {
+		buf.memory = V4L2_MEMORY_MMAP;
+	} else {
+		buf.memory = V4L2_MEMORY_USERPTR;
+		buf.m.userptr = (unsigned long)s->mem[i];
+		buf.length = s->len[i];
+	}
+	return xioctl(s->fd, VIDIOC_QBUF, &buf);
+}
+
+/* Queue again every buffer the driver holds neither queued nor done */
+static int requeue_idle(struct stream *s)
+{
+	struct v4l2_buffer buf;
+	unsigned i;
+
+	for (i = 0; i < s->nbufs; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = s->type;
+		buf.index = i;
+		if (xioctl(s->fd, VIDIOC_QUERYBUF, &buf) == -1)
+			return -1;
+		if (buf.flags & (V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE))
+			continue;
+		if (queue(s, i) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static int start_stream(struct stream *s, int codec)
+{
+	struct v4l2_requestbuffers req;
+	unsigned i;
+
+	s->fd = open(s->dev, O_RDWR | O_NONBLOCK);
+	if (s->fd == -1)
+		return -1;
+	if (codec && set_codec(s->fd) == -1)
+		fprintf(stderr, "%s: could not set the codec: %s\n", s->dev,
+			strerror(errno));
+	s->bufsize = buffer_size(s);
+
+	if (io == IO_READ) {
+		if (s->bufsize < READ_SIZE)
+			s->bufsize = READ_SIZE;
+		s->mem[0] = malloc(s->bufsize);
+		if (s->mem[0] == NULL)
+			return -1;
+		s->nbufs = 1;
+		/* the first read starts the capture */
+		s->started = 1;
+		return 0;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.count = nbufs;
+	req.type = s->type;
+	req.memory = io == IO_MMAP ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+	if (xioctl(s->fd, VIDIOC_REQBUFS, &req) == -1)
+		return -1;
+	if (req.count < 1) {
+		errno = ENOMEM;
+		return -1;
+	}
+	s->nbufs = req.count < MAX_BUFS ? req.count : MAX_BUFS;
+
+	for (i = 0; i < s->nbufs; i++) {
+		if (io == IO_MMAP) {
+			struct v4l2_buffer buf;
+
+			memset(&buf, 0, sizeof(buf));
+			buf.type = s->type;
+			buf.memory = V4L2_MEMORY_MMAP;
+			buf.index = i;
+			if (xioctl(s->fd, VIDIOC_QUERYBUF, &buf) == -1)
+				return -1;
+			s->len[i] = buf.length;
+			s->mem[i] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+					 MAP_SHARED, s->fd, buf.m.offset);
+			if (s->mem[i] == MAP_FAILED) {
+				s->mem[i] = NULL;
+				return -1;
+			}
+		} else {
+			s->len[i] = s->bufsize;
+			if (posix_memalign(&s->mem[i], 4096, s->bufsize)) {
+				s->mem[i] = NULL;
+				errno = ENOMEM;
+				return -1;
+			}
+			/* fault it in now rather than in the first DMA */
+			memset(s->mem[i], 0, s->bufsize);
+		}
+		if (queue(s, i) == -1)
+			return -1;
+	}
+	if (xioctl(s->fd, VIDIOC_STREAMON, &s->type) == -1)
+		return -1;
+	s->started = 1;
+	return 0;
+}
+
+static void stop_stream(struct stream *s)
+{
+	unsigned i;
+
+	if (s->fd == -1)
+		return;
+	if (s->started && io != IO_READ)
+		xioctl(s->fd, VIDIOC_STREAMOFF, &s->type);
+	for (i = 0; i < s->nbufs; i++) {
+		if (s->mem[i] == NULL)
+			continue;
+		if (io == IO_MMAP)
+			munmap(s->mem[i], s->len[i]);
+		else
+			free(s->mem[i]);
+	}
+	close(s->fd);
+	s->fd = -1;
+}
+
+/* Capturing */
+
+static void consume(struct stream *s, const void *p, size_t len)
+{
+	const uint32_t *w = p;
+	uint32_t sum = s->sum;
+	size_t i;
+
+	s->bytes += len;
+	s->buffers++;
+	if (!touch)
+		return;
+	for (i = 0; i < len / 4; i++)
+		sum += w[i];
+	s->sum = sum;
+}
+
+/* Takes what is done, at most a round of the buffers so that the
+   other streams get their turn, returns -1 when the stream failed */
+static int service(struct stream *s)
+{
+	uint64_t t0 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+	struct v4l2_buffer buf;
+	struct ivtv_buf_ts ts;
+	unsigned round;
+	ssize_t n;
+	int ret = 0;
+
+	for (round = 0; round < MAX_BUFS; round++) {
+		if (io == IO_READ) {
+			n = read(s->fd, s->mem[0], s->bufsize);
+			if (n == -1) {
+				if (errno != EAGAIN && errno != EINTR)
+					ret = -1;
+				break;
+			}
+			if (n == 0)
+				break;
+			consume(s, s->mem[0], n);
+			continue;
+		}
+
+		memset(&buf, 0, sizeof(buf));
+		buf.type = s->type;
+		buf.memory = io == IO_MMAP ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+		if (xioctl(s->fd, VIDIOC_DQBUF, &buf) == -1) {
+			/* EIO: the transfer failed and the buffer was
+			   dequeued, but the index isn't copied back */
+			if (errno == EIO) {
+				s->errors++;
+				if (requeue_idle(s) == 0)
+					continue;
+			}
+			if (errno != EAGAIN)
+				ret = -1;
+			break;
+		}
+		if (buf.index >= s->nbufs) {
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+
+		/* how long it waited since the DMA into it ended */
+		memset(&ts, 0, sizeof(ts));
+		ts.index = buf.index;
+		if (xioctl(s->fd, IVTV_IOC_G_BUF_TS, &ts) == 0 && ts.mono_ns) {
+			uint64_t now = now_ns(CLOCK_MONOTONIC);
+
+			samples_add(&s->lat, now > ts.mono_ns ?
+				    (now - ts.mono_ns) / 1000 : 0);
+		}
+
+		if (s->have_seq && buf.sequence > s->last_seq + 1) {
+			s->gaps++;
+			s->lost += buf.sequence - s->last_seq - 1;
+		}
+		s->have_seq = 1;
+		s->last_seq = buf.sequence;
+		consume(s, s->mem[buf.index], buf.bytesused);
+
+		if (queue(s, buf.index) == -1) {
+			ret = -1;
+			break;
+		}
+	}
+	s->cpu_ns += now_ns(CLOCK_THREAD_CPUTIME_ID) - t0;
+	return ret;
+}
+
+/* /proc/stat: all time and the part in interrupts, in ticks */
+static void system_ticks(uint64_t *total, uint64_t *idle, uint64_t *irq)
+{
+	unsigned long long v[8] = { 0 };
+	FILE *f = fopen("/proc/stat", "r");
+	int i;
+
+	*total = *idle = *irq = 0;
+	if (f == NULL)
+		return;
+	if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 8) {
+		for (i = 0; i < 8; i++)
+			*total += v[i];
+		*idle = v[3] + v[4];	/* idle, iowait */
+		*irq = v[5] + v[6];	/* irq, softirq */
+	}
+	fclose(f);
+}
+
+/* The report */
+
+static void json_str(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void report_stream(FILE *f, struct stream *s, double secs)
+{
+	fprintf(f, "        {\n          \"stream\": \"%s\",\n          \"device\": ",
+		kind_name[s->kind]);
+	json_str(f, s->dev);
+	fprintf(f, ",\n");
+	if (s->failed)
+		fprintf(f, "          \"error\": \"%s\",\n", strerror(s->failed));
+	fprintf(f, "          \"buffer_size\": %zu,\n", s->bufsize);
+	fprintf(f, "          \"buffers\": %lu,\n", s->buffers);
+	fprintf(f, "          \"bytes\": %llu,\n", (unsigned long long)s->bytes);
+	fprintf(f, "          \"mb_per_s\": %.3f,\n", secs > 0 ? s->bytes / secs / 1e6 : 0);
+	if (io == IO_READ) {
+		/* read() has no buffers to tell */
+		fprintf(f, "          \"seq_gaps\": null,\n          \"seq_lost\": null,\n"
+			"          \"buf_errors\": null,\n");
+	} else {
+		fprintf(f, "          \"seq_gaps\": %lu,\n", s->gaps);
+		fprintf(f, "          \"seq_lost\": %lu,\n", s->lost);
+		fprintf(f, "          \"buf_errors\": %lu,\n", s->errors);
+	}
+	if (s->lat.n)
+		fprintf(f, "          \"dqbuf_latency_us\": { \"samples\": %zu, "
+			"\"p50\": %u, \"p90\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u },\n",
+			s->lat.n, permille(&s->lat, 500), permille(&s->lat, 900),
+			permille(&s->lat, 990), permille(&s->lat, 999),
+			permille(&s->lat, 1000));
+	else
+		fprintf(f, "          \"dqbuf_latency_us\": null,\n");
+	fprintf(f, "          \"cpu_pct\": %.3f\n        }",
+		secs > 0 ? s->cpu_ns / secs / 1e7 : 0);
+}
+
+static void report(FILE *f, double secs, struct rusage *ru,
+		   uint64_t ticks, uint64_t idle, uint64_t irq)
+{
+	double cpu = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+		ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+	uint64_t total = 0;
+	int i, k, first = 1;
+
+	fprintf(f, "{\n  \"tool\": \"ivtv-bench\",\n");
+	fprintf(f, "  \"duration_s\": %.3f,\n", secs);
+	fprintf(f, "  \"io\": \"%s\",\n", io_name[io]);
+	fprintf(f, "  \"buffers_per_stream\": %u,\n", io == IO_READ ? 0 : nbufs);
+	fprintf(f, "  \"touch\": %s,\n", touch ? "true" : "false");
+	fprintf(f, "  \"codec\": { \"bitrate\": %ld, \"bitrate_peak\": %ld, "
+		"\"bitrate_mode\": %ld, \"stream_type\": %ld },\n",
+		bitrate, bitrate_peak, bitrate_mode, stream_type);
+	fprintf(f, "  \"cpu\": {\n");
+	fprintf(f, "    \"process_pct\": %.3f,\n", secs > 0 ? 100 * cpu / secs : 0);
+	fprintf(f, "    \"user_s\": %.3f,\n",
+		ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6);
+	fprintf(f, "    \"system_s\": %.3f,\n",
+		ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6);
+	fprintf(f, "    \"host_busy_pct\": %.3f,\n",
+		ticks ? 100.0 * (ticks - idle) / ticks : 0);
+	fprintf(f, "    \"host_irq_pct\": %.3f,\n", ticks ? 100.0 * irq / ticks : 0);
+	fprintf(f, "    \"cpus\": %ld\n  },\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	fprintf(f, "  \"cards\": [");
+	for (i = 0; i < ncards; i++) {
+		struct card *c = &cards[i];
+		int sfirst = 1;
+
+		if (!card_used(c))
+			continue;
+		fprintf(f, "%s\n    {\n      \"card\": %d,\n      \"name\": ",
+			first ? "" : ",", c->nr);
+		json_str(f, c->name);
+		fprintf(f, ",\n      \"bus_info\": ");
+		json_str(f, c->bus_info);
+		fprintf(f, ",\n      \"streams\": [");
+		for (k = 0; k < NKINDS; k++) {
+			if (!want_kind[k] || c->st[k] == NULL)
+				continue;
+			fprintf(f, "%s\n", sfirst ? "" : ",");
+			report_stream(f, c->st[k], secs);
+			total += c->st[k]->bytes;
+			sfirst = 0;
+		}
+		fprintf(f, "\n      ]\n    }");
+		first = 0;
+	}
+	fprintf(f, "\n  ],\n");
+	fprintf(f, "  \"total_mb_per_s\": %.3f\n}\n", secs > 0 ? total / secs / 1e6 : 0);
+}
+
+static void list_cards(void)
+{
+	int i, k;
+
+	for (i = 0; i < ncards; i++) {
+		printf("card %d: %s, bus info %s\n", cards[i].nr, cards[i].name,
+		       cards[i].bus_info);
+		for (k = 0; k < NKINDS; k++)
+			if (cards[i].st[k])
+				printf("    %s: %s\n", kind_name[k], cards[i].st[k]->dev);
+	}
+}
+
+static void parse_list(char *arg, int is_cards)
+{
+	char *tok;
+	int k;
+
+	if (!is_cards)
+		memset(want_kind, 0, sizeof(want_kind));
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (is_cards) {
+			k = atoi(tok);
+			if (k < 0 || k >= MAX_CARDS) {
+				fprintf(stderr, "No card %s\n", tok);
+				exit(EXIT_FAILURE);
+			}
+			want_card[k] = 1;
+			any_card = 0;
+			continue;
+		}
+		for (k = 0; k < NKINDS; k++)
+			if (!strcmp(tok, kind_name[k]))
+				break;
+		if (k == NKINDS) {
+			fprintf(stderr, "Unknown stream %s\n", tok);
+			exit(EXIT_FAILURE);
+		}
+		want_kind[k] = 1;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct stream *used[MAX_CARDS * NKINDS];
+	struct pollfd pfd[MAX_CARDS * NKINDS];
+	uint64_t t0, t1, end, ticks0, idle0, irq0, ticks1, idle1, irq1;
+	struct rusage ru0, ru1, ru;
+	FILE *out = stdout;
+	int nused = 0, active, i, k, opt;
+
+	while ((opt = getopt(argc, argv, "t:s:c:i:n:b:p:m:S:xo:lh")) != -1) {
+		switch (opt) {
+		case 't':
+			duration = atof(optarg);
+			break;
+		case 's':
+			parse_list(optarg, 0);
+			break;
+		case 'c':
+			parse_list(optarg, 1);
+			break;
+		case 'i':
+			for (i = 0; i < 3; i++)
+				if (!strcmp(optarg, io_name[i]))
+					break;
+			if (i == 3) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			io = i;
+			break;
+		case 'n':
+			nbufs = atoi(optarg);
+			if (nbufs < 2 || nbufs > MAX_BUFS) {
+				fprintf(stderr, "2 to %d buffers\n", MAX_BUFS);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'b':
+			bitrate = atol(optarg);
+			break;
+		case 'p':
+			bitrate_peak = atol(optarg);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "vbr"))
+				bitrate_mode = 0;
+			else if (!strcmp(optarg, "cbr"))
+				bitrate_mode = 1;
+			else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			stream_type = atol(optarg);
+			break;
+		case 'x':
+			touch = 1;
+			break;
+		case 'o':
+			out_name = optarg;
+			break;
+		case 'l':
+			list_only = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (optind != argc || duration <= 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	discover();
+	if (list_only) {
+		list_cards();
+		return EXIT_SUCCESS;
+	}
+
+	/* start everything before timing anything */
+	for (i = 0; i < ncards; i++) {
+		int codec = 1;	/* once per card, on its first device */
+
+		if (!card_used(&cards[i]))
+			continue;
+		for (k = 0; k < NKINDS; k++) {
+			struct stream *s = cards[i].st[k];
+
+			if (!want_kind[k] || s == NULL)
+				continue;
+			if (start_stream(s, codec) == -1) {
+				fprintf(stderr, "%s: %s\n", s->dev, strerror(errno));
+				s->failed = errno;
+				stop_stream(s);
+				continue;
+			}
+			codec = 0;
+			used[nused++] = s;
+		}
+	}
+	if (nused == 0) {
+		fprintf(stderr, "No stream to capture, see -l\n");
+		return EXIT_FAILURE;
+	}
+	if (out_name && (out = fopen(out_name, "w")) == NULL) {
+		perror(out_name);
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+	getrusage(RUSAGE_SELF, &ru0);
+	system_ticks(&ticks0, &idle0, &irq0);
+	t0 = now_ns(CLOCK_MONOTONIC);
+	end = t0 + (uint64_t)(duration * 1e9);
+
+	/* the first read() starts the capture, until then poll() waits */
+	if (io == IO_READ)
+		for (i = 0; i < nused; i++)
+			service(used[i]);
+
+	for (active = nused; active && !stop; ) {
+		int64_t left = (int64_t)(end - now_ns(CLOCK_MONOTONIC));
+		int n = 0;
+
+		if (left <= 0)
+			break;
+		/* a stopped stream has fd -1, which poll() skips */
+		for (i = 0; i < nused; i++) {
+			pfd[n].fd = used[i]->fd;
+			pfd[n].events = POLLIN;
+			pfd[n++].revents = 0;
+		}
+		if (poll(pfd, n, left / 1000000 + 1) == -1 && errno != EINTR)
+			break;
+		for (i = 0; i < nused; i++) {
+			struct stream *s = used[i];
+
+			if (s->fd == -1 || !(pfd[i].revents & (POLLIN | POLLERR)))
+				continue;
+			if (service(s) == -1) {
+				fprintf(stderr, "%s: %s\n", s->dev, strerror(errno));
+				s->failed = errno;
+				stop_stream(s);
+				active--;
+			}
+		}
+	}
+
+	t1 = now_ns(CLOCK_MONOTONIC);
+	getrusage(RUSAGE_SELF, &ru1);
+	system_ticks(&ticks1, &idle1, &irq1);
+	for (i = 0; i < nused; i++)
+		stop_stream(used[i]);
+
+	timersub(&ru1.ru_utime, &ru0.ru_utime, &ru.ru_utime);
+	timersub(&ru1.ru_stime, &ru0.ru_stime, &ru.ru_stime);
+	report(out, (t1 - t0) / 1e9, &ru, ticks1 - ticks0, idle1 - idle0,
+	       irq1 - irq0);
+	if (out != stdout)
+		fclose(out);
+	return EXIT_SUCCESS;
+}
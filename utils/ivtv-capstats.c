@@ -0,0 +1,298 @@
+/*
+   Per buffer timing and drop accounting of a capture
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "ivtv-capstats.h"
+
+#define BAR	50
+
+uint64_t ivtv_capstats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void series_add(struct ivtv_capstats_series *s, uint64_t us)
+{
+	if (s->n == s->size) {
+		unsigned long size = s->size ? s->size * 2 : 4096;
+		uint32_t *v = realloc(s->v, size * sizeof(*v));
+
+		/* out of memory: the percentiles are of what fitted */
+		if (v == NULL)
+			return;
+		s->v = v;
+		s->size = size;
+	}
+	s->v[s->n++] = us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* s must be sorted */
+static uint32_t permille(const struct ivtv_capstats_series *s, int pm)
+{
+	unsigned long i;
+
+	if (s->n == 0)
+		return 0;
+	i = (s->n * pm + 999) / 1000;
+	return s->v[i ? i - 1 : 0];
+}
+
+int ivtv_capstats_open(struct ivtv_capstats *s, const char *trace_file)
+{
+	memset(s, 0, sizeof(*s));
+	if (trace_file == NULL)
+		return 0;
+	if ((s->trace = fopen(trace_file, "w")) == NULL)
+		return -1;
+	fprintf(s->trace, "buffer,sequence,index,bytesused,capture_ns,dequeue_ns,"
+		"latency_us,capture_interval_us,dequeue_interval_us,lost,"
+		"queued,done\n");
+	return 0;
+}
+
+void ivtv_capstats_add(struct ivtv_capstats *s, const struct ivtv_capstats_buf *b)
+{
+	uint64_t lat = 0, cap_int = 0, deq_int = 0;
+	uint32_t lost = 0;
+	int has_lat = 0, has_cap_int = 0, b_lat = 0;
+
+	if (s->bufs == 0)
+		s->first_ns = b->dequeue_ns;
+	s->last_ns = b->dequeue_ns;
+	s->bufs++;
+	s->bytes += b->bytesused;
+
+	if (b->has_seq) {
+		if (s->has_seq && b->sequence > s->last_seq + 1) {
+			lost = b->sequence - s->last_seq - 1;
+			s->gaps++;
+			s->lost += lost;
+		}
+		s->has_seq = 1;
+		s->last_seq = b->sequence;
+	}
+
+	if (b->capture_ns) {
+		lat = b->dequeue_ns > b->capture_ns ?
+			(b->dequeue_ns - b->capture_ns) / 1000 : 0;
+		has_lat = 1;
+		series_add(&s->latency, lat);
+		while (b_lat < IVTV_CAPSTATS_HIST - 1 && (1ULL << b_lat) <= lat)
+			b_lat++;
+		s->lat_hist[b_lat]++;
+
+		/* an interval over lost buffers is not jitter */
+		if (s->last_capture_ns && b->capture_ns > s->last_capture_ns) {
+			cap_int = (b->capture_ns - s->last_capture_ns) / 1000;
+			has_cap_int = 1;
+			if (lost == 0)
+				series_add(&s->capture_int, cap_int);
+		}
+		s->last_capture_ns = b->capture_ns;
+	}
+
+	if (s->last_dequeue_ns) {
+		deq_int = (b->dequeue_ns - s->last_dequeue_ns) / 1000;
+		series_add(&s->dequeue_int, deq_int);
+	}
+	s->last_dequeue_ns = b->dequeue_ns;
+
+	if (b->queued >= 0 && b->done >= 0) {
+		s->queued_hist[b->queued < IVTV_CAPSTATS_DEPTH ?
+			       b->queued : IVTV_CAPSTATS_DEPTH - 1]++;
+		s->done_hist[b->done < IVTV_CAPSTATS_DEPTH ?
+			     b->done : IVTV_CAPSTATS_DEPTH - 1]++;
+		s->depth_n++;
+	}
+
+	if (s->trace == NULL)
+		return;
+	fprintf(s->trace, "%lu,", s->bufs - 1);
+	if (b->has_seq)
+		fprintf(s->trace, "%u,%u,", b->sequence, b->index);
+	else
+		fprintf(s->trace, ",,");
+	fprintf(s->trace, "%u,", b->bytesused);
+	if (b->capture_ns)
+		fprintf(s->trace, "%llu,", (unsigned long long)b->capture_ns);
+	else
+		fprintf(s->trace, ",");
+	fprintf(s->trace, "%llu,", (unsigned long long)b->dequeue_ns);
+	if (has_lat)
+		fprintf(s->trace, "%llu,", (unsigned long long)lat);
+	else
+		fprintf(s->trace, ",");
+	if (has_cap_int)
+		fprintf(s->trace, "%llu,", (unsigned long long)cap_int);
+	else
+		fprintf(s->trace, ",");
+	if (s->bufs > 1)
+		fprintf(s->trace, "%llu,", (unsigned long long)deq_int);
+	else
+		fprintf(s->trace, ",");
+	fprintf(s->trace, "%u,", lost);
+	if (b->queued >= 0 && b->done >= 0)
+		fprintf(s->trace, "%d,%d\n", b->queued, b->done);
+	else
+		fprintf(s->trace, ",\n");
+}
+
+static void print_series(FILE *f, const char *name,
+			 struct ivtv_capstats_series *s)
+{
+	if (s->n == 0) {
+		fprintf(f, "%-18s %8s\n", name, "-");
+		return;
+	}
+	qsort(s->v, s->n, sizeof(s->v[0]), cmp_u32);
+	fprintf(f, "%-18s %8lu %8u %8u %8u %8u %8u\n", name, s->n,
+		permille(s, 500), permille(s, 900), permille(s, 990),
+		permille(s, 999), s->v[s->n - 1]);
+}
+
+/* How far each interval is from the median one, s must be sorted */
+static void print_jitter(FILE *f, const struct ivtv_capstats_series *s)
+{
+	struct ivtv_capstats_series j;
+	uint32_t median = permille(s, 500);
+	unsigned long i;
+
+	memset(&j, 0, sizeof(j));
+	for (i = 0; i < s->n; i++)
+		series_add(&j, s->v[i] > median ? s->v[i] - median :
+			   median - s->v[i]);
+	print_series(f, "  jitter", &j);
+	free(j.v);
+}
+
+static void print_bar(FILE *f, unsigned long n, unsigned long max)
+{
+	int i, len = max ? (n * BAR + max - 1) / max : 0;
+
+	for (i = 0; i < len; i++)
+		fputc('#', f);
+	fputc('\n', f);
+}
+
+void ivtv_capstats_report(struct ivtv_capstats *s, FILE *f)
+{
+	double secs = (s->last_ns - s->first_ns) / 1e9;
+	unsigned long max = 0;
+	int b, first = -1, last = 0;
+
+	fprintf(f, "\n%lu buffers, %llu bytes in %.1f s", s->bufs,
+		(unsigned long long)s->bytes, secs);
+	if (secs > 0)
+		fprintf(f, ", %.2f Mbit/s", s->bytes * 8 / secs / 1e6);
+	fprintf(f, "\n");
+	if (s->has_seq)
+		fprintf(f, "%lu sequence gaps, %lu buffers lost (%.3f%%)\n",
+			s->gaps, s->lost,
+			s->lost ? 100.0 * s->lost / (s->lost + s->bufs) : 0.0);
+	else
+		fprintf(f, "no sequence numbers, drops unknown\n");
+
+	fprintf(f, "\n%-18s %8s %8s %8s %8s %8s %8s\n", "us", "samples",
+		"p50", "p90", "p99", "p99.9", "max");
+	print_series(f, "latency", &s->latency);
+	print_series(f, "capture interval", &s->capture_int);
+	if (s->capture_int.n)
+		print_jitter(f, &s->capture_int);
+	print_series(f, "dequeue interval", &s->dequeue_int);
+	if (s->dequeue_int.n)
+		print_jitter(f, &s->dequeue_int);
+
+	for (b = 0; b < IVTV_CAPSTATS_HIST; b++) {
+		if (s->lat_hist[b] == 0)
+			continue;
+		if (first < 0)
+			first = b;
+		last = b;
+		if (s->lat_hist[b] > max)
+			max = s->lat_hist[b];
+	}
+	if (first >= 0) {
+		fprintf(f, "\nlatency, us\n");
+		for (b = first; b <= last; b++) {
+			if (b == 0)
+				fprintf(f, "%8s < %7u %8lu ", "", 1, s->lat_hist[b]);
+			else if (b == IVTV_CAPSTATS_HIST - 1)
+				fprintf(f, "%8lu +%8s %8lu ", 1UL << (b - 1), "",
+					s->lat_hist[b]);
+			else
+				fprintf(f, "%8lu - %7lu %8lu ", 1UL << (b - 1),
+					1UL << b, s->lat_hist[b]);
+			print_bar(f, s->lat_hist[b], max);
+		}
+	}
+
+	if (s->depth_n == 0)
+		return;
+	max = 0;
+	first = -1;
+	for (b = 0; b < IVTV_CAPSTATS_DEPTH; b++) {
+		if (s->queued_hist[b] == 0 && s->done_hist[b] == 0)
+			continue;
+		if (first < 0)
+			first = b;
+		last = b;
+		if (s->queued_hist[b] > max)
+			max = s->queued_hist[b];
+	}
+	fprintf(f, "\nat dequeue: buffers with the driver / done waiting\n");
+	for (b = first; b <= last; b++) {
+		fprintf(f, "%6d%s %8lu / %8lu ", b,
+			b == IVTV_CAPSTATS_DEPTH - 1 ? "+" : " ",
+			s->queued_hist[b], s->done_hist[b]);
+		print_bar(f, s->queued_hist[b], max);
+	}
+	if (s->queued_hist[0])
+		fprintf(f, "the driver had no buffer left %lu times, "
+			"more buffers may help\n", s->queued_hist[0]);
+}
+
+int ivtv_capstats_close(struct ivtv_capstats *s)
+{
+	int ret = 0;
+
+	if (s->trace && fclose(s->trace))
+		ret = -1;
+	s->trace = NULL;
+	free(s->latency.v);
+	free(s->capture_int.v);
+	free(s->dequeue_int.v);
+	memset(&s->latency, 0, sizeof(s->latency));
+	memset(&s->capture_int, 0, sizeof(s->capture_int));
+	memset(&s->dequeue_int, 0, sizeof(s->dequeue_int));
+	return ret;
+}
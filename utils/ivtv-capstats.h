@@ -0,0 +1,87 @@
+/*
+   Per buffer timing and drop accounting of a capture
+
+   Each buffer dequeued is recorded with when it was captured and when
+   the application got it, both CLOCK_MONOTONIC, its sequence number and
+   how many buffers the driver still had to capture into. The report
+   gives the latency between the two, the jitter of the intervals
+   between buffers, sequence gaps and the queue depth, as percentiles
+   and histograms. Every buffer can also go to a CSV trace.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __IVTV_CAPSTATS_H
+#define __IVTV_CAPSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define IVTV_CAPSTATS_HIST	24	/* latency buckets, powers of 2 in us */
+#define IVTV_CAPSTATS_DEPTH	33	/* depth buckets, 0 to 32 buffers */
+
+/* One buffer dequeued. Unknown values are 0, or -1 for the depths. */
+struct ivtv_capstats_buf {
+	int has_seq;
+	uint32_t sequence;
+	uint32_t index;
+	uint32_t bytesused;
+	uint64_t capture_ns;	/* DMA into the buffer completed */
+	uint64_t dequeue_ns;	/* the application got it */
+	int queued;		/* buffers left with the driver to fill */
+	int done;		/* filled and waiting to be dequeued */
+};
+
+/* Growing array of values in us, for exact percentiles */
+struct ivtv_capstats_series {
+	uint32_t *v;
+	unsigned long n, size;
+};
+
+struct ivtv_capstats {
+	FILE *trace;
+	unsigned long bufs;
+	uint64_t bytes;
+	uint64_t first_ns, last_ns;	/* dequeue of the first and last */
+
+	int has_seq;
+	uint32_t last_seq;
+	uint64_t last_capture_ns, last_dequeue_ns;
+	unsigned long gaps;	/* sequence jumps */
+	unsigned long lost;	/* sequence numbers never seen */
+
+	struct ivtv_capstats_series latency;	/* capture to dequeue */
+	struct ivtv_capstats_series capture_int;	/* between captures */
+	struct ivtv_capstats_series dequeue_int;	/* between dequeues */
+	unsigned long lat_hist[IVTV_CAPSTATS_HIST];
+	unsigned long queued_hist[IVTV_CAPSTATS_DEPTH];
+	unsigned long done_hist[IVTV_CAPSTATS_DEPTH];
+	unsigned long depth_n;
+};
+
+/* Start collecting, with a CSV trace to trace_file if not NULL */
+int ivtv_capstats_open(struct ivtv_capstats *s, const char *trace_file);
+
+void ivtv_capstats_add(struct ivtv_capstats *s, const struct ivtv_capstats_buf *b);
+
+/* Summary, percentiles and histograms */
+void ivtv_capstats_report(struct ivtv_capstats *s, FILE *f);
+
+/* Close the trace, returns -1 with errno set if writing it failed */
+int ivtv_capstats_close(struct ivtv_capstats *s);
+
+uint64_t ivtv_capstats_now(void);
+
+#endif
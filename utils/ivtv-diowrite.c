@@ -0,0 +1,260 @@
+/*
+   Writing a capture to disk around the page cache
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "ivtv-diowrite.h"
+
+/* No libaio needed, the calls are simple enough */
+static int io_setup(unsigned nr, aio_context_t *ctx)
+{
+	return syscall(SYS_io_setup, nr, ctx);
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+	return syscall(SYS_io_destroy, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **cbs)
+{
+	return syscall(SYS_io_submit, ctx, nr, cbs);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr,
+			struct io_event *events, struct timespec *timeout)
+{
+	return syscall(SYS_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+static uint64_t mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void account(struct ivtv_diow *w, uint64_t us)
+{
+	int b = 0;
+
+	while (b < IVTV_DIOW_HIST - 1 && (1ULL << b) <= us)
+		b++;
+	w->lat_hist[b]++;
+	w->lat_sum += us;
+	if (us > w->lat_max)
+		w->lat_max = us;
+	w->completed++;
+}
+
+/* Collect finished writes, waiting for at least min_nr. A failed write
+   is kept in w->error, the return is for the wait itself failing. */
+static int reap(struct ivtv_diow *w, int min_nr, struct timespec *timeout)
+{
+	struct io_event ev[IVTV_DIOW_MAX_DEPTH];
+	uint64_t now;
+	int n, i;
+
+	do
+		n = io_getevents(w->ctx, min_nr, w->depth, ev, timeout);
+	while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -1;
+	now = mono_ns();
+	for (i = 0; i < n; i++) {
+		struct ivtv_diow_buf *b = &w->bufs[ev[i].data];
+
+		if (w->error == 0 && (long long)ev[i].res < 0)
+			w->error = -ev[i].res;
+		else if (w->error == 0 && ev[i].res != b->cb.aio_nbytes)
+			w->error = EIO;
+		account(w, (now - b->submit_ns) / 1000);
+		b->busy = 0;
+		b->used = 0;
+		w->inflight--;
+	}
+	return 0;
+}
+
+static int submit(struct ivtv_diow *w)
+{
+	struct ivtv_diow_buf *b = &w->bufs[w->cur];
+	struct iocb *cbs[1] = { &b->cb };
+	size_t len;
+
+	/* only the last buffer is short, pad it to a whole block */
+	len = (b->used + IVTV_DIOW_ALIGN - 1) & ~(size_t)(IVTV_DIOW_ALIGN - 1);
+	memset(b->data + b->used, 0, len - b->used);
+
+	memset(&b->cb, 0, sizeof(b->cb));
+	b->cb.aio_data = w->cur;
+	b->cb.aio_lio_opcode = IOCB_CMD_PWRITE;
+	b->cb.aio_fildes = w->fd;
+	b->cb.aio_buf = (unsigned long)b->data;
+	b->cb.aio_nbytes = len;
+	b->cb.aio_offset = w->offset;
+	b->submit_ns = mono_ns();
+	while (io_submit(w->ctx, 1, cbs) != 1) {
+		if (errno != EINTR && errno != EAGAIN)
+			return -1;
+		if (errno == EINTR)
+			continue;
+		/* out of requests, wait for one of ours; with none
+		   in flight the kernel has nothing to give back */
+		if (w->inflight == 0 || reap(w, 1, NULL) < 0)
+			return -1;
+	}
+	b->busy = 1;
+	w->inflight++;
+	w->offset += len;
+	w->cur = (w->cur + 1) % w->depth;
+
+	/* wait if the next one is still going to disk */
+	if (w->bufs[w->cur].busy) {
+		w->stalls++;
+		while (w->bufs[w->cur].busy)
+			if (reap(w, 1, NULL) < 0)
+				return -1;
+	}
+	if (w->error) {
+		errno = w->error;
+		return -1;
+	}
+	return 0;
+}
+
+int ivtv_diow_open(struct ivtv_diow *w, const char *file, int depth,
+		   size_t bufsize)
+{
+	int i;
+
+	memset(w, 0, sizeof(*w));
+	if (depth < 2)
+		depth = 2;
+	if (depth > IVTV_DIOW_MAX_DEPTH)
+		depth = IVTV_DIOW_MAX_DEPTH;
+	w->depth = depth;
+	w->bufsize = (bufsize + IVTV_DIOW_ALIGN - 1) & ~(size_t)(IVTV_DIOW_ALIGN - 1);
+
+	w->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if (w->fd < 0)
+		return -1;
+	if (io_setup(depth, &w->ctx) < 0) {
+		close(w->fd);
+		return -1;
+	}
+	w->bufs = calloc(depth, sizeof(*w->bufs));
+	if (w->bufs == NULL)
+		goto fail;
+	for (i = 0; i < depth; i++) {
+		void *p;
+
+		if (posix_memalign(&p, IVTV_DIOW_ALIGN, w->bufsize))
+			goto fail;
+		/* fault it in now, not during capture */
+		memset(p, 0, w->bufsize);
+		w->bufs[i].data = p;
+	}
+	return 0;
+
+fail:
+	if (w->bufs)
+		for (i = 0; i < depth; i++)
+			free(w->bufs[i].data);
+	free(w->bufs);
+	io_destroy(w->ctx);
+	close(w->fd);
+	errno = ENOMEM;
+	return -1;
+}
+
+int ivtv_diow_write(struct ivtv_diow *w, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	struct timespec zero = { 0, 0 };
+
+	/* pick up what has finished, without waiting */
+	if (w->inflight && reap(w, 0, &zero) < 0)
+		return -1;
+	if (w->error) {
+		errno = w->error;
+		return -1;
+	}
+
+	w->bytes += len;
+	while (len) {
+		struct ivtv_diow_buf *b = &w->bufs[w->cur];
+		size_t n = w->bufsize - b->used;
+
+		if (n > len)
+			n = len;
+		memcpy(b->data + b->used, p, n);
+		b->used += n;
+		p += n;
+		len -= n;
+		if (b->used == w->bufsize && submit(w) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int ivtv_diow_close(struct ivtv_diow *w)
+{
+	int i, ret = 0;
+
+	if (w->bufs[w->cur].used && submit(w) < 0)
+		ret = -1;
+	while (w->inflight && reap(w, 1, NULL) == 0)
+		;
+	/* the padding of the last block goes */
+	if (ftruncate(w->fd, w->bytes) < 0)
+		ret = -1;
+	if (close(w->fd) < 0)
+		ret = -1;
+	if (w->error) {
+		errno = w->error;
+		ret = -1;
+	}
+	io_destroy(w->ctx);
+	for (i = 0; i < w->depth; i++)
+		free(w->bufs[i].data);
+	free(w->bufs);
+	w->bufs = NULL;
+	return ret;
+}
+
+unsigned long ivtv_diow_percentile(struct ivtv_diow *w, int percent)
+{
+	unsigned long want = (w->completed * percent + 99) / 100, n = 0;
+	int b;
+
+	for (b = 0; b < IVTV_DIOW_HIST; b++) {
+		n += w->lat_hist[b];
+		if (n >= want && n)
+			return 1UL << b;
+	}
+	return w->lat_max;
+}
@@ -0,0 +1,77 @@
+/*
+   Writing a capture to disk around the page cache
+
+   Data is gathered into a few aligned staging buffers. A full buffer
+   goes to the file with O_DIRECT through Linux AIO while the next one
+   fills, so capture never waits for the disk unless every buffer is
+   still being written, and no dirty pages build up for writeback.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __IVTV_DIOWRITE_H
+#define __IVTV_DIOWRITE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/aio_abi.h>
+
+#define IVTV_DIOW_ALIGN		4096	/* offsets, lengths and memory */
+#define IVTV_DIOW_BUFSIZE	(2 * 1024 * 1024)
+#define IVTV_DIOW_MAX_DEPTH	64
+#define IVTV_DIOW_HIST		32	/* latency buckets, powers of 2 in us */
+
+struct ivtv_diow_buf {
+	unsigned char *data;
+	size_t used;
+	int busy;		/* being written */
+	uint64_t submit_ns;
+	struct iocb cb;
+};
+
+struct ivtv_diow {
+	int fd;
+	aio_context_t ctx;
+	int depth;
+	size_t bufsize;
+	struct ivtv_diow_buf *bufs;
+	int cur;		/* buffer being filled */
+	int inflight;
+	uint64_t offset;	/* in the file of the buffer being filled */
+	uint64_t bytes;		/* given to write, the size of the file */
+	int error;		/* of the first write that failed */
+
+	/* submit to complete, in us */
+	unsigned long completed;
+	unsigned long stalls;	/* times every buffer was busy */
+	uint64_t lat_sum;
+	uint64_t lat_max;
+	unsigned long lat_hist[IVTV_DIOW_HIST];
+};
+
+/* Create file for writing depth buffers of bufsize at a time */
+int ivtv_diow_open(struct ivtv_diow *w, const char *file, int depth,
+		   size_t bufsize);
+
+/* Copy len bytes in, returns -1 with errno set when a write failed */
+int ivtv_diow_write(struct ivtv_diow *w, const void *data, size_t len);
+
+/* Write out the rest, cut the file to the bytes given, and close it */
+int ivtv_diow_close(struct ivtv_diow *w);
+
+/* Latency in us below which that percent of the writes completed */
+unsigned long ivtv_diow_percentile(struct ivtv_diow *w, int percent);
+
+#endif
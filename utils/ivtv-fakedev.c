@@ -0,0 +1,1397 @@
+/*
+   A stand-in for an ivtv capture card, for testing without one
+
+   Loaded with LD_PRELOAD, it takes over the open() of /dev/videoN and
+   /dev/vbiN and answers the ioctls, read() and mmap() the capture tools
+   use the way the driver does, so they can be run and timed on any
+   Linux box:
+
+       LD_PRELOAD=./libivtv-fake.so ./v4l2cap -d /dev/video32 -c 300
+
+   The kind of stream follows the device minor, as with the driver:
+   video0-15 MPEG, video24-31 PCM, video32-47 HM12 YUV and vbi0-7 raw
+   VBI. PCM and VBI can be packed with IVTV_IOC_S_PACK. A device is backed by an eventfd that counts the finished
+   buffers, so select() and poll() on it work as usual, and a thread
+   fills the queued buffers at the rate of the card.
+
+   Set in the environment:
+
+       IVTV_FAKE_SPEED   times real time, 0 to fill buffers as fast as
+                         they are queued (default 1)
+       IVTV_FAKE_STD     pal for 625 line timing (default ntsc)
+       IVTV_FAKE_MPEG    program stream to play round and round on the
+                         MPEG device, instead of generated packs
+       IVTV_FAKE_SWAP    1 if that file is byteswapped the way the
+                         firmware writes, it is then swapped back per
+                         buffer like the driver does
+
+   Anything else is not emulated: the tuner, inputs and the other
+   ioctls that only set something succeed and do nothing.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+
+#include <linux/types.h>
+#include <linux/videodev2.h>
+#include "ivtv.h"
+
+#define FAKE_MAX_DEVS	16
+#define FAKE_MAX_BUFS	32
+#define FAKE_READ_BUFS	8	/* behind read(), like the driver's queue */
+
+#define PAGE_ALIGN(x)	(((x) + 4095) & ~(size_t)4095)
+
+#define MPEG_BUF_SIZE	0x20000
+#define PCM_BUF_SIZE	0x1200	/* 1152 stereo samples */
+#define VBI_LINE	1443	/* samples of a raw VBI line */
+#define PACK_SIZE	2048
+
+/* IVTV_IOC_S_PACK, as the driver lays out a packed buffer */
+#define PACK_CHUNK(n)	(((n) + 255) & ~(size_t)255)
+#define PACK_DATA_OFFSET	PACK_CHUNK(sizeof(struct ivtv_pack_header))
+
+enum kind { K_MPG, K_PCM, K_YUV, K_VBI };
+
+struct fake_buf {
+	unsigned char *mem;	/* ours, or the application's with USERPTR */
+	int queued;
+	int done;
+	uint32_t bytesused;
+	uint32_t sequence;
+	struct timeval timestamp;
+	uint64_t pts;
+	uint64_t mono_ns;
+	uint32_t pack_count;	/* transfers in it so far */
+};
+
+struct fake {
+	int fd;			/* the eventfd the application holds */
+	enum kind kind;
+	int pal;
+	uint32_t width, height;
+	size_t bufsize;
+	size_t chunksize;	/* of one transfer */
+	uint32_t pack;		/* transfers per buffer, 0 unpacked */
+	struct ivtv_ioctl_codec codec;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	/* a buffer was queued, or stop */
+	pthread_t thread;
+	int running;
+
+	enum v4l2_memory memory;
+	unsigned char *mem;	/* MMAP buffers, bufsize apart page aligned */
+	int nbufs;
+	struct fake_buf bufs[FAKE_MAX_BUFS];
+	int queue[FAKE_MAX_BUFS], qhead, nqueued;
+	int done[FAKE_MAX_BUFS], dhead, ndone;
+
+	/* capture started by read() */
+	int reading;
+	int rd_index;		/* buffer being read out, -1 for none */
+	size_t rd_off;
+
+	uint64_t start_ns;
+	double period_ns;	/* of a buffer, at speed 1 */
+	uint64_t tick;		/* buffers the card produced or dropped */
+	uint32_t sequence;
+
+	/* sources */
+	int src;		/* the MPEG file, -1 to generate */
+	uint32_t frame;		/* generated MPEG frames */
+	double phase;		/* of the PCM tone */
+};
+
+static struct fake *fakes[FAKE_MAX_DEVS];
+static pthread_mutex_t fakes_lock = PTHREAD_MUTEX_INITIALIZER;
+static double speed = 1.0;
+static int swap_words;
+static const char *mpeg_file;
+static int pal_default;
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+static void *(*real_mmap64)(void *, size_t, int, int, int, off64_t);
+static int (*real_munmap)(void *, size_t);
+static int (*real_select)(int, fd_set *, fd_set *, fd_set *, struct timeval *);
+static int (*real_poll)(struct pollfd *, nfds_t, int);
+static int (*real_stat)(const char *, struct stat *);
+static int (*real_stat64)(const char *, struct stat64 *);
+static int (*real_xstat)(int, const char *, struct stat *);
+
+int __xstat(int ver, const char *path, struct stat *st);
+
+static void __attribute__((constructor)) fake_init(void)
+{
+	const char *s;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_open64 = dlsym(RTLD_NEXT, "open64");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_mmap = dlsym(RTLD_NEXT, "mmap");
+	real_mmap64 = dlsym(RTLD_NEXT, "mmap64");
+	real_munmap = dlsym(RTLD_NEXT, "munmap");
+	real_select = dlsym(RTLD_NEXT, "select");
+	real_poll = dlsym(RTLD_NEXT, "poll");
+	real_stat = dlsym(RTLD_NEXT, "stat");
+	real_stat64 = dlsym(RTLD_NEXT, "stat64");
+	real_xstat = dlsym(RTLD_NEXT, "__xstat");
+
+	s = getenv("IVTV_FAKE_SPEED");
+	if (s) {
+		speed = atof(s);
+		if (speed < 0)
+			speed = 0;
+	}
+	s = getenv("IVTV_FAKE_STD");
+	pal_default = s && (s[0] == 'p' || s[0] == 'P');
+	s = getenv("IVTV_FAKE_SWAP");
+	swap_words = s && atoi(s);
+	mpeg_file = getenv("IVTV_FAKE_MPEG");
+}
+
+static uint64_t mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct fake *fake_get(int fd)
+{
+	struct fake *f = NULL;
+	int i;
+
+	if (fd < 0)
+		return NULL;
+	pthread_mutex_lock(&fakes_lock);
+	for (i = 0; i < FAKE_MAX_DEVS; i++)
+		if (fakes[i] && fakes[i]->fd == fd) {
+			f = fakes[i];
+			break;
+		}
+	pthread_mutex_unlock(&fakes_lock);
+	return f;
+}
+
+static int fail(int err)
+{
+	errno = err;
+	return -1;
+}
+
+/* Buffer size and timing from the kind, standard and format */
+static void fake_setup(struct fake *f)
+{
+	double frame_ns = f->pal ? 40000000.0 : 1001000000.0 / 30;
+	int rate;
+
+	switch (f->kind) {
+	case K_MPG:
+		f->bufsize = MPEG_BUF_SIZE;
+		f->period_ns = frame_ns;
+		break;
+	case K_YUV:
+		/* HM12: the UV macroblocks start on the page after the Y */
+		f->bufsize = PAGE_ALIGN(f->width * f->height) +
+			f->width * f->height / 2;
+		f->period_ns = frame_ns;
+		break;
+	case K_PCM:
+		switch (f->codec.audio_bitmask & 0x03) {
+		case 0: rate = 44100; break;
+		case 2: rate = 32000; break;
+		default: rate = 48000; break;
+		}
+		f->bufsize = PCM_BUF_SIZE;
+		f->period_ns = 1e9 * (PCM_BUF_SIZE / 4) / rate;
+		break;
+	case K_VBI:
+		f->bufsize = VBI_LINE * (f->pal ? 36 : 24);
+		f->period_ns = frame_ns;
+		break;
+	}
+	f->chunksize = f->bufsize;
+	if (f->pack)
+		f->bufsize = PAGE_ALIGN(PACK_DATA_OFFSET +
+					f->pack * PACK_CHUNK(f->chunksize));
+}
+
+/* MPEG bytes per frame at the codec bitrate, in whole packs */
+static size_t mpeg_frame_bytes(struct fake *f)
+{
+	double fps = f->pal ? 25.0 : 30000.0 / 1001;
+	size_t n = (size_t)(f->codec.bitrate / 8 / fps);
+
+	n -= n % PACK_SIZE;
+	if (n < PACK_SIZE)
+		n = PACK_SIZE;
+	if (n > f->bufsize)
+		n = f->bufsize - f->bufsize % PACK_SIZE;
+	return n;
+}
+
+static void put_scr(unsigned char *p, uint64_t scr)
+{
+	p[0] = 0x44 | ((scr >> 27) & 0x38) | ((scr >> 28) & 0x03);
+	p[1] = scr >> 20;
+	p[2] = ((scr >> 12) & 0xf8) | 0x04 | ((scr >> 13) & 0x03);
+	p[3] = scr >> 5;
+	p[4] = ((scr << 3) & 0xf8) | 0x04;
+	p[5] = 0x01;
+}
+
+static void put_pts(unsigned char *p, uint64_t pts)
+{
+	p[0] = 0x21 | ((pts >> 29) & 0x0e);
+	p[1] = pts >> 22;
+	p[2] = (pts >> 14) | 0x01;
+	p[3] = pts >> 7;
+	p[4] = (pts << 1) | 0x01;
+}
+
+/* One frame of program stream: video PES in 2048 byte packs, the first
+   carrying a sequence and GOP header at each GOP and the picture start
+   code. The rest is stuffing without start codes in it. */
+static size_t gen_mpeg(struct fake *f, unsigned char *p, size_t len)
+{
+	uint32_t tpf = f->pal ? 3600 : 3003, fps = f->pal ? 25 : 30;
+	uint32_t gop_len = f->codec.framespergop, tr = f->frame % gop_len;
+	uint32_t secs = f->frame / fps, pics = f->frame % fps;
+	uint64_t pts = (uint64_t)f->frame * tpf;
+	size_t off;
+	unsigned char *q;
+
+	for (off = 0; off + PACK_SIZE <= len; off += PACK_SIZE) {
+		q = p + off;
+		memcpy(q, "\x00\x00\x01\xba", 4);
+		put_scr(q + 4, pts);
+		q[10] = 0x01;	/* mux rate 50 bytes/s units, 10.08 Mbit */
+		q[11] = 0x89;
+		q[12] = 0xc3;
+		q[13] = 0xf8;	/* no pack stuffing */
+		memcpy(q + 14, "\x00\x00\x01\xe0", 4);
+		q[18] = (PACK_SIZE - 20) >> 8;
+		q[19] = (PACK_SIZE - 20) & 0xff;
+		q[20] = 0x81;
+		q += 21;
+		if (off == 0) {
+			q[0] = 0x80;
+			q[1] = 5;
+			put_pts(q + 2, pts + tpf);
+			q += 7;
+			if (tr == 0) {
+				/* 720 wide, 4:3 at the frame rate */
+				memcpy(q, "\x00\x00\x01\xb3\x2d\x01\xe0\x24"
+				       "\xff\xff\xe0\x18", 12);
+				if (f->pal) {
+					q[5] = 0x02;
+					q[6] = 0x40;
+					q[7] = 0x23;
+				}
+				q += 12;
+				memcpy(q, "\x00\x00\x01\xb8", 4);
+				q[4] = (secs / 3600 % 24) << 2 | (secs / 60 % 60) >> 4;
+				q[5] = (secs / 60 % 60 & 0x0f) << 4 | 0x08 |
+					(secs % 60) >> 3;
+				q[6] = (secs % 60 & 0x07) << 5 | pics >> 1;
+				q[7] = (pics & 1) << 7 | 0x40;
+				q += 8;
+			}
+			memcpy(q, "\x00\x00\x01\x00", 4);
+			q[4] = tr >> 2;
+			q[5] = (tr & 3) << 6 | (tr == 0 ? 1 : 2) << 3;
+			q[6] = 0xff;
+			q[7] = 0xf8;
+			q += 8;
+		} else {
+			q[0] = 0x00;
+			q[1] = 0;
+			q += 2;
+		}
+		memset(q, 0xff, p + off + PACK_SIZE - q);
+	}
+	f->frame++;
+	return off;
+}
+
+/* The next len bytes of the file, from the start again at its end */
+static size_t replay_mpeg(struct fake *f, unsigned char *p, size_t len)
+{
+	size_t got = 0;
+	ssize_t n;
+	int restarted = 0;
+
+	while (got < len) {
+		n = real_read(f->src, p + got, len - got);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (restarted)
+				break;
+			lseek(f->src, 0, SEEK_SET);
+			restarted = 1;
+			continue;
+		}
+		restarted = 0;
+		got += n;
+	}
+	f->frame++;
+	return got;
+}
+
+static void swab32(unsigned char *p, size_t len)
+{
+	uint32_t *w = (uint32_t *)p;
+	size_t i;
+
+	for (i = 0; i < len / 4; i++)
+		w[i] = __builtin_bswap32(w[i]);
+}
+
+/* Luma stripes moving a macroblock per frame, grey chroma */
+static size_t gen_hm12(struct fake *f, unsigned char *p)
+{
+	uint32_t mbw = f->width / 16, mbh = f->height / 16, x, y;
+	size_t ysize = f->width * f->height;
+	unsigned char *uv = p + PAGE_ALIGN(ysize);
+
+	for (y = 0; y < mbh; y++)
+		for (x = 0; x < mbw; x++, p += 256)
+			memset(p, 16 + ((x + f->tick) % mbw) * 219 / mbw, 256);
+	memset(uv, 128, ysize / 2);
+	return f->bufsize;
+}
+
+/* A 1 kHz tone, 16 bit stereo */
+static size_t gen_pcm(struct fake *f, unsigned char *p)
+{
+	int16_t *s = (int16_t *)p;
+	double step = 2 * M_PI * 1000 * f->period_ns / 1e9 / (PCM_BUF_SIZE / 4);
+	int i;
+
+	for (i = 0; i < PCM_BUF_SIZE / 4; i++) {
+		s[2 * i] = s[2 * i + 1] = 8192 * sin(f->phase);
+		f->phase += step;
+	}
+	f->phase = fmod(f->phase, 2 * M_PI);
+	return PCM_BUF_SIZE;
+}
+
+/* Blanking lines with the sequence number in the first samples */
+static size_t gen_vbi(struct fake *f, unsigned char *p, uint32_t sequence)
+{
+	size_t lines = f->chunksize / VBI_LINE, l;
+
+	for (l = 0; l < lines; l++) {
+		unsigned char *q = p + l * VBI_LINE;
+
+		memset(q, 16, VBI_LINE);
+		memcpy(q, &sequence, sizeof(sequence));
+		q[4] = l;
+	}
+	return f->chunksize;
+}
+
+static size_t fill(struct fake *f, unsigned char *p)
+{
+	size_t n = 0;
+
+	switch (f->kind) {
+	case K_MPG:
+		if (f->src < 0)
+			return gen_mpeg(f, p, mpeg_frame_bytes(f));
+		n = replay_mpeg(f, p, mpeg_frame_bytes(f));
+		if (swap_words)
+			swab32(p, n);
+		return n;
+	case K_YUV:
+		return gen_hm12(f, p);
+	case K_PCM:
+		return gen_pcm(f, p);
+	case K_VBI:
+		return gen_vbi(f, p, f->sequence);
+	}
+	return n;
+}
+
+/* One more transfer into a packed buffer, after those already in it,
+   and its entry in the header. Returns the bytes used so far. */
+static size_t fill_pack(struct fake *f, struct fake_buf *b, uint64_t pts)
+{
+	struct ivtv_pack_header *h = (struct ivtv_pack_header *)b->mem;
+	struct ivtv_pack_entry *e = &h->entry[b->pack_count];
+	size_t off = PACK_DATA_OFFSET;
+
+	if (b->pack_count)
+		off = h->entry[b->pack_count - 1].offset +
+			PACK_CHUNK(h->entry[b->pack_count - 1].size);
+	e->offset = off;
+	e->size = fill(f, b->mem + off);
+	e->pts = pts;
+	h->magic = IVTV_PACK_MAGIC;
+	h->count = ++b->pack_count;
+	return off + e->size;
+}
+
+static uint64_t tick_pts(struct fake *f)
+{
+	if (f->kind == K_PCM)
+		return (uint64_t)(f->tick * f->period_ns * 9 / 100000);
+	return f->tick * (f->pal ? 3600 : 3003);
+}
+
+/* The card: a buffer every period, dropped if none is queued */
+static void *producer(void *arg)
+{
+	struct fake *f = arg;
+	struct fake_buf *b;
+	struct timespec ts;
+	uint64_t due, one = 1;
+	size_t n;
+	int i;
+
+	pthread_mutex_lock(&f->lock);
+	while (f->running) {
+		if (speed > 0) {
+			due = f->start_ns + (uint64_t)(f->tick * f->period_ns / speed);
+			ts.tv_sec = due / 1000000000;
+			ts.tv_nsec = due % 1000000000;
+			pthread_mutex_unlock(&f->lock);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					       &ts, NULL) == EINTR)
+				;
+			pthread_mutex_lock(&f->lock);
+		} else {
+			while (f->running && f->nqueued == 0)
+				pthread_cond_wait(&f->cond, &f->lock);
+		}
+		if (!f->running)
+			break;
+
+		if (f->nqueued == 0) {
+			/* overrun, the data is lost */
+			if (f->kind == K_MPG) {
+				if (f->src >= 0)
+					lseek(f->src, mpeg_frame_bytes(f), SEEK_CUR);
+				f->frame++;
+			}
+			f->tick++;
+			f->sequence++;
+			continue;
+		}
+		i = f->queue[f->qhead];
+		b = &f->bufs[i];
+		if (f->pack) {
+			/* the buffer stays first in the queue until full */
+			if (b->pack_count == 0)
+				b->pts = tick_pts(f);
+			n = fill_pack(f, b, tick_pts(f));
+			if (b->pack_count < f->pack &&
+			    PACK_CHUNK(n) + PACK_CHUNK(f->chunksize) <= f->bufsize) {
+				f->tick++;
+				continue;
+			}
+			b->mono_ns = mono_ns();
+			gettimeofday(&b->timestamp, NULL);
+		}
+		f->qhead = (f->qhead + 1) % FAKE_MAX_BUFS;
+		f->nqueued--;
+		b->queued = 0;
+		b->sequence = f->sequence;
+
+		if (!f->pack) {
+			b->pts = tick_pts(f);
+			/* the buffer is out of the queue, nobody else
+			   touches it */
+			pthread_mutex_unlock(&f->lock);
+			n = fill(f, b->mem);
+			b->mono_ns = mono_ns();
+			gettimeofday(&b->timestamp, NULL);
+			pthread_mutex_lock(&f->lock);
+		}
+
+		b->bytesused = n;
+		b->done = 1;
+		f->done[(f->dhead + f->ndone) % FAKE_MAX_BUFS] = i;
+		f->ndone++;
+		f->tick++;
+		f->sequence++;
+		if (syscall(SYS_write, f->fd, &one, sizeof(one)) < 0)
+			break;
+	}
+	pthread_mutex_unlock(&f->lock);
+	return NULL;
+}
+
+static int fake_queue(struct fake *f, int i)
+{
+	struct fake_buf *b = &f->bufs[i];
+
+	if (b->queued || b->done)
+		return fail(EINVAL);
+	b->queued = 1;
+	b->pack_count = 0;
+	f->queue[(f->qhead + f->nqueued) % FAKE_MAX_BUFS] = i;
+	f->nqueued++;
+	pthread_cond_signal(&f->cond);
+	return 0;
+}
+
+/* Take the oldest finished buffer, waiting unless the fd is nonblocking */
+static int fake_dequeue(struct fake *f)
+{
+	uint64_t v;
+	int i;
+
+	pthread_mutex_lock(&f->lock);
+	if (!f->running) {
+		pthread_mutex_unlock(&f->lock);
+		return fail(EINVAL);
+	}
+	pthread_mutex_unlock(&f->lock);
+
+	/* the eventfd counts the finished buffers, and is what poll sees */
+	if (syscall(SYS_read, f->fd, &v, sizeof(v)) < 0)
+		return -1;
+
+	pthread_mutex_lock(&f->lock);
+	if (f->ndone == 0) {
+		pthread_mutex_unlock(&f->lock);
+		return fail(EINVAL);
+	}
+	i = f->done[f->dhead];
+	f->dhead = (f->dhead + 1) % FAKE_MAX_BUFS;
+	f->ndone--;
+	f->bufs[i].done = 0;
+	pthread_mutex_unlock(&f->lock);
+	return i;
+}
+
+static int fake_streamon(struct fake *f)
+{
+	if (f->running)
+		return 0;
+	if (f->nbufs == 0)
+		return fail(EINVAL);
+	f->start_ns = mono_ns();
+	f->tick = 0;
+	f->running = 1;
+	if (pthread_create(&f->thread, NULL, producer, f)) {
+		f->running = 0;
+		return fail(ENOMEM);
+	}
+	return 0;
+}
+
+static void fake_streamoff(struct fake *f)
+{
+	struct pollfd pfd;
+	uint64_t v;
+	int i;
+
+	pthread_mutex_lock(&f->lock);
+	if (!f->running) {
+		pthread_mutex_unlock(&f->lock);
+		return;
+	}
+	f->running = 0;
+	pthread_cond_broadcast(&f->cond);
+	pthread_mutex_unlock(&f->lock);
+	pthread_join(f->thread, NULL);
+
+	/* nothing stays finished or queued */
+	pfd.fd = f->fd;
+	pfd.events = POLLIN;
+	while (real_poll(&pfd, 1, 0) == 1 &&
+	       syscall(SYS_read, f->fd, &v, sizeof(v)) == sizeof(v))
+		;
+	for (i = 0; i < f->nbufs; i++)
+		f->bufs[i].queued = f->bufs[i].done = 0;
+	f->qhead = f->nqueued = 0;
+	f->dhead = f->ndone = 0;
+}
+
+static void fake_free_bufs(struct fake *f)
+{
+	if (f->mem)
+		real_munmap(f->mem, f->nbufs * PAGE_ALIGN(f->bufsize));
+	f->mem = NULL;
+	f->nbufs = 0;
+	memset(f->bufs, 0, sizeof(f->bufs));
+}
+
+static int fake_alloc_bufs(struct fake *f, int count, enum v4l2_memory memory)
+{
+	size_t stride = PAGE_ALIGN(f->bufsize);
+	int i;
+
+	fake_free_bufs(f);
+	f->memory = memory;
+	if (count == 0)
+		return 0;
+	if (count < 2)
+		count = 2;
+	if (count > FAKE_MAX_BUFS)
+		count = FAKE_MAX_BUFS;
+	if (memory == V4L2_MEMORY_MMAP) {
+		f->mem = real_mmap(NULL, count * stride, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (f->mem == MAP_FAILED) {
+			f->mem = NULL;
+			return fail(ENOMEM);
+		}
+		for (i = 0; i < count; i++)
+			f->bufs[i].mem = f->mem + i * stride;
+	}
+	f->nbufs = count;
+	return count;
+}
+
+/* read() gets its own buffers and starts the capture, as the driver does */
+static void fake_stop_read(struct fake *f)
+{
+	if (!f->reading)
+		return;
+	fake_streamoff(f);
+	fake_free_bufs(f);
+	f->reading = 0;
+}
+
+static int fake_start_read(struct fake *f)
+{
+	int i;
+
+	if (f->reading)
+		return 0;
+	if (f->nbufs)
+		return fail(EBUSY);
+	if (fake_alloc_bufs(f, FAKE_READ_BUFS, V4L2_MEMORY_MMAP) < 0)
+		return -1;
+	for (i = 0; i < f->nbufs; i++)
+		fake_queue(f, i);
+	f->reading = 1;
+	f->rd_index = -1;
+	if (fake_streamon(f) < 0) {
+		fake_free_bufs(f);
+		f->reading = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/* The device node of path if it is one we stand in for, else -1 */
+static int fake_minor(const char *path, enum kind *kind)
+{
+	int n;
+	char c;
+
+	if (path == NULL)
+		return -1;
+	if (sscanf(path, "/dev/video%d%c", &n, &c) == 1) {
+		if (n >= 0 && n < 16)
+			*kind = K_MPG;
+		else if (n >= 24 && n < 32)
+			*kind = K_PCM;
+		else if (n >= 32 && n < 48)
+			*kind = K_YUV;
+		else
+			return -1;
+		return n;
+	}
+	if (sscanf(path, "/dev/vbi%d%c", &n, &c) == 1 && n >= 0 && n < 8) {
+		*kind = K_VBI;
+		return 224 + n;
+	}
+	return -1;
+}
+
+static int fake_open(enum kind kind, int flags)
+{
+	struct fake *f;
+	int i;
+
+	f = calloc(1, sizeof(*f));
+	if (f == NULL)
+		return fail(ENOMEM);
+	f->fd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC |
+			((flags & O_NONBLOCK) ? EFD_NONBLOCK : 0));
+	if (f->fd < 0) {
+		free(f);
+		return -1;
+	}
+	f->kind = kind;
+	f->pal = pal_default;
+	f->width = 720;
+	f->height = f->pal ? 576 : 480;
+	f->codec.aspect = 2;
+	f->codec.audio_bitmask = 0xe9;
+	f->codec.bframes = 3;
+	f->codec.bitrate = 6000000;
+	f->codec.bitrate_peak = 8000000;
+	f->codec.framerate = f->pal;
+	f->codec.framespergop = f->pal ? 12 : 15;
+	f->codec.gop_closure = 1;
+	f->codec.stream_type = 0;
+	f->src = -1;
+	if (kind == K_MPG && mpeg_file) {
+		f->src = real_open(mpeg_file, O_RDONLY | O_CLOEXEC);
+		if (f->src < 0) {
+			i = errno;
+			real_close(f->fd);
+			free(f);
+			return fail(i);
+		}
+	}
+	pthread_mutex_init(&f->lock, NULL);
+	pthread_cond_init(&f->cond, NULL);
+	fake_setup(f);
+
+	pthread_mutex_lock(&fakes_lock);
+	for (i = 0; i < FAKE_MAX_DEVS; i++)
+		if (fakes[i] == NULL) {
+			fakes[i] = f;
+			break;
+		}
+	pthread_mutex_unlock(&fakes_lock);
+	if (i == FAKE_MAX_DEVS) {
+		if (f->src >= 0)
+			real_close(f->src);
+		real_close(f->fd);
+		free(f);
+		return fail(EMFILE);
+	}
+	return f->fd;
+}
+
+static void fake_close(struct fake *f)
+{
+	int i;
+
+	pthread_mutex_lock(&fakes_lock);
+	for (i = 0; i < FAKE_MAX_DEVS; i++)
+		if (fakes[i] == f)
+			fakes[i] = NULL;
+	pthread_mutex_unlock(&fakes_lock);
+	fake_streamoff(f);
+	fake_free_bufs(f);
+	if (f->src >= 0)
+		real_close(f->src);
+	real_close(f->fd);
+	pthread_mutex_destroy(&f->lock);
+	pthread_cond_destroy(&f->cond);
+	free(f);
+}
+
+static void fill_v4l2_buf(struct fake *f, struct v4l2_buffer *vb, int i)
+{
+	struct fake_buf *b = &f->bufs[i];
+
+	vb->index = i;
+	vb->memory = f->memory;
+	vb->length = f->bufsize;
+	vb->bytesused = b->bytesused;
+	vb->sequence = b->sequence;
+	vb->timestamp = b->timestamp;
+	vb->field = f->kind == K_YUV ? V4L2_FIELD_INTERLACED : V4L2_FIELD_NONE;
+	vb->flags = 0;
+	if (f->memory == V4L2_MEMORY_MMAP) {
+		vb->m.offset = i * PAGE_ALIGN(f->bufsize);
+		vb->flags |= V4L2_BUF_FLAG_MAPPED;
+	} else {
+		vb->m.userptr = (unsigned long)b->mem;
+	}
+	if (b->queued)
+		vb->flags |= V4L2_BUF_FLAG_QUEUED;
+	if (b->done)
+		vb->flags |= V4L2_BUF_FLAG_DONE;
+}
+
+static int fake_qbuf(struct fake *f, struct v4l2_buffer *vb)
+{
+	int ret;
+
+	if (vb->index >= (unsigned)f->nbufs || vb->memory != f->memory)
+		return fail(EINVAL);
+	if (f->memory == V4L2_MEMORY_USERPTR) {
+		if (vb->m.userptr == 0 || vb->length < f->bufsize)
+			return fail(EINVAL);
+		f->bufs[vb->index].mem = (unsigned char *)vb->m.userptr;
+	}
+	pthread_mutex_lock(&f->lock);
+	ret = fake_queue(f, vb->index);
+	pthread_mutex_unlock(&f->lock);
+	return ret;
+}
+
+/* IVTV_IOC_BATCH_BUF: queue what is given, then dequeue all that is done */
+static int fake_batch(struct fake *f, struct ivtv_buf_batch *bb)
+{
+	struct ivtv_batch_buf *e;
+	struct v4l2_buffer vb;
+	uint32_t i, max = IVTV_BATCH_MAX;
+	int fl, idx, err = 0;
+
+	if (bb->nqueue > IVTV_BATCH_MAX)
+		return fail(EINVAL);
+	if ((bb->flags & IVTV_BATCH_LIMIT) && bb->ndone < max)
+		max = bb->ndone;
+	bb->error = 0;
+	for (i = 0; i < bb->nqueue; i++) {
+		e = &bb->buf[i];
+		memset(&vb, 0, sizeof(vb));
+		vb.index = e->index;
+		vb.memory = e->userptr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+		vb.m.userptr = e->userptr;
+		vb.length = e->length;
+		if (fake_qbuf(f, &vb) < 0) {
+			bb->nqueue = i;
+			bb->error = -errno;
+			break;
+		}
+	}
+	fl = fcntl(f->fd, F_GETFL);
+	for (i = 0; i < max; i++) {
+		/* only the first one waits */
+		if (i == 1 || !(bb->flags & IVTV_BATCH_WAIT))
+			fcntl(f->fd, F_SETFL, fl | O_NONBLOCK);
+		idx = fake_dequeue(f);
+		if (idx < 0) {
+			err = errno;
+			break;
+		}
+		memset(&vb, 0, sizeof(vb));
+		fill_v4l2_buf(f, &vb, idx);
+		e = &bb->buf[i];
+		e->index = idx;
+		e->bytesused = vb.bytesused;
+		e->sequence = vb.sequence;
+		e->flags = vb.flags;
+		e->userptr = f->memory == V4L2_MEMORY_USERPTR ? vb.m.userptr : 0;
+		e->length = vb.length;
+		e->error = 0;
+		e->ts_usec = (uint64_t)vb.timestamp.tv_sec * 1000000 +
+			vb.timestamp.tv_usec;
+		e->pts = f->bufs[idx].pts;
+		e->mono_ns = f->bufs[idx].mono_ns;
+	}
+	bb->ndone = i;
+	if (fl != -1)
+		fcntl(f->fd, F_SETFL, fl);
+	if (i == 0 && err == EINTR && bb->error == 0)
+		return fail(EINTR);
+	return 0;
+}
+
+static int fake_g_fmt(struct fake *f, struct v4l2_format *fmt)
+{
+	switch (fmt->type) {
+	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
+		if (f->kind == K_VBI)
+			return fail(EINVAL);
+		memset(&fmt->fmt.pix, 0, sizeof(fmt->fmt.pix));
+		fmt->fmt.pix.width = f->width;
+		fmt->fmt.pix.height = f->height;
+		fmt->fmt.pix.field = V4L2_FIELD_INTERLACED;
+		if (f->kind == K_YUV) {
+			fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_NV12;
+			fmt->fmt.pix.bytesperline = f->width;
+		} else {
+			fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_MPEG;
+		}
+		fmt->fmt.pix.sizeimage = f->bufsize;
+		return 0;
+	case V4L2_BUF_TYPE_VBI_CAPTURE:
+		if (f->kind != K_VBI)
+			return fail(EINVAL);
+		memset(&fmt->fmt.vbi, 0, sizeof(fmt->fmt.vbi));
+		fmt->fmt.vbi.sampling_rate = 27000000;
+		fmt->fmt.vbi.offset = 248;
+		fmt->fmt.vbi.samples_per_line = VBI_LINE;
+		fmt->fmt.vbi.sample_format = V4L2_PIX_FMT_GREY;
+		fmt->fmt.vbi.start[0] = f->pal ? 6 : 10;
+		fmt->fmt.vbi.start[1] = f->pal ? 318 : 273;
+		fmt->fmt.vbi.count[0] = fmt->fmt.vbi.count[1] = f->pal ? 18 : 12;
+		return 0;
+	}
+	return fail(EINVAL);
+}
+
+static int fake_s_fmt(struct fake *f, struct v4l2_format *fmt, int try)
+{
+	uint32_t w, h, maxh = f->pal ? 576 : 480;
+
+	if (fmt->type == V4L2_BUF_TYPE_VIDEO_CAPTURE && f->kind == K_YUV) {
+		w = fmt->fmt.pix.width & ~15;
+		h = fmt->fmt.pix.height & ~15;
+		if (w < 16)
+			w = 16;
+		if (w > 720)
+			w = 720;
+		if (h < 16)
+			h = 16;
+		if (h > maxh)
+			h = maxh;
+		if (!try) {
+			if (f->nbufs)
+				return fail(EBUSY);
+			f->width = w;
+			f->height = h;
+			fake_setup(f);
+			return fake_g_fmt(f, fmt);
+		}
+		fake_g_fmt(f, fmt);
+		fmt->fmt.pix.width = w;
+		fmt->fmt.pix.height = h;
+		fmt->fmt.pix.bytesperline = w;
+		fmt->fmt.pix.sizeimage = PAGE_ALIGN(w * h) + w * h / 2;
+		return 0;
+	}
+	/* the MPEG, PCM and VBI formats are fixed */
+	return fake_g_fmt(f, fmt);
+}
+
+static int fake_ioctl(struct fake *f, unsigned long req, void *arg)
+{
+	struct v4l2_capability *cap = arg;
+	struct v4l2_requestbuffers *rb = arg;
+	struct v4l2_buffer *vb = arg;
+	struct ivtv_buf_ts *bt = arg;
+	struct ivtv_ioctl_tune *tune = arg;
+	int idx;
+
+	switch (req) {
+	case VIDIOC_QUERYCAP:
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "ivtv");
+		strcpy((char *)cap->card, "ivtv-fake");
+		strcpy((char *)cap->bus_info, "fake");
+		cap->version = 0x000a00;
+		cap->capabilities = V4L2_CAP_TUNER | V4L2_CAP_AUDIO |
+			V4L2_CAP_READWRITE | V4L2_CAP_STREAMING |
+			(f->kind == K_VBI ? V4L2_CAP_VBI_CAPTURE :
+			 V4L2_CAP_VIDEO_CAPTURE);
+		return 0;
+
+	case VIDIOC_G_FMT:
+		return fake_g_fmt(f, arg);
+	case VIDIOC_S_FMT:
+		return fake_s_fmt(f, arg, 0);
+	case VIDIOC_TRY_FMT:
+		return fake_s_fmt(f, arg, 1);
+
+	case VIDIOC_G_STD:
+		*(v4l2_std_id *)arg = f->pal ? V4L2_STD_PAL : V4L2_STD_NTSC;
+		return 0;
+	case VIDIOC_S_STD:
+		if (f->nbufs)
+			return fail(EBUSY);
+		f->pal = !(*(v4l2_std_id *)arg & V4L2_STD_525_60);
+		if (f->height > (f->pal ? 576u : 480u))
+			f->height = f->pal ? 576 : 480;
+		f->codec.framerate = f->pal;
+		f->codec.framespergop = f->pal ? 12 : 15;
+		fake_setup(f);
+		return 0;
+
+	case VIDIOC_CROPCAP:
+		/* no scaler, the tools go on without cropping */
+		return fail(EINVAL);
+
+	case VIDIOC_REQBUFS:
+		if (rb->memory != V4L2_MEMORY_MMAP &&
+		    rb->memory != V4L2_MEMORY_USERPTR)
+			return fail(EINVAL);
+		fake_stop_read(f);
+		if (f->running)
+			return fail(EBUSY);
+		idx = fake_alloc_bufs(f, rb->count, rb->memory);
+		if (idx < 0)
+			return -1;
+		rb->count = idx;
+		return 0;
+
+	case VIDIOC_QUERYBUF:
+		if (vb->index >= (unsigned)f->nbufs)
+			return fail(EINVAL);
+		pthread_mutex_lock(&f->lock);
+		fill_v4l2_buf(f, vb, vb->index);
+		pthread_mutex_unlock(&f->lock);
+		return 0;
+
+	case VIDIOC_QBUF:
+		if (f->reading)
+			return fail(EBUSY);
+		return fake_qbuf(f, vb);
+
+	case VIDIOC_DQBUF:
+		if (f->reading)
+			return fail(EBUSY);
+		idx = fake_dequeue(f);
+		if (idx < 0)
+			return -1;
+		fill_v4l2_buf(f, vb, idx);
+		return 0;
+
+	case VIDIOC_STREAMON:
+		if (f->reading)
+			return fail(EBUSY);
+		return fake_streamon(f);
+	case VIDIOC_STREAMOFF:
+		if (!f->reading)
+			fake_streamoff(f);
+		return 0;
+
+	case IVTV_IOC_G_CODEC:
+		*(struct ivtv_ioctl_codec *)arg = f->codec;
+		return 0;
+	case IVTV_IOC_S_CODEC:
+		if (f->running)
+			return fail(EBUSY);
+		idx = f->codec.framerate;
+		f->codec = *(struct ivtv_ioctl_codec *)arg;
+		f->codec.framerate = idx;
+		f->codec.framespergop = f->pal ? 12 : 15;
+		fake_setup(f);
+		return 0;
+
+	case IVTV_IOC_G_ENC_INDEX:
+		/* no index, the firmware only keeps one for real encodes */
+		memset(arg, 0, sizeof(struct ivtv_enc_index));
+		return 0;
+
+	case IVTV_IOC_G_BUF_TS:
+		if (bt->index >= (unsigned)f->nbufs)
+			return fail(EINVAL);
+		bt->sequence = f->bufs[bt->index].sequence;
+		bt->pts = f->bufs[bt->index].pts;
+		bt->mono_ns = f->bufs[bt->index].mono_ns;
+		return 0;
+
+	case IVTV_IOC_BATCH_BUF:
+		if (f->reading)
+			return fail(EBUSY);
+		return fake_batch(f, arg);
+
+	case IVTV_IOC_S_PACK:
+		if (f->kind != K_PCM && f->kind != K_VBI)
+			return fail(EINVAL);
+		if (f->running || f->nbufs)
+			return fail(EBUSY);
+		f->pack = ((struct ivtv_pack *)arg)->chunks;
+		if (f->pack > IVTV_PACK_MAX_CHUNKS)
+			f->pack = IVTV_PACK_MAX_CHUNKS;
+		fake_setup(f);
+		((struct ivtv_pack *)arg)->chunks = f->pack;
+		((struct ivtv_pack *)arg)->bufsize = f->bufsize;
+		return 0;
+
+	case IVTV_IOC_S_FREQUENCY_WAIT:
+		tune->status = IVTV_TUNE_LOCKED | IVTV_TUNE_VIDEO;
+		tune->afc = 0;
+		tune->lock_time = tune->signal_time = 0;
+		return 0;
+
+	case VIDIOC_S_CTRL:
+	case VIDIOC_S_INPUT:
+	case VIDIOC_S_AUDIO:
+	case VIDIOC_S_TUNER:
+	case VIDIOC_S_CROP:
+	case IVTV_IOC_S_GOP_END:
+		return 0;
+	}
+
+	/* tuning, inputs, controls: accepted without effect */
+	if (_IOC_TYPE(req) == 'V' || _IOC_TYPE(req) == '@')
+		if (_IOC_DIR(req) == _IOC_WRITE)
+			return 0;
+	return fail(EINVAL);
+}
+
+static ssize_t fake_read(struct fake *f, void *buf, size_t count)
+{
+	struct fake_buf *b;
+	size_t n;
+	int ret;
+
+	if (f->nbufs && !f->reading)
+		return fail(EBUSY);
+	if (fake_start_read(f) < 0)
+		return -1;
+	if (f->rd_index < 0) {
+		f->rd_index = fake_dequeue(f);
+		if (f->rd_index < 0)
+			return -1;
+		f->rd_off = 0;
+	}
+	b = &f->bufs[f->rd_index];
+	n = b->bytesused - f->rd_off;
+	if (n > count)
+		n = count;
+	memcpy(buf, b->mem + f->rd_off, n);
+	f->rd_off += n;
+	if (f->rd_off == b->bytesused) {
+		pthread_mutex_lock(&f->lock);
+		ret = fake_queue(f, f->rd_index);
+		pthread_mutex_unlock(&f->lock);
+		f->rd_index = -1;
+		if (ret < 0)
+			return -1;
+	}
+	return n;
+}
+
+/* The interposed calls */
+
+static int do_open(int (*fn)(const char *, int, ...), const char *path,
+		   int flags, mode_t mode)
+{
+	enum kind kind;
+
+	if (fake_minor(path, &kind) >= 0)
+		return fake_open(kind, flags);
+	return fn(path, flags, mode);
+}
+
+int open(const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode = 0;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	return do_open(real_open, path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode = 0;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	return do_open(real_open64, path, flags, mode);
+}
+
+/* what open() becomes with _FORTIFY_SOURCE */
+int __open_2(const char *path, int flags)
+{
+	return do_open(real_open, path, flags, 0);
+}
+
+int __open64_2(const char *path, int flags)
+{
+	return do_open(real_open64, path, flags, 0);
+}
+
+/* The tools check that the device is a character device first */
+static int fake_stat(const char *path, struct stat *st)
+{
+	enum kind kind;
+	int minor = fake_minor(path, &kind);
+
+	if (minor < 0)
+		return 0;
+	memset(st, 0, sizeof(*st));
+	st->st_mode = S_IFCHR | 0660;
+	st->st_rdev = makedev(81, minor);
+	st->st_nlink = 1;
+	return 1;
+}
+
+int stat(const char *path, struct stat *st)
+{
+	if (fake_stat(path, st))
+		return 0;
+	return real_stat(path, st);
+}
+
+int stat64(const char *path, struct stat64 *st)
+{
+	struct stat s;
+
+	if (fake_stat(path, &s)) {
+		memset(st, 0, sizeof(*st));
+		st->st_mode = s.st_mode;
+		st->st_rdev = s.st_rdev;
+		st->st_nlink = s.st_nlink;
+		return 0;
+	}
+	return real_stat64(path, st);
+}
+
+/* what stat() calls in glibc before 2.33 */
+int __xstat(int ver, const char *path, struct stat *st)
+{
+	if (fake_stat(path, st))
+		return 0;
+	return real_xstat(ver, path, st);
+}
+
+/* Waiting for a read capture starts it, as the driver's poll does */
+static void fake_poll_start(int fd)
+{
+	struct fake *f = fake_get(fd);
+
+	if (f && !f->nbufs)
+		fake_start_read(f);
+}
+
+int select(int nfds, fd_set *rfds, fd_set *wfds, fd_set *efds,
+	   struct timeval *timeout)
+{
+	int i;
+
+	for (i = 0; rfds && i < nfds; i++)
+		if (FD_ISSET(i, rfds))
+			fake_poll_start(i);
+	return real_select(nfds, rfds, wfds, efds, timeout);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	nfds_t i;
+
+	for (i = 0; i < nfds; i++)
+		if (fds[i].events & POLLIN)
+			fake_poll_start(fds[i].fd);
+	return real_poll(fds, nfds, timeout);
+}
+
+int close(int fd)
+{
+	struct fake *f = fake_get(fd);
+
+	if (f) {
+		fake_close(f);
+		return 0;
+	}
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long req, ...)
+{
+	struct fake *f = fake_get(fd);
+	va_list ap;
+	void *arg;
+
+	va_start(ap, req);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+	/* the kernel only looks at 32 bits, tools pass an int */
+	if (f)
+		return fake_ioctl(f, (unsigned int)req, arg);
+	return real_ioctl(fd, req, arg);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	struct fake *f = fake_get(fd);
+
+	if (f)
+		return fake_read(f, buf, count);
+	return real_read(fd, buf, count);
+}
+
+ssize_t __read_chk(int fd, void *buf, size_t count, size_t buflen)
+{
+	return read(fd, buf, count);
+}
+
+/* Our own buffers stand in for the driver's, they stay until close */
+static void *do_mmap(struct fake *f, size_t length, off_t offset)
+{
+	size_t stride = PAGE_ALIGN(f->bufsize);
+
+	if (f->memory != V4L2_MEMORY_MMAP || f->mem == NULL ||
+	    offset % stride || offset / stride >= (off_t)f->nbufs ||
+	    length > stride) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+	return f->mem + offset;
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	struct fake *f = fake_get(fd);
+
+	if (f)
+		return do_mmap(f, length, offset);
+	return real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd,
+	     off64_t offset)
+{
+	struct fake *f = fake_get(fd);
+
+	if (f)
+		return do_mmap(f, length, offset);
+	return real_mmap64(addr, length, prot, flags, fd, offset);
+}
+
+int munmap(void *addr, size_t length)
+{
+	int i;
+
+	pthread_mutex_lock(&fakes_lock);
+	for (i = 0; i < FAKE_MAX_DEVS; i++) {
+		struct fake *f = fakes[i];
+
+		if (f && f->mem && (unsigned char *)addr >= f->mem &&
+		    (unsigned char *)addr < f->mem + f->nbufs * PAGE_ALIGN(f->bufsize)) {
+			pthread_mutex_unlock(&fakes_lock);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&fakes_lock);
+	return real_munmap(addr, length);
+}
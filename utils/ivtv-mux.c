@@ -0,0 +1,1142 @@
+/*
+   Capture the YUV, PCM and VBI streams of an ivtv card into one AVI
+
+   Each stream is dequeued by its own thread and handed to the writer
+   through a lock-free single producer/single consumer ring. The writer
+   always takes the packet with the lowest timestamp of the three, so the
+   streams come out interleaved in capture order. Video (I420, converted
+   from the card's HM12) is the master clock: missing frames are filled
+   with empty chunks, and the audio is kept in step by inserting silence
+   or dropping samples once it drifts by more than the tolerance. The
+   drift seen before correction is reported at the end.
+
+   With -p the PCM and raw VBI transfers are packed several to a buffer
+   (IVTV_IOC_S_PACK), for fewer wakeups and ioctls. Each transfer in a
+   buffer still becomes a packet of its own, with its own PTS.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <asm/types.h>
+#include <inttypes.h>
+
+#define __user
+#include "videodev2.h"
+#include "ivtv.h"
+#include "ivtv-pts.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define NUMBUFS		8
+#define RING_SIZE	64	/* packets, power of two */
+#define WAIT_MS		200	/* longest the writer waits for a stream */
+#define SPLIT_SIZE	(1000 << 20)	/* start a new file after this */
+#define SPLIT_MAX	(2000u << 20)	/* even if no video frame comes */
+
+enum { S_VIDEO, S_AUDIO, S_VBI, NSTREAMS };
+
+static const char *stream_name[NSTREAMS] = { "video", "audio", "vbi" };
+static const char *chunk_id[NSTREAMS] = { "00dc", "01wb", "02dt" };
+
+struct packet {
+	int64_t pts;		/* 90 kHz */
+	uint32_t size;
+	uint32_t sequence;
+	uint8_t data[0];
+};
+
+/* Lock-free, one capture thread pushes and the writer pops */
+struct ring {
+	struct packet *slot[RING_SIZE];
+	volatile unsigned head;	/* written by the producer only */
+	volatile unsigned tail;	/* written by the consumer only */
+};
+
+struct mapping {
+	void *start;
+	size_t length;
+};
+
+struct stream {
+	const char *device;
+	int fd;
+	enum v4l2_buf_type type;
+	struct mapping *bufs;
+	int nbufs;
+	pthread_t thread;
+	int running;		/* thread started */
+	struct ring ring;
+	volatile int done;
+	struct ivtv_pts_clock clock;
+	int packed;		/* transfers per buffer, 0 unpacked */
+
+	/* capture thread statistics */
+	unsigned long packets;
+	unsigned long chunks;	/* transfers in packed buffers */
+	unsigned long bad_packs;	/* packed buffers that didn't parse */
+	unsigned long overruns;	/* ring full, packet dropped */
+	unsigned long seq_gaps;	/* frames lost by the driver */
+	unsigned hiwater;	/* most packets waiting in the ring */
+	uint32_t last_seq;
+
+	/* writer statistics */
+	unsigned long written;	/* frames or samples in the file */
+	unsigned long long bytes;
+	unsigned long late;	/* arrived after a later packet was written */
+	unsigned long filled;	/* empty frames or silent samples added */
+	unsigned long dropped;	/* samples dropped */
+};
+
+struct index_entry {
+	char id[4];
+	uint32_t flags;
+	uint32_t offset;
+	uint32_t size;
+};
+
+struct avi {
+	const char *name;
+	int part;
+	int fd;
+	uint32_t movi;		/* file offset of the movi list */
+	uint32_t pos;		/* current file offset */
+	uint32_t frames[NSTREAMS];	/* per file dwLength */
+	struct index_entry *index;
+	int nindex, maxindex;
+	uint32_t hdr_len[NSTREAMS];	/* offsets of the fields patched at close */
+	uint32_t hdr_frames;
+};
+
+static struct stream streams[NSTREAMS];
+static struct avi avi;
+static sem_t ready;
+static volatile int stop;
+
+static int width = 720, height = 480;
+static int fps_num = 30000, fps_den = 1001;
+static int rate = 48000;
+static int64_t frame_dur;	/* 90 kHz ticks per frame */
+static int tolerance = 40;	/* msecs of audio drift before correcting */
+static int correct = 1;
+static int pack;		/* -p */
+static long wait_ms = WAIT_MS;
+static uint8_t *vbi_fmt;	/* strf of the VBI stream */
+static int vbi_fmt_len;
+
+static int64_t drift_min, drift_max, drift_sum;
+static unsigned long drift_n;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "    -y <device>    YUV device (default: /dev/video32, none to skip)\n");
+	fprintf(stderr, "    -a <device>    PCM device (default: /dev/video24, none to skip)\n");
+	fprintf(stderr, "    -v <device>    VBI device (default: none)\n");
+	fprintf(stderr, "    -o <file>      output file (default: capture.avi)\n");
+	fprintf(stderr, "    -t <secs>      stop after this many seconds (default: until ^C)\n");
+	fprintf(stderr, "    -d <msecs>     audio drift tolerated before correcting (default: %d)\n", tolerance);
+	fprintf(stderr, "    -n             don't correct audio drift, only report it\n");
+	fprintf(stderr, "    -p <chunks>    pack up to this many PCM and VBI transfers into a buffer\n");
+	fprintf(stderr, "    -h             display this help message\n");
+}
+
+static void sig_stop(int sig)
+{
+	stop = 1;
+}
+
+static int xioctl(int fd, int request, void *arg)
+{
+	int r;
+
+	do r = ioctl(fd, request, arg);
+	while (r == -1 && errno == EINTR);
+	return r;
+}
+
+static int ring_push(struct ring *r, struct packet *p)
+{
+	if (r->head - r->tail == RING_SIZE)
+		return -1;
+	r->slot[r->head & (RING_SIZE - 1)] = p;
+	/* the packet must be visible before the new head */
+	__sync_synchronize();
+	r->head++;
+	return 0;
+}
+
+static struct packet *ring_peek(struct ring *r)
+{
+	if (r->tail == r->head)
+		return NULL;
+	__sync_synchronize();
+	return r->slot[r->tail & (RING_SIZE - 1)];
+}
+
+static void ring_pop(struct ring *r)
+{
+	/* done with the slot before the producer may reuse it */
+	__sync_synchronize();
+	r->tail++;
+}
+
+/* The capture time of a dequeued buffer in 90 kHz units. The firmware
+   PTS is mapped to CLOCK_MONOTONIC, which lines the streams up to well
+   within a frame. Without IVTV_IOC_G_BUF_TS all there is is the time
+   the DMA completed. */
+static int64_t buf_pts(struct stream *s, const struct v4l2_buffer *b, int size)
+{
+	struct ivtv_buf_ts ts;
+	int64_t pts;
+
+	memset(&ts, 0, sizeof(ts));
+	ts.index = b->index;
+	if (xioctl(s->fd, IVTV_IOC_G_BUF_TS, &ts) == 0) {
+		ivtv_pts_update(&s->clock, ts.pts, ts.mono_ns);
+		return ivtv_pts_to_ns(&s->clock, ts.pts) * 9 / 100000;
+	}
+
+	pts = (int64_t)b->timestamp.tv_sec * 90000 + b->timestamp.tv_usec * 9 / 100;
+	/* the buffer is done after its last sample, the packet starts
+	   with the first one */
+	if (s == &streams[S_AUDIO])
+		pts -= (int64_t)size / 4 * 90000 / rate;
+	return pts;
+}
+
+/* HM12 is 16x16 macroblocks of Y, then the page aligned UV plane in
+   16x16 blocks of interleaved UV. Unpack into planar I420. */
+static void hm12_to_i420(uint8_t *dst, const uint8_t *src)
+{
+	uint8_t *dstu = dst + width * height;
+	uint8_t *dstv = dstu + width * height / 4;
+	int pagesize = getpagesize();
+	int x, y, i, j;
+
+	for (y = 0; y < height; y += 16)
+		for (x = 0; x < width; x += 16)
+			for (i = 0; i < 16; i++) {
+				if (y + i < height)
+					memcpy(dst + x + (y + i) * width, src, 16);
+				src += 16;
+			}
+
+	src += (pagesize - (width * height) % pagesize) % pagesize;
+	for (y = 0; y < height / 2; y += 16)
+		for (x = 0; x < width / 2; x += 8)
+			for (i = 0; i < 16; i++) {
+				int idx = x + (y + i) * width / 2;
+
+				if (y + i < height / 2) {
+					for (j = 0; j < 8; j++) {
+						dstu[idx + j] = src[2 * j];
+						dstv[idx + j] = src[2 * j + 1];
+					}
+				}
+				src += 16;
+			}
+}
+
+static int open_stream(struct stream *s, int id)
+{
+	struct v4l2_requestbuffers req;
+	struct v4l2_format fmt;
+	struct v4l2_buffer buf;
+	int i;
+
+	if ((s->fd = open(s->device, O_RDWR | O_NONBLOCK)) < 0) {
+		fprintf(stderr, "%s: %s\n", s->device, strerror(errno));
+		return -1;
+	}
+
+	memset(&fmt, 0, sizeof(fmt));
+	switch (id) {
+	case S_VIDEO:
+		s->type = fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (xioctl(s->fd, VIDIOC_G_FMT, &fmt) == 0) {
+			width = fmt.fmt.pix.width;
+			height = fmt.fmt.pix.height;
+		}
+		break;
+	case S_AUDIO:
+		s->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		break;
+	case S_VBI:
+		/* sliced if the card was set up for it, raw otherwise */
+		fmt.type = V4L2_BUF_TYPE_SLICED_VBI_CAPTURE;
+		if (xioctl(s->fd, VIDIOC_G_FMT, &fmt) == 0 && fmt.fmt.sliced.service_set) {
+			s->type = V4L2_BUF_TYPE_SLICED_VBI_CAPTURE;
+		} else {
+			s->type = fmt.type = V4L2_BUF_TYPE_VBI_CAPTURE;
+			xioctl(s->fd, VIDIOC_G_FMT, &fmt);
+		}
+		vbi_fmt_len = sizeof(fmt);
+		vbi_fmt = malloc(vbi_fmt_len);
+		memcpy(vbi_fmt, &fmt, vbi_fmt_len);
+		break;
+	}
+
+	if (pack && (id == S_AUDIO || s->type == V4L2_BUF_TYPE_VBI_CAPTURE)) {
+		struct ivtv_pack pk;
+
+		memset(&pk, 0, sizeof(pk));
+		pk.chunks = pack;
+		if (xioctl(s->fd, IVTV_IOC_S_PACK, &pk) == 0)
+			s->packed = pk.chunks;
+		else
+			fprintf(stderr, "%s: IVTV_IOC_S_PACK: %s, one transfer per buffer\n",
+					s->device, strerror(errno));
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.count = NUMBUFS;
+	req.type = s->type;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (xioctl(s->fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) {
+		fprintf(stderr, "%s: VIDIOC_REQBUFS: %s\n", s->device, strerror(errno));
+		return -1;
+	}
+
+	s->bufs = calloc(req.count, sizeof(*s->bufs));
+	for (i = 0; i < req.count; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = s->type;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (xioctl(s->fd, VIDIOC_QUERYBUF, &buf) < 0) {
+			fprintf(stderr, "%s: VIDIOC_QUERYBUF: %s\n", s->device, strerror(errno));
+			return -1;
+		}
+		s->bufs[i].length = buf.length;
+		s->bufs[i].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+				MAP_SHARED, s->fd, buf.m.offset);
+		if (s->bufs[i].start == MAP_FAILED) {
+			fprintf(stderr, "%s: mmap: %s\n", s->device, strerror(errno));
+			return -1;
+		}
+		if (xioctl(s->fd, VIDIOC_QBUF, &buf) < 0) {
+			fprintf(stderr, "%s: VIDIOC_QBUF: %s\n", s->device, strerror(errno));
+			return -1;
+		}
+	}
+	s->nbufs = req.count;
+	return 0;
+}
+
+static void close_stream(struct stream *s)
+{
+	int i;
+
+	xioctl(s->fd, VIDIOC_STREAMOFF, &s->type);
+	for (i = 0; i < s->nbufs; i++)
+		munmap(s->bufs[i].start, s->bufs[i].length);
+	free(s->bufs);
+	close(s->fd);
+}
+
+static void count_buffer(struct stream *s, uint32_t sequence)
+{
+	if (s->packets && sequence != s->last_seq + 1)
+		s->seq_gaps += sequence - s->last_seq - 1;
+	s->last_seq = sequence;
+	s->packets++;
+}
+
+/* Copy a dequeued buffer into a new packet, the pts left to the caller */
+static struct packet *new_packet(struct stream *s, int index, uint32_t sequence,
+				 int bytesused)
+{
+	struct packet *p;
+	int size;
+
+	count_buffer(s, sequence);
+
+	size = s == &streams[S_VIDEO] ? width * height * 3 / 2 : bytesused;
+	p = malloc(sizeof(*p) + size);
+	if (p == NULL)
+		return NULL;
+	p->size = size;
+	p->sequence = sequence;
+	if (s == &streams[S_VIDEO])
+		hm12_to_i420(p->data, s->bufs[index].start);
+	else
+		memcpy(p->data, s->bufs[index].start, size);
+	return p;
+}
+
+static void push_packet(struct stream *s, struct packet *p)
+{
+	unsigned waiting;
+
+	if (ring_push(&s->ring, p)) {
+		s->overruns++;
+		free(p);
+		return;
+	}
+	waiting = s->ring.head - s->ring.tail;
+	if (waiting > s->hiwater)
+		s->hiwater = waiting;
+	sem_post(&ready);
+}
+
+/* A packed buffer: a packet for each transfer listed in the header. The
+   buffer was done with its last transfer, mono_ns maps that one's PTS
+   to the host clock, the others are placed by their PTS from it. With
+   no mono_ns, done_pts is the 90 kHz host time the buffer was done.
+   Returns -1 if out of memory. */
+static int push_chunks(struct stream *s, int index, uint32_t sequence,
+		       uint32_t bytesused, uint64_t mono_ns, int64_t done_pts)
+{
+	const uint8_t *start = s->bufs[index].start;
+	const struct ivtv_pack_header *h = (const struct ivtv_pack_header *)start;
+	const struct ivtv_pack_entry *e, *last;
+	struct packet *p;
+	uint32_t i;
+
+	count_buffer(s, sequence);
+	if (bytesused < sizeof(*h) || h->magic != IVTV_PACK_MAGIC ||
+	    h->count == 0 || h->count > IVTV_PACK_MAX_CHUNKS) {
+		s->bad_packs++;
+		return 0;
+	}
+	last = &h->entry[h->count - 1];
+	if (mono_ns) {
+		ivtv_pts_update(&s->clock, last->pts, mono_ns);
+		done_pts = ivtv_pts_to_ns(&s->clock, last->pts) * 9 / 100000;
+	}
+
+	for (i = 0; i < h->count; i++) {
+		e = &h->entry[i];
+		if (e->offset < sizeof(*h) || e->offset > bytesused ||
+		    e->size > bytesused - e->offset) {
+			s->bad_packs++;
+			return 0;
+		}
+		p = malloc(sizeof(*p) + e->size);
+		if (p == NULL)
+			return -1;
+		p->size = e->size;
+		p->sequence = sequence;
+		memcpy(p->data, start + e->offset, e->size);
+		/* the 33 bit PTS may have wrapped in between */
+		p->pts = done_pts - (int64_t)((last->pts - e->pts) & 0x1ffffffffULL);
+		s->chunks++;
+		push_packet(s, p);
+	}
+	return 0;
+}
+
+static int wait_stream(struct stream *s)
+{
+	struct timeval tv;
+	fd_set fds;
+
+	FD_ZERO(&fds);
+	FD_SET(s->fd, &fds);
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	return select(s->fd + 1, &fds, NULL, NULL, &tv);
+}
+
+/* PCM and VBI buffers are small and come many a second. IVTV_IOC_BATCH_BUF
+   takes all the buffers that are done, with their timestamps, and gives
+   back the ones copied before in one call, in place of a VIDIOC_DQBUF,
+   IVTV_IOC_G_BUF_TS and VIDIOC_QBUF for each. Returns -1 at once if the
+   driver doesn't have it. */
+static int capture_batch(struct stream *s)
+{
+	struct ivtv_buf_batch b;
+	struct ivtv_batch_buf *e;
+	struct packet *p;
+	unsigned i;
+
+	memset(&b, 0, sizeof(b));
+	while (!stop) {
+		if (wait_stream(s) <= 0)
+			continue;
+		if (ioctl(s->fd, IVTV_IOC_BATCH_BUF, &b) < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EINVAL || errno == ENOTTY) && s->packets == 0)
+				return -1;
+			fprintf(stderr, "%s: IVTV_IOC_BATCH_BUF: %s\n", s->device, strerror(errno));
+			return 0;
+		}
+		if (b.error) {
+			fprintf(stderr, "%s: IVTV_IOC_BATCH_BUF: %s\n", s->device, strerror(-b.error));
+			return 0;
+		}
+		for (i = 0; i < b.ndone; i++) {
+			e = &b.buf[i];
+			if (e->error)
+				continue;
+			if (s->packed) {
+				if (push_chunks(s, e->index, e->sequence, e->bytesused,
+						e->mono_ns, e->ts_usec * 9 / 100) < 0)
+					return 0;
+				continue;
+			}
+			p = new_packet(s, e->index, e->sequence, e->bytesused);
+			if (p == NULL)
+				return 0;
+			ivtv_pts_update(&s->clock, e->pts, e->mono_ns);
+			p->pts = ivtv_pts_to_ns(&s->clock, e->pts) * 9 / 100000;
+			push_packet(s, p);
+		}
+		b.nqueue = b.ndone;
+	}
+	return 0;
+}
+
+static void *capture_thread(void *arg)
+{
+	struct stream *s = arg;
+	struct v4l2_buffer buf;
+	struct packet *p;
+
+	if (xioctl(s->fd, VIDIOC_STREAMON, &s->type) < 0) {
+		fprintf(stderr, "%s: VIDIOC_STREAMON: %s\n", s->device, strerror(errno));
+		goto out;
+	}
+
+	if (capture_batch(s) == 0)
+		goto out;
+
+	while (!stop) {
+		if (wait_stream(s) <= 0)
+			continue;
+
+		memset(&buf, 0, sizeof(buf));
+		buf.type = s->type;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (xioctl(s->fd, VIDIOC_DQBUF, &buf) < 0) {
+			if (errno == EAGAIN || errno == EIO)
+				continue;
+			fprintf(stderr, "%s: VIDIOC_DQBUF: %s\n", s->device, strerror(errno));
+			break;
+		}
+
+		if (s->packed) {
+			struct ivtv_buf_ts ts;
+
+			memset(&ts, 0, sizeof(ts));
+			ts.index = buf.index;
+			if (xioctl(s->fd, IVTV_IOC_G_BUF_TS, &ts) < 0)
+				ts.mono_ns = 0;
+			if (push_chunks(s, buf.index, buf.sequence, buf.bytesused, ts.mono_ns,
+					(int64_t)buf.timestamp.tv_sec * 90000 +
+					buf.timestamp.tv_usec * 9 / 100) < 0)
+				break;
+			if (xioctl(s->fd, VIDIOC_QBUF, &buf) < 0) {
+				fprintf(stderr, "%s: VIDIOC_QBUF: %s\n", s->device, strerror(errno));
+				break;
+			}
+			continue;
+		}
+
+		p = new_packet(s, buf.index, buf.sequence, buf.bytesused);
+		if (p == NULL)
+			break;
+		p->pts = buf_pts(s, &buf, p->size);
+
+		if (xioctl(s->fd, VIDIOC_QBUF, &buf) < 0) {
+			fprintf(stderr, "%s: VIDIOC_QBUF: %s\n", s->device, strerror(errno));
+			free(p);
+			break;
+		}
+		push_packet(s, p);
+	}
+
+out:
+	__sync_synchronize();
+	s->done = 1;
+	sem_post(&ready);
+	return NULL;
+}
+
+/* AVI writing, little endian fields built in a byte buffer */
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+	return p + 4;
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	return p + 2;
+}
+
+static uint8_t *putid(uint8_t *p, const char *id)
+{
+	memcpy(p, id, 4);
+	return p + 4;
+}
+
+static int avi_write(const void *data, uint32_t len)
+{
+	const uint8_t *p = data;
+	int n;
+
+	while (len) {
+		n = write(avi.fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "%s: write: %s\n", avi.name, strerror(errno));
+			return -1;
+		}
+		p += n;
+		len -= n;
+		avi.pos += n;
+	}
+	return 0;
+}
+
+static void avi_patch(uint32_t offset, uint32_t v)
+{
+	uint8_t b[4];
+
+	put32(b, v);
+	if (pwrite(avi.fd, b, 4, offset) != 4)
+		fprintf(stderr, "%s: write: %s\n", avi.name, strerror(errno));
+}
+
+static uint8_t *avi_strl(uint8_t *p, int id, uint32_t *len_offset, uint8_t *base)
+{
+	uint8_t *list = p, *strf;
+	uint32_t scale, srate, samplesize, bufsize;
+	const char *type;
+
+	switch (id) {
+	case S_VIDEO:
+		type = "vids";
+		scale = fps_den;
+		srate = fps_num;
+		samplesize = 0;
+		bufsize = width * height * 3 / 2;
+		break;
+	case S_AUDIO:
+		type = "auds";
+		scale = 1;
+		srate = rate;
+		samplesize = 4;
+		bufsize = rate * 4 / 10;
+		break;
+	default:
+		type = "dats";
+		scale = fps_den;
+		srate = fps_num;
+		samplesize = 0;
+		bufsize = 0;
+		break;
+	}
+
+	p = putid(p, "LIST");
+	p += 4;
+	p = putid(p, "strl");
+
+	p = putid(p, "strh");
+	p = put32(p, 56);
+	p = putid(p, type);
+	p = putid(p, id == S_VIDEO ? "I420" : "\0\0\0\0");
+	p = put32(p, 0);		/* flags */
+	p = put32(p, 0);		/* priority, language */
+	p = put32(p, 0);		/* initial frames */
+	p = put32(p, scale);
+	p = put32(p, srate);
+	p = put32(p, 0);		/* start */
+	*len_offset = p - base;
+	p = put32(p, 0);		/* length, patched at close */
+	p = put32(p, bufsize);
+	p = put32(p, 0xffffffff);	/* quality */
+	p = put32(p, samplesize);
+	p = put16(p, 0);		/* frame rectangle */
+	p = put16(p, 0);
+	p = put16(p, id == S_VIDEO ? width : 0);
+	p = put16(p, id == S_VIDEO ? height : 0);
+
+	p = putid(p, "strf");
+	strf = p;
+	p += 4;
+	switch (id) {
+	case S_VIDEO:		/* BITMAPINFOHEADER */
+		p = put32(p, 40);
+		p = put32(p, width);
+		p = put32(p, height);
+		p = put16(p, 1);
+		p = put16(p, 12);
+		p = putid(p, "I420");
+		p = put32(p, width * height * 3 / 2);
+		p = put32(p, 0);
+		p = put32(p, 0);
+		p = put32(p, 0);
+		p = put32(p, 0);
+		break;
+	case S_AUDIO:		/* WAVEFORMATEX, 16 bit stereo PCM */
+		p = put16(p, 1);
+		p = put16(p, 2);
+		p = put32(p, rate);
+		p = put32(p, rate * 4);
+		p = put16(p, 4);
+		p = put16(p, 16);
+		p = put16(p, 0);
+		break;
+	default:		/* the struct v4l2_format of the VBI device */
+		memcpy(p, vbi_fmt, vbi_fmt_len);
+		p += vbi_fmt_len;
+		break;
+	}
+	put32(strf, p - strf - 4);
+	put32(list + 4, p - list - 8);
+	return p;
+}
+
+static int avi_open(void)
+{
+	uint8_t hdr[4096], *p = hdr, *hdrl;
+	char name[1024];
+	const char *dot;
+	int nstreams = 0, i;
+
+	for (i = 0; i < NSTREAMS; i++)
+		if (streams[i].device)
+			nstreams++;
+
+	if (avi.part == 0) {
+		snprintf(name, sizeof(name), "%s", avi.name);
+	} else {
+		dot = strrchr(avi.name, '.');
+		if (dot == NULL)
+			dot = avi.name + strlen(avi.name);
+		snprintf(name, sizeof(name), "%.*s-%d%s", (int)(dot - avi.name),
+				avi.name, avi.part, dot);
+	}
+	avi.fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (avi.fd < 0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		return -1;
+	}
+	fprintf(stderr, "Writing %s\n", name);
+
+	p = putid(p, "RIFF");
+	p += 4;			/* patched at close */
+	p = putid(p, "AVI ");
+	hdrl = p;
+	p = putid(p, "LIST");
+	p += 4;
+	p = putid(p, "hdrl");
+
+	p = putid(p, "avih");
+	p = put32(p, 56);
+	p = put32(p, (uint64_t)1000000 * fps_den / fps_num);
+	p = put32(p, 0);		/* max bytes per second */
+	p = put32(p, 0);		/* padding granularity */
+	p = put32(p, 0x10);		/* AVIF_HASINDEX */
+	avi.hdr_frames = p - hdr;
+	p = put32(p, 0);		/* total frames, patched at close */
+	p = put32(p, 0);		/* initial frames */
+	p = put32(p, nstreams);
+	p = put32(p, width * height * 3 / 2);
+	p = put32(p, width);
+	p = put32(p, height);
+	memset(p, 0, 16);
+	p += 16;
+
+	for (i = 0; i < NSTREAMS; i++)
+		if (streams[i].device)
+			p = avi_strl(p, i, &avi.hdr_len[i], hdr);
+	put32(hdrl + 4, p - hdrl - 8);
+
+	p = putid(p, "LIST");
+	p += 4;			/* patched at close */
+	p = putid(p, "movi");
+
+	avi.pos = 0;
+	avi.movi = p - hdr - 12;
+	avi.nindex = 0;
+	memset(avi.frames, 0, sizeof(avi.frames));
+	memset(hdr + 4, 0, 4);
+	memset(hdr + avi.movi + 4, 0, 4);
+	return avi_write(hdr, p - hdr);
+}
+
+static int avi_close(void)
+{
+	uint8_t b[16];
+	uint32_t movi_end = avi.pos;
+	int i, r = 0;
+
+	/* idx1, offsets relative to the "movi" fourcc */
+	put32(putid(b, "idx1"), avi.nindex * 16);
+	r |= avi_write(b, 8);
+	for (i = 0; i < avi.nindex && r == 0; i++) {
+		uint8_t *p = putid(b, avi.index[i].id);
+
+		p = put32(p, avi.index[i].flags);
+		p = put32(p, avi.index[i].offset - avi.movi - 8);
+		put32(p, avi.index[i].size);
+		r |= avi_write(b, 16);
+	}
+
+	avi_patch(4, avi.pos - 8);
+	avi_patch(avi.movi + 4, movi_end - avi.movi - 8);
+	avi_patch(avi.hdr_frames, avi.frames[S_VIDEO]);
+	for (i = 0; i < NSTREAMS; i++)
+		if (streams[i].device)
+			avi_patch(avi.hdr_len[i], avi.frames[i]);
+	close(avi.fd);
+	return r;
+}
+
+static int avi_chunk(int id, const void *data, uint32_t size, uint32_t units)
+{
+	static const uint8_t pad;
+	struct index_entry *e;
+	uint8_t b[8];
+
+	/* keep to the 32 bit offsets of AVI 1.0, a new file starts on a
+	   video frame so each one plays on its own.  Without video, or
+	   when it has stalled for too long, any chunk starts it. */
+	if (avi.pos > SPLIT_SIZE &&
+	    (id == S_VIDEO || streams[S_VIDEO].device == NULL ||
+	     avi.pos > SPLIT_MAX)) {
+		if (avi_close())
+			return -1;
+		avi.part++;
+		if (avi_open())
+			return -1;
+	}
+
+	if (avi.nindex == avi.maxindex) {
+		avi.maxindex = avi.maxindex ? avi.maxindex * 2 : 4096;
+		avi.index = realloc(avi.index, avi.maxindex * sizeof(*avi.index));
+		if (avi.index == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+	}
+	e = &avi.index[avi.nindex++];
+	memcpy(e->id, chunk_id[id], 4);
+	e->flags = id == S_VIDEO || id == S_AUDIO ? 0x10 : 0;	/* AVIIF_KEYFRAME */
+	e->offset = avi.pos;
+	e->size = size;
+
+	put32(putid(b, chunk_id[id]), size);
+	if (avi_write(b, 8) || avi_write(data, size))
+		return -1;
+	if ((size & 1) && avi_write(&pad, 1))
+		return -1;
+	avi.frames[id] += units;
+	streams[id].written += units;
+	streams[id].bytes += size;
+	return 0;
+}
+
+/* Video and VBI take one slot per frame period. Frames the card didn't
+   deliver get an empty chunk, which players take as a repeat. */
+static int write_frame(int id, struct packet *p, int64_t t0)
+{
+	struct stream *s = &streams[id];
+	int64_t slot = (p->pts - t0 + frame_dur / 2) / frame_dur;
+
+	while ((int64_t)s->written < slot) {
+		if (avi_chunk(id, NULL, 0, 1))
+			return -1;
+		s->filled++;
+	}
+	return avi_chunk(id, p->data, p->size, 1);
+}
+
+/* Audio follows the video clock, the samples in the file should line
+   up with the packet's PTS. Beyond the tolerance the gap is filled with
+   silence or the overlap dropped. */
+static int write_audio(struct packet *p, int64_t t0)
+{
+	static uint8_t silence[4096];
+	struct stream *s = &streams[S_AUDIO];
+	int64_t expect = (p->pts - t0) * rate / 90000;
+	int64_t drift = (int64_t)s->written - expect;	/* samples */
+	int64_t tol = (int64_t)tolerance * rate / 1000;
+	uint32_t skip = 0, n;
+
+	drift = drift * 90000 / rate;
+	if (drift_n == 0 || drift < drift_min)
+		drift_min = drift;
+	if (drift_n == 0 || drift > drift_max)
+		drift_max = drift;
+	drift_sum += drift;
+	drift_n++;
+
+	if (correct && expect - (int64_t)s->written > tol) {
+		uint64_t fill = expect - s->written;
+
+		s->filled += fill;
+		while (fill) {
+			n = fill > sizeof(silence) / 4 ? sizeof(silence) / 4 : fill;
+			if (avi_chunk(S_AUDIO, silence, n * 4, n))
+				return -1;
+			fill -= n;
+		}
+	} else if (correct && (int64_t)s->written - expect > tol) {
+		skip = s->written - expect;
+		if (skip > p->size / 4)
+			skip = p->size / 4;
+		s->dropped += skip;
+	}
+	if (skip * 4 == p->size)
+		return 0;
+	return avi_chunk(S_AUDIO, p->data + skip * 4, p->size - skip * 4,
+			p->size / 4 - skip);
+}
+
+static void deadline(struct timespec *ts)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_nsec += wait_ms * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/* Merge the rings in timestamp order until every capture thread is done */
+static int writer(void)
+{
+	struct packet *p, *head[NSTREAMS];
+	int64_t t0 = 0, last = 0;
+	int started = 0, stalled[NSTREAMS] = { 0 };
+	int active, missing, id, i;
+	struct timespec ts;
+
+	for (;;) {
+		/* a stream that is still running but has nothing queued
+		   could have the next packet, give it wait_ms. One that
+		   doesn't make it isn't waited for again until it delivers. */
+		deadline(&ts);
+		for (;;) {
+			active = missing = 0;
+			for (i = 0; i < NSTREAMS; i++) {
+				head[i] = NULL;
+				if (!streams[i].device)
+					continue;
+				head[i] = ring_peek(&streams[i].ring);
+				if (head[i])
+					stalled[i] = 0;
+				else if (!streams[i].done && !stalled[i])
+					missing++;
+				if (head[i] || !streams[i].done)
+					active++;
+			}
+			if (!missing)
+				break;
+			if (sem_timedwait(&ready, &ts) < 0 && errno == ETIMEDOUT) {
+				for (i = 0; i < NSTREAMS; i++)
+					if (streams[i].device && head[i] == NULL)
+						stalled[i] = 1;
+				break;
+			}
+		}
+		if (!active)
+			return 0;
+
+		id = -1;
+		for (i = 0; i < NSTREAMS; i++)
+			if (head[i] && (id < 0 || head[i]->pts < head[id]->pts))
+				id = i;
+		if (id < 0)
+			continue;
+		p = head[id];
+
+		if (!started) {
+			t0 = last = p->pts;
+			started = 1;
+		}
+		if (p->pts < last)
+			streams[id].late++;
+		else
+			last = p->pts;
+
+		if ((id == S_AUDIO ? write_audio(p, t0) : write_frame(id, p, t0)) < 0)
+			return -1;
+		ring_pop(&streams[id].ring);
+		free(p);
+	}
+}
+
+static void report(void)
+{
+	int i;
+
+	for (i = 0; i < NSTREAMS; i++) {
+		struct stream *s = &streams[i];
+
+		if (!s->device)
+			continue;
+		fprintf(stderr, "%-6s %s: %lu buffers, %llu bytes, %lu %s written, "
+				"%lu lost by the driver, %lu ring overruns, "
+				"%u most queued, %lu late\n",
+				stream_name[i], s->device, s->packets, s->bytes,
+				s->written, i == S_AUDIO ? "samples" : "frames",
+				s->seq_gaps, s->overruns, s->hiwater, s->late);
+		if (s->packed)
+			fprintf(stderr, "%-6s %lu transfers packed %d to a buffer, "
+					"%.1f each, %lu buffers damaged\n",
+					stream_name[i], s->chunks, s->packed,
+					s->packets ? (double)s->chunks / s->packets : 0,
+					s->bad_packs);
+		if (s->clock.started)
+			fprintf(stderr, "%-6s card clock %+.1f ppm against the host\n",
+					stream_name[i], ivtv_pts_drift_ppm(&s->clock));
+	}
+	if (streams[S_VIDEO].device)
+		fprintf(stderr, "video: %lu empty frames for frames not captured\n",
+				streams[S_VIDEO].filled);
+	if (drift_n)
+		fprintf(stderr, "A/V drift: min %.1f ms, max %.1f ms, mean %.1f ms, "
+				"%.1f ms silence added, %.1f ms audio dropped\n",
+				drift_min / 90.0, drift_max / 90.0,
+				drift_sum / 90.0 / drift_n,
+				streams[S_AUDIO].filled * 1000.0 / rate,
+				streams[S_AUDIO].dropped * 1000.0 / rate);
+}
+
+int main(int argc, char **argv)
+{
+	struct ivtv_ioctl_codec codec;
+	v4l2_std_id std;
+	int seconds = 0, opt, ret, err, fd, i;
+
+	streams[S_VIDEO].device = "/dev/video32";
+	streams[S_AUDIO].device = "/dev/video24";
+	avi.name = "capture.avi";
+
+	while ((opt = getopt(argc, argv, "y:a:v:o:t:d:np:h")) != -1) {
+		switch (opt) {
+		case 'y':
+			streams[S_VIDEO].device = strcmp(optarg, "none") ? optarg : NULL;
+			break;
+		case 'a':
+			streams[S_AUDIO].device = strcmp(optarg, "none") ? optarg : NULL;
+			break;
+		case 'v':
+			streams[S_VBI].device = strcmp(optarg, "none") ? optarg : NULL;
+			break;
+		case 'o':
+			avi.name = optarg;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'd':
+			tolerance = atoi(optarg);
+			break;
+		case 'n':
+			correct = 0;
+			break;
+		case 'p':
+			pack = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	for (i = 0; i < NSTREAMS; i++) {
+		ivtv_pts_init(&streams[i].clock);
+		if (streams[i].device && open_stream(&streams[i], i))
+			return 1;
+	}
+
+	/* frame and sample rate of the card, from whichever device is open */
+	fd = streams[S_VIDEO].device ? streams[S_VIDEO].fd :
+	     streams[S_AUDIO].device ? streams[S_AUDIO].fd : streams[S_VBI].fd;
+	if (xioctl(fd, VIDIOC_G_STD, &std) == 0 && !(std & V4L2_STD_525_60)) {
+		fps_num = 25;
+		fps_den = 1;
+	}
+	if (xioctl(fd, IVTV_IOC_G_CODEC, &codec) == 0)
+		rate = (codec.audio_bitmask & 3) == 0 ? 44100 :
+		       (codec.audio_bitmask & 3) == 2 ? 32000 : 48000;
+	frame_dur = (int64_t)90000 * fps_den / fps_num;
+	/* a packed buffer comes once all its transfers are in, VBI has a
+	   frame in each */
+	if (pack)
+		wait_ms += pack * frame_dur / 90;
+
+	if (avi_open())
+		return 1;
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+	signal(SIGALRM, sig_stop);
+	if (seconds)
+		alarm(seconds);
+
+	sem_init(&ready, 0, 0);
+	ret = 0;
+	for (i = 0; i < NSTREAMS && ret == 0; i++) {
+		if (!streams[i].device)
+			continue;
+		/* the writer needs them all, a missing one ends the capture */
+		err = pthread_create(&streams[i].thread, NULL, capture_thread, &streams[i]);
+		if (err) {
+			fprintf(stderr, "%s: cannot start capture: %s\n",
+				streams[i].device, strerror(err));
+			ret = -1;
+		} else {
+			streams[i].running = 1;
+		}
+	}
+
+	if (ret == 0)
+		ret = writer();
+	stop = 1;
+
+	for (i = 0; i < NSTREAMS; i++) {
+		if (!streams[i].device)
+			continue;
+		if (streams[i].running)
+			pthread_join(streams[i].thread, NULL);
+		while (ring_peek(&streams[i].ring)) {
+			free(ring_peek(&streams[i].ring));
+			ring_pop(&streams[i].ring);
+		}
+		close_stream(&streams[i]);
+	}
+	if (avi_close())
+		ret = -1;
+	report();
+	return ret ? 1 : 0;
+}
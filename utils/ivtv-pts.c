@@ -0,0 +1,146 @@
+/*
+   Map the firmware PTS of ivtv capture buffers to the host clock
+
+   The driver stamps each capture buffer with the encoder's PTS and with
+   CLOCK_MONOTONIC when its DMA completed. The DMA follows the capture
+   after a varying delay, but never comes before it, so the PTS to host
+   mapping is the line under all the samples. Of each second of samples
+   the one with the least delay is kept, the slope is fitted over the
+   last IVTV_PTS_WINDOW of those and the offset is the smallest one that
+   any of them gives. That takes out the interrupt and DMA jitter, and
+   follows the card's crystal drifting against the host.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "ivtv-pts.h"
+
+#define PTS_BITS	33
+#define PTS_MASK	((1LL << PTS_BITS) - 1)
+#define NS_PER_TICK	(1000000000.0 / 90000)
+#define SECOND		90000
+#define MIN_SPAN	(2 * SECOND)	/* fit the slope over at least this */
+
+void ivtv_pts_init(struct ivtv_pts_clock *c)
+{
+	memset(c, 0, sizeof(*c));
+	c->slope = NS_PER_TICK;
+}
+
+/* The 64 bit value of pts closest to last */
+static int64_t unwrap(int64_t last, uint64_t pts)
+{
+	int64_t delta = ((int64_t)pts - last) & PTS_MASK;
+
+	if (delta >= 1LL << (PTS_BITS - 1))
+		delta -= 1LL << PTS_BITS;
+	return last + delta;
+}
+
+int64_t ivtv_pts_unwrap(struct ivtv_pts_clock *c, uint64_t pts)
+{
+	if (!c->started) {
+		c->started = 1;
+		c->last = pts & PTS_MASK;
+	} else {
+		c->last = unwrap(c->last, pts);
+	}
+	return c->last;
+}
+
+/* the delay of a sample, give or take a constant */
+static double delay(const struct ivtv_pts_clock *c, const struct ivtv_pts_sample *s)
+{
+	return s->ns - c->slope * s->pts;
+}
+
+static void fit(struct ivtv_pts_clock *c)
+{
+	double mp = c->cur.pts, mn = c->cur.ns, sxy = 0, sxx = 0;
+	int64_t lo = c->cur.pts;
+	int i;
+
+	for (i = 0; i < c->n; i++) {
+		mp += c->s[i].pts;
+		mn += c->s[i].ns;
+		if (c->s[i].pts < lo)
+			lo = c->s[i].pts;
+	}
+	mp /= c->n + 1;
+	mn /= c->n + 1;
+
+	if (c->cur.pts - lo >= MIN_SPAN) {
+		sxy = (c->cur.pts - mp) * (c->cur.ns - mn);
+		sxx = (c->cur.pts - mp) * (c->cur.pts - mp);
+		for (i = 0; i < c->n; i++) {
+			sxy += (c->s[i].pts - mp) * (c->s[i].ns - mn);
+			sxx += (c->s[i].pts - mp) * (c->s[i].pts - mp);
+		}
+		c->slope = sxy / sxx;
+	}
+
+	/* lower envelope, the sample with the least delay */
+	c->offset = delay(c, &c->cur);
+	for (i = 0; i < c->n; i++)
+		if (delay(c, &c->s[i]) < c->offset)
+			c->offset = delay(c, &c->s[i]);
+}
+
+int64_t ivtv_pts_update(struct ivtv_pts_clock *c, uint64_t pts, uint64_t mono_ns)
+{
+	struct ivtv_pts_sample s;
+	int first = !c->started;
+	int64_t p = ivtv_pts_unwrap(c, pts);
+
+	if (first) {
+		c->base_pts = p;
+		c->base_ns = mono_ns;
+	}
+	s.pts = p - c->base_pts;
+	s.ns = (int64_t)mono_ns - c->base_ns;
+
+	if (!first && s.pts - c->cur_start >= SECOND) {
+		c->s[c->pos] = c->cur;
+		c->pos = (c->pos + 1) % IVTV_PTS_WINDOW;
+		if (c->n < IVTV_PTS_WINDOW)
+			c->n++;
+		first = 1;
+	}
+	if (first) {
+		c->cur = s;
+		c->cur_start = s.pts;
+	} else if (delay(c, &s) < delay(c, &c->cur)) {
+		c->cur = s;
+	}
+	fit(c);
+	return p;
+}
+
+int64_t ivtv_pts_to_ns(struct ivtv_pts_clock *c, uint64_t pts)
+{
+	int64_t p;
+
+	if (!c->started)
+		return 0;
+	p = unwrap(c->last, pts) - c->base_pts;
+	return c->base_ns + (int64_t)(c->offset + c->slope * p);
+}
+
+double ivtv_pts_drift_ppm(const struct ivtv_pts_clock *c)
+{
+	return (c->slope / NS_PER_TICK - 1) * 1e6;
+}
@@ -0,0 +1,63 @@
+/*
+   Map the firmware PTS of ivtv capture buffers to the host clock
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __IVTV_PTS_H
+#define __IVTV_PTS_H
+
+#include <stdint.h>
+
+#define IVTV_PTS_WINDOW		128	/* seconds the estimate is made from */
+
+/* One per card, or per stream. Fed with the pts and mono_ns pairs from
+   IVTV_IOC_G_BUF_TS it follows the rate of the card's 90 kHz clock
+   against CLOCK_MONOTONIC, and maps PTS values to CLOCK_MONOTONIC. */
+struct ivtv_pts_clock {
+	int64_t last;		/* last PTS seen, unwrapped */
+	int started;
+
+	/* the sample with the least delay of each second, relative to
+	   the first sample */
+	int64_t base_pts;
+	int64_t base_ns;
+	struct ivtv_pts_sample {
+		int64_t pts;
+		int64_t ns;
+	} s[IVTV_PTS_WINDOW], cur;
+	int n, pos;
+	int64_t cur_start;	/* PTS the second in cur started at */
+
+	/* the mapping: ns = offset + slope * (pts - base_pts) + base_ns */
+	double slope;		/* host ns per PTS tick */
+	double offset;
+};
+
+void ivtv_pts_init(struct ivtv_pts_clock *c);
+
+/* Unwrap a 33 bit PTS against the last one seen, to 64 bits */
+int64_t ivtv_pts_unwrap(struct ivtv_pts_clock *c, uint64_t pts);
+
+/* Add a sample, returns the unwrapped PTS */
+int64_t ivtv_pts_update(struct ivtv_pts_clock *c, uint64_t pts, uint64_t mono_ns);
+
+/* CLOCK_MONOTONIC nanoseconds for a PTS near the last one seen */
+int64_t ivtv_pts_to_ns(struct ivtv_pts_clock *c, uint64_t pts);
+
+/* How fast the card's clock runs against the host, in ppm */
+double ivtv_pts_drift_ppm(const struct ivtv_pts_clock *c);
+
+#endif
@@ -34,6 +34,7 @@
 #include <signal.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <asm/types.h>
 
@@ -47,10 +48,15 @@
 #define TRUE 1
 #define FALSE 0
 
+#define MAX_RADIOS 8
+
 struct config {
 	int just_tune;
 	int passthrough;
 	int channelchange;
+	int scan;
+	char *scan_devs[MAX_RADIOS];
+	int nscan_devs;
 	char prog_name[255];
 	struct v4l2_tuner tuner;
 	struct v4l2_frequency freq;
@@ -68,6 +74,9 @@ void print_usage(void)
 	fprintf(stderr,
 		"    -d <device>    Radio control device (default: %s)\n",
 		RADIO_DEV);
+	fprintf(stderr,
+		"                   Repeat to scan with up to %d cards in parallel\n",
+		MAX_RADIOS);
 	fprintf(stderr, "    -s             Scan for channels\n");
 	fprintf(stderr, "    -a             Scan for frequencies\n");
 	fprintf(stderr, 
@@ -107,104 +116,274 @@ static int get_cardnr(int fd)
 	return -1;
 }
 
-int scan_channels(int allfreqs)
+/* Station scanner.
+
+   A station shows up above SIGNAL_MIN over several neighbouring 1/16 MHz
+   steps, so a coarse pass every COARSE_STEP steps cannot miss one. From
+   every coarse hit the scan climbs towards the stronger neighbour until
+   neither side is stronger, and the middle of that top plateau is the
+   station. Only the steps on the way up and the two around the top are
+   tuned, not the whole run above SIGNAL_MIN.
+
+   The tuner needs a moment to settle after each frequency change. An empty
+   step is taken at its first reading, but a signal is read until two
+   readings agree so a peak is not placed on a value still moving.
+
+   With several -d devices the band is split between them and each card
+   scans its part in its own thread. */
+
+#define FM_LOW		1392	/* 87.0 MHz */
+#define FM_HIGH		1728	/* 108.0 MHz */
+#define SIGNAL_MIN	16384
+#define COARSE_STEP	3	/* 187.5 kHz */
+#define SETTLE_USEC	5000
+#define SETTLE_TRIES	8
+#define UNMEASURED	-1
+
+struct station {
+	int freq;
+	int signal;
+};
+
+struct scan_job {
+	const char *dev;
+	int fh;
+	int low, high;		/* slice of the band this job starts runs in */
+	int band_low, band_high;
+	int *sig;		/* per 1/16 MHz step, UNMEASURED if not tuned */
+	struct station *stations;
+	int nstations;
+	int ioctls;
+	int failed;
+};
+
+static int scan_signal(struct scan_job *job, int freq)
 {
+	struct v4l2_frequency vf;
+	struct v4l2_tuner vt;
+	int *sig = &job->sig[freq - job->band_low];
+	int last = UNMEASURED;
 	int i;
 
-	cfg.fh = open(cfg.radio_dev, O_RDONLY);
-	if (cfg.fh == -1) {
-		perror("radio");
-		fprintf(stderr, "cannot open %s\n", cfg.radio_dev);
-		exit(1);
+	if (*sig != UNMEASURED)
+		return *sig;
+
+	memset(&vf, 0, sizeof(vf));
+	vf.tuner = 0;
+	vf.type = V4L2_TUNER_RADIO;
+	vf.frequency = freq;
+	job->ioctls++;
+	if (ioctl(job->fh, VIDIOC_S_FREQUENCY, &vf) == -1) {
+		fprintf(stderr, "%s: failed to set freq (%s)\n",
+			job->dev, strerror(errno));
+		job->failed = 1;
+		return *sig = 0;
 	}
 
-	cfg.tuner.index = 0;
-	if (ioctl(cfg.fh, VIDIOC_G_TUNER, &cfg.tuner) == -1) {
-		fprintf(stderr, "ioctl: Failed to set tuner (%s)\n",
+	for (i = 0; i < SETTLE_TRIES; i++) {
+		usleep(SETTLE_USEC);
+		memset(&vt, 0, sizeof(vt));
+		vt.index = 0;
+		job->ioctls++;
+		if (ioctl(job->fh, VIDIOC_G_TUNER, &vt) == -1) {
+			fprintf(stderr, "%s: failed to get tuner (%s)\n",
+				job->dev, strerror(errno));
+			job->failed = 1;
+			return *sig = 0;
+		}
+		/* nothing there is final, a signal has to read the same twice */
+		if ((int)vt.signal <= SIGNAL_MIN || (int)vt.signal == last) {
+			last = vt.signal;
+			break;
+		}
+		last = vt.signal;
+	}
+	return *sig = last;
+}
+
+static void *scan_band(void *arg)
+{
+	struct scan_job *job = arg;
+	int f, g;
+
+	/* coarse pass */
+	for (f = job->low; f <= job->high && !job->failed; f += COARSE_STEP)
+		scan_signal(job, f);
+
+	/* climb from each hit, which may lead into the neighbour's slice */
+	for (f = job->low; f <= job->high && !job->failed; f += COARSE_STEP) {
+		int best, first, last;
+
+		if (job->sig[f - job->band_low] <= SIGNAL_MIN)
+			continue;
+		for (g = f;;) {
+			best = scan_signal(job, g);
+			for (first = g; first > job->band_low &&
+			     scan_signal(job, first - 1) == best; first--)
+				;
+			for (last = g; last < job->band_high &&
+			     scan_signal(job, last + 1) == best; last++)
+				;
+			/* both edges are measured by now */
+			if (first > job->band_low &&
+			    job->sig[first - 1 - job->band_low] > best)
+				g = first - 1;
+			else if (last < job->band_high &&
+				 job->sig[last + 1 - job->band_low] > best)
+				g = last + 1;
+			else
+				break;
+		}
+
+		/* the next coarse hit may climb the same station */
+		g = (first + last) / 2;
+		if (job->nstations &&
+		    job->stations[job->nstations - 1].freq == g)
+			continue;
+		job->stations[job->nstations].freq = g;
+		job->stations[job->nstations].signal = best;
+		job->nstations++;
+	}
+	return NULL;
+}
+
+/* round to the 100 kHz grid stations are announced on */
+static double station_mhz(int freq)
+{
+	if (freq % 16 == 12)
+		return freq / 16.0 - 0.01;
+	if (freq % 16 == 4)
+		return freq / 16.0 + 0.01;
+	return freq / 16.0;
+}
+
+static int cmp_station(const void *a, const void *b)
+{
+	return ((const struct station *)a)->freq -
+	       ((const struct station *)b)->freq;
+}
+
+int scan_channels(char **devs, int ndevs, int allfreqs)
+{
+	struct scan_job jobs[MAX_RADIOS];
+	pthread_t threads[MAX_RADIOS];
+	int started[MAX_RADIOS];
+	struct station *stations;
+	struct v4l2_tuner vt;
+	int band_low, band_high, nsteps;
+	int i, f, n, err, ioctls = 0;
+
+	memset(jobs, 0, sizeof(jobs));
+	for (i = 0; i < ndevs; i++) {
+		jobs[i].dev = devs[i];
+		jobs[i].fh = open(devs[i], O_RDONLY);
+		if (jobs[i].fh == -1) {
+			perror("radio");
+			fprintf(stderr, "cannot open %s\n", devs[i]);
+			exit(1);
+		}
+	}
+
+	memset(&vt, 0, sizeof(vt));
+	vt.index = 0;
+	if (ioctl(jobs[0].fh, VIDIOC_G_TUNER, &vt) == -1) {
+		fprintf(stderr, "ioctl: Failed to get tuner (%s)\n",
 			strerror(errno));
 		exit(1);
 	}
-	int isafreq = 0;
-	int freqindex = 0;
-	int freqstrength;
-	int rangehigh;
-	int rangelow;
-	double freqs[5][2];
-	double printedfreq;
-
 	if (allfreqs == 1) {
-		rangelow = cfg.tuner.rangelow;
-		rangehigh = cfg.tuner.rangehigh;
+		band_low = vt.rangelow;
+		band_high = vt.rangehigh;
 	} else {
-		rangelow = 1392;
-		rangehigh = 1728;
+		band_low = FM_LOW;
+		band_high = FM_HIGH;
 	}
-	for (i = rangelow; i < rangehigh; i++) {
-		cfg.freq.tuner = 0;
-		cfg.freq.type = V4L2_TUNER_RADIO;
-		cfg.freq.frequency = i;
-		if (ioctl(cfg.fh, VIDIOC_S_FREQUENCY, &cfg.freq) == -1) {
-			fprintf(stderr, "ioctl: Failed to set freq (%s)\n",
-				strerror(errno));
+	nsteps = band_high - band_low + 1;
+
+	for (i = 0; i < ndevs; i++) {
+		jobs[i].band_low = band_low;
+		jobs[i].band_high = band_high;
+		/* slices start on the coarse grid so no gap opens between them */
+		jobs[i].low = band_low + (nsteps / COARSE_STEP * i / ndevs) * COARSE_STEP;
+		jobs[i].high = i == ndevs - 1 ? band_high :
+			band_low + (nsteps / COARSE_STEP * (i + 1) / ndevs) * COARSE_STEP - 1;
+		jobs[i].sig = malloc(nsteps * sizeof(int));
+		jobs[i].stations = malloc(nsteps * sizeof(struct station));
+		if (jobs[i].sig == NULL || jobs[i].stations == NULL) {
+			fprintf(stderr, "out of memory\n");
 			exit(1);
 		}
-		if (ioctl(cfg.fh, VIDIOC_G_TUNER, &cfg.tuner) == -1) {
-			fprintf(stderr, "ioctl: Failed to set tuner (%s)\n",
-				strerror(errno));
-			exit(1);
+		for (f = 0; f < nsteps; f++)
+			jobs[i].sig[f] = UNMEASURED;
+	}
+
+	/* a card without a thread of its own scans its part from here */
+	for (i = 0; i < ndevs; i++) {
+		started[i] = 0;
+		if (ndevs == 1)
+			continue;
+		err = pthread_create(&threads[i], NULL, scan_band, &jobs[i]);
+		if (err)
+			fprintf(stderr, "%s: cannot start a scan thread (%s), "
+				"scanning its part in turn\n",
+				jobs[i].dev, strerror(err));
+		else
+			started[i] = 1;
+	}
+	for (i = 0; i < ndevs; i++)
+		if (!started[i])
+			scan_band(&jobs[i]);
+	for (i = 0; i < ndevs; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+
+	stations = malloc(nsteps * ndevs * sizeof(struct station));
+	if (stations == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (n = 0, i = 0; i < ndevs; i++) {
+		memcpy(stations + n, jobs[i].stations,
+		       jobs[i].nstations * sizeof(struct station));
+		n += jobs[i].nstations;
+		ioctls += jobs[i].ioctls;
+	}
+	qsort(stations, n, sizeof(struct station), cmp_station);
+
+	if (allfreqs == 1) {
+		for (f = band_low; f <= band_high; f++) {
+			int best = UNMEASURED;
+
+			for (i = 0; i < ndevs; i++)
+				if (jobs[i].sig[f - band_low] > best)
+					best = jobs[i].sig[f - band_low];
+			if (best > SIGNAL_MIN)
+				printf("%3.2f, %4d: %d \n", f / 16.0, f, best);
 		}
-		if (cfg.tuner.signal > 16384) {
-			printedfreq = cfg.freq.frequency;
-			freqstrength = cfg.tuner.signal;
-			//print long freq info if wanted
-			if(allfreqs == 1) {
-				printf("%3.2f, %4.0f: %d \n", printedfreq / 16.0, printedfreq, freqstrength);	
-			} 
-			isafreq++;
-			freqindex = isafreq - 1;
-			//if there are multiple stations in a row, this may detect the 1st and not the rest.
-			if (isafreq < 6) {
-				freqs[freqindex][0] = cfg.freq.frequency;
-				freqs[freqindex][1] = cfg.tuner.signal;
-			}
-		} else {
-			if(isafreq > 0) {
-				switch(isafreq) {
-				case 1:
-					printedfreq = freqs[0][0];
-					freqstrength = freqs[0][1];
-				break;
-				case 2:
-					printedfreq = (freqs[0][0] + freqs[1][0]) / 2;
-					freqstrength = (freqs[0][1] + freqs[1][1]) / 2;
-				break;
-				case 3:
-					printedfreq = freqs[1][0];
-					freqstrength = freqs[1][1];
-				break;
-				case 4:
-					printedfreq = (freqs[1][0] + freqs[2][0]) / 2;
-					freqstrength = (freqs[1][1] + freqs[2][1]) / 2;
-				break;
-				default:
-					printedfreq = freqs[2][0];
-					freqstrength = freqs[2][1];
-				break;
-				}
-				if(printedfreq > 1392 && printedfreq < 1728) {
-					if((((int)printedfreq) % 16) == 12) {
-						printf("STATION: %3.1fFM\n", (printedfreq / 16.0) - 0.01);				
-					} else if((((int)printedfreq) % 16) == 4) {
-						printf("STATION: %3.1fFM\n", (printedfreq / 16.0) + 0.01);
-					} else {
-						printf("STATION: %3.1fFM\n", (printedfreq / 16.0));				
-					}
-				}
-			}	
-			isafreq = 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		/* a run across a slice boundary is found from both sides */
+		if (i + 1 < n && stations[i + 1].freq - stations[i].freq < COARSE_STEP) {
+			if (stations[i + 1].signal < stations[i].signal)
+				stations[i + 1] = stations[i];
+			continue;
 		}
+		if (stations[i].freq > FM_LOW && stations[i].freq < FM_HIGH)
+			printf("STATION: %3.1fFM signal %d%%\n",
+			       station_mhz(stations[i].freq),
+			       stations[i].signal * 100 / 65535);
 	}
-	close(cfg.fh);
+	fprintf(stderr, "scanned %3.1f-%3.1f MHz on %d card%s, %d ioctls\n",
+		band_low / 16.0, band_high / 16.0, ndevs, ndevs > 1 ? "s" : "",
+		ioctls);
+
+	for (i = 0; i < ndevs; i++) {
+		close(jobs[i].fh);
+		free(jobs[i].sig);
+		free(jobs[i].stations);
+	}
+	free(stations);
 	return 0;
 }
 
@@ -249,6 +428,8 @@ int main(int argc, char **argv)
 			break;
 		case 'd':
 			strcpy(cfg.radio_dev, optarg);
+			if (cfg.nscan_devs < MAX_RADIOS)
+				cfg.scan_devs[cfg.nscan_devs++] = optarg;
 			break;
 		case 'i':
 			strcpy(cfg.audio_in, optarg);
@@ -260,11 +441,11 @@ int main(int argc, char **argv)
 			cfg.channelchange = TRUE;
 			break;
 		case 's':
-			scan_channels(0);
-			exit(0);
+			cfg.scan = 1;
+			break;
 		case 'a':
-			scan_channels(1);
-			exit(0);
+			cfg.scan = 2;
+			break;
 		case 'h':
 			print_usage();
 			exit(0);
@@ -275,6 +456,13 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (cfg.scan) {
+		if (cfg.nscan_devs == 0)
+			cfg.scan_devs[cfg.nscan_devs++] = cfg.radio_dev;
+		scan_channels(cfg.scan_devs, cfg.nscan_devs, cfg.scan == 2);
+		exit(0);
+	}
+
 	cfg.fh = open(cfg.radio_dev, O_RDWR);
 	if (cfg.fh == -1) {
 		perror("radio");
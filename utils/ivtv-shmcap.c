@@ -0,0 +1,459 @@
+/*
+   Publish a V4L2 capture in a shared memory ring
+
+   The capture loop is the one of v4l2cap. Instead of a file, each buffer
+   goes into an ivtv-shmring, where any number of local processes can
+   use it without a copy of their own (see ivtv-shmring.h). With user
+   pointer I/O, the default, the driver DMAs straight into the ring's
+   slots, so publishing a frame costs no copy at all; with -m or -r the
+   buffer is copied into the ring once. A consumer that does not keep up
+   loses frames, capture never waits for it.
+
+   Started with -a the program is a consumer instead, writing the frames
+   to a file and telling how many it lost.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <asm/types.h>
+
+#define __user
+#include "videodev2.h"
+#include "ivtv-shmring.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+
+#define DEFAULT_SLOT_SIZE	(128 * 1024)
+
+enum io_method { IO_READ, IO_MMAP, IO_USERPTR };
+
+static const char *dev_name = "/dev/video0";
+static const char *ring_name = "/ivtv-capture";
+static enum io_method io = IO_USERPTR;
+static unsigned nslots = 16;
+static unsigned held = 4;	/* buffers queued with the driver */
+static unsigned long count;	/* frames, 0 is until ^C */
+static volatile int stop;
+
+static int fd = -1;
+static struct ivtv_shmring ring;
+static void **mmap_start;
+static size_t *mmap_length;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "    -d <device>    capture device (default: %s)\n", dev_name);
+	fprintf(stderr, "    -s <name>      shared memory ring name (default: %s)\n", ring_name);
+	fprintf(stderr, "    -n <slots>     frames the ring holds (default: %u)\n", nslots);
+	fprintf(stderr, "    -b <buffers>   buffers queued with the driver (default: %u)\n", held);
+	fprintf(stderr, "    -c <frames>    stop after this many frames (default: until ^C)\n");
+	fprintf(stderr, "    -u             capture into the ring with user pointers (default)\n");
+	fprintf(stderr, "    -m             capture into mmap buffers and copy\n");
+	fprintf(stderr, "    -r             capture with read() into the ring\n");
+	fprintf(stderr, "    -a <name>      attach to a ring as a consumer instead\n");
+	fprintf(stderr, "    -o <file>      consumer: write the frames here (default: none)\n");
+	fprintf(stderr, "    -h             display this help message\n");
+}
+
+static void sig_stop(int sig)
+{
+	stop = 1;
+}
+
+static void errno_exit(const char *s)
+{
+	fprintf(stderr, "%s error %d, %s\n", s, errno, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static int xioctl(int fd, int request, void *arg)
+{
+	int r;
+
+	do r = ioctl(fd, request, arg);
+	while (r == -1 && errno == EINTR);
+	return r;
+}
+
+/* Hand the slot of frame to the driver */
+static void queue_slot(uint32_t frame)
+{
+	struct v4l2_buffer buf;
+	unsigned slot = frame % nslots;
+
+	ivtv_shmring_begin(&ring, frame);
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_USERPTR;
+	buf.index = slot;
+	buf.m.userptr = (unsigned long)ivtv_shmring_slot_data(&ring, slot);
+	buf.length = ring.hdr->slot_size;
+	if (xioctl(fd, VIDIOC_QBUF, &buf) == -1)
+		errno_exit("VIDIOC_QBUF");
+}
+
+/* Returns 1 if a frame was published, 0 if there was none */
+static int read_frame(void)
+{
+	struct v4l2_buffer buf;
+	uint32_t head = ring.hdr->head;
+	ssize_t n;
+
+	switch (io) {
+	case IO_READ:
+		ivtv_shmring_begin(&ring, head);
+		n = read(fd, ivtv_shmring_slot_data(&ring, head % nslots),
+			 ring.hdr->slot_size);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				return 0;
+			errno_exit("read");
+		}
+		ivtv_shmring_publish(&ring, n, head, 0);
+		break;
+
+	case IO_MMAP:
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (xioctl(fd, VIDIOC_DQBUF, &buf) == -1) {
+			if (errno == EAGAIN || errno == EIO)
+				return 0;
+			errno_exit("VIDIOC_DQBUF");
+		}
+		if (buf.bytesused > ring.hdr->slot_size)
+			buf.bytesused = ring.hdr->slot_size;
+		ivtv_shmring_begin(&ring, head);
+		memcpy(ivtv_shmring_slot_data(&ring, head % nslots),
+		       mmap_start[buf.index], buf.bytesused);
+		ivtv_shmring_publish(&ring, buf.bytesused, buf.sequence, buf.flags);
+		if (xioctl(fd, VIDIOC_QBUF, &buf) == -1)
+			errno_exit("VIDIOC_QBUF");
+		break;
+
+	case IO_USERPTR:
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_USERPTR;
+		if (xioctl(fd, VIDIOC_DQBUF, &buf) == -1) {
+			if (errno == EAGAIN || errno == EIO)
+				return 0;
+			errno_exit("VIDIOC_DQBUF");
+		}
+		/* the driver gives the buffers back in the order queued */
+		if (buf.index != head % nslots) {
+			fprintf(stderr, "buffer %u returned out of order, expected %u\n",
+				buf.index, head % nslots);
+			exit(EXIT_FAILURE);
+		}
+		ivtv_shmring_publish(&ring, buf.bytesused, buf.sequence, buf.flags);
+		queue_slot(head + held);
+		break;
+	}
+	return 1;
+}
+
+static void mainloop(void)
+{
+	unsigned long frames = 0;
+
+	while (!stop && (count == 0 || frames < count)) {
+		fd_set fds;
+		struct timeval tv;
+		int r;
+
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		tv.tv_sec = 10;
+		tv.tv_usec = 0;
+
+		r = select(fd + 1, &fds, NULL, NULL, &tv);
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			errno_exit("select");
+		}
+		if (r == 0) {
+			fprintf(stderr, "select timeout\n");
+			exit(EXIT_FAILURE);
+		}
+		frames += read_frame();
+	}
+	fprintf(stderr, "Published %lu frames\n", frames);
+}
+
+static void init_device(struct v4l2_format *fmt)
+{
+	struct v4l2_capability cap;
+	struct v4l2_requestbuffers req;
+	struct v4l2_buffer buf;
+	unsigned i;
+
+	if (xioctl(fd, VIDIOC_QUERYCAP, &cap) == -1)
+		errno_exit("VIDIOC_QUERYCAP");
+	if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+		fprintf(stderr, "%s is no video capture device\n", dev_name);
+		exit(EXIT_FAILURE);
+	}
+	if (io != IO_READ && !(cap.capabilities & V4L2_CAP_STREAMING)) {
+		fprintf(stderr, "%s does not support streaming i/o\n", dev_name);
+		exit(EXIT_FAILURE);
+	}
+
+	/* the format is whatever the device is set to */
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (xioctl(fd, VIDIOC_G_FMT, fmt) == -1)
+		errno_exit("VIDIOC_G_FMT");
+	if (fmt->fmt.pix.sizeimage == 0)
+		fmt->fmt.pix.sizeimage = DEFAULT_SLOT_SIZE;
+
+	if (io == IO_READ) {
+		held = 1;
+		return;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (io == IO_MMAP) {
+		req.count = held;
+		req.memory = V4L2_MEMORY_MMAP;
+	} else {
+		/* one buffer index for each slot, so each is pinned once */
+		req.count = nslots;
+		req.memory = V4L2_MEMORY_USERPTR;
+	}
+	if (xioctl(fd, VIDIOC_REQBUFS, &req) == -1)
+		errno_exit("VIDIOC_REQBUFS");
+	if (req.count < 2) {
+		fprintf(stderr, "Insufficient buffer memory on %s\n", dev_name);
+		exit(EXIT_FAILURE);
+	}
+
+	if (io == IO_USERPTR) {
+		if (req.count < nslots) {
+			fprintf(stderr, "Ring reduced to the %u buffers the driver allows\n",
+				req.count);
+			nslots = req.count;
+		}
+		if (held >= nslots)
+			held = nslots - 1;
+		return;
+	}
+
+	held = req.count;
+	mmap_start = calloc(req.count, sizeof(*mmap_start));
+	mmap_length = calloc(req.count, sizeof(*mmap_length));
+	if (mmap_start == NULL || mmap_length == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < req.count; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (xioctl(fd, VIDIOC_QUERYBUF, &buf) == -1)
+			errno_exit("VIDIOC_QUERYBUF");
+		mmap_length[i] = buf.length;
+		mmap_start[i] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+				     MAP_SHARED, fd, buf.m.offset);
+		if (mmap_start[i] == MAP_FAILED)
+			errno_exit("mmap");
+	}
+}
+
+static void start_capturing(void)
+{
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	struct v4l2_buffer buf;
+	unsigned i;
+
+	switch (io) {
+	case IO_READ:
+		return;
+
+	case IO_MMAP:
+		for (i = 0; i < held; i++) {
+			memset(&buf, 0, sizeof(buf));
+			buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buf.memory = V4L2_MEMORY_MMAP;
+			buf.index = i;
+			if (xioctl(fd, VIDIOC_QBUF, &buf) == -1)
+				errno_exit("VIDIOC_QBUF");
+		}
+		break;
+
+	case IO_USERPTR:
+		for (i = 0; i < held; i++)
+			queue_slot(i);
+		break;
+	}
+	if (xioctl(fd, VIDIOC_STREAMON, &type) == -1)
+		errno_exit("VIDIOC_STREAMON");
+}
+
+static void stop_capturing(void)
+{
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	unsigned i;
+
+	if (io != IO_READ && xioctl(fd, VIDIOC_STREAMOFF, &type) == -1)
+		errno_exit("VIDIOC_STREAMOFF");
+	if (io == IO_MMAP)
+		for (i = 0; i < held; i++)
+			munmap(mmap_start[i], mmap_length[i]);
+}
+
+static int consume(const char *name, const char *out)
+{
+	struct ivtv_shmring_frame f;
+	unsigned long frames = 0, torn = 0;
+	int ofd = -1;
+	int r;
+
+	if (ivtv_shmring_attach(&ring, name)) {
+		fprintf(stderr, "Cannot attach to %s: %s\n", name, strerror(errno));
+		return 1;
+	}
+	fprintf(stderr, "Attached to %s: %u slots of %u bytes, %ux%u %.4s\n",
+		name, ring.hdr->nslots, ring.hdr->slot_size,
+		ring.hdr->width, ring.hdr->height,
+		(const char *)&ring.hdr->pixelformat);
+	if (out) {
+		ofd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (ofd < 0) {
+			fprintf(stderr, "Cannot open %s: %s\n", out, strerror(errno));
+			return 1;
+		}
+	}
+
+	while (!stop && (count == 0 || frames < count)) {
+		r = ivtv_shmring_wait(&ring, 1000);
+		if (r < 0)
+			break;
+		while (ivtv_shmring_get(&ring, &f) == 0) {
+			if (ofd >= 0 && write(ofd, f.data, f.bytesused) != f.bytesused) {
+				perror(out);
+				stop = 1;
+			}
+			/* torn frames are in the file already, count them */
+			if (ivtv_shmring_put(&ring, &f))
+				torn++;
+			frames++;
+		}
+	}
+	fprintf(stderr, "Read %lu frames, lapped %u times, %u frames lost, %lu torn\n",
+		frames, ring.lapped, ring.lost, torn);
+	if (ofd >= 0)
+		close(ofd);
+	ivtv_shmring_detach(&ring);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct v4l2_format fmt;
+	struct ivtv_shmring_format rfmt;
+	const char *attach = NULL, *out = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:s:n:b:c:umra:o:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev_name = optarg;
+			break;
+		case 's':
+			ring_name = optarg;
+			break;
+		case 'n':
+			nslots = atoi(optarg);
+			break;
+		case 'b':
+			held = atoi(optarg);
+			break;
+		case 'c':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			io = IO_USERPTR;
+			break;
+		case 'm':
+			io = IO_MMAP;
+			break;
+		case 'r':
+			io = IO_READ;
+			break;
+		case 'a':
+			attach = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+	if (nslots < 2 || nslots > IVTV_SHMRING_MAX_SLOTS || held < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+
+	if (attach)
+		return consume(attach, out);
+
+	fd = open(dev_name, O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n",
+			dev_name, errno, strerror(errno));
+		return 1;
+	}
+	init_device(&fmt);
+
+	rfmt.pixelformat = fmt.fmt.pix.pixelformat;
+	rfmt.width = fmt.fmt.pix.width;
+	rfmt.height = fmt.fmt.pix.height;
+	rfmt.bytesperline = fmt.fmt.pix.bytesperline;
+	if (ivtv_shmring_create(&ring, ring_name, nslots, fmt.fmt.pix.sizeimage,
+				io == IO_USERPTR ? held : 1, &rfmt)) {
+		fprintf(stderr, "Cannot create %s: %s\n", ring_name, strerror(errno));
+		return 1;
+	}
+	fprintf(stderr, "Publishing %s in %s: %u slots of %u bytes\n",
+		dev_name, ring_name, nslots, ring.hdr->slot_size);
+
+	start_capturing();
+	mainloop();
+	stop_capturing();
+
+	ivtv_shmring_destroy(&ring);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,259 @@
+/*
+   Shared memory ring for handing captured buffers to several processes
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ivtv-shmring.h"
+
+#define wmb()	__sync_synchronize()
+#define rmb()	__sync_synchronize()
+
+static size_t page_align(size_t n)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	return (n + page - 1) & ~(page - 1);
+}
+
+static uint64_t mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int ivtv_shmring_create(struct ivtv_shmring *r, const char *name,
+			unsigned nslots, unsigned slot_size, unsigned held,
+			const struct ivtv_shmring_format *fmt)
+{
+	struct ivtv_shmring_hdr *h;
+	size_t data_offset = page_align(sizeof(*h));
+	int fd;
+
+	if (nslots < 2 || nslots > IVTV_SHMRING_MAX_SLOTS ||
+	    held < 1 || held >= nslots) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(r, 0, sizeof(*r));
+	slot_size = page_align(slot_size);
+	r->size = data_offset + (size_t)nslots * slot_size;
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->producer = 1;
+
+	/* a stale ring of a producer that died goes */
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, r->size) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	h = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == MAP_FAILED) {
+		shm_unlink(name);
+		return -1;
+	}
+	r->hdr = h;
+
+	h->version = IVTV_SHMRING_VERSION;
+	h->nslots = nslots;
+	h->slot_size = slot_size;
+	h->data_offset = data_offset;
+	h->held = held;
+	h->producer_pid = getpid();
+	h->pixelformat = fmt->pixelformat;
+	h->width = fmt->width;
+	h->height = fmt->height;
+	h->bytesperline = fmt->bytesperline;
+	wmb();
+	h->magic = IVTV_SHMRING_MAGIC;
+	return 0;
+}
+
+void ivtv_shmring_destroy(struct ivtv_shmring *r)
+{
+	r->hdr->closed = 1;
+	r->hdr->wake++;
+	syscall(SYS_futex, &r->hdr->wake, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+	munmap(r->hdr, r->size);
+	shm_unlink(r->name);
+	r->hdr = NULL;
+}
+
+void *ivtv_shmring_slot_data(struct ivtv_shmring *r, unsigned slot)
+{
+	return (char *)r->hdr + r->hdr->data_offset +
+		(size_t)slot * r->hdr->slot_size;
+}
+
+void ivtv_shmring_begin(struct ivtv_shmring *r, uint32_t frame)
+{
+	struct ivtv_shmring_hdr *h = r->hdr;
+
+	h->slot[frame % h->nslots].seq = 2 * frame + 1;
+	wmb();
+}
+
+void ivtv_shmring_publish(struct ivtv_shmring *r, uint32_t bytesused,
+			  uint32_t sequence, uint32_t flags)
+{
+	struct ivtv_shmring_hdr *h = r->hdr;
+	uint32_t frame = h->head;
+	struct ivtv_shmring_slot *s = &h->slot[frame % h->nslots];
+
+	s->bytesused = bytesused;
+	s->sequence = sequence;
+	s->flags = flags;
+	s->mono_ns = mono_ns();
+	wmb();
+	s->seq = 2 * (frame + 1);
+	wmb();
+	h->head = frame + 1;
+	h->wake++;
+	syscall(SYS_futex, &h->wake, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+}
+
+int ivtv_shmring_attach(struct ivtv_shmring *r, const char *name)
+{
+	struct ivtv_shmring_hdr *h;
+	struct stat st;
+	int fd;
+
+	memset(r, 0, sizeof(*r));
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*h)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	r->size = st.st_size;
+	h = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == MAP_FAILED)
+		return -1;
+	rmb();
+	if (h->magic != IVTV_SHMRING_MAGIC ||
+	    h->version != IVTV_SHMRING_VERSION ||
+	    h->data_offset + (size_t)h->nslots * h->slot_size > r->size) {
+		munmap(h, r->size);
+		errno = EINVAL;
+		return -1;
+	}
+	r->hdr = h;
+	r->next = h->head;
+	return 0;
+}
+
+void ivtv_shmring_detach(struct ivtv_shmring *r)
+{
+	munmap(r->hdr, r->size);
+	r->hdr = NULL;
+}
+
+int ivtv_shmring_wait(struct ivtv_shmring *r, int timeout_ms)
+{
+	struct ivtv_shmring_hdr *h = r->hdr;
+	struct timespec ts, *tp = NULL;
+	uint32_t wake = h->wake;
+
+	rmb();
+	if (r->next != h->head)
+		return 1;
+	if (h->closed)
+		return -1;
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+		tp = &ts;
+	}
+	/* returns at once if a frame came since wake was read */
+	syscall(SYS_futex, &h->wake, FUTEX_WAIT, wake, tp, NULL, 0);
+	rmb();
+	if (r->next != h->head)
+		return 1;
+	return h->closed ? -1 : 0;
+}
+
+int ivtv_shmring_get(struct ivtv_shmring *r, struct ivtv_shmring_frame *f)
+{
+	struct ivtv_shmring_hdr *h = r->hdr;
+	struct ivtv_shmring_slot *s;
+	uint32_t head, seq, keep = h->nslots - h->held;
+
+	for (;;) {
+		head = h->head;
+		rmb();
+		if (r->next == head) {
+			errno = EAGAIN;
+			return -1;
+		}
+		/* the oldest frames may be being written again */
+		if (head - r->next > keep) {
+			r->lapped++;
+			r->lost += head - keep - r->next;
+			r->next = head - keep;
+		}
+
+		s = &h->slot[r->next % h->nslots];
+		seq = s->seq;
+		rmb();
+		if (seq != 2 * (r->next + 1))
+			continue;	/* taken since, head tells by how much */
+		f->frame = r->next;
+		f->data = (const char *)h + h->data_offset +
+			(size_t)(r->next % h->nslots) * h->slot_size;
+		f->bytesused = s->bytesused;
+		f->sequence = s->sequence;
+		f->flags = s->flags;
+		f->mono_ns = s->mono_ns;
+		rmb();
+		if (s->seq != seq)
+			continue;
+		r->next++;
+		return 0;
+	}
+}
+
+int ivtv_shmring_put(struct ivtv_shmring *r, const struct ivtv_shmring_frame *f)
+{
+	struct ivtv_shmring_hdr *h = r->hdr;
+
+	rmb();
+	if (h->slot[f->frame % h->nslots].seq == 2 * (f->frame + 1))
+		return 0;
+	r->lapped++;
+	r->lost++;
+	return -1;
+}
@@ -0,0 +1,135 @@
+/*
+   Shared memory ring for handing captured buffers to several processes
+
+   One producer writes frames into a ring of slots in a POSIX shared
+   memory object, any number of consumers map it read-only and use the
+   frames in place. Each slot carries a sequence count that is odd while
+   the slot is being written (seqlock), a consumer checks it before and
+   after using the data and so finds out when the producer lapped it.
+   The producer never waits for a consumer.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __IVTV_SHMRING_H
+#define __IVTV_SHMRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define IVTV_SHMRING_MAGIC	0x52535649	/* "IVSR" */
+#define IVTV_SHMRING_VERSION	1
+#define IVTV_SHMRING_MAX_SLOTS	256
+
+struct ivtv_shmring_slot {
+	volatile uint32_t seq;	/* odd while written, else 2 * (frame + 1) */
+	uint32_t bytesused;
+	uint32_t sequence;	/* as returned by VIDIOC_DQBUF */
+	uint32_t flags;
+	uint64_t mono_ns;	/* CLOCK_MONOTONIC when the frame was published */
+};
+
+/* At the start of the shared memory object, the slots' data follows at
+   data_offset, slot_size bytes each, all page aligned. */
+struct ivtv_shmring_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t slot_size;
+	uint32_t data_offset;
+	uint32_t held;		/* slots the producer may be writing at once */
+
+	/* the capture format, from VIDIOC_G_FMT */
+	uint32_t pixelformat;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytesperline;
+
+	volatile uint32_t head;	/* frames published, frame n is in slot n % nslots */
+	volatile uint32_t wake;	/* futex, changes with every frame */
+	volatile uint32_t closed;	/* the producer is gone */
+	uint32_t producer_pid;
+	uint32_t reserved[10];
+
+	struct ivtv_shmring_slot slot[IVTV_SHMRING_MAX_SLOTS];
+};
+
+struct ivtv_shmring {
+	struct ivtv_shmring_hdr *hdr;
+	size_t size;
+	char name[64];
+	int producer;
+
+	/* consumer state */
+	uint32_t next;		/* next frame to get */
+	uint32_t lapped;	/* times the producer overtook this consumer */
+	uint32_t lost;		/* frames that went by that */
+};
+
+/* A frame in the ring, valid until ivtv_shmring_put() */
+struct ivtv_shmring_frame {
+	uint32_t frame;
+	const void *data;
+	uint32_t bytesused;
+	uint32_t sequence;
+	uint32_t flags;
+	uint64_t mono_ns;
+};
+
+/* The capture format a producer publishes with its ring */
+struct ivtv_shmring_format {
+	uint32_t pixelformat;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytesperline;
+};
+
+/* Producer side. name is a shared memory object name as for shm_open(),
+   starting with '/'. held is how many slots can be with the driver or
+   otherwise being written at a time. The ring is attachable, with fmt
+   in its header, once this returns. Return 0 or -1 with errno set. */
+int ivtv_shmring_create(struct ivtv_shmring *r, const char *name,
+			unsigned nslots, unsigned slot_size, unsigned held,
+			const struct ivtv_shmring_format *fmt);
+void ivtv_shmring_destroy(struct ivtv_shmring *r);
+
+/* Writable data of a slot */
+void *ivtv_shmring_slot_data(struct ivtv_shmring *r, unsigned slot);
+
+/* The slot of frame n is about to be written, consumers still on the
+   frame it holds find it gone. */
+void ivtv_shmring_begin(struct ivtv_shmring *r, uint32_t frame);
+
+/* Frame head is complete in its slot, make it the newest one */
+void ivtv_shmring_publish(struct ivtv_shmring *r, uint32_t bytesused,
+			  uint32_t sequence, uint32_t flags);
+
+/* Consumer side. Attach starts at the newest frame. */
+int ivtv_shmring_attach(struct ivtv_shmring *r, const char *name);
+void ivtv_shmring_detach(struct ivtv_shmring *r);
+
+/* Wait up to timeout_ms (-1 forever) for a new frame. Returns 1 if there
+   is one, 0 on timeout and -1 once the producer is gone. */
+int ivtv_shmring_wait(struct ivtv_shmring *r, int timeout_ms);
+
+/* Get the next frame without copying it. Returns 0, or -1 with errno
+   EAGAIN if there is none yet. Skips ahead if the producer lapped us. */
+int ivtv_shmring_get(struct ivtv_shmring *r, struct ivtv_shmring_frame *f);
+
+/* Done with a frame from ivtv_shmring_get(). Returns 0 if it stayed
+   intact all along, -1 if the producer overwrote it meanwhile. */
+int ivtv_shmring_put(struct ivtv_shmring *r, const struct ivtv_shmring_frame *f);
+
+#endif
@@ -0,0 +1,404 @@
+/*
+   Channel scanner and signal survey over all ivtv tuners in the box
+
+   Finds every ivtv card the way ivtv-detect does, splits a frequency
+   table from frequencies.c between their tuners and checks each channel
+   for tuner lock and cx25840 video in parallel, one thread per card.
+   The result is a channel map ranked by signal quality.
+
+   frequencies.{c,h} are © Nathan Laredo <laredo@broked.net>
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <asm/types.h>
+#include <inttypes.h>
+
+#define __user
+#include "videodev2.h"
+#define IVTV_INTERNAL
+#include "ivtv.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "frequencies.h"
+
+#define MAXCARD		16
+#define MAXDEV		16	/* /dev/videoN below 16 are the MPG encoders */
+#define TUNE_TIMEOUT	300	/* msecs to wait for lock and video */
+#define POLL_USEC	10000
+
+struct card {
+	char device[64];
+	char bus_info[40];
+	int fd;
+	int input;		/* input selected before the scan */
+	struct v4l2_frequency freq;	/* frequency before the scan */
+	int channels;		/* channels this card has checked */
+	pthread_t thread;
+	int running;		/* thread started */
+};
+
+struct result {
+	const char *name;
+	int freq;		/* kHz */
+	int card;
+	int status;		/* IVTV_TUNE_* */
+	int afc;
+	int lock_time;
+	int signal_time;
+	int signal;
+	int stereo;
+};
+
+static struct card cards[MAXCARD];
+static int ncards;
+
+static struct CHANLISTS *table;
+static struct result *results;
+static int next_channel;
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+static int timeout = TUNE_TIMEOUT;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "    -t <freqtable> frequency map to scan (default: us-cable)\n");
+	fprintf(stderr, "    -d <device>    scan with this device only, may be repeated\n");
+	fprintf(stderr, "                   (default: every ivtv card with a tuner)\n");
+	fprintf(stderr, "    -w <msecs>     wait this long for lock and video (default: %d)\n",
+			TUNE_TIMEOUT);
+	fprintf(stderr, "    -o <file>      write the channel map here (default: stdout)\n");
+	fprintf(stderr, "    -h             display this help message\n");
+	fprintf(stderr, "Every card used is retuned, don't scan while recording.\n");
+}
+
+static int msecs_since(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+		(now.tv_usec - start->tv_usec) / 1000;
+}
+
+/* Open a device, and keep it if it is an ivtv encoder with a tuner
+   on a card we haven't seen yet. */
+static int add_card(const char *device)
+{
+	struct ivtv_driver_info info;
+	struct ivtv_stream_info stream_info;
+	struct v4l2_capability cap;
+	struct v4l2_tuner vt;
+	struct v4l2_input vin;
+	struct card *c = &cards[ncards];
+	int fd, i;
+
+	if (ncards == MAXCARD)
+		return -1;
+	if ((fd = open(device, O_RDWR)) < 0)
+		return -1;
+
+	memset(&info, 0, sizeof(info));
+	info.size = sizeof(info);
+	if (ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0 ||
+	    ioctl(fd, IVTV_IOC_G_DRIVER_INFO, &info) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	stream_info.size = sizeof(stream_info);
+	if (ioctl(fd, IVTV_IOC_G_STREAM_INFO, &stream_info) == 0 &&
+	    stream_info.type != IVTV_ENC_STREAM_TYPE_MPG)
+	{
+		close(fd);
+		return -1;
+	}
+
+	memset(&vt, 0, sizeof(vt));
+	vt.index = 0;
+	if (ioctl(fd, VIDIOC_G_TUNER, &vt) < 0 ||
+	    vt.type != V4L2_TUNER_ANALOG_TV)
+	{
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < ncards; i++)
+	{
+		if (!strcmp(cards[i].bus_info, (char *)cap.bus_info))
+		{
+			close(fd);
+			return -1;
+		}
+	}
+
+	memset(c, 0, sizeof(*c));
+	strncpy(c->device, device, sizeof(c->device) - 1);
+	snprintf(c->bus_info, sizeof(c->bus_info), "%s", (char *)cap.bus_info);
+	c->fd = fd;
+	ioctl(fd, VIDIOC_G_INPUT, &c->input);
+	c->freq.tuner = 0;
+	ioctl(fd, VIDIOC_G_FREQUENCY, &c->freq);
+
+	/* the scan needs the tuner input */
+	for (vin.index = 0; ioctl(fd, VIDIOC_ENUMINPUT, &vin) == 0; vin.index++)
+	{
+		if (vin.type == V4L2_INPUT_TYPE_TUNER)
+		{
+			i = vin.index;
+			ioctl(fd, VIDIOC_S_INPUT, &i);
+			break;
+		}
+	}
+
+	fprintf(stderr, "%s: ivtv card #%d, %s\n", device, info.cardnr, cap.bus_info);
+	ncards++;
+	return 0;
+}
+
+/* Tune and wait for lock and video. Drivers without
+   IVTV_IOC_S_FREQUENCY_WAIT get the same done from user space. */
+static void check_channel(struct card *c, struct result *r)
+{
+	struct ivtv_ioctl_tune tune;
+	struct v4l2_frequency vf;
+	struct v4l2_tuner vt;
+	struct timeval start;
+
+	memset(&tune, 0, sizeof(tune));
+	tune.frequency = r->freq * 16 / 1000;
+	tune.timeout = timeout;
+	if (ioctl(c->fd, IVTV_IOC_S_FREQUENCY_WAIT, &tune) == 0)
+	{
+		r->status = tune.status;
+		r->afc = tune.afc;
+		r->lock_time = tune.lock_time;
+		r->signal_time = tune.signal_time;
+	}
+	else
+	{
+		memset(&vf, 0, sizeof(vf));
+		vf.tuner = 0;
+		vf.type = V4L2_TUNER_ANALOG_TV;
+		vf.frequency = r->freq * 16 / 1000;
+		gettimeofday(&start, NULL);
+		if (ioctl(c->fd, VIDIOC_S_FREQUENCY, &vf) < 0)
+			return;
+		r->status = IVTV_TUNE_LOCKED;
+		do
+		{
+			memset(&vt, 0, sizeof(vt));
+			vt.index = 0;
+			if (ioctl(c->fd, VIDIOC_G_TUNER, &vt) == 0 && vt.signal)
+			{
+				r->status |= IVTV_TUNE_VIDEO;
+				r->signal_time = msecs_since(&start);
+				break;
+			}
+			usleep(POLL_USEC);
+		} while (msecs_since(&start) < timeout);
+	}
+
+	memset(&vt, 0, sizeof(vt));
+	vt.index = 0;
+	if (ioctl(c->fd, VIDIOC_G_TUNER, &vt) == 0)
+	{
+		r->signal = vt.signal;
+		r->stereo = (vt.rxsubchans & V4L2_TUNER_SUB_STEREO) ? 1 : 0;
+	}
+}
+
+static void *scan_thread(void *arg)
+{
+	struct card *c = arg;
+	int i;
+
+	/* each card takes the next unchecked channel, so a slow card
+	   holds up nobody */
+	for (;;)
+	{
+		pthread_mutex_lock(&next_lock);
+		i = next_channel++;
+		pthread_mutex_unlock(&next_lock);
+		if (i >= table->count)
+			break;
+
+		results[i].card = c - cards;
+		check_channel(c, &results[i]);
+		c->channels++;
+	}
+	return NULL;
+}
+
+/* video first, then lock, then the best centered AFC, then the fastest */
+static int cmp_result(const void *a, const void *b)
+{
+	const struct result *x = a, *y = b;
+
+	if (x->status != y->status)
+		return y->status - x->status;
+	if (abs(x->afc) != abs(y->afc))
+		return abs(x->afc) - abs(y->afc);
+	if (x->signal_time != y->signal_time)
+		return x->signal_time - y->signal_time;
+	return x->freq - y->freq;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *freqtable = "us-cable";
+	const char *outfile = NULL;
+	char device[64];
+	struct timeval start;
+	FILE *out = stdout;
+	int i, opt, found, err, started = 0;
+
+	while ((opt = getopt(argc, argv, "t:d:w:o:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			freqtable = optarg;
+			break;
+		case 'd':
+			if (add_card(optarg) < 0)
+				fprintf(stderr, "%s: not an ivtv encoder with a tuner\n", optarg);
+			break;
+		case 'w':
+			timeout = atoi(optarg);
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	for (i = 0; chanlists[i].name != NULL &&
+			strcmp(chanlists[i].name, freqtable) != 0; i++);
+	if (chanlists[i].name == NULL)
+	{
+		fprintf(stderr, "Unknown frequency table '%s', try ivtv-tune -L\n", freqtable);
+		return 1;
+	}
+	table = &chanlists[i];
+
+	if (ncards == 0)
+	{
+		for (i = 0; i < MAXDEV; i++)
+		{
+			sprintf(device, "/dev/video%d", i);
+			add_card(device);
+		}
+	}
+	if (ncards == 0)
+	{
+		fprintf(stderr, "No ivtv cards with a tuner found\n");
+		return 1;
+	}
+
+	results = calloc(table->count, sizeof(struct result));
+	if (results == NULL)
+		return 1;
+	for (i = 0; i < table->count; i++)
+	{
+		results[i].name = table->list[i].name;
+		results[i].freq = table->list[i].freq;
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < ncards; i++)
+	{
+		/* the other cards take its share */
+		err = pthread_create(&cards[i].thread, NULL, scan_thread, &cards[i]);
+		if (err)
+		{
+			fprintf(stderr, "%s: cannot start a scan: %s\n",
+					cards[i].device, strerror(err));
+			continue;
+		}
+		cards[i].running = 1;
+		started++;
+	}
+	for (i = 0; i < ncards; i++)
+		if (cards[i].running)
+			pthread_join(cards[i].thread, NULL);
+
+	fprintf(stderr, "Scanned %d channels of '%s' on %d tuner%s in %.1f seconds\n",
+			table->count, freqtable, started, started != 1 ? "s" : "",
+			msecs_since(&start) / 1000.0);
+	for (i = 0; i < ncards; i++)
+	{
+		fprintf(stderr, "%s: %d channels\n", cards[i].device, cards[i].channels);
+		/* leave the card as it was */
+		ioctl(cards[i].fd, VIDIOC_S_INPUT, &cards[i].input);
+		if (cards[i].freq.frequency)
+			ioctl(cards[i].fd, VIDIOC_S_FREQUENCY, &cards[i].freq);
+		close(cards[i].fd);
+	}
+	if (started == 0)
+	{
+		free(results);
+		return 1;
+	}
+
+	qsort(results, table->count, sizeof(struct result), cmp_result);
+
+	if (outfile && (out = fopen(outfile, "w")) == NULL)
+	{
+		fprintf(stderr, "Failed to open %s\n", outfile);
+		return 1;
+	}
+	fprintf(out, "# freqtable %s\n", freqtable);
+	fprintf(out, "# channel\tMHz\tvideo\tlock\tafc\tlock_ms\tvideo_ms\tsignal\tstereo\tdevice\n");
+	for (i = found = 0; i < table->count; i++)
+	{
+		struct result *r = &results[i];
+
+		if (r->status & IVTV_TUNE_VIDEO)
+			found++;
+		fprintf(out, "%s\t%.3f\t%s\t%s\t%d\t%d\t%d\t%d\t%s\t%s\n",
+				r->name, r->freq / 1000.0,
+				(r->status & IVTV_TUNE_VIDEO) ? "yes" : "no",
+				(r->status & IVTV_TUNE_LOCKED) ? "yes" : "no",
+				r->afc, r->lock_time, r->signal_time,
+				r->signal * 100 / 65535,
+				r->stereo ? "yes" : "no",
+				cards[r->card].device);
+	}
+	if (out != stdout)
+		fclose(out);
+	fprintf(stderr, "%d channels with video\n", found);
+
+	free(results);
+	return 0;
+}
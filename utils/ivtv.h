@@ -69,6 +69,12 @@
 #define IVTV_IOC_PREP_FRAME_YUV    _IOW ('@', 60, struct ivtvyuv_ioctl_dma_host_to_ivtv_args)
 #define IVTV_IOC_G_YUV_INTERLACE   _IOR ('@', 61, struct ivtv_ioctl_yuv_interlace)
 #define IVTV_IOC_S_YUV_INTERLACE   _IOW ('@', 62, struct ivtv_ioctl_yuv_interlace)
+#define IVTV_IOC_S_FREQUENCY_WAIT  _IOWR('@', 64, struct ivtv_ioctl_tune)
+#define IVTV_IOC_G_ENC_INDEX       _IOR ('@', 65, struct ivtv_enc_index)
+#define IVTV_IOC_S_PACK            _IOWR('@', 66, struct ivtv_pack)
+#define IVTV_IOC_G_BUF_TS          _IOWR('@', 67, struct ivtv_buf_ts)
+#define IVTV_IOC_G_FANOUT          _IOR ('@', 68, struct ivtv_fanout_status)
+#define IVTV_IOC_BATCH_BUF         _IOWR('@', 69, struct ivtv_buf_batch)
 
 // Note: You only append to this structure, you never reorder the members,
 // you never play tricks with its alignment, you never change the size of
@@ -213,6 +219,135 @@ struct ivtv_ioctl_codec {
 	uint32_t pulldown;
 	uint32_t stream_type;
 };
+
+/* For use with IVTV_IOC_S_FREQUENCY_WAIT. Tunes like VIDIOC_S_FREQUENCY,
+   then waits until the tuner PLL is locked and the video decoder sees a
+   signal, or until the timeout runs out. */
+#define IVTV_TUNE_LOCKED	(1 << 0)	/* tuner PLL locked */
+#define IVTV_TUNE_VIDEO		(1 << 1)	/* decoder sees video */
+
+struct ivtv_ioctl_tune {
+	uint32_t frequency;	/* same units as VIDIOC_S_FREQUENCY */
+	uint32_t timeout;	/* msecs, 0 selects the driver default */
+	uint32_t status;	/* returned IVTV_TUNE_* flags */
+	int32_t afc;		/* last tuner AFC reading, 0 is centered */
+	uint32_t lock_time;	/* msecs from tuning to PLL lock */
+	uint32_t signal_time;	/* msecs from tuning to video present */
+	uint32_t reserved[2];
+};
+
+/* For use with IVTV_IOC_G_ENC_INDEX. The encoder firmware indexes every
+   picture it encodes, the driver collects these entries as the MPEG data
+   is transferred. Each call returns the entries collected since the last
+   call, oldest first. Offsets count bytes since the start of the capture. */
+#define IVTV_ENC_INDEX_ENTRIES		64
+#define IVTV_ENC_INDEX_FRAME_I		0
+#define IVTV_ENC_INDEX_FRAME_P		1
+#define IVTV_ENC_INDEX_FRAME_B		2
+#define IVTV_ENC_INDEX_FRAME_MASK	0xf
+
+struct ivtv_enc_index_entry {
+	uint64_t offset;	/* offset of the picture in the MPEG stream */
+	uint64_t pts;		/* 33 bit PTS of the picture */
+	uint32_t length;	/* length of the picture in bytes */
+	uint32_t flags;		/* IVTV_ENC_INDEX_FRAME_* */
+	uint32_t reserved[2];
+};
+
+struct ivtv_enc_index {
+	uint32_t entries;	/* number of entries returned */
+	uint32_t entries_cap;	/* entries the driver keeps between calls */
+	uint32_t reserved[4];
+	struct ivtv_enc_index_entry entry[IVTV_ENC_INDEX_ENTRIES];
+};
+
+/* For use with IVTV_IOC_S_PACK on the PCM or raw VBI device. With chunks
+   set, each capture buffer collects up to that many DMA transfers back
+   to back instead of one, and starts with a struct ivtv_pack_header
+   telling where each one is. chunks 0 turns packing off. The driver
+   returns the new buffer size, capture must not be running. */
+#define IVTV_PACK_MAX_CHUNKS		32
+#define IVTV_PACK_MAGIC			0x4b505649	/* "IVPK" */
+
+struct ivtv_pack {
+	uint32_t chunks;	/* chunks per buffer, at most IVTV_PACK_MAX_CHUNKS */
+	uint32_t bufsize;	/* returned: size of each buffer */
+	uint32_t reserved[2];
+};
+
+struct ivtv_pack_entry {
+	uint32_t offset;	/* from the start of the buffer */
+	uint32_t size;
+	uint64_t pts;		/* 33 bit PTS of the chunk */
+};
+
+struct ivtv_pack_header {
+	uint32_t magic;		/* IVTV_PACK_MAGIC */
+	uint32_t count;		/* entries in use */
+	uint32_t reserved[2];
+	struct ivtv_pack_entry entry[IVTV_PACK_MAX_CHUNKS];
+};
+
+/* For use with IVTV_IOC_G_BUF_TS after VIDIOC_DQBUF: when the buffer
+   was captured, valid until the buffer is queued again. mono_ns is
+   CLOCK_MONOTONIC when the DMA into the buffer completed, pts is the
+   encoder's 90 kHz clock for the data, the same clock on every stream
+   of a card. With IVTV_IOC_S_PACK it is the PTS of the first chunk. */
+struct ivtv_buf_ts {
+	uint32_t index;		/* buffer index, set by the application */
+	uint32_t sequence;	/* as returned by VIDIOC_DQBUF */
+	uint64_t pts;		/* 33 bit firmware PTS */
+	uint64_t mono_ns;	/* CLOCK_MONOTONIC, nanoseconds */
+	uint32_t reserved[4];
+};
+
+/* For use with IVTV_IOC_G_FANOUT on the MPEG device, when the driver was
+   loaded with mpg_fanout. All readers then share the stream, a reader
+   that is more than buffers transfers behind loses data. The counts are
+   for the calling file handle, which must have read or polled. */
+struct ivtv_fanout_status {
+	uint32_t buffers;	/* transfers the ring holds */
+	uint32_t readers;
+	uint32_t lag;		/* transfers not read yet */
+	uint32_t overruns;	/* times this reader fell behind */
+	uint32_t lost;		/* transfers it lost by that */
+	uint32_t reserved[3];
+};
+
+/* For use with IVTV_IOC_BATCH_BUF on a streaming capture device, in place
+   of a VIDIOC_QBUF and a VIDIOC_DQBUF per buffer. The first nqueue
+   entries of buf[] are queued, index and for user pointer buffers
+   userptr and length set by the application. Then every buffer that is
+   done, up to IVTV_BATCH_MAX, is dequeued into buf[] from the start and
+   ndone set to their number. With IVTV_BATCH_WAIT the call waits for one
+   if none is done, failing with EINTR only if all of buf[] was queued.
+   With IVTV_BATCH_LIMIT no more than ndone, as given, are dequeued.
+   A buffer that could not be queued stops the queueing, nqueue is then
+   set to the number queued and error to the reason. */
+#define IVTV_BATCH_MAX		32
+#define IVTV_BATCH_WAIT		0x0001
+#define IVTV_BATCH_LIMIT	0x0002
+
+struct ivtv_batch_buf {
+	uint32_t index;
+	uint32_t bytesused;	/* dequeued */
+	uint32_t sequence;	/* dequeued */
+	uint32_t flags;		/* dequeued, V4L2_BUF_FLAG_* */
+	uint64_t userptr;	/* queued with V4L2_MEMORY_USERPTR if set */
+	uint32_t length;	/* of userptr */
+	uint32_t error;		/* dequeued, EIO if the transfer failed */
+	uint64_t ts_usec;	/* dequeued, the v4l2_buffer timestamp */
+	uint64_t pts;		/* dequeued, as from IVTV_IOC_G_BUF_TS */
+	uint64_t mono_ns;	/* dequeued, as from IVTV_IOC_G_BUF_TS */
+};
+
+struct ivtv_buf_batch {
+	uint32_t nqueue;
+	uint32_t ndone;
+	uint32_t flags;
+	int32_t error;
+	struct ivtv_batch_buf buf[IVTV_BATCH_MAX];
+};
 struct ivtv_ioctl_yuv_interlace{
 	int interlace_mode; /* Takes one of IVTV_YUV_MODE_xxxxxx values */
 	int threshold; /* If mode is auto then if src_height <= this value treat as progressive otherwise treat as interlaced */
@@ -0,0 +1,74 @@
+/*
+   process_packet() from enc_mindex.c, for ivtv-ubench
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "enc_mindex.c"
+
+#include "ubench.h"
+
+static FILE *stream;
+
+int ub_mindex_load(const uint8_t *data, size_t len)
+{
+	if (stream)
+		fclose(stream);
+	if ((stream = tmpfile()) == NULL)
+		return -1;
+	if (fwrite(data, 1, len, stream) != len || fflush(stream)) {
+		fclose(stream);
+		stream = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* mindex() without the file names, and stopping at the end of the
+   stream instead of waiting for more */
+unsigned long ub_mindex(void)
+{
+	uint32_t marker = 0xFFFFFFFF;
+	uint8_t byte = 0;
+
+	fp = stream;
+	indexfd = fopen("/dev/null", "w");
+	framecount = 0;
+	file_offset_of_last_packet = 0;
+	buffer_min = buffer_max = 0;
+	offset = 0;
+	buffer_seek(0);
+
+	for (;;) {
+		if ((marker & 0xFFFFFF00) == 0x100) {
+			loff_t newpos = process_packet(byte, NULL);
+
+			if (newpos != 0) {
+				marker = 0xFFFFFFFF;
+				buffer_seek(newpos);
+			}
+		}
+		marker <<= 8;
+		if (buffer_get_byte(&byte) < 0)
+			break;
+		marker |= byte;
+	}
+
+	if (indexfd)
+		fclose(indexfd);
+	indexfd = NULL;
+	fp = NULL;
+	return framecount;
+}
@@ -0,0 +1,63 @@
+/*
+ * mpeg_find_nearest() from ivtvplay.cc, for ivtv-ubench
+ *
+ * This program is licensed under the GNU General Public License, version 2
+ */
+
+#define main ivtvplay_main
+#include "ivtvplay.cc"
+#undef main
+
+extern "C" {
+#include "ubench.h"
+}
+
+static struct mpeg_file index_file;
+
+uint32_t ub_timestamp(int hour, int minute, int second, int frame) {
+  gop_header_t gop;
+  gop.data = 0;
+  gop.hour = hour;
+  gop.minute = minute;
+  gop.second = second;
+  gop.frame = frame;
+  return gop.data;
+}
+
+int ub_index_set(const uint32_t* gops, int n) {
+  free(index_file.index);
+  index_file.index = (struct mpeg_index_entry*)calloc(n, sizeof(struct mpeg_index_entry));
+  if (!index_file.index)
+    return -1;
+  for (int i = 0; i < n; i++) {
+    index_file.index[i].frame = i * 15;
+    index_file.index[i].timestamp.data = gops[i];
+    index_file.index[i].offset = (unsigned long long)i * 262144;
+  }
+  index_file.index_count = n;
+  return 0;
+}
+
+// mpeg_find_nearest() prints every lookup: that stays in the time, the
+// text goes to /dev/null
+unsigned long ub_find_nearest(const uint32_t* keys, int n) {
+  unsigned long sum = 0;
+  gop_header_t gop;
+  int out, null;
+
+  fflush(stdout);
+  out = dup(1);
+  null = open("/dev/null", O_WRONLY);
+  dup2(null, 1);
+  close(null);
+
+  for (int i = 0; i < n; i++) {
+    gop.data = keys[i];
+    sum += mpeg_find_nearest(&index_file, gop)->offset >> 18;
+  }
+
+  fflush(stdout);
+  dup2(out, 1);
+  close(out);
+  return sum;
+}
@@ -0,0 +1,577 @@
+/*
+   Microbenchmarks for the per-byte loops of the user space tools
+
+   Times HM12 to I420 conversion (ivtv-mux), the raw VBI byteswap
+   (ivtv-vbislice), the start code scan of splice() (ivtv-encoder), MPEG
+   indexing with process_packet() (ivtv-encoder) and GOP lookup with
+   mpeg_find_nearest() (ivtvplay). The inputs are made from a fixed seed,
+   so every run and every build sees the same bytes; -Y and -M use a
+   capture instead.
+
+   Each kernel is run -w times to warm up, then -r times measured. The
+   median run gives the time and TSC cycles per byte (or per lookup) and
+   the throughput. With -o the results are written one kernel per line,
+   and -c reads such a file back and prints the change against it, so
+   runs on two builds can be compared. The check column is a sum of the
+   kernel's output: if it changes between builds, so did the results.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "vbislice.h"
+#include "ubench.h"
+
+#define WARMUP		2
+#define REPEAT		11
+#define MAX_RUNS	1000
+
+#define HM12_FRAMES	8		/* distinct frames, more than the caches */
+#define HM12_RUN	25		/* frames converted per run */
+#define VBI_SIZE	(4 << 20)
+#define MPEG_SIZE	(16 << 20)
+#define SPLICE_CHUNK	(128 * 1024)	/* a read() of the encoder */
+#define GOPS		21600		/* 3 hours of 15 frame GOPs at 30 fps */
+#define LOOKUPS		100000
+
+struct kernel {
+	const char *name;
+	const char *unit;
+	double units;			/* per run */
+	unsigned long (*run)(void);
+};
+
+struct result {
+	double ns;			/* per unit, median run */
+	double ns_min;
+	double cycles;			/* per unit, median run */
+	unsigned long check;
+	int unstable;			/* check differed between runs */
+};
+
+static uint32_t seed = 0x1d872b41;
+
+/* HM12 input and I420 output */
+static int width = 720, height = 480;
+static uint8_t *hm12[HM12_FRAMES];
+static size_t hm12_size;
+static int hm12_frames = HM12_FRAMES;
+static uint8_t *i420;
+
+static uint8_t *vbi;
+static uint8_t *mpeg;
+static size_t mpeg_size;
+static uint32_t gops[GOPS];
+static uint32_t keys[LOOKUPS];
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "    -w <runs>      warmup runs (default: %d)\n", WARMUP);
+	fprintf(stderr, "    -r <runs>      measured runs (default: %d)\n", REPEAT);
+	fprintf(stderr, "    -k <kernels>   run only these, as hm12,splice\n");
+	fprintf(stderr, "    -s pal|ntsc    size of the HM12 frames (default: ntsc)\n");
+	fprintf(stderr, "    -Y <file>      HM12 capture to convert instead of test frames\n");
+	fprintf(stderr, "    -M <file>      MPEG capture to scan instead of a test stream\n");
+	fprintf(stderr, "    -l <label>     label of this run, as a revision\n");
+	fprintf(stderr, "    -o <file>      write the results here\n");
+	fprintf(stderr, "    -c <file>      compare with results written by -o\n");
+	fprintf(stderr, "    -h             display this help message\n");
+}
+
+static uint32_t rnd(void)
+{
+	/* xorshift32, the same on every libc */
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* TSC ticks, not core clocks: with frequency scaling they differ */
+static uint64_t cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	uint32_t lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return (uint64_t)hi << 32 | lo;
+#else
+	return 0;
+#endif
+}
+
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size);
+
+	if (p == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static uint8_t *load(const char *file, size_t *size)
+{
+	struct stat st;
+	uint8_t *p;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		exit(1);
+	}
+	p = xmalloc(st.st_size + 1);
+	if (read(fd, p, st.st_size) != st.st_size) {
+		fprintf(stderr, "%s: short read\n", file);
+		exit(1);
+	}
+	close(fd);
+	*size = st.st_size;
+	return p;
+}
+
+/* Payload bytes with roughly the zeros of coded video, but never a
+   start code */
+static uint8_t *put_payload(uint8_t *p, int n)
+{
+	while (n--) {
+		uint32_t r = rnd();
+		uint8_t b = (r & 7) ? r >> 8 : 0;
+
+		if (b <= 1 && p[-1] == 0 && p[-2] == 0)
+			b = 0x80;
+		*p++ = b;
+	}
+	return p;
+}
+
+static uint8_t *put_code(uint8_t *p, uint8_t code)
+{
+	*p++ = 0;
+	*p++ = 0;
+	*p++ = 1;
+	*p++ = code;
+	return p;
+}
+
+static uint8_t *put_be32(uint8_t *p, uint32_t v)
+{
+	*p++ = v >> 24;
+	*p++ = v >> 16;
+	*p++ = v >> 8;
+	*p++ = v;
+	return p;
+}
+
+/* The video elementary stream: a sequence header and GOP header every
+   15 pictures of 30 slices, IBBPBBPBBPBBPBB, about 6 Mbit/s at 30 fps */
+static size_t make_video(uint8_t *es, size_t size)
+{
+	static const int kbytes[3] = { 60, 30, 19 };	/* I, P, B */
+	uint8_t *p = es + 2, *end = es + size - 1024 * 1024;
+	int gop = 0, pic, slice, type, len;
+
+	es[0] = es[1] = 0xff;
+	while (p < end) {
+		int secs = gop / 2;
+
+		p = put_code(p, 0xb3);
+		p = put_be32(p, 720 << 20 | 480 << 8 | 0x34);
+		p = put_be32(p, 0xffffe000);
+		p = put_code(p, 0xb5);
+		p = put_payload(p, 6);
+		p = put_code(p, 0xb8);
+		p = put_be32(p, (secs / 3600) << 26 | (secs / 60 % 60) << 20 |
+			     1 << 19 | (secs % 60) << 13 | (gop & 1) * 15 << 7 |
+			     1 << 6);
+		for (pic = 0; pic < 15; pic++) {
+			type = pic == 0 ? 0 : pic % 3 == 0 ? 1 : 2;
+			p = put_code(p, 0x00);
+			p = put_be32(p, pic << 22 | (type + 1) << 19);
+			len = kbytes[type] * 1024 / 30;
+			for (slice = 1; slice <= 30; slice++) {
+				p = put_code(p, slice);
+				p = put_payload(p, len - 4 + (int)(rnd() % 64) - 32);
+			}
+		}
+		gop++;
+	}
+	return p - es - 2;
+}
+
+/* Cut the video into the 2048 byte packs of a program stream, with an
+   audio packet every 27 packs, as the card muxes 224 kbit/s of MPEG
+   audio with the video */
+static size_t make_mpeg(uint8_t *ps, size_t size)
+{
+	uint8_t *es = xmalloc(size), *v;
+	uint8_t *p = ps, *end = ps + size - 2048;
+	size_t es_len = make_video(es, size);
+	int pack = 0, n;
+
+	v = es + 2;
+	while (p < end && v < es + 2 + es_len) {
+		/* pack header */
+		p = put_code(p, 0xba);
+		p = put_be32(p, 0x44000400 | (pack & 0xffff) << 3);
+		p = put_be32(p, 0x04010189);
+		*p++ = 0xc3;
+		*p++ = 0xf8;
+
+		/* one PES packet fills the rest of the pack */
+		n = 2048 - 14 - 6;
+		p = put_code(p, pack % 27 == 26 ? 0xc0 : 0xe0);
+		*p++ = n >> 8;
+		*p++ = n;
+		*p++ = 0x81;
+		*p++ = 0x80;
+		*p++ = 5;
+		p = put_payload(p, 5);
+		n -= 8;
+		if (pack % 27 == 26) {
+			p = put_payload(p, n);
+		} else {
+			if (n > es + 2 + es_len - v)
+				n = es + 2 + es_len - v;
+			memcpy(p, v, n);
+			p += n;
+			v += n;
+		}
+		pack++;
+	}
+	p = put_code(p, 0xb9);
+	free(es);
+	return p - ps;
+}
+
+static void make_hm12(uint8_t *p)
+{
+	int x, y, i;
+
+	/* a gradient with noise, in macroblock order it is all the same */
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			*p++ = 16 + (x + y) % 200 + (rnd() & 15);
+	p += hm12_size - width * height - width * height / 2;
+	for (i = 0; i < width * height / 2; i++)
+		*p++ = 128 + (int)(rnd() % 64) - 32;
+}
+
+static void setup(const char *yuv_file, const char *mpeg_file)
+{
+	int pagesize = getpagesize();
+	size_t ysize = width * height, size;
+	int i;
+
+	hm12_size = (ysize + pagesize - 1) / pagesize * pagesize + ysize / 2;
+	i420 = xmalloc(ysize * 3 / 2);
+	if (yuv_file) {
+		uint8_t *p = load(yuv_file, &size);
+
+		hm12_frames = size / hm12_size;
+		if (hm12_frames == 0) {
+			fprintf(stderr, "%s: less than one %dx%d frame\n",
+				yuv_file, width, height);
+			exit(1);
+		}
+		if (hm12_frames > HM12_FRAMES)
+			hm12_frames = HM12_FRAMES;
+		for (i = 0; i < hm12_frames; i++)
+			hm12[i] = p + i * hm12_size;
+	} else {
+		for (i = 0; i < HM12_FRAMES; i++) {
+			hm12[i] = xmalloc(hm12_size);
+			make_hm12(hm12[i]);
+		}
+	}
+
+	vbi = xmalloc(VBI_SIZE);
+	for (i = 0; i < VBI_SIZE / 4; i++)
+		((uint32_t *)vbi)[i] = rnd();
+
+	if (mpeg_file) {
+		mpeg = load(mpeg_file, &mpeg_size);
+	} else {
+		mpeg = xmalloc(MPEG_SIZE);
+		mpeg_size = make_mpeg(mpeg, MPEG_SIZE);
+	}
+	if (ub_mindex_load(mpeg, mpeg_size) < 0) {
+		fprintf(stderr, "can't write a temporary file: %s\n",
+			strerror(errno));
+		exit(1);
+	}
+
+	/* two GOPs a second; mpeg_find_nearest() never returns for a key
+	   before the first GOP or after the last, so keep them inside */
+	for (i = 0; i < GOPS; i++)
+		gops[i] = ub_timestamp(i / 7200, i / 120 % 60, i / 2 % 60,
+				       (i & 1) * 15);
+	if (ub_index_set(gops, GOPS) < 0) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < LOOKUPS; i++) {
+		int gop = rnd() % (GOPS - 1);
+
+		keys[i] = ub_timestamp(gop / 7200, gop / 120 % 60, gop / 2 % 60,
+				       rnd() % 30);
+	}
+}
+
+static unsigned long sum(const uint8_t *p, size_t len)
+{
+	unsigned long s = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		s = s * 31 + p[i];
+	return s;
+}
+
+static unsigned long run_hm12(void)
+{
+	int i;
+
+	for (i = 0; i < HM12_RUN; i++)
+		ub_hm12_to_i420(i420, hm12[i % hm12_frames], width, height);
+	return sum(i420, width * height * 3 / 2);
+}
+
+/* swapping twice leaves the buffer as it was for the next run */
+static unsigned long run_bswap(void)
+{
+	vbislice_swap(vbi, VBI_SIZE);
+	vbislice_swap(vbi, VBI_SIZE);
+	return sum(vbi, 4096);
+}
+
+static unsigned long run_splice(void)
+{
+	return ub_splice(mpeg, mpeg_size, SPLICE_CHUNK);
+}
+
+static unsigned long run_mindex(void)
+{
+	return ub_mindex();
+}
+
+static unsigned long run_nearest(void)
+{
+	return ub_find_nearest(keys, LOOKUPS);
+}
+
+static struct kernel kernels[] = {
+	{ "hm12", "byte", 0, run_hm12 },
+	{ "bswap", "byte", 2.0 * VBI_SIZE, run_bswap },
+	{ "splice", "byte", 0, run_splice },
+	{ "mindex", "byte", 0, run_mindex },
+	{ "nearest", "lookup", LOOKUPS, run_nearest },
+};
+
+#define NKERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void measure(const struct kernel *k, int warmup, int repeat,
+		    struct result *r)
+{
+	static double ns[MAX_RUNS], cyc[MAX_RUNS];
+	unsigned long check;
+	uint64_t c;
+	double t;
+	int i;
+
+	memset(r, 0, sizeof(*r));
+	for (i = 0; i < warmup; i++)
+		r->check = k->run();
+	for (i = 0; i < repeat; i++) {
+		t = now_ns();
+		c = cycles();
+		check = k->run();
+		cyc[i] = cycles() - c;
+		ns[i] = now_ns() - t;
+		if ((warmup || i) && check != r->check)
+			r->unstable = 1;
+		r->check = check;
+	}
+	qsort(ns, repeat, sizeof(ns[0]), cmp_double);
+	qsort(cyc, repeat, sizeof(cyc[0]), cmp_double);
+	r->ns = ns[repeat / 2] / k->units;
+	r->ns_min = ns[0] / k->units;
+	r->cycles = cyc[repeat / 2] / k->units;
+}
+
+/* Find kernel name in a results file, 0 if it has it */
+static int find_old(FILE *f, const char *name, struct result *r)
+{
+	char line[256], kname[64], unit[64];
+	double units, mps;
+
+	rewind(f);
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%63s %63s %lf %lf %lf %lf %lf %lx", kname, unit,
+			   &units, &r->ns, &r->ns_min, &r->cycles, &mps,
+			   &r->check) == 8 && !strcmp(kname, name))
+			return 0;
+	}
+	return -1;
+}
+
+static int selected(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p;
+
+	if (list == NULL)
+		return 1;
+	for (p = list; (p = strstr(p, name)); p += len)
+		if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == 0))
+			return 1;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *only = NULL, *label = "-";
+	const char *yuv_file = NULL, *mpeg_file = NULL;
+	const char *out_file = NULL, *old_file = NULL;
+	int warmup = WARMUP, repeat = REPEAT;
+	FILE *out = NULL, *old = NULL;
+	struct result r, o;
+	int i, opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "w:r:k:s:Y:M:l:o:c:h")) != -1) {
+		switch (opt) {
+		case 'w':
+			warmup = atoi(optarg);
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'k':
+			only = optarg;
+			break;
+		case 's':
+			height = strcmp(optarg, "pal") ? 480 : 576;
+			break;
+		case 'Y':
+			yuv_file = optarg;
+			break;
+		case 'M':
+			mpeg_file = optarg;
+			break;
+		case 'l':
+			label = optarg;
+			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		case 'c':
+			old_file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+	if (warmup < 0 || repeat <= 0 || repeat > MAX_RUNS) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (old_file && (old = fopen(old_file, "r")) == NULL) {
+		fprintf(stderr, "%s: %s\n", old_file, strerror(errno));
+		return 1;
+	}
+	if (out_file && (out = fopen(out_file, "w")) == NULL) {
+		fprintf(stderr, "%s: %s\n", out_file, strerror(errno));
+		return 1;
+	}
+
+	setup(yuv_file, mpeg_file);
+	kernels[0].units = (double)HM12_RUN * width * height * 3 / 2;
+	kernels[2].units = mpeg_size;
+	kernels[3].units = mpeg_size;
+
+	if (out) {
+		fprintf(out, "# ivtv-ubench %s, %d warmup and %d measured runs\n",
+			label, warmup, repeat);
+		fprintf(out, "# hm12 %dx%d%s, mpeg %s\n", width, height,
+			yuv_file ? " from a capture" : "",
+			mpeg_file ? mpeg_file : "test stream");
+		fprintf(out, "# kernel unit units/run ns/unit min-ns/unit "
+			"cycles/unit M-units/s check\n");
+	}
+	printf("%-8s %6s %10s %10s %11s %12s  %s\n", "kernel", "unit",
+	       "ns/unit", "min", "cycles/unit", "M-units/s", "check");
+
+	for (i = 0; i < NKERNELS; i++) {
+		const struct kernel *k = &kernels[i];
+
+		if (!selected(only, k->name))
+			continue;
+		measure(k, warmup, repeat, &r);
+		printf("%-8s %6s %10.4f %10.4f %11.3f %12.2f  %08lx%s\n",
+		       k->name, k->unit, r.ns, r.ns_min, r.cycles, 1e3 / r.ns,
+		       r.check, r.unstable ? " (differs between runs)" : "");
+		if (out)
+			fprintf(out, "%s %s %.0f %.6f %.6f %.6f %.4f %lx\n",
+				k->name, k->unit, k->units, r.ns, r.ns_min,
+				r.cycles, 1e3 / r.ns, r.check);
+		if (r.unstable)
+			failed = 1;
+		if (old && find_old(old, k->name, &o) == 0) {
+			printf("%-8s %6s %+9.1f%% %+9.1f%% %+10.1f%%  %s\n",
+			       "", "vs old", (r.ns / o.ns - 1) * 100,
+			       (r.ns_min / o.ns_min - 1) * 100,
+			       o.cycles ? (r.cycles / o.cycles - 1) * 100 : 0,
+			       r.check == o.check ? "same output" :
+			       "OUTPUT DIFFERS");
+		}
+	}
+
+	if (out)
+		fclose(out);
+	if (old)
+		fclose(old);
+	return failed;
+}
@@ -0,0 +1,46 @@
+/*
+   The kernels ivtv-ubench measures. Each ub-*.c builds the tool source
+   a kernel lives in, with its main() renamed, so the code timed is the
+   code the tool runs.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __UBENCH_H
+#define __UBENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ivtv-mux.c: one HM12 frame to planar I420 */
+void ub_hm12_to_i420(uint8_t *dst, const uint8_t *src, int width, int height);
+
+/* encoder.c: splice() in GOP_COUNTER mode over len bytes, fed chunk bytes
+   at a time like a read() loop would. Returns GOPs plus pictures seen. */
+unsigned long ub_splice(uint8_t *buf, size_t len, int chunk);
+
+/* enc_mindex.c: index an MPEG program stream with process_packet(), the
+   loop of mindex() reading the stream from a temporary file. ub_mindex_load()
+   writes that file, ub_mindex() returns the pictures counted. */
+int ub_mindex_load(const uint8_t *data, size_t len);
+unsigned long ub_mindex(void);
+
+/* ivtvplay.cc: mpeg_find_nearest() on an index of n GOP timestamps, in
+   the packed form of gop_header_t made by ub_timestamp() */
+uint32_t ub_timestamp(int hour, int minute, int second, int frame);
+int ub_index_set(const uint32_t *gops, int n);
+unsigned long ub_find_nearest(const uint32_t *keys, int n);
+
+#endif
@@ -17,6 +17,8 @@
 #include <fcntl.h>              /* low-level i/o */
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
@@ -25,12 +27,25 @@
 #include <asm/page.h>
 
 #include <asm/types.h>          /* for videodev2.h */
+#include <stdint.h>
 
 #define __user
 #include "videodev2.h"
+#include "ivtv.h"
+
+#include "ivtv-diowrite.h"
+#include "ivtv-capstats.h"
 
 #define CLEAR(x) memset (&(x), 0, sizeof (x))
 
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB	0x40000
+#endif
+#define HUGE_SIZE	(2 * 1024 * 1024)
+/* -s queries the queue depth every this many buffers, it costs a
+   VIDIOC_QUERYBUF per buffer allocated */
+#define DEPTH_EVERY	32
+
 static void stop_capturing (void);
 
 typedef enum {
@@ -63,6 +78,16 @@ static int		frames_read	= 0;
 static int pageysize;
 static int pageuvsize;
 static int		nonblocking	= 1;
+static int		aio_depth	= 0;	/* O_DIRECT and AIO when set */
+static struct ivtv_diow	diow;
+static int		huge		= 0;	/* userp buffers from one arena */
+static int		batch		= 0;	/* IVTV_IOC_BATCH_BUF */
+static void *		arena		= NULL;
+static size_t		arena_size	= 0;
+static int		stats		= 0;	/* per buffer latency and drops */
+static char *		trace_name	= NULL;	/* CSV of every buffer */
+static struct ivtv_capstats capstats;
+static int		arena_mapped	= 0;	/* hugetlbfs, else malloced */
 static int 		height		= 480;
 static int		width		= 720;
 
@@ -90,6 +115,28 @@ xioctl                          (int                    fd,
         return r;
 }
 
+static int
+write_out			(const void *		p,
+				 size_t			len)
+{
+	if (aio_depth)
+		return ivtv_diow_write (&diow, p, len);
+	return write (fd_out, p, len);
+}
+
+/* HM12 goes out as the Y plane then the UV plane, without the padding
+   that starts the UV plane on a page. A buffer short of both is skipped. */
+static int
+write_hm12			(const char *		p,
+				 unsigned int		bytesused)
+{
+	if (bytesused < (unsigned int)(ysize + uvoffset + uvsize))
+		return 0;
+	if (-1 == write_out (p, ysize))
+		return -1;
+	return write_out (p + ysize + uvoffset, uvsize);
+}
+
 static void
 process_image                   (const void *           p)
 {
@@ -97,15 +144,94 @@ process_image                   (const void *           p)
         fflush (stdout);
 }
 
+/* Buffers the driver still has to capture into, and those done and
+   waiting for a VIDIOC_DQBUF */
+static void
+query_depth			(int *			queued,
+				 int *			done)
+{
+	struct v4l2_buffer buf;
+	unsigned int i;
+
+	*queued = *done = 0;
+	for (i = 0; i < n_buffers; ++i) {
+		CLEAR (buf);
+
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.index = i;
+
+		if (-1 == xioctl (fd, VIDIOC_QUERYBUF, &buf)) {
+			*queued = *done = -1;
+			return;
+		}
+		if (buf.flags & V4L2_BUF_FLAG_QUEUED)
+			++*queued;
+		else if (buf.flags & V4L2_BUF_FLAG_DONE)
+			++*done;
+	}
+}
+
+/* When the DMA into a dequeued buffer completed, on CLOCK_MONOTONIC */
+static uint64_t
+capture_time			(const struct v4l2_buffer *	buf)
+{
+	struct ivtv_buf_ts ts;
+	struct timespec real;
+	int64_t ns;
+
+	CLEAR (ts);
+	ts.index = buf->index;
+	if (0 == xioctl (fd, IVTV_IOC_G_BUF_TS, &ts) && ts.mono_ns)
+		return ts.mono_ns;
+
+	/* not an ivtv: the timestamp is gettimeofday(), move it over */
+	if (0 == buf->timestamp.tv_sec && 0 == buf->timestamp.tv_usec)
+		return 0;
+	clock_gettime (CLOCK_REALTIME, &real);
+	ns = (int64_t) buf->timestamp.tv_sec * 1000000000 +
+		buf->timestamp.tv_usec * 1000;
+	ns += (int64_t) ivtv_capstats_now () -
+		((int64_t) real.tv_sec * 1000000000 + real.tv_nsec);
+	return ns > 0 ? ns : 0;
+}
+
+static void
+record_buffer			(const struct v4l2_buffer *	buf,
+				 uint64_t		dequeue_ns)
+{
+	struct ivtv_capstats_buf b;
+
+	CLEAR (b);
+	b.has_seq = 1;
+	b.sequence = buf->sequence;
+	b.index = buf->index;
+	b.bytesused = buf->bytesused;
+	b.dequeue_ns = dequeue_ns;
+	b.capture_ns = capture_time (buf);
+	if (0 == capstats.bufs % DEPTH_EVERY)
+		query_depth (&b.queued, &b.done);
+	else
+		b.queued = b.done = -1;
+
+	ivtv_capstats_add (&capstats, &b);
+}
+
+static void
+stop_signal			(int			sig)
+{
+	/* select() returns EINTR and the loops end */
+}
+
 static int
 read_frame			(void)
 {
 	struct v4l2_buffer buf;
 	unsigned int i;
+	ssize_t n;
 
 	switch (io) {
 	case IO_METHOD_READ:
-    		if (-1 == read (fd, buffers[0].start, buffers[0].length)) {
+    		if (-1 == (n = read (fd, buffers[0].start, buffers[0].length))) {
             		switch (errno) {
             		case EAGAIN:
                     		return 0;
@@ -120,8 +246,18 @@ read_frame			(void)
 			}
 		}
 
+		if (stats) {
+			struct ivtv_capstats_buf b;
+
+			CLEAR (b);
+			b.bytesused = n;
+			b.dequeue_ns = ivtv_capstats_now ();
+			b.queued = b.done = -1;
+			ivtv_capstats_add (&capstats, &b);
+		}
+
     		process_image (buffers[0].start);
-		if (-1 == write (fd_out, (void *)buffers[0].start, buffers[0].length))
+		if (-1 == write_out ((void *)buffers[0].start, buffers[0].length))
                        	errno_exit ("write");
 
 		break;
@@ -150,6 +286,9 @@ read_frame			(void)
 
                 assert (buf.index < n_buffers);
 
+		if (stats)
+			record_buffer (&buf, ivtv_capstats_now ());
+
 	        process_image (buffers[buf.index].start);
 
 		// Write out Data
@@ -164,19 +303,8 @@ read_frame			(void)
 			fprintf(stderr, "\nGot buffer with %d bytes of yuv data (actual=%d, expected=%d)", 
 				buf.bytesused, buffers[buf.index].length, (ysize+uvoffset+uvsize));
 
-			if (buf.bytesused/*buffers[buf.index].length*/ >= (ysize+uvoffset+uvsize))
-			{
-#if 0
-				if (-1 == write (fd_out, (void *)buffers[buf.index].start, 4))
-                        		errno_exit ("write");
-			}
-#else
-				if (-1 == write (fd_out, (void *)buffers[buf.index].start, ysize))
-                        		errno_exit ("write");
-				if (-1 == write (fd_out, (void *)buffers[buf.index].start+(ysize+uvoffset), uvsize))
-                        		errno_exit ("write");
-			}
-#endif
+			if (-1 == write_hm12 (buffers[buf.index].start, buf.bytesused))
+				errno_exit ("write");
 
 #if 0
 				for(y=0;y<height;y+=16) {
@@ -223,7 +351,7 @@ read_frame			(void)
 			if (buf.bytesused <= buffers[buf.index].length && 
 				buffers[buf.index].length > 0)
 			{
-				if (-1 == write (fd_out,
+				if (-1 == write_out (
                         		(void *)buffers[buf.index].start, buf.bytesused/*buffers[buf.index].length*/))
                 		{
                         		errno_exit ("write");
@@ -233,7 +361,7 @@ read_frame			(void)
 		} else {
 			fprintf(stderr, 
 				"\nGot buffer with %d bytes of data (max=%d)", buf.bytesused, buffers[buf.index].length);
-			if (-1 == write (fd_out, (void *)buffers[buf.index].start, 4))
+			if (-1 == write_out ((void *)buffers[buf.index].start, 4))
                        		errno_exit ("write");
 		}
 
@@ -264,6 +392,9 @@ read_frame			(void)
 			}
 		}
 
+		if (stats)
+			record_buffer (&buf, ivtv_capstats_now ());
+
 		for (i = 0; i < n_buffers; ++i)
 			if (buf.m.userptr == (unsigned long) buffers[i].start
 			    && buf.length == buffers[i].length)
@@ -275,7 +406,7 @@ read_frame			(void)
 
     		process_image ((void *) buf.m.userptr);
 
- 		if (-1 == write (fd_out, (void *) buf.m.userptr, buf.bytesused))
+ 		if (-1 == write_out ((void *) buf.m.userptr, buf.bytesused))
                         errno_exit ("write");
 
 		if (-1 == xioctl (fd, VIDIOC_QBUF, &buf)) {
@@ -338,6 +469,107 @@ mainloop                        (void)
         }
 }
 
+/* One IVTV_IOC_BATCH_BUF for all the buffers done, which gives back
+   those written out before. With nothing to give back select() waits
+   first, otherwise the ioctl does: the driver may have none left to
+   fill and nothing would ever be done. */
+static void
+batch_loop                      (void)
+{
+	struct ivtv_buf_batch b;
+	unsigned int i, limit;
+	uint64_t now = 0;
+
+	CLEAR (b);
+	while (count > 0) {
+		fd_set fds;
+		struct timeval tv;
+		int r;
+
+		if (0 == b.nqueue) {
+			FD_ZERO (&fds);
+			FD_SET (fd, &fds);
+			tv.tv_sec = 10;
+			tv.tv_usec = 0;
+
+			r = select (fd + 1, &fds, NULL, NULL, &tv);
+			if (-1 == r) {
+				if (EINTR == errno)
+					return;
+				errno_exit ("select");
+			}
+			if (0 == r) {
+				fprintf (stderr, "select timeout\n");
+				exit (EXIT_FAILURE);
+			}
+		}
+
+		/* no more than the frames still wanted */
+		b.flags = IVTV_BATCH_LIMIT | (b.nqueue ? IVTV_BATCH_WAIT : 0);
+		limit = count < IVTV_BATCH_MAX ? count : IVTV_BATCH_MAX;
+		b.ndone = limit;
+		if (-1 == ioctl (fd, IVTV_IOC_BATCH_BUF, &b)) {
+			if (EINTR == errno)
+				return;
+			errno_exit ("IVTV_IOC_BATCH_BUF");
+		}
+		if (b.error) {
+			errno = -b.error;
+			errno_exit ("IVTV_IOC_BATCH_BUF");
+		}
+		if (stats)
+			now = ivtv_capstats_now ();
+
+		for (i = 0; i < b.ndone; i++) {
+			struct ivtv_batch_buf *e = &b.buf[i];
+
+			frames_read++;
+			if (e->error || 0 == count)
+				continue;
+			count--;
+
+			assert (e->index < n_buffers);
+			if (stats) {
+				struct ivtv_capstats_buf cb;
+
+				CLEAR (cb);
+				cb.has_seq = 1;
+				cb.sequence = e->sequence;
+				cb.index = e->index;
+				cb.bytesused = e->bytesused;
+				cb.capture_ns = e->mono_ns;
+				cb.dequeue_ns = now;
+				/* all given back before the call, so
+				   the driver has what this batch
+				   didn't return, and the rest of the
+				   batch was waiting too.  A batch cut
+				   short by the limit may have left
+				   more done, so then neither is known */
+				if (b.ndone < limit) {
+					cb.queued = n_buffers - b.ndone;
+					cb.done = b.ndone - 1 - i;
+				} else {
+					cb.queued = -1;
+					cb.done = -1;
+				}
+				ivtv_capstats_add (&capstats, &cb);
+			}
+			process_image (buffers[e->index].start);
+			if (hm12) {
+				if (-1 == write_hm12 (buffers[e->index].start,
+						      e->bytesused))
+					errno_exit ("write");
+			} else if (-1 == write_out (buffers[e->index].start,
+						    e->bytesused)) {
+				errno_exit ("write");
+			}
+		}
+
+		/* as dequeued, index and userptr are what is needed */
+		b.nqueue = b.ndone;
+	}
+}
+
 static void
 stop_capturing                  (void)
 {
@@ -400,6 +632,7 @@ start_capturing                 (void)
 
         		buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         		buf.memory      = V4L2_MEMORY_USERPTR;
+			buf.index       = i;
         		buf.m.userptr	= (unsigned long) buffers[i].start;
 			buf.length      = buffers[i].length;
 
@@ -434,8 +667,13 @@ uninit_device                   (void)
 		break;
 
 	case IO_METHOD_USERPTR:
-		for (i = 0; i < n_buffers; ++i)
-			free (buffers[i].start);
+		if (arena_mapped)
+			munmap (arena, arena_size);
+		else if (arena)
+			free (arena);
+		else
+			for (i = 0; i < n_buffers; ++i)
+				free (buffers[i].start);
 		break;
 	}
 
@@ -522,6 +760,40 @@ init_mmap			(void)
         }
 }
 
+/* One region for all the buffers, in huge pages if possible: from
+   hugetlbfs, else aligned for transparent huge pages. The driver then
+   pins and maps it a huge page at a time. */
+static void
+init_arena			(unsigned int		n,
+				 size_t			buffer_size)
+{
+	void *p;
+
+	arena_size = (n * buffer_size + HUGE_SIZE - 1) & ~(size_t)(HUGE_SIZE - 1);
+	arena = mmap (NULL, arena_size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (arena != MAP_FAILED) {
+		arena_mapped = 1;
+		fprintf (stderr, "%zu byte arena in hugetlb pages\n", arena_size);
+		return;
+	}
+	arena = NULL;
+	if (posix_memalign (&p, HUGE_SIZE, arena_size)) {
+		fprintf (stderr, "Out of memory\n");
+		exit (EXIT_FAILURE);
+	}
+	arena = p;
+#ifdef MADV_HUGEPAGE
+	if (0 == madvise (arena, arena_size, MADV_HUGEPAGE))
+		fprintf (stderr, "%zu byte arena, transparent huge pages\n",
+			 arena_size);
+	else
+#endif
+		fprintf (stderr, "%zu byte arena, no huge pages\n", arena_size);
+	/* fault it in now, not during capture */
+	memset (arena, 0, arena_size);
+}
+
 static void
 init_userp			(unsigned int		buffer_size)
 {
@@ -550,6 +822,19 @@ init_userp			(unsigned int		buffer_size)
                 exit (EXIT_FAILURE);
         }
 
+	if (huge) {
+		size_t stride = (buffer_size + getpagesize () - 1) &
+				~(size_t)(getpagesize () - 1);
+
+		init_arena (req.count, stride);
+		for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
+			buffers[n_buffers].length = buffer_size;
+			buffers[n_buffers].start =
+				(char *) arena + n_buffers * stride;
+		}
+		return;
+	}
+
         for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
                 buffers[n_buffers].length = buffer_size;
                 buffers[n_buffers].start = malloc (buffer_size);
@@ -708,6 +993,20 @@ close_device                    (void)
 
         fd = -1;
 
+	if (aio_depth) {
+		if (-1 == ivtv_diow_close (&diow))
+			errno_exit ("write");
+		fprintf (stderr, "%lu writes, %lu waits for a free buffer, "
+			 "latency avg %llu p50 < %lu p99 < %lu max %llu us\n",
+			 diow.completed, diow.stalls,
+			 (unsigned long long) (diow.completed ?
+					       diow.lat_sum / diow.completed : 0),
+			 ivtv_diow_percentile (&diow, 50),
+			 ivtv_diow_percentile (&diow, 99),
+			 (unsigned long long) diow.lat_max);
+		return;
+	}
+
  	if (-1 == close (fd_out))
                 errno_exit ("close");
 	fd_out = -1;
@@ -741,6 +1040,15 @@ open_device                     (void)
         }
 
 	fprintf (stderr, "Writing to '%s'\n", out_dev_name);
+	if (aio_depth) {
+		if (-1 == ivtv_diow_open (&diow, out_dev_name, aio_depth,
+					  IVTV_DIOW_BUFSIZE)) {
+			fprintf (stderr, "Cannot open '%s' for O_DIRECT: %d, %s\n",
+				 out_dev_name, errno, strerror (errno));
+			exit (EXIT_FAILURE);
+		}
+		return;
+	}
         fd_out = open (out_dev_name,
                 O_RDWR | O_CREAT| O_APPEND |O_TRUNC, S_IRWXU|S_IRGRP|S_IROTH);
 
@@ -768,11 +1076,16 @@ usage                           (FILE *                 fp,
                  "-m | --mmap          Use memory mapped buffers\n"
                  "-r | --read          Use read() calls\n"
                  "-u | --userp         Use application allocated buffers\n"
+                 "-a | --aio     depth Write with O_DIRECT, depth buffers in flight\n"
+                 "-H | --huge          Userp buffers from one huge page arena\n"
+                 "-B | --batch         Dequeue and queue buffers in batches\n"
+                 "-s | --stats         Latency, jitter, drops and queue depth\n"
+                 "-t | --trace   name  Also write every buffer to a CSV file\n"
                  "",
 		 argv[0]);
 }
 
-static const char short_options [] = "d:c:o:b:hmru";
+static const char short_options [] = "d:c:o:b:hmrua:HBst:";
 
 static const struct option
 long_options [] = {
@@ -784,6 +1097,11 @@ long_options [] = {
         { "mmap",       no_argument,            NULL,           'm' },
         { "read",       no_argument,            NULL,           'r' },
         { "userp",      no_argument,            NULL,           'u' },
+        { "aio",        required_argument,      NULL,           'a' },
+        { "huge",       no_argument,            NULL,           'H' },
+        { "batch",      no_argument,            NULL,           'B' },
+        { "stats",      no_argument,            NULL,           's' },
+        { "trace",      required_argument,      NULL,           't' },
         { 0, 0, 0, 0 }
 };
 
@@ -839,6 +1157,26 @@ main                            (int                    argc,
                 case 'u':
                         io = IO_METHOD_USERPTR;
 			break;
+
+		case 'a':
+			aio_depth = (int)atoi(optarg);
+			break;
+
+		case 'H':
+			huge = 1;
+			io = IO_METHOD_USERPTR;
+			break;
+
+		case 'B':
+			batch = 1;
+			break;
+
+		case 't':
+			trace_name = optarg;
+			/* fall through */
+		case 's':
+			stats = 1;
+			break;
                 default:
                         usage (stderr, argc, argv);
                         exit (EXIT_FAILURE);
@@ -849,12 +1187,33 @@ main                            (int                    argc,
 
         init_device ();
 
+	if (stats) {
+		struct sigaction sa;
+
+		if (-1 == ivtv_capstats_open (&capstats, trace_name))
+			errno_exit (trace_name);
+
+		/* Ctrl-C ends the capture with a report */
+		CLEAR (sa);
+		sa.sa_handler = stop_signal;
+		sigaction (SIGINT, &sa, NULL);
+	}
+
         start_capturing ();
 
-        mainloop ();
+	if (batch && io != IO_METHOD_READ)
+		batch_loop ();
+	else
+		mainloop ();
 
         stop_capturing ();
 
+	if (stats) {
+		ivtv_capstats_report (&capstats, stderr);
+		if (-1 == ivtv_capstats_close (&capstats))
+			errno_exit (trace_name);
+	}
+
         uninit_device ();
 
         close_device ();
@@ -0,0 +1,185 @@
+/*
+   Slice raw VBI from an ivtv card, or from a raw capture file
+
+   Writes struct v4l2_sliced_vbi_data records, one block per frame like
+   a sliced VBI device would, or with -c the field 1 closed caption text.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+#define __user
+#include "videodev2.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "vbislice.h"
+
+#define MAX_LINES	36
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "    -d <device>    raw VBI device (default: /dev/vbi0)\n");
+	fprintf(stderr, "    -f <file>      read a raw VBI capture instead\n");
+	fprintf(stderr, "    -s pal|ntsc    standard of the capture file (default: ntsc)\n");
+	fprintf(stderr, "    -o <file>      write here (default: stdout)\n");
+	fprintf(stderr, "    -c             write the closed caption text\n");
+	fprintf(stderr, "    -n             data is not byteswapped (default for -f)\n");
+	fprintf(stderr, "    -h             display this help message\n");
+}
+
+/* ivtv's raw VBI format, see ivtv_get_fmt() */
+static void default_fmt(struct v4l2_vbi_format *vbi, int is_625)
+{
+	memset(vbi, 0, sizeof(*vbi));
+	vbi->sampling_rate = 27000000;
+	vbi->offset = 248;
+	vbi->samples_per_line = 1440;
+	vbi->sample_format = V4L2_PIX_FMT_GREY;
+	vbi->start[0] = is_625 ? 6 : 10;
+	vbi->start[1] = is_625 ? 318 : 273;
+	vbi->count[0] = vbi->count[1] = is_625 ? 18 : 12;
+}
+
+static void write_caption(FILE *out, const struct v4l2_sliced_vbi_data *d)
+{
+	int i, c;
+
+	if (d->id != V4L2_SLICED_CAPTION_525 || d->field != 0)
+		return;
+	for (i = 0; i < 2; i++) {
+		c = d->data[i] & 0x7f;
+		/* control codes start with 0x10-0x1f, skip both bytes */
+		if (c >= 0x10 && c < 0x20)
+			return;
+		if (c >= 0x20)
+			fputc(c, out);
+	}
+	fflush(out);
+}
+
+int main(int argc, char **argv)
+{
+	const char *device = "/dev/vbi0";
+	const char *file = NULL;
+	const char *outfile = NULL;
+	struct v4l2_sliced_vbi_data sliced[MAX_LINES];
+	struct v4l2_format fmt;
+	struct vbislice vs;
+	FILE *out = stdout;
+	uint8_t *raw;
+	int is_625 = 0, captions = 0, swap = -1;
+	int fd, opt, size, n, i;
+
+	while ((opt = getopt(argc, argv, "d:f:s:o:cnh")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 's':
+			is_625 = !strcmp(optarg, "pal");
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'c':
+			captions = 1;
+			break;
+		case 'n':
+			swap = 0;
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VBI_CAPTURE;
+	if (file) {
+		if ((fd = open(file, O_RDONLY)) < 0) {
+			fprintf(stderr, "%s: %s\n", file, strerror(errno));
+			return 1;
+		}
+		default_fmt(&fmt.fmt.vbi, is_625);
+		if (swap < 0)
+			swap = 0;
+	} else {
+		if ((fd = open(device, O_RDONLY)) < 0) {
+			fprintf(stderr, "%s: %s\n", device, strerror(errno));
+			return 1;
+		}
+		/* switches the card to raw VBI */
+		if (ioctl(fd, VIDIOC_S_FMT, &fmt) < 0 &&
+		    ioctl(fd, VIDIOC_G_FMT, &fmt) < 0) {
+			fprintf(stderr, "%s: no raw VBI: %s\n", device, strerror(errno));
+			return 1;
+		}
+		/* the card delivers VBI in byteswapped 32 bit words */
+		if (swap < 0)
+			swap = 1;
+	}
+
+	if (vbislice_init(&vs, &fmt.fmt.vbi, captions ? V4L2_SLICED_CAPTION_525 :
+			  V4L2_SLICED_VBI_525 | V4L2_SLICED_VBI_625) == 0) {
+		fprintf(stderr, "No VBI service can be sliced from this format\n");
+		return 1;
+	}
+
+	if (outfile && (out = fopen(outfile, "w")) == NULL) {
+		fprintf(stderr, "%s: %s\n", outfile, strerror(errno));
+		return 1;
+	}
+
+	size = (vs.count[0] + vs.count[1]) * vs.samples_per_line;
+	if ((raw = malloc(size)) == NULL)
+		return 1;
+
+	while ((n = read(fd, raw, size)) == size) {
+		if (swap)
+			vbislice_swap(raw, size);
+
+		n = vbislice_frame(&vs, raw, sliced, MAX_LINES);
+		if (captions) {
+			for (i = 0; i < n; i++)
+				write_caption(out, &sliced[i]);
+		} else if (n && fwrite(sliced, sizeof(sliced[0]), n, out) != n) {
+			fprintf(stderr, "write: %s\n", strerror(errno));
+			break;
+		}
+	}
+	if (n < 0)
+		fprintf(stderr, "read: %s\n", strerror(errno));
+
+	fprintf(stderr, "%lu of %lu lines sliced, %lu parity/biphase errors\n",
+		vs.sliced, vs.lines, vs.errors);
+	if (out != stdout)
+		fclose(out);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,376 @@
+/*
+   Benchmark and self check for the raw VBI slicer
+
+   Without -f, builds PAL frames carrying VPS, WSS and teletext and NTSC
+   frames carrying closed captions, with random payloads, noise and start
+   jitter, slices them with the plain C and the SSE2 kernels and checks
+   that every payload comes back. With -f, times a raw VBI capture
+   (cat /dev/vbi0 > file) instead.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/types.h>
+
+#define __user
+#include "videodev2.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "vbislice.h"
+
+#define FRAMES		1000
+#define MAX_LINES	36
+
+/* ivtv's raw VBI format, see ivtv_get_fmt() */
+#define RATE		27000000
+#define OFFSET		248
+#define SAMPLES		1440
+
+#define BLANK		60
+#define WHITE		200
+
+struct frame {
+	uint8_t *raw;
+	struct v4l2_sliced_vbi_data want[MAX_LINES];
+	int nwant;
+};
+
+static struct v4l2_vbi_format pal = {
+	RATE, OFFSET, SAMPLES, V4L2_PIX_FMT_GREY, { 6, 318 }, { 18, 18 }, 0
+};
+static struct v4l2_vbi_format ntsc = {
+	RATE, OFFSET, SAMPLES, V4L2_PIX_FMT_GREY, { 10, 273 }, { 12, 12 }, 0
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "    -n <frames>    frames to slice per run (default: %d)\n", FRAMES);
+	fprintf(stderr, "    -f <file>      time a raw VBI capture instead of test frames\n");
+	fprintf(stderr, "    -s pal|ntsc    standard of the capture (default: pal)\n");
+	fprintf(stderr, "    -h             display this help message\n");
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Draw elements (0/1, in time order) at rate elements/s starting start_ns
+   after 0H, as the decoder would sample it: soft edges and some noise */
+static void draw(uint8_t *line, const uint8_t *el, int n, double rate,
+		 double start_ns, int high)
+{
+	int x[SAMPLES];
+	double t;
+	int s, e;
+
+	for (s = 0; s < SAMPLES; s++) {
+		t = (OFFSET + s + 0.5) * 1e9 / RATE;
+		e = (int)((t - start_ns) * rate / 1e9);
+		x[s] = (t >= start_ns && e < n && el[e]) ? high : BLANK;
+	}
+	for (s = 0; s < SAMPLES; s++) {
+		int y = x[s] * 2 + x[s > 0 ? s - 1 : s] + x[s < SAMPLES - 1 ? s + 1 : s];
+
+		y = y / 4 + (rand() % 9) - 4;
+		line[s] = y < 0 ? 0 : y > 255 ? 255 : y;
+	}
+}
+
+static int put_bits(uint8_t *el, int n, uint32_t bits, int count)
+{
+	while (count--)
+		el[n++] = (bits >> count) & 1;
+	return n;
+}
+
+static int put_lsb(uint8_t *el, int n, const uint8_t *data, int bytes)
+{
+	int i, k;
+
+	for (i = 0; i < bytes; i++)
+		for (k = 0; k < 8; k++)
+			el[n++] = (data[i] >> k) & 1;
+	return n;
+}
+
+static uint8_t with_parity(uint8_t c)
+{
+	c &= 0x7f;
+	return vbislice_odd_parity(c) ? c : c | 0x80;
+}
+
+static double jitter(void)
+{
+	/* the data must end before the raw line does, 62.5us after 0H */
+	return (rand() % 501) - 250.0;
+}
+
+static void make_line(struct frame *f, uint8_t *line, uint32_t id, int field,
+		      int nr)
+{
+	struct v4l2_sliced_vbi_data *w = &f->want[f->nwant++];
+	uint8_t el[1024];
+	int i, k, n = 0;
+
+	memset(w, 0, sizeof(*w));
+	w->id = id;
+	w->field = field;
+	w->line = nr;
+
+	switch (id) {
+	case V4L2_SLICED_TELETEXT_B:
+		for (i = 0; i < 42; i++)
+			w->data[i] = rand();
+		n = put_bits(el, n, 0xaaaae4, 24);
+		n = put_lsb(el, n, w->data, 42);
+		draw(line, el, n, 6937500, 10300 + jitter(), WHITE);
+		break;
+
+	case V4L2_SLICED_VPS:
+		for (i = 0; i < 13; i++)
+			w->data[i] = rand();
+		n = put_bits(el, n, 0xaaaa8a99, 32);
+		for (i = 0; i < 13; i++)
+			for (k = 7; k >= 0; k--)
+				n = put_bits(el, n, (w->data[i] >> k) & 1 ? 2 : 1, 2);
+		draw(line, el, n, 5000000, 12500 + jitter(), WHITE);
+		break;
+
+	case V4L2_SLICED_WSS_625:
+		w->data[0] = rand();
+		w->data[1] = rand() & 0x3f;
+		n = put_bits(el, n, 0x1f1c71c7, 29);
+		n = put_bits(el, n, 0x1e3c1f, 24);
+		for (i = 0; i < 14; i++)
+			n = put_bits(el, n, (w->data[i >> 3] >> (i & 7)) & 1 ?
+				     0x38 : 0x07, 6);
+		draw(line, el, n, 5000000, 11000 + jitter(), WHITE);
+		break;
+
+	case V4L2_SLICED_CAPTION_525:
+		/* drawn at the run-in rate, twice the bit rate */
+		w->data[0] = with_parity(rand());
+		w->data[1] = with_parity(rand());
+		n = put_bits(el, n, 0x2aaa, 14);
+		n = put_bits(el, n, 0x03, 6);
+		for (i = 0; i < 16; i++)
+			n = put_bits(el, n, (w->data[i >> 3] >> (i & 7)) & 1 ? 3 : 0, 2);
+		draw(line, el, n, 1006994, 10500 + jitter(), (BLANK + WHITE) / 2);
+		break;
+	}
+}
+
+static void make_frame(struct frame *f, const struct v4l2_vbi_format *fmt)
+{
+	int is_625 = fmt->start[1] >= 313;
+	int field, i, nr;
+	uint8_t *line = f->raw;
+	uint8_t el[1] = { 0 };
+
+	f->nwant = 0;
+	for (field = 0; field < 2; field++) {
+		nr = fmt->start[field] - (field ? (is_625 ? 313 : 263) : 0);
+		for (i = 0; i < fmt->count[field]; i++, nr++, line += SAMPLES) {
+			if (is_625 && field == 0 && nr == 16)
+				make_line(f, line, V4L2_SLICED_VPS, field, nr);
+			else if (is_625 && field == 0 && nr == 23)
+				make_line(f, line, V4L2_SLICED_WSS_625, field, nr);
+			else if (is_625 && nr >= 7 && nr <= 22)
+				make_line(f, line, V4L2_SLICED_TELETEXT_B, field, nr);
+			else if (!is_625 && nr == 21)
+				make_line(f, line, V4L2_SLICED_CAPTION_525, field, nr);
+			else
+				draw(line, el, 0, 1, 0, BLANK);
+		}
+	}
+}
+
+static int data_len(uint32_t id)
+{
+	switch (id) {
+	case V4L2_SLICED_TELETEXT_B:
+		return 42;
+	case V4L2_SLICED_VPS:
+		return 13;
+	default:
+		return 2;
+	}
+}
+
+/* Returns the number of frames sliced exactly as made */
+static int check(struct frame *f, int nframes, struct vbislice *vs)
+{
+	struct v4l2_sliced_vbi_data out[MAX_LINES];
+	int i, j, n, good = 0;
+
+	for (i = 0; i < nframes; i++) {
+		n = vbislice_frame(vs, f[i].raw, out, MAX_LINES);
+		if (n != f[i].nwant)
+			continue;
+		for (j = 0; j < n; j++) {
+			if (out[j].id != f[i].want[j].id ||
+			    out[j].field != f[i].want[j].field ||
+			    out[j].line != f[i].want[j].line ||
+			    memcmp(out[j].data, f[i].want[j].data,
+				   data_len(out[j].id)))
+				break;
+		}
+		if (j == n)
+			good++;
+	}
+	return good;
+}
+
+static void run(const char *name, struct frame *f, int nframes,
+		const struct v4l2_vbi_format *fmt, int selfcheck, int *failed)
+{
+	struct v4l2_sliced_vbi_data out[MAX_LINES];
+	struct vbislice vs;
+	int simd, i, good;
+	double t, fps = fmt->start[1] >= 313 ? 25.0 : 29.97;
+
+	for (simd = 0; simd < 2; simd++) {
+		vbislice_init(&vs, fmt, V4L2_SLICED_VBI_525 | V4L2_SLICED_VBI_625);
+		if (simd && !vs.simd)
+			break;
+		vs.simd = simd;
+
+		t = now();
+		for (i = 0; i < nframes; i++)
+			vbislice_frame(&vs, f[i].raw, out, MAX_LINES);
+		t = now() - t;
+
+		printf("%-6s %-4s %8.2f us/frame %10.0f lines/s  %6.0f streams/core"
+		       "  %lu/%lu lines sliced, %lu errors\n",
+		       name, simd ? "SSE2" : "C", t * 1e6 / nframes,
+		       vs.lines / t, nframes / t / fps,
+		       vs.sliced, vs.lines, vs.errors);
+
+		if (selfcheck) {
+			vbislice_init(&vs, fmt, V4L2_SLICED_VBI_525 | V4L2_SLICED_VBI_625);
+			vs.simd = simd;
+			good = check(f, nframes, &vs);
+			printf("%-6s %-4s %d of %d frames sliced correctly\n",
+			       name, simd ? "SSE2" : "C", good, nframes);
+			if (good != nframes)
+				*failed = 1;
+		}
+	}
+}
+
+static int load(const char *file, struct frame **fp, int *nframes,
+		const struct v4l2_vbi_format *fmt)
+{
+	int size = (fmt->count[0] + fmt->count[1]) * SAMPLES;
+	struct stat st;
+	struct frame *f;
+	uint8_t *raw;
+	int fd, i, n;
+
+	if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	n = st.st_size / size;
+	if (n == 0) {
+		fprintf(stderr, "%s: less than one frame\n", file);
+		close(fd);
+		return -1;
+	}
+	raw = malloc((size_t)n * size);
+	f = calloc(n, sizeof(*f));
+	if (raw == NULL || f == NULL || read(fd, raw, (size_t)n * size) != (ssize_t)n * size) {
+		fprintf(stderr, "%s: can't read %d frames\n", file, n);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	for (i = 0; i < n; i++)
+		f[i].raw = raw + (size_t)i * size;
+	*fp = f;
+	*nframes = n;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const struct v4l2_vbi_format *fmt = &pal;
+	const char *file = NULL;
+	struct frame *f;
+	int nframes = FRAMES, failed = 0;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "n:f:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = atoi(optarg);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 's':
+			fmt = strcmp(optarg, "ntsc") ? &pal : &ntsc;
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+	if (nframes <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (file) {
+		if (load(file, &f, &nframes, fmt) < 0)
+			return 1;
+		run(file, f, nframes, fmt, 0, &failed);
+		return 0;
+	}
+
+	f = calloc(nframes, sizeof(*f));
+	if (f == NULL)
+		return 1;
+	for (i = 0; i < nframes; i++) {
+		f[i].raw = malloc(MAX_LINES * SAMPLES);
+		if (f[i].raw == NULL)
+			return 1;
+	}
+
+	srand(1);
+	for (i = 0; i < nframes; i++)
+		make_frame(&f[i], &pal);
+	run("PAL", f, nframes, &pal, 1, &failed);
+
+	for (i = 0; i < nframes; i++)
+		make_frame(&f[i], &ntsc);
+	run("NTSC", f, nframes, &ntsc, 1, &failed);
+
+	return failed;
+}
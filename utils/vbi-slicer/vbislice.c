@@ -0,0 +1,432 @@
+/*
+   Raw VBI slicer for closed captions, WSS, VPS and teletext
+
+   Finds the clock run-in and framing code of each service in the raw
+   luma samples of a VBI line, slices the payload bits and checks them
+   the same way cx25840-vbi.c checks the data sliced by the chip: odd
+   parity for captions, biphase for VPS and WSS.
+
+   The per sample work, finding the signal levels and comparing against
+   the slicing level, is done 16 samples at a time with SSE2 when the
+   compiler has it. The rest works on the resulting bitmap, 8 samples
+   per byte.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include <byteswap.h>
+#include <sys/time.h>
+#include <linux/types.h>
+
+#define __user
+#include "videodev2.h"
+
+#include "vbislice.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MIN_AMPLITUDE	20	/* weakest signal we try to slice */
+#define CRI_WINDOW	3000	/* ns the CRI may be off its nominal start */
+
+enum {
+	NRZ_LSB,	/* bytes sent LSB first */
+	BIPHASE_VPS,	/* 1 = 10, 0 = 01, MSB first, see decode_vps() */
+	BIPHASE_WSS,	/* 1 = 111000, 0 = 000111, LSB first */
+};
+
+struct vbislice_service {
+	uint32_t id;
+	int is_625;
+	int line[2][2];		/* first and last line in each field */
+	uint32_t cri_rate;	/* clock run-in elements per second */
+	uint32_t rate;		/* framing code and payload elements per second */
+	uint32_t cri;		/* clock run-in and framing code, first
+				   element in the MSB, starting with a
+				   rising edge */
+	uint32_t cri_mask;	/* elements of cri that must match */
+	int cri_bits;		/* clock run-in elements in cri */
+	int frc_bits;		/* framing code elements in cri */
+	int payload;		/* payload elements */
+	int modulation;
+	uint32_t start_ns;	/* nominal start of cri after 0H */
+};
+
+/* Tried in this order, teletext last since it is on most lines */
+static const struct vbislice_service services[] = {
+	/* 3 bytes run-in and start code, 13 bytes biphase */
+	{ V4L2_SLICED_VPS, 1, { { 16, 16 }, { 0, -1 } }, 5000000, 5000000,
+	  0xaaaa8a99, 0xffffffff, 16, 16, 13 * 16, BIPHASE_VPS, 12500 },
+	/* end of the run-in and the start code, 14 bits of 6 elements */
+	{ V4L2_SLICED_WSS_625, 1, { { 23, 23 }, { 0, -1 } }, 5000000, 5000000,
+	  0x071e3c1f, 0x07ffffff, 3, 24, 14 * 6, BIPHASE_WSS, 16200 },
+	/* 7 cycles run-in at twice the bit rate, start bits 001, two bytes */
+	{ V4L2_SLICED_CAPTION_525, 0, { { 21, 21 }, { 21, 21 } }, 1006994, 503497,
+	  0x00015551, 0x000007ff, 14, 3, 16, NRZ_LSB, 10500 },
+	/* run-in 0x55 0x55, framing code 0x27, 42 bytes */
+	{ V4L2_SLICED_TELETEXT_B, 1, { { 6, 22 }, { 5, 22 } }, 6937500, 6937500,
+	  0x00aaaae4, 0x0000ffff, 16, 8, 42 * 8, NRZ_LSB, 10300 },
+};
+
+int vbislice_odd_parity(uint8_t c)
+{
+	c ^= (c >> 4);
+	c ^= (c >> 2);
+	c ^= (c >> 1);
+
+	return c & 1;
+}
+
+int vbislice_decode_vps(uint8_t *dst, const uint8_t *p)
+{
+	static const uint8_t biphase_tbl[] = {
+		0xf0, 0x78, 0x70, 0xf0, 0xb4, 0x3c, 0x34, 0xb4,
+		0xb0, 0x38, 0x30, 0xb0, 0xf0, 0x78, 0x70, 0xf0,
+		0xd2, 0x5a, 0x52, 0xd2, 0x96, 0x1e, 0x16, 0x96,
+		0x92, 0x1a, 0x12, 0x92, 0xd2, 0x5a, 0x52, 0xd2,
+		0xd0, 0x58, 0x50, 0xd0, 0x94, 0x1c, 0x14, 0x94,
+		0x90, 0x18, 0x10, 0x90, 0xd0, 0x58, 0x50, 0xd0,
+		0xf0, 0x78, 0x70, 0xf0, 0xb4, 0x3c, 0x34, 0xb4,
+		0xb0, 0x38, 0x30, 0xb0, 0xf0, 0x78, 0x70, 0xf0,
+		0xe1, 0x69, 0x61, 0xe1, 0xa5, 0x2d, 0x25, 0xa5,
+		0xa1, 0x29, 0x21, 0xa1, 0xe1, 0x69, 0x61, 0xe1,
+		0xc3, 0x4b, 0x43, 0xc3, 0x87, 0x0f, 0x07, 0x87,
+		0x83, 0x0b, 0x03, 0x83, 0xc3, 0x4b, 0x43, 0xc3,
+		0xc1, 0x49, 0x41, 0xc1, 0x85, 0x0d, 0x05, 0x85,
+		0x81, 0x09, 0x01, 0x81, 0xc1, 0x49, 0x41, 0xc1,
+		0xe1, 0x69, 0x61, 0xe1, 0xa5, 0x2d, 0x25, 0xa5,
+		0xa1, 0x29, 0x21, 0xa1, 0xe1, 0x69, 0x61, 0xe1,
+		0xe0, 0x68, 0x60, 0xe0, 0xa4, 0x2c, 0x24, 0xa4,
+		0xa0, 0x28, 0x20, 0xa0, 0xe0, 0x68, 0x60, 0xe0,
+		0xc2, 0x4a, 0x42, 0xc2, 0x86, 0x0e, 0x06, 0x86,
+		0x82, 0x0a, 0x02, 0x82, 0xc2, 0x4a, 0x42, 0xc2,
+		0xc0, 0x48, 0x40, 0xc0, 0x84, 0x0c, 0x04, 0x84,
+		0x80, 0x08, 0x00, 0x80, 0xc0, 0x48, 0x40, 0xc0,
+		0xe0, 0x68, 0x60, 0xe0, 0xa4, 0x2c, 0x24, 0xa4,
+		0xa0, 0x28, 0x20, 0xa0, 0xe0, 0x68, 0x60, 0xe0,
+		0xf0, 0x78, 0x70, 0xf0, 0xb4, 0x3c, 0x34, 0xb4,
+		0xb0, 0x38, 0x30, 0xb0, 0xf0, 0x78, 0x70, 0xf0,
+		0xd2, 0x5a, 0x52, 0xd2, 0x96, 0x1e, 0x16, 0x96,
+		0x92, 0x1a, 0x12, 0x92, 0xd2, 0x5a, 0x52, 0xd2,
+		0xd0, 0x58, 0x50, 0xd0, 0x94, 0x1c, 0x14, 0x94,
+		0x90, 0x18, 0x10, 0x90, 0xd0, 0x58, 0x50, 0xd0,
+		0xf0, 0x78, 0x70, 0xf0, 0xb4, 0x3c, 0x34, 0xb4,
+		0xb0, 0x38, 0x30, 0xb0, 0xf0, 0x78, 0x70, 0xf0,
+	};
+
+	uint8_t c, err = 0;
+	int i;
+
+	for (i = 0; i < 2 * 13; i += 2) {
+		err |= biphase_tbl[p[i]] | biphase_tbl[p[i + 1]];
+		c = (biphase_tbl[p[i + 1]] & 0xf) |
+		    ((biphase_tbl[p[i]] & 0xf) << 4);
+		dst[i / 2] = c;
+	}
+
+	return err & 0xf0;
+}
+
+/* Kernels: signal levels of a stretch of samples, and the bitmap of the
+   samples at or above the slicing level, sample 0 in bit 0 of byte 0 */
+
+static void minmax_c(const uint8_t *p, int n, int *min, int *max)
+{
+	int i, lo = 255, hi = 0;
+
+	for (i = 0; i < n; i++) {
+		if (p[i] < lo)
+			lo = p[i];
+		if (p[i] > hi)
+			hi = p[i];
+	}
+	*min = lo;
+	*max = hi;
+}
+
+static void slice_c(const uint8_t *p, int n, int thr, uint8_t *bits)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (!(i & 7))
+			bits[i >> 3] = 0;
+		bits[i >> 3] |= (p[i] >= thr) << (i & 7);
+	}
+}
+
+#ifdef __SSE2__
+static void minmax_sse2(const uint8_t *p, int n, int *min, int *max)
+{
+	__m128i vmin = _mm_set1_epi8((char)0xff);
+	__m128i vmax = _mm_setzero_si128();
+	uint8_t lo[16], hi[16];
+	int i, tmin, tmax;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+
+		vmin = _mm_min_epu8(vmin, v);
+		vmax = _mm_max_epu8(vmax, v);
+	}
+	_mm_storeu_si128((__m128i *)lo, vmin);
+	_mm_storeu_si128((__m128i *)hi, vmax);
+
+	minmax_c(p + i, n - i, &tmin, &tmax);
+	for (i = 0; i < 16; i++) {
+		if (lo[i] < tmin)
+			tmin = lo[i];
+		if (hi[i] > tmax)
+			tmax = hi[i];
+	}
+	*min = tmin;
+	*max = tmax;
+}
+
+static void slice_sse2(const uint8_t *p, int n, int thr, uint8_t *bits)
+{
+	/* no unsigned byte compare in SSE2, move both sides to signed */
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m128i t = _mm_set1_epi8((char)((thr - 1) ^ 0x80));
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		int m = _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_xor_si128(v, bias), t));
+
+		bits[i >> 3] = m;
+		bits[(i >> 3) + 1] = m >> 8;
+	}
+	slice_c(p + i, n - i, thr, bits + (i >> 3));
+}
+#endif
+
+static inline int bit(const uint8_t *bits, uint32_t pos)
+{
+	return (bits[pos >> 3] >> (pos & 7)) & 1;
+}
+
+static uint32_t ns_to_sample(struct vbislice *vs, uint32_t ns)
+{
+	uint64_t s = (uint64_t)ns * vs->sampling_rate / 1000000000;
+
+	return s > vs->offset ? s - vs->offset : 0;
+}
+
+uint32_t vbislice_init(struct vbislice *vs, const struct v4l2_vbi_format *fmt,
+		       uint32_t services_wanted)
+{
+	const struct vbislice_service *s;
+	struct vbislice_job *job;
+	int i, span;
+
+	memset(vs, 0, sizeof(*vs));
+#ifdef __SSE2__
+	vs->simd = 1;
+#endif
+	vs->sampling_rate = fmt->sampling_rate;
+	vs->offset = fmt->offset;
+	vs->samples_per_line = fmt->samples_per_line;
+	vs->start[0] = fmt->start[0];
+	vs->start[1] = fmt->start[1];
+	vs->count[0] = fmt->count[0];
+	vs->count[1] = fmt->count[1];
+	vs->is_625 = fmt->start[1] >= 313;
+
+	if (fmt->sample_format != V4L2_PIX_FMT_GREY ||
+	    vs->samples_per_line == 0 ||
+	    vs->samples_per_line > VBISLICE_MAX_SAMPLES)
+		return 0;
+
+	for (i = 0; i < sizeof(services) / sizeof(services[0]); i++) {
+		s = &services[i];
+		if (!(s->id & services_wanted) || s->is_625 != vs->is_625)
+			continue;
+
+		job = &vs->job[vs->njobs];
+		job->s = s;
+		job->cri_step = ((uint64_t)vs->sampling_rate << 16) / s->cri_rate;
+		job->step = ((uint64_t)vs->sampling_rate << 16) / s->rate;
+		/* less than 2 samples per element can't be sliced */
+		if (job->cri_step < 0x20000 || job->step < 0x20000)
+			continue;
+
+		span = (((uint64_t)job->cri_step * s->cri_bits +
+			 (uint64_t)job->step * (s->frc_bits + s->payload)) >> 16) + 2;
+		job->first = ns_to_sample(vs, s->start_ns - CRI_WINDOW);
+		job->last = ns_to_sample(vs, s->start_ns + CRI_WINDOW);
+		if (job->first < 1)
+			job->first = 1;
+		if (job->last > (int)vs->samples_per_line - span)
+			job->last = vs->samples_per_line - span;
+		if (job->last < job->first)
+			continue;
+		job->end = job->last + span;
+		memcpy(job->line, s->line, sizeof(job->line));
+
+		vs->services |= s->id;
+		vs->njobs++;
+	}
+	return vs->services;
+}
+
+/* Slice the payload that follows a CRI found at bitmap position pos */
+static int slice_payload(const struct vbislice_job *job, const uint8_t *bits,
+			 uint32_t pos, uint8_t *data)
+{
+	const struct vbislice_service *s = job->s;
+	uint8_t raw[26];
+	int i, k, e[6];
+
+	switch (s->modulation) {
+	case NRZ_LSB:
+		for (i = 0; i < s->payload / 8; i++) {
+			for (k = 0; k < 8; k++, pos += job->step)
+				data[i] |= bit(bits, pos >> 16) << k;
+		}
+		if (s->id == V4L2_SLICED_CAPTION_525)
+			return vbislice_odd_parity(data[0]) &&
+				vbislice_odd_parity(data[1]);
+		return 1;
+
+	case BIPHASE_VPS:
+		memset(raw, 0, sizeof(raw));
+		for (i = 0; i < s->payload; i++, pos += job->step)
+			raw[i >> 3] |= bit(bits, pos >> 16) << (i & 7);
+		return vbislice_decode_vps(data, raw) == 0;
+
+	case BIPHASE_WSS:
+		for (i = 0; i < s->payload / 6; i++) {
+			for (k = 0; k < 6; k++, pos += job->step)
+				e[k] = bit(bits, pos >> 16);
+			if (e[0] != e[1] || e[1] != e[2] ||
+			    e[3] != e[4] || e[4] != e[5] || e[0] == e[3])
+				return 0;
+			data[i >> 3] |= e[0] << (i & 7);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+static int slice_job(struct vbislice *vs, const struct vbislice_job *job,
+		     const uint8_t *raw, uint8_t *data)
+{
+	const struct vbislice_service *s = job->s;
+	uint8_t bits[VBISLICE_MAX_SAMPLES / 8 + 2];
+	int base = job->first - 1;	/* one sample before, for edges */
+	int n = job->end - base;
+	int min, max, i, j, k, edges, carry = 0;
+	uint32_t pos, c;
+
+#ifdef __SSE2__
+	if (vs->simd)
+		minmax_sse2(raw + base, n, &min, &max);
+	else
+#endif
+		minmax_c(raw + base, n, &min, &max);
+	if (max - min < MIN_AMPLITUDE)
+		return 0;
+
+#ifdef __SSE2__
+	if (vs->simd)
+		slice_sse2(raw + base, n, (min + max + 1) >> 1, bits);
+	else
+#endif
+		slice_c(raw + base, n, (min + max + 1) >> 1, bits);
+
+	/* try every rising edge in the window as the start of the CRI,
+	   8 samples at a time */
+	for (j = 0; j <= (job->last - base) >> 3; j++) {
+		edges = bits[j] & ~((bits[j] << 1) | carry) & 0xff;
+		carry = bits[j] >> 7;
+
+		for (; edges; edges &= edges - 1) {
+			i = j * 8 + __builtin_ctz(edges);
+			if (i < 1 || i > job->last - base)
+				continue;
+
+			/* the crossing is half a sample before i, sample
+			   each element in its middle */
+			pos = (i << 16) + job->cri_step / 2 - 0x8000;
+			for (c = 0, k = 0; k < s->cri_bits; k++, pos += job->cri_step)
+				c = (c << 1) | bit(bits, pos >> 16);
+			pos += (job->step - job->cri_step) / 2;
+			for (k = 0; k < s->frc_bits; k++, pos += job->step)
+				c = (c << 1) | bit(bits, pos >> 16);
+			if ((c ^ s->cri) & s->cri_mask)
+				continue;
+
+			memset(data, 0, 48);
+			if (slice_payload(job, bits, pos, data))
+				return 1;
+			vs->errors++;
+			return 0;
+		}
+	}
+	return 0;
+}
+
+int vbislice_line(struct vbislice *vs, const uint8_t *raw, int field, int line,
+		  struct v4l2_sliced_vbi_data *out)
+{
+	const struct vbislice_job *job;
+	int i;
+
+	vs->lines++;
+	for (i = 0; i < vs->njobs; i++) {
+		job = &vs->job[i];
+		if (line < job->line[field][0] || line > job->line[field][1])
+			continue;
+		if (slice_job(vs, job, raw, out->data)) {
+			out->id = job->s->id;
+			out->field = field;
+			out->line = line;
+			out->reserved = 0;
+			vs->sliced++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int vbislice_frame(struct vbislice *vs, const uint8_t *raw,
+		   struct v4l2_sliced_vbi_data *out, int max)
+{
+	int field, i, line, n = 0;
+
+	for (field = 0; field < 2; field++) {
+		line = vs->start[field];
+		if (field)
+			line -= vs->is_625 ? 313 : 263;
+		for (i = 0; i < vs->count[field]; i++, line++) {
+			if (n < max && vbislice_line(vs, raw, field, line, &out[n]))
+				n++;
+			raw += vs->samples_per_line;
+		}
+	}
+	return n;
+}
+
+void vbislice_swap(uint8_t *raw, int size)
+{
+	uint32_t *w = (uint32_t *)raw;
+	int i;
+
+	for (i = 0; i < size / 4; i++)
+		w[i] = bswap_32(w[i]);
+}
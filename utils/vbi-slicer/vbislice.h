@@ -0,0 +1,90 @@
+/*
+   Raw VBI slicer for closed captions, WSS, VPS and teletext
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __VBISLICE_H
+#define __VBISLICE_H
+
+#include <stdint.h>
+
+struct v4l2_vbi_format;
+struct v4l2_sliced_vbi_data;
+
+#define VBISLICE_MAX_SAMPLES	2048
+#define VBISLICE_MAX_JOBS	4
+
+struct vbislice_service;
+
+/* One service set up for the raw format in use, positions in samples
+   from the start of a raw line */
+struct vbislice_job {
+	const struct vbislice_service *s;
+	uint32_t cri_step;	/* samples per CRI element, 16.16 fixed point */
+	uint32_t step;		/* samples per framing code and payload
+				   element, 16.16 */
+	int first, last;	/* window for the start of the CRI */
+	int end;		/* last sample the payload may need */
+	int line[2][2];		/* first and last line in each field */
+};
+
+struct vbislice {
+	uint32_t services;	/* V4L2_SLICED_* found in this format */
+	int simd;		/* use the SSE2 kernels, if built in */
+	int is_625;
+
+	/* the raw format, see struct v4l2_vbi_format */
+	uint32_t sampling_rate;
+	uint32_t offset;
+	uint32_t samples_per_line;
+	uint32_t start[2];
+	uint32_t count[2];
+
+	struct vbislice_job job[VBISLICE_MAX_JOBS];
+	int njobs;
+
+	/* statistics */
+	unsigned long lines;	/* lines looked at */
+	unsigned long sliced;	/* lines with data */
+	unsigned long errors;	/* found a CRI but failed parity/biphase */
+};
+
+/* Set up a slicer for a raw VBI format as returned by VIDIOC_G_FMT.
+   services is a mask of V4L2_SLICED_*, services the format can't carry
+   are dropped. Returns the services left, 0 if none. */
+uint32_t vbislice_init(struct vbislice *vs, const struct v4l2_vbi_format *fmt,
+		       uint32_t services);
+
+/* Slice one raw line. line is the line number within the field, as in
+   struct v4l2_sliced_vbi_data. Returns 1 and fills in *out if a service
+   was found on the line, 0 otherwise. */
+int vbislice_line(struct vbislice *vs, const uint8_t *raw, int field, int line,
+		  struct v4l2_sliced_vbi_data *out);
+
+/* Slice a whole raw frame (count[0] + count[1] lines). Returns the number
+   of entries written to out, at most max. */
+int vbislice_frame(struct vbislice *vs, const uint8_t *raw,
+		   struct v4l2_sliced_vbi_data *out, int max);
+
+/* The card delivers raw VBI in byteswapped 32 bit words, put size bytes
+   of it back in order */
+void vbislice_swap(uint8_t *raw, int size);
+
+/* The same checks cx25840-vbi.c does on sliced data from the chip */
+int vbislice_odd_parity(uint8_t c);
+int vbislice_decode_vps(uint8_t *dst, const uint8_t *p);
+
+#endif